@@ -204,6 +204,33 @@ stat_dataplane(int argc, char** argv)
 }
 
 
+// The latency data plane command.
+//
+//    latency <dp-name> [start|stop|reset]
+//
+// Start or stop timing the data plane's packets, or forget the
+// times recorded so far, and display the latency of each stage.
+int
+latency_dataplane(int argc, char** argv)
+{
+  if (!check_argument_arity_at_least(argc, 2))
+    return -1;
+  if (argc > 3) {
+    print(std::cerr, "error: too many arguments\n");
+    return -1;
+  }
+  char const* dp = argv[1];
+  char const* action = argc == 3 ? argv[2] : "read";
+
+  std::string json = json::make_object({
+    {"target",  "dp"},
+    {"command", "latency"},
+    {"dp",      dp},
+    {"action",  action}
+  });
+  return send_command(json);
+}
+
 
 // The list data planes command.
 //
@@ -230,6 +257,7 @@ Command_map commands {
   {"set",   set_dataplane},
   {"show",  show_dataplane},
   {"stat",  stat_dataplane},
+  {"latency", latency_dataplane},
   {"list",  list_dataplanes}
 };
 
@@ -129,38 +129,42 @@ set_port(int argc, char** argv)
 }
 
 
-// Show the static configuration of a port.
+// Show a port of the data plane and its counters.
 //
-//    show <port-id> 
+//    show <dp-name> <port-id>
 int 
 show_port(int argc, char** argv) 
 { 
-  if (!check_argument_arity(argc, 2))
+  if (!check_argument_arity(argc, 3))
     return -1;
-  char const* port = argv[1];
+  char const* dp = argv[1];
+  char const* port = argv[2];
 
   std::string json = json::make_object({
     {"target",  "port"},
     {"command", "show"},
-    {"port",     port}
+    {"dp",      dp},
+    {"port",    port}
   });
   return send_command(json);
 }
 
 
-// Request statistics for a port.
+// Request statistics for a port of the data plane.
 //
-//    stat <port-id>
+//    stat <dp-name> <port-id>
 int 
 stat_port(int argc, char** argv)
 {
-  if (!check_argument_arity(argc, 2))
+  if (!check_argument_arity(argc, 3))
     return -1;
-  char const* port = argv[1];
+  char const* dp = argv[1];
+  char const* port = argv[2];
 
   std::string json = json::make_object({
     {"target",  "port"},
     {"command", "stat"},
+    {"dp",      dp},
     {"port",    port}
   });
   return send_command(json);
@@ -116,11 +116,14 @@ send_command(std::string const& str, std::string& result)
   if (bytes > 0) {
     result.assign(buf, buf + bytes);
 
-    // Look at the result. If we it's not "ok", then print
-    // the received error.
-    //
-    // TODO: Pass the result back as JSON.s
-    if (result != "ok")
+    // Look at the result. Commands that return information
+    // (e.g., statistics) get a JSON object, which is printed.
+    // Anything else that is not "ok" is an error.
+    bool info = !result.empty() && result[0] == '{' &&
+                result.find(R"("status":"error")") == std::string::npos;
+    if (info)
+      std::cout << result << '\n';
+    else if (result != "ok")
       std::cerr << result << '\n';
   }
 
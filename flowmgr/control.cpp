@@ -3,6 +3,8 @@
 
 #include "control.hpp"
 #include "request.hpp"
+#include "dataplane.hpp"
+#include "port.hpp"
 #include "utility.hpp"
 
 #include "freeflow/unix.hpp"
@@ -133,15 +135,23 @@ Control_channel::on_input()
 }
 
 
-// Send the result to the caller.
-//
-// FIXME: A lot of operations return more than just success/fail. For
-// example, if we get the dataplane state, then we should return 
-// that information to the caller.
+// Send the result to the caller. Requests that return
+// information (e.g., statistics) are rendered as JSON by the
+// module that made the request. Others return "ok" or an
+// error.
 bool
 Control_channel::on_reply(fp_reply const* rep)
 {
-  // FIXME: This is broken.
+  if (rep->result == FP_SUCCESS) {
+    switch (rep->kind) {
+    case FP_DATPLANE_STAT:
+    case FP_DATPLANE_LATENCY:
+      return dataplane_reply(*this, rep);
+    case FP_PORT_GET:
+      return port_reply(*this, rep);
+    }
+  }
+
   std::string result;
   if (rep->result == FP_SUCCESS)
     result = "ok";
@@ -12,7 +12,9 @@
 #include "flowpath/proto.h"
 #include "flowpath/error.h"
 
+#include <cstring>
 #include <iostream>
+#include <unordered_map>
 
 using namespace ff;
 
@@ -76,6 +78,54 @@ show_request(Io_handler& io, json::Map const& map)
 void
 stat_request(Io_handler& io, json::Map const& map)
 {
+  json::String const* name = get_string_arg(map, "dp");
+  if (!name)
+    return send_error(io, "missing name");
+
+  // Construct and send the message.
+  char buf[FP_MESSAGE_LEN];
+  fp_request* req = fp_make_request(buf);
+  auto* args = fp_get_dataplane_stat_arguments(req);
+  std::copy(name->begin(), name->end(), args->name);
+  bool res = switch_channel()->on_request(req);
+  if (!res)
+    send_error(io, "request failed");
+}
+
+
+// Latency actions, by name.
+std::unordered_map<std::string, uint8_t> latency_actions_ {
+  {"read",  FP_LATENCY_READ},
+  {"start", FP_LATENCY_START},
+  {"stop",  FP_LATENCY_STOP},
+  {"reset", FP_LATENCY_RESET}
+};
+
+
+void
+latency_request(Io_handler& io, json::Map const& map)
+{
+  json::String const* name = get_string_arg(map, "dp");
+  if (!name)
+    return send_error(io, "missing name");
+
+  uint8_t action = FP_LATENCY_READ;
+  if (json::String const* str = get_string_arg(map, "action")) {
+    auto iter = latency_actions_.find(str->str());
+    if (iter == latency_actions_.end())
+      return send_error(io, "unknown latency action");
+    action = iter->second;
+  }
+
+  // Construct and send the message.
+  char buf[FP_MESSAGE_LEN];
+  fp_request* req = fp_make_request(buf);
+  auto* args = fp_get_dataplane_latency_arguments(req);
+  std::copy(name->begin(), name->end(), args->name);
+  args->action = action;
+  bool res = switch_channel()->on_request(req);
+  if (!res)
+    send_error(io, "request failed");
 }
 
 
@@ -92,6 +142,7 @@ Dispatch_table reqs_ {
   {"set",  set_request},
   {"show", show_request},
   {"stat", stat_request},
+  {"latency", latency_request},
   {"list", list_request}
 };
 
@@ -116,8 +167,64 @@ dataplane_request(Io_handler& io, json::Map const& args)
 }
 
 
-void 
-dataplane_reply(Io_handler& io, json::Map const& args)
+namespace
+{
+
+// Render the result of a successful data plane stat request.
+bool
+stat_reply(Io_handler& io, fp_reply const* rep)
 {
+  // The result is not aligned within the message.
+  fp_dataplane_stat_result res;
+  std::memcpy(&res, fp_get_dataplane_stat_result(rep), sizeof(res));
+  char const* state = res.state == FP_DATAPLANE_STATE_UP ? "up" : "down";
+  std::string json = format(R"({{"status":"ok","state":"{}","ports":{},)",
+                            state, res.nports)
+                   + format_counters(res.counters) + '}';
+  return ff::send(io.fd(), json) >= 0;
+}
+
+
+// Render the result of a successful data plane latency request.
+// Stages defined by the pipeline are only shown once they have
+// timed packets.
+bool
+latency_reply(Io_handler& io, fp_reply const* rep)
+{
+  static char const* names[] = {
+    "receive", "pipeline", "egress", "total"
+  };
+  int const nnames = sizeof(names) / sizeof(names[0]);
+
+  fp_dataplane_latency_result res;
+  std::memcpy(&res, fp_get_dataplane_latency_result(rep), sizeof(res));
+  std::string stages;
+  for (uint32_t i = 0; i < res.nstages && i < FP_STAT_STAGES; ++i) {
+    fp_stage_latency const& s = res.stages[i];
+    if (i >= nnames && !s.count)
+      continue;
+    if (!stages.empty())
+      stages += ',';
+    std::string name = i < nnames ? names[i] : format("stage{}", i);
+    stages += format(R"("{}":{{"count":{},"p50":{},"p99":{},"p999":{},"max":{}}})",
+                     name, s.count, s.p50, s.p99, s.p999, s.max);
+  }
+  std::string json = format(R"({{"status":"ok","timing":{},"stages":{{)",
+                            res.timing ? "true" : "false")
+                   + stages + "}}";
+  return ff::send(io.fd(), json) >= 0;
+}
 
+
+} // namespace
+
+
+// Render the result of a successful data plane stat or latency
+// request as JSON. Returns false if the reply could not be sent.
+bool
+dataplane_reply(Io_handler& io, fp_reply const* rep)
+{
+  if (rep->kind == FP_DATPLANE_LATENCY)
+    return latency_reply(io, rep);
+  return stat_reply(io, rep);
 }
@@ -7,7 +7,9 @@
 #include "freeflow/async.hpp"
 #include "freeflow/json.hpp"
 
+#include "flowpath/proto.h"
+
 void dataplane_request(ff::Io_handler&, ff::json::Map const&);
-void dataplane_reply(ff::Io_handler&, ff::json::Map const&);
+bool dataplane_reply(ff::Io_handler&, fp_reply const*);
 
 #endif
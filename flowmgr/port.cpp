@@ -1,7 +1,7 @@
 // Copyright (c) 2014-2015 Flowgrammable.org
 // All rights reserved
 
-#include "dataplane.hpp"
+#include "port.hpp"
 #include "dispatch.hpp"
 #include "control.hpp"
 #include "switch.hpp"
@@ -12,6 +12,8 @@
 #include "flowpath/proto.h"
 #include "flowpath/error.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 
@@ -75,6 +77,36 @@ del_request(Io_handler& io, json::Map const& map)
 }
 
 
+// Request the counters of a port. This handles both the show
+// and stat commands.
+void
+get_request(Io_handler& io, json::Map const& map)
+{
+  json::String const* name = get_string_arg(map, "dp");
+  if (!name)
+    return send_error(io, "missing name");
+
+  json::String const* pid = get_string_arg(map, "port");
+  if (!pid)
+    return send_error(io, "missing port id");
+
+  char* end;
+  unsigned long id = std::strtoul(pid->str().c_str(), &end, 10);
+  if (pid->str().empty() || *end)
+    return send_error(io, "invalid port id");
+
+  // Construct a message and send it.
+  char buf[FP_MESSAGE_LEN];
+  fp_request* req = fp_make_request(buf);
+  auto* args = fp_get_port_get_arguments(req);
+  std::copy(name->begin(), name->end(), args->name);
+  args->pid = id;
+  bool res = switch_channel()->on_request(req);
+  if (!res)
+    send_error(io, "request failed");
+}
+
+
 void
 list_request(Io_handler& io, json::Map const& map)
 {
@@ -94,6 +126,8 @@ list_request(Io_handler& io, json::Map const& map)
 Dispatch_table reqs_ {
   {"add",  add_request},
   {"del",  del_request},
+  {"show", get_request},
+  {"stat", get_request},
   {"list", list_request}
 };
 
@@ -115,8 +149,16 @@ port_request(Io_handler& io, json::Map const& args)
   return iter->second(io, args);
 }
 
-void
-port_reply(Io_handler& io, json::Map const& args)
+// Render the result of a successful port get request as JSON.
+// Returns false if the reply could not be sent.
+bool
+port_reply(Io_handler& io, fp_reply const* rep)
 {
-  
+  // The result is not aligned within the message.
+  fp_port_get_result res;
+  std::memcpy(&res, fp_get_port_get_result(rep), sizeof(res));
+  std::string json = format(R"({{"status":"ok","port":{},"index":{},)",
+                            res.pid, res.index)
+                   + format_counters(res.counters) + '}';
+  return ff::send(io.fd(), json) >= 0;
 }
\ No newline at end of file
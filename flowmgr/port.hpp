@@ -7,7 +7,9 @@
 #include "freeflow/async.hpp"
 #include "freeflow/json.hpp"
 
+#include "flowpath/proto.h"
+
 void port_request(ff::Io_handler&, ff::json::Map const&);
-void port_reply(ff::Io_handler&, ff::json::Map const&);
+bool port_reply(ff::Io_handler&, fp_reply const*);
 
 #endif
\ No newline at end of file
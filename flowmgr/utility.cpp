@@ -19,3 +19,22 @@ require_switch(Io_handler& io)
   return nullptr;
 }
 
+
+// Returns the JSON members that describe packet counters. Drops
+// are an object keyed by reason.
+std::string
+format_counters(fp_stat_counters const& c)
+{
+  static char const* reasons[FP_STAT_DROPS] = {
+    "policy", "no_port", "tx", "rss"
+  };
+  std::string drops;
+  for (int i = 0; i < FP_STAT_DROPS; ++i) {
+    if (i)
+      drops += ',';
+    drops += format(R"("{}":{})", reasons[i], c.drops[i]);
+  }
+  return format(R"("rx_packets":{},"rx_bytes":{},"tx_packets":{},"tx_bytes":{},)",
+                c.rx_packets, c.rx_bytes, c.tx_packets, c.tx_bytes)
+       + R"("drops":{)" + drops + '}';
+}
@@ -11,6 +11,8 @@
 #include "freeflow/json.hpp"
 #include "freeflow/format.hpp"
 
+#include "flowpath/proto.h"
+
 
 struct Control_channel;
 struct Switch_channel;
@@ -62,5 +64,7 @@ send_error(ff::Io_handler& io, std::string const& msg)
 Control_channel* require_control(ff::Io_handler&);
 Switch_channel*  require_switch(ff::Io_handler&);
 
+std::string format_counters(fp_stat_counters const&);
+
 
 #endif
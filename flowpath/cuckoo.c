@@ -0,0 +1,418 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "cuckoo.h"
+#include "hashfn.h"
+
+
+/* Hash a key. */
+static inline uint64_t
+hash_key(void const* key, size_t len)
+{
+  return fp_hash_bytes(key, len, FP_HASH_SEED);
+}
+
+
+/* Returns the signature of a hash. */
+static inline uint16_t
+hash_sig(uint64_t h)
+{
+  return h >> 48;
+}
+
+
+/* Returns the key's primary bucket. */
+static inline uint32_t
+primary_bucket(struct fp_cuckoo_table const* t, uint64_t h)
+{
+  return h & (t->nbuckets - 1);
+}
+
+
+/* Returns the other bucket of a key in bucket b with the
+   given signature. This is an involution: applying it twice
+   yields b. */
+static inline uint32_t
+alt_bucket(struct fp_cuckoo_table const* t, uint32_t b, uint16_t sig)
+{
+  return (b ^ ((sig + 1) * 0x5bd1e995u)) & (t->nbuckets - 1);
+}
+
+
+/* Returns the entry with the given (1-based) index. */
+static inline unsigned char*
+get_entry(struct fp_cuckoo_table const* t, uint32_t idx)
+{
+  return t->entries + (size_t)(idx - 1) * t->entry_size;
+}
+
+
+static inline uintptr_t*
+entry_value(unsigned char* ent)
+{
+  return (uintptr_t*)ent;
+}
+
+
+static inline unsigned char*
+entry_key(unsigned char* ent)
+{
+  return ent + sizeof(uintptr_t);
+}
+
+
+/* Returns the version counter for bucket b. */
+static inline uint32_t*
+get_version(struct fp_cuckoo_table const* t, uint32_t b)
+{
+  return (uint32_t*)&t->versions[b % FP_CUCKOO_STRIPES];
+}
+
+
+/* Mark the buckets as being modified. Concurrent searches
+   of these buckets retry until end_write() is called. */
+static inline void
+begin_write(struct fp_cuckoo_table* t, uint32_t b1, uint32_t b2)
+{
+  uint32_t* v1 = get_version(t, b1);
+  uint32_t* v2 = get_version(t, b2);
+  __atomic_store_n(v1, *v1 + 1, __ATOMIC_RELAXED);
+  if (v2 != v1)
+    __atomic_store_n(v2, *v2 + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static inline void
+end_write(struct fp_cuckoo_table* t, uint32_t b1, uint32_t b2)
+{
+  uint32_t* v1 = get_version(t, b1);
+  uint32_t* v2 = get_version(t, b2);
+  __atomic_store_n(v1, *v1 + 1, __ATOMIC_RELEASE);
+  if (v2 != v1)
+    __atomic_store_n(v2, *v2 + 1, __ATOMIC_RELEASE);
+}
+
+
+/* Search bucket b for the key. Returns the slot, or -1 if the
+   key is not in the bucket. The key's entry is stored in *ent. */
+static inline int
+search_bucket(struct fp_cuckoo_table const* t, uint32_t b,
+              uint16_t sig, void const* key, unsigned char** ent)
+{
+  struct fp_cuckoo_bucket const* bkt = &t->buckets[b];
+  for (int i = 0; i < FP_CUCKOO_SLOTS; ++i) {
+    if (bkt->sig[i] != sig)
+      continue;
+    uint32_t idx = __atomic_load_n(&bkt->idx[i], __ATOMIC_ACQUIRE);
+    if (!idx)
+      continue;
+    *ent = get_entry(t, idx);
+    if (!memcmp(entry_key(*ent), key, t->key_size))
+      return i;
+  }
+  return -1;
+}
+
+
+/* Returns the first empty slot in bucket b, or -1 if the
+   bucket is full. */
+static inline int
+empty_slot(struct fp_cuckoo_table const* t, uint32_t b)
+{
+  struct fp_cuckoo_bucket const* bkt = &t->buckets[b];
+  for (int i = 0; i < FP_CUCKOO_SLOTS; ++i)
+    if (!bkt->idx[i])
+      return i;
+  return -1;
+}
+
+
+/* Search for a key with the given hash. */
+static uintptr_t
+find_hashed(struct fp_cuckoo_table const* t, void const* key, uint64_t h)
+{
+  uint16_t sig = hash_sig(h);
+  uint32_t b1 = primary_bucket(t, h);
+  uint32_t b2 = alt_bucket(t, b1, sig);
+  uint32_t* v1 = get_version(t, b1);
+  uint32_t* v2 = get_version(t, b2);
+  while (true) {
+    uint32_t s1 = __atomic_load_n(v1, __ATOMIC_ACQUIRE);
+    uint32_t s2 = __atomic_load_n(v2, __ATOMIC_ACQUIRE);
+    if ((s1 | s2) & 1) {
+      fp_cpu_relax();
+      continue;
+    }
+
+    uintptr_t value = 0;
+    unsigned char* ent;
+    if (search_bucket(t, b1, sig, key, &ent) >= 0 ||
+        search_bucket(t, b2, sig, key, &ent) >= 0)
+      value = __atomic_load_n(entry_value(ent), __ATOMIC_RELAXED);
+
+    /* Retry if the writer moved or removed anything in either
+       bucket while we were looking. */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(v1, __ATOMIC_RELAXED) == s1 &&
+        __atomic_load_n(v2, __ATOMIC_RELAXED) == s2)
+      return value;
+  }
+}
+
+
+/* Allocate a table for at most capacity keys of key_size
+   bytes. The number of buckets allows for a load of about
+   90%, which cuckoo hashing with 8-slot buckets reaches
+   reliably. */
+struct fp_cuckoo_table*
+fp_cuckoo_table_new(size_t key_size, size_t capacity)
+{
+  size_t need = (capacity * 10 / 9 + FP_CUCKOO_SLOTS - 1) / FP_CUCKOO_SLOTS;
+  uint32_t nbuckets = 2;
+  while (nbuckets < need)
+    nbuckets <<= 1;
+
+  struct fp_cuckoo_table* t = fp_allocate(struct fp_cuckoo_table);
+  memset(t, 0, sizeof(struct fp_cuckoo_table));
+  t->key_size = key_size;
+  t->entry_size = (sizeof(uintptr_t) + key_size + 7) & ~(size_t)7;
+  t->nbuckets = nbuckets;
+  t->capacity = capacity;
+  t->size = 0;
+
+  if (posix_memalign((void**)&t->buckets, FP_CACHE_LINE,
+                     nbuckets * sizeof(struct fp_cuckoo_bucket)) != 0) {
+    fp_deallocate(t);
+    return NULL;
+  }
+  memset(t->buckets, 0, nbuckets * sizeof(struct fp_cuckoo_bucket));
+  t->entries = fp_allocate_n(unsigned char, capacity * t->entry_size);
+  t->free = fp_allocate_n(uint32_t, capacity);
+  if (!t->entries || !t->free) {
+    fp_cuckoo_table_delete(t);
+    return NULL;
+  }
+
+  /* Hand out entries in address order. */
+  t->nfree = capacity;
+  for (uint32_t i = 0; i < capacity; ++i)
+    t->free[i] = capacity - i;
+  return t;
+}
+
+
+/* Delete the table. This does not release objects referred
+   to by values. */
+void
+fp_cuckoo_table_delete(struct fp_cuckoo_table* t)
+{
+  if (!t)
+    return;
+  fp_deallocate(t->buckets);
+  fp_deallocate(t->entries);
+  fp_deallocate(t->free);
+  fp_deallocate(t);
+}
+
+
+/* Returns the value associated with the key, or 0 if the key
+   is not in the table. This may be called concurrently with
+   modifications. */
+uintptr_t
+fp_cuckoo_table_find(struct fp_cuckoo_table const* t, void const* key)
+{
+  return find_hashed(t, key, hash_key(key, t->key_size));
+}
+
+
+/* Search for n keys, storing the value of each (or 0) in
+   values. The candidate buckets of every key are prefetched
+   before any is searched, so that their cache misses overlap.
+   Returns the number of keys found. */
+int
+fp_cuckoo_table_find_n(struct fp_cuckoo_table const* t, void const* keys[],
+                       int n, uintptr_t values[])
+{
+  uint64_t hashes[FP_CUCKOO_BURST];
+  int found = 0;
+  while (n > 0) {
+    int m = n < FP_CUCKOO_BURST ? n : FP_CUCKOO_BURST;
+    for (int i = 0; i < m; ++i) {
+      uint64_t h = hashes[i] = hash_key(keys[i], t->key_size);
+      uint32_t b1 = primary_bucket(t, h);
+      __builtin_prefetch(&t->buckets[b1]);
+      __builtin_prefetch(&t->buckets[alt_bucket(t, b1, hash_sig(h))]);
+    }
+    for (int i = 0; i < m; ++i)
+      found += (values[i] = find_hashed(t, keys[i], hashes[i])) != 0;
+    keys += m;
+    values += m;
+    n -= m;
+  }
+  return found;
+}
+
+
+/* A bucket visited by the displacement search. The entry in
+   the parent's slot pslot has this bucket as its alternate. */
+struct search_node
+{
+  uint32_t bucket;
+  int      parent;
+  int      pslot;
+};
+
+
+/* Returns true if bucket b is on the path to node i. */
+static bool
+on_path(struct search_node const* nodes, int i, uint32_t b)
+{
+  for (; i >= 0; i = nodes[i].parent)
+    if (nodes[i].bucket == b)
+      return true;
+  return false;
+}
+
+
+/* Move the entry in slot s of bucket src to the empty slot d
+   of bucket dst. */
+static void
+move_entry(struct fp_cuckoo_table* t, uint32_t src, int s, uint32_t dst, int d)
+{
+  struct fp_cuckoo_bucket* from = &t->buckets[src];
+  struct fp_cuckoo_bucket* to = &t->buckets[dst];
+  begin_write(t, src, dst);
+  to->sig[d] = from->sig[s];
+  __atomic_store_n(&to->idx[d], from->idx[s], __ATOMIC_RELAXED);
+  __atomic_store_n(&from->idx[s], 0, __ATOMIC_RELAXED);
+  end_write(t, src, dst);
+}
+
+
+/* Make room in bucket b1 or b2 by displacing entries along a
+   path found by a breadth-first search. The buckets on a path
+   are distinct. On success, the freed slot is stored in *b
+   and *s. Returns false if no path is found within the search
+   bound. */
+static bool
+make_room(struct fp_cuckoo_table* t, uint32_t b1, uint32_t b2, uint32_t* b, int* s)
+{
+  struct search_node nodes[FP_CUCKOO_SEARCH_MAX];
+  int count = 0;
+  nodes[count++] = (struct search_node){b1, -1, -1};
+  if (b2 != b1)
+    nodes[count++] = (struct search_node){b2, -1, -1};
+
+  for (int head = 0; head < count; ++head) {
+    struct fp_cuckoo_bucket* bkt = &t->buckets[nodes[head].bucket];
+    for (int i = 0; i < FP_CUCKOO_SLOTS; ++i) {
+      uint32_t alt = alt_bucket(t, nodes[head].bucket, bkt->sig[i]);
+      if (on_path(nodes, head, alt))
+        continue;
+
+      int e = empty_slot(t, alt);
+      if (e < 0) {
+        if (count < FP_CUCKOO_SEARCH_MAX)
+          nodes[count++] = (struct search_node){alt, head, i};
+        continue;
+      }
+
+      /* Shift entries toward the empty slot, starting from
+         the end of the path. */
+      uint32_t dst = alt;
+      int d = e;
+      int cur = head;
+      int src = i;
+      while (true) {
+        move_entry(t, nodes[cur].bucket, src, dst, d);
+        if (nodes[cur].parent < 0)
+          break;
+        dst = nodes[cur].bucket;
+        d = src;
+        src = nodes[cur].pslot;
+        cur = nodes[cur].parent;
+      }
+      *b = nodes[cur].bucket;
+      *s = src;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/* Insert the key with the given value, which must not be 0.
+   If the key is already present, its value is replaced.
+   Returns ENOSPC if the table is full or no displacement path
+   can be found. This must not be called concurrently with
+   other modifications. */
+fp_error_t
+fp_cuckoo_table_insert(struct fp_cuckoo_table* t, void const* key, uintptr_t value)
+{
+  assert(value != 0);
+  uint64_t h = hash_key(key, t->key_size);
+  uint16_t sig = hash_sig(h);
+  uint32_t b1 = primary_bucket(t, h);
+  uint32_t b2 = alt_bucket(t, b1, sig);
+
+  /* Replace the value of an existing key. */
+  unsigned char* ent;
+  if (search_bucket(t, b1, sig, key, &ent) >= 0 ||
+      search_bucket(t, b2, sig, key, &ent) >= 0) {
+    __atomic_store_n(entry_value(ent), value, __ATOMIC_RELAXED);
+    return FP_OK;
+  }
+
+  if (t->nfree == 0)
+    return fp_system_error(ENOSPC);
+
+  /* Find a slot before filling in the entry so that a failed
+     insertion does not consume it. */
+  uint32_t b;
+  int s;
+  if ((s = empty_slot(t, b = b1)) < 0 && (s = empty_slot(t, b = b2)) < 0)
+    if (!make_room(t, b1, b2, &b, &s))
+      return fp_system_error(ENOSPC);
+
+  uint32_t idx = t->free[--t->nfree];
+  ent = get_entry(t, idx);
+  *entry_value(ent) = value;
+  memcpy(entry_key(ent), key, t->key_size);
+
+  /* Publish the entry. Searches that see the index also see
+     the entry. */
+  t->buckets[b].sig[s] = sig;
+  __atomic_store_n(&t->buckets[b].idx[s], idx, __ATOMIC_RELEASE);
+  ++t->size;
+  return FP_OK;
+}
+
+
+/* Remove the key from the table. This must not be called
+   concurrently with other modifications. */
+void
+fp_cuckoo_table_remove(struct fp_cuckoo_table* t, void const* key)
+{
+  uint64_t h = hash_key(key, t->key_size);
+  uint16_t sig = hash_sig(h);
+  uint32_t b = primary_bucket(t, h);
+  unsigned char* ent;
+  int i = search_bucket(t, b, sig, key, &ent);
+  if (i < 0) {
+    b = alt_bucket(t, b, sig);
+    i = search_bucket(t, b, sig, key, &ent);
+  }
+  if (i < 0)
+    return;
+
+  /* Bump the bucket's version so that a concurrent search
+     holding this entry retries rather than reading it after
+     it has been reused. */
+  uint32_t idx = t->buckets[b].idx[i];
+  begin_write(t, b, b);
+  __atomic_store_n(&t->buckets[b].idx[i], 0, __ATOMIC_RELAXED);
+  end_write(t, b, b);
+  t->free[t->nfree++] = idx;
+  --t->size;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_CUCKOO_H
+#define FLOWPATH_CUCKOO_H
+
+/* This module implements a bucketized cuckoo hash table that
+   maps fixed-size byte-string keys to non-zero intptrs. It is
+   intended for exact-match flow tables with millions of
+   entries.
+
+   Each key has two candidate buckets, and each bucket has
+   FP_CUCKOO_SLOTS slots. A bucket stores a 16-bit signature
+   of each key and an index into a separate entry array, so
+   that a bucket fits in a cache line and most mismatches are
+   rejected without touching the key. The second bucket is
+   computed from the first and the signature (partial-key
+   cuckoo hashing), so entries can be moved without reading
+   their keys.
+
+   When both buckets are full, an insertion searches, breadth
+   first, for a short path of displacements that ends in an
+   empty slot. The search is bounded to FP_CUCKOO_SEARCH_MAX
+   buckets; if no path is found, the insertion fails.
+
+   Concurrency: any number of threads may search the table
+   while one thread modifies it. Searches take no locks. The
+   writer bumps a version counter (one of FP_CUCKOO_STRIPES)
+   for each bucket whose contents it moves or removes, and a
+   search that observes a change to the counters of its
+   buckets retries. Insertion into an empty slot does not
+   disturb searches. Modifications must be serialized by the
+   caller.
+
+   Note that a search may return a value that is concurrently
+   being removed. Objects referenced by values must not be
+   reclaimed until concurrent searches have finished. */
+
+#include "util.h"
+#include "error.h"
+
+
+/* The number of slots per bucket. */
+#define FP_CUCKOO_SLOTS      8
+
+/* The number of version counters. Buckets share counters
+   modulo this value. */
+#define FP_CUCKOO_STRIPES    1024
+
+/* The maximum number of buckets visited when searching for a
+   displacement path. */
+#define FP_CUCKOO_SEARCH_MAX 256
+
+/* The maximum number of keys searched at once by
+   fp_cuckoo_table_find_n(). */
+#define FP_CUCKOO_BURST      64
+
+
+/* A bucket. A slot is empty when its index is 0; otherwise,
+   the index is one more than the position of its entry. */
+struct fp_cuckoo_bucket
+{
+  uint16_t sig[FP_CUCKOO_SLOTS];
+  uint32_t idx[FP_CUCKOO_SLOTS];
+} fp_cache_aligned;
+
+
+/* A cuckoo hash table. Each entry holds the value followed
+   by the key. */
+struct fp_cuckoo_table
+{
+  size_t   key_size;    /* Bytes per key. */
+  size_t   entry_size;  /* Bytes per entry. */
+  uint32_t nbuckets;    /* A power of 2. */
+  uint32_t capacity;    /* Maximum number of elements. */
+  uint32_t size;        /* Number of elements. */
+
+  struct fp_cuckoo_bucket* buckets;
+  unsigned char*           entries;
+
+  /* Entries not in use. Only the writer uses this. */
+  uint32_t  nfree;
+  uint32_t* free;
+
+  uint32_t versions[FP_CUCKOO_STRIPES];
+};
+
+
+struct fp_cuckoo_table* fp_cuckoo_table_new(size_t, size_t);
+void                    fp_cuckoo_table_delete(struct fp_cuckoo_table*);
+uintptr_t               fp_cuckoo_table_find(struct fp_cuckoo_table const*, void const*);
+int                     fp_cuckoo_table_find_n(struct fp_cuckoo_table const*, void const*[], int, uintptr_t[]);
+fp_error_t              fp_cuckoo_table_insert(struct fp_cuckoo_table*, void const*, uintptr_t);
+void                    fp_cuckoo_table_remove(struct fp_cuckoo_table*, void const*);
+
+
+#endif
@@ -5,10 +5,10 @@
 #include "pipeline.h"
 #include "port.h"
 #include "proto.h"
+#include "emc.h"
+#include "rss.h"
 
 
-#define FP_DATAPLANE_MAX 64
-
 /* Table of data planes. 
    FIXME: This should probably be a hash table. */
 static struct fp_dataplane* dps_[FP_DATAPLANE_MAX];
@@ -22,7 +22,12 @@ allocate_dataplane()
   int i = 0;
   for (; i < FP_DATAPLANE_MAX; ++i) {
     if (!dps_[i]) {
-      dps_[i] = fp_allocate(struct fp_dataplane);
+      /* The port array is cache aligned. */
+      void* p;
+      if (posix_memalign(&p, FP_CACHE_LINE, sizeof(struct fp_dataplane)) != 0)
+        return NULL;
+      memset(p, 0, sizeof(struct fp_dataplane));
+      dps_[i] = (struct fp_dataplane*)p;
       dps_[i]->id = i;
       return dps_[i];
     }
@@ -81,6 +86,10 @@ fp_dataplane_create(char const* name, char const* type, fp_error_t* err)
   }
   dp->name = name;
   dp->type = type;
+  dp->decoder = NULL;
+  fp_stats_block_init(&dp->ports.stats,
+                      FP_DATAPLANE_MAX_PORTS * sizeof(struct fp_port_stats));
+  fp_stats_block_init(&dp->latency, FP_LATENCY_BLOCK_SIZE);
 
   /* Load a pipeline based on the type of dataplane. 
 
@@ -93,10 +102,10 @@ fp_dataplane_create(char const* name, char const* type, fp_error_t* err)
   }
 
   /* Initialize the port table. */
-  dp->ports.table = fp_chained_hash_table_new(17, fp_uint_hash, fp_uint_eq);
+  dp->ports.table = fp_flat_hash_table_new(17, fp_uint_hash, fp_uint_eq);
   
   /* Initialize an empty set of flow tables. */
-  dp->tables.table = fp_chained_hash_table_new(17, fp_uint_hash, fp_uint_eq);
+  dp->tables.table = fp_flat_hash_table_new(17, fp_uint_hash, fp_uint_eq);
 
   /* This will be updated if key is changed. */
   dp->key_size = sizeof(struct fp_base_key); 
@@ -117,15 +126,26 @@ fp_dataplane_create(char const* name, char const* type, fp_error_t* err)
 void
 fp_dataplane_delete(struct fp_dataplane* dp, fp_error_t* err)
 {
+  /* Results cached for this data plane must not be seen by a
+     data plane that reuses its id. */
+  fp_emc_invalidate();
+
   /* Release the pipeline. */
   if (dp->pipeline)
     fp_pipeline_unload(dp, err);
 
   /* Clear the port table. */
-  fp_chained_hash_table_delete(dp->ports.table);
+  fp_flat_hash_table_delete(dp->ports.table);
 
   /* Clear the flow tables. */
-  fp_chained_hash_table_delete(dp->tables.table);
+  fp_flat_hash_table_delete(dp->tables.table);
+
+  /* Release the decoder. */
+  fp_decoder_delete(dp->decoder);
+
+  /* Release the port counters and latency histograms. */
+  fp_stats_block_clear(&dp->ports.stats);
+  fp_stats_block_clear(&dp->latency);
 
   /* Release the slot from the database table. */
   deallocate_dataplane(dp);
@@ -141,15 +161,33 @@ fp_dataplane_lookup(char const* name)
 
 
 /* Add a port to the data plane and notify the pipeline about
-   the addition. */
+   the addition. The port is given the lowest free local index.
+   If the data plane has no free index, the port is not added
+   and the error is ENOSPC. */
 void
 fp_dataplane_add_port(struct fp_dataplane* dp, struct fp_port* port, fp_error_t* err)
 {
   /* TODO: Can insertion ever fail? */
-  struct fp_chained_hash_table* t = dp->ports.table;
-  
+  struct fp_flat_hash_table* t = dp->ports.table;
+
+  /* Find a local index for the port. */
+  fp_port_id_t i = 0;
+  while (i < FP_DATAPLANE_MAX_PORTS && dp->ports.index[i])
+    ++i;
+  if (i == FP_DATAPLANE_MAX_PORTS) {
+    *err = fp_system_error(ENOSPC);
+    return;
+  }
+
+  /* The port's counters start from the index's totals. */
+  fp_stats_block_sum(&dp->ports.stats, i * sizeof(struct fp_port_stats),
+                     sizeof(struct fp_port_stats) / sizeof(uint64_t),
+                     (uint64_t*)&dp->ports.base[i]);
+
   /* Add the port to the data planes port table. */
-  fp_chained_hash_table_insert(t, port->id, (uintptr_t)port);
+  fp_flat_hash_table_insert(t, port->id, i);
+  __atomic_store_n(&dp->ports.index[i], port, __ATOMIC_RELEASE);
+  __atomic_store_n(&port->index, i, __ATOMIC_RELEASE);
 
   /* Add the port to the pipeline. */
   *err = dp->pipeline->add_port(dp, port);
@@ -157,7 +195,9 @@ fp_dataplane_add_port(struct fp_dataplane* dp, struct fp_port* port, fp_error_t*
 
 
 /* Remove the port from the data plane. This does not destroy
-   the port object.
+   the port object. Workers may still refer to the port until
+   they pass through a quiescent state, so its deletion must be
+   deferred (see qsbr.h).
 
    TODO: Do we need to stop the port, release memory, 
    clear its queues? What? */
@@ -167,9 +207,13 @@ fp_dataplane_remove_port(struct fp_dataplane* dp, struct fp_port* port, fp_error
   /* TODO: Is the success of the pipeline removal a necessary
      condition for removing from the data plane's port table? */
   *err = dp->pipeline->del_port(dp, port);
-  if (err == FP_OK) {
-    struct fp_chained_hash_table* t = dp->ports.table;
-    fp_chained_hash_table_remove(t, port->id);
+  if (*err == FP_OK) {
+    struct fp_flat_hash_table* t = dp->ports.table;
+    struct fp_flat_hash_entry* ent = fp_flat_hash_table_find(t, port->id);
+    if (ent)
+      __atomic_store_n(&dp->ports.index[ent->value], NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&port->index, FP_PORT_DROP, __ATOMIC_RELEASE);
+    fp_flat_hash_table_remove(t, port->id);
   }  
 }
 
@@ -177,28 +221,85 @@ fp_dataplane_remove_port(struct fp_dataplane* dp, struct fp_port* port, fp_error
 void
 fp_dataplane_list_ports(struct fp_dataplane* dp, struct fp_port** ports, fp_error_t* err)
 {
-  struct fp_chained_hash_table* t = dp->ports.table;  
-  int i;
-  for (i = 0; i < t->size; i++) {
-    ports[i] = (struct fp_port*)t->data[i]->value;
-  }
+  struct fp_flat_hash_table* t = dp->ports.table;  
+  struct fp_flat_hash_entry* ent;
+  size_t pos = 0;
+  int i = 0;
+  while ((ent = fp_flat_hash_table_next(t, &pos)))
+    ports[i++] = dp->ports.index[ent->value];
+}
+
+
+/* Aggregate the counters of the port with the given local
+   index. */
+void
+fp_dataplane_port_stats(struct fp_dataplane* dp, fp_port_id_t index,
+                        struct fp_port_stats* stats)
+{
+  assert(index < FP_DATAPLANE_MAX_PORTS);
+  int n = sizeof(struct fp_port_stats) / sizeof(uint64_t);
+  uint64_t* p = (uint64_t*)stats;
+  uint64_t const* base = (uint64_t const*)&dp->ports.base[index];
+  fp_stats_block_sum(&dp->ports.stats, index * sizeof(struct fp_port_stats), n, p);
+  for (int i = 0; i < n; ++i)
+    p[i] -= base[i];
 }
 
 
 /* Returns a pointer to the port with the given id or NULL
-   if no such port exists. */
+   if no such port exists. Reserved ports have no port objects.
+   This searches the port table, which only the control path may
+   do; workers find ports by local index (see
+   fp_dataplane_port()), and resolve output ports with
+   fp_dataplane_output_port(). */
 struct fp_port*
 fp_dataplane_get_port(struct fp_dataplane* dp, fp_port_id_t p)
 {
-  struct fp_chained_hash_table* t = dp->ports.table;
-  struct fp_chained_hash_entry* ent = fp_chained_hash_table_find(t, p);
+  if (fp_is_reserved_port(p))
+    return NULL;
+  struct fp_flat_hash_table* t = dp->ports.table;
+  struct fp_flat_hash_entry* ent = fp_flat_hash_table_find(t, p);
   if (ent)
-    return (struct fp_port*)ent->value;
+    return fp_dataplane_port(dp, ent->value);
   else
     return NULL;
 }
 
 
+/* Returns the local index of the port with the given id. This
+   is the value of a context's out_index that sends packets to
+   the port. Reserved ports are their own indexes. If the data
+   plane has no such port, this returns FP_PORT_DROP. Like
+   fp_dataplane_get_port(), this must not be called by
+   workers. */
+fp_port_id_t
+fp_dataplane_port_index(struct fp_dataplane* dp, fp_port_id_t p)
+{
+  if (fp_is_reserved_port(p))
+    return p;
+  struct fp_flat_hash_entry* ent = fp_flat_hash_table_find(dp->ports.table, p);
+  return ent ? (fp_port_id_t)ent->value : FP_PORT_DROP;
+}
+
+
+/* Returns the local index of the port with the given id, as
+   fp_dataplane_port_index() does, by searching the port array
+   rather than the table. This may be called by workers, but it
+   costs a scan of the array. */
+fp_port_id_t
+fp_dataplane_find_index(struct fp_dataplane* dp, fp_port_id_t p)
+{
+  if (fp_is_reserved_port(p))
+    return p;
+  for (fp_port_id_t i = 0; i < FP_DATAPLANE_MAX_PORTS; ++i) {
+    struct fp_port* port = fp_dataplane_port(dp, i);
+    if (port && port->id == p)
+      return i;
+  }
+  return FP_PORT_DROP;
+}
+
+
 /* Start the data plane. */
 fp_error_t
 fp_dataplane_start(struct fp_dataplane* dp)
@@ -227,6 +328,290 @@ fp_dataplane_stop(struct fp_dataplane* dp)
 
 
 
+/* Count packets received on the port with the given local
+   index, of which rejected were dropped by its RSS stage. */
+static void
+count_receive(struct fp_dataplane* dp, fp_port_id_t index, int n,
+              uint64_t bytes, int rejected)
+{
+  if (index >= FP_DATAPLANE_MAX_PORTS)
+    return;
+  int shard;
+  struct fp_port_stats* s = fp_dataplane_port_counters(dp, index, &shard);
+  if (!s)
+    return;
+  fp_stats_add(&s->rx_packets, n, shard);
+  fp_stats_add(&s->rx_bytes, bytes, shard);
+  if (rejected)
+    fp_stats_add(&s->drops[FP_DROP_RSS], rejected, shard);
+}
+
+
+/* Receive up to budget packets from the port and run each
+   through the data plane's pipeline, or, if the port has an RSS
+   stage, distribute them to the stage's rings. Packets that do
+   not fit in their rings are dropped. Returns the number of
+   packets received. When this returns less than the budget,
+   the port has been drained.
+
+   Packets are counted as received here, and not when they are
+   taken from an RSS ring. When the data plane is timing packets,
+   each is given the time at which its burst was received. */
+int
+fp_dataplane_receive(struct fp_dataplane* dp, struct fp_port* port, int budget)
+{
+  struct fp_packet* pkts[FP_PIPELINE_BURST];
+  struct fp_arrival arrs[FP_PIPELINE_BURST];
+  fp_port_id_t index = __atomic_load_n(&port->index, __ATOMIC_ACQUIRE);
+  struct fp_arrival arr = {port->id, port->id, 0, index};
+  int total = 0;
+  int rejected = 0;
+  uint64_t bytes = 0;
+  if (fp_dataplane_is_quiesced(dp))
+    return 0;
+  struct fp_pipeline* p = __atomic_load_n(&dp->pipeline, __ATOMIC_ACQUIRE);
+  while (total < budget) {
+    /* Gather a burst. */
+    int max = budget - total;
+    if (max > FP_PIPELINE_BURST)
+      max = FP_PIPELINE_BURST;
+    uint64_t now = fp_dataplane_clock(dp);
+    int n = fp_port_recv_burst(port, pkts, max);
+    if (n <= 0)
+      break;
+    for (int i = 0; i < n; ++i) {
+      arrs[i] = arr;
+      bytes += pkts[i]->size;
+      if (now)
+        pkts[i]->timestamp = now;
+    }
+
+    /* And process it, or hand it to other workers. */
+    if (port->rss) {
+      int r = fp_rss_distribute(port->rss, pkts, n);
+      for (int i = 0; i < r; ++i)
+        fp_port_drop_packet(port, pkts[i]);
+      rejected += r;
+    } else {
+      p->insert_burst(dp, pkts, arrs, n);
+    }
+    total += n;
+    if (n < max)
+      break;
+  }
+  if (total)
+    count_receive(dp, index, total, bytes, rejected);
+  return total;
+}
+
+
+/* Run up to budget packets from the given ring of the port's
+   RSS stage through the pipeline. Returns the number of packets
+   processed. */
+int
+fp_dataplane_receive_ring(struct fp_dataplane* dp, struct fp_port* port,
+                          int ring, int budget)
+{
+  struct fp_packet* pkts[FP_PIPELINE_BURST];
+  struct fp_arrival arrs[FP_PIPELINE_BURST];
+  fp_port_id_t index = __atomic_load_n(&port->index, __ATOMIC_ACQUIRE);
+  struct fp_arrival arr = {port->id, port->id, 0, index};
+  int total = 0;
+  if (fp_dataplane_is_quiesced(dp))
+    return 0;
+  struct fp_pipeline* p = __atomic_load_n(&dp->pipeline, __ATOMIC_ACQUIRE);
+  while (total < budget) {
+    int max = budget - total;
+    if (max > FP_PIPELINE_BURST)
+      max = FP_PIPELINE_BURST;
+    int n = fp_rss_receive(port->rss, ring, pkts, max);
+    if (n <= 0)
+      break;
+    for (int i = 0; i < n; ++i)
+      arrs[i] = arr;
+    p->insert_burst(dp, pkts, arrs, n);
+    total += n;
+    if (n < max)
+      break;
+  }
+  return total;
+}
+
+
+/* Start or stop timing the data plane's packets. Packets
+   received while timing is off are not timed. */
+void
+fp_dataplane_set_timing(struct fp_dataplane* dp, bool on)
+{
+  /* Calibrate the clock before it is needed by readers. */
+  if (on)
+    fp_cycles_per_ns();
+  __atomic_store_n(&dp->timing, on, __ATOMIC_RELAXED);
+}
+
+
+/* Record the time between each of n receive times and end in
+   the given stage. Packets of a burst share their receive time,
+   so runs of equal times are recorded together. */
+static void
+time_since_receive(struct fp_dataplane* dp, int stage, uint64_t const* t,
+                   int n, uint64_t end)
+{
+  int i = 0;
+  while (i < n) {
+    int j = i + 1;
+    while (j < n && t[j] == t[i])
+      ++j;
+    fp_dataplane_time(dp, stage, t[i], end, j - i);
+    i = j;
+  }
+}
+
+
+/* Mark the entry of n packets into the pipeline, recording the
+   time since they were received. Returns the time of ingress,
+   to be passed to fp_dataplane_time(), or 0 if the data plane is
+   not timing packets. Pipelines call this when a burst enters
+   them. */
+uint64_t
+fp_dataplane_ingress(struct fp_dataplane* dp, struct fp_packet** pkts, int n)
+{
+  uint64_t now = fp_dataplane_clock(dp);
+  if (!now)
+    return 0;
+  uint64_t t[n];
+  for (int i = 0; i < n; ++i)
+    t[i] = pkts[i]->timestamp;
+  time_since_receive(dp, FP_STAGE_RECEIVE, t, n, now);
+  return now;
+}
+
+
+/* Send the context's packet through its output port (see
+   fp_dataplane_output_port()), counting it as sent or dropped.
+   If there is no output port, the packet is dropped. */
+void
+fp_dataplane_output(struct fp_dataplane* dp, struct fp_context* cxt)
+{
+  struct fp_port* port = fp_dataplane_output_port(dp, cxt);
+  if (!port) {
+    fp_dataplane_drop(dp, cxt, FP_DROP_NO_PORT);
+    return;
+  }
+  fp_port_id_t index = cxt->out_index;
+  if (index >= FP_DATAPLANE_MAX_PORTS)
+    index = cxt->in_index;
+  int size = cxt->packet->size;
+  uint64_t stamp = cxt->packet->timestamp;
+  uint64_t begin = fp_dataplane_clock(dp);
+  int sent = fp_port_output(port, cxt) > 0;
+  if (begin) {
+    uint64_t end = fp_cycles();
+    fp_dataplane_time(dp, FP_STAGE_EGRESS, begin, end, 1);
+    fp_dataplane_time(dp, FP_STAGE_TOTAL, stamp, end, 1);
+  }
+  int shard;
+  struct fp_port_stats* s;
+  if (index >= FP_DATAPLANE_MAX_PORTS ||
+      !(s = fp_dataplane_port_counters(dp, index, &shard)))
+    return;
+  if (sent) {
+    fp_stats_add(&s->tx_packets, 1, shard);
+    fp_stats_add(&s->tx_bytes, size, shard);
+  } else {
+    fp_stats_add(&s->drops[FP_DROP_TX], 1, shard);
+  }
+}
+
+
+/* Send n packets through the port with the given local index,
+   counting them as sent or dropped, and timing their egress.
+   Returns the number of packets sent. The port takes ownership
+   of every packet. Since devices do not report which packets
+   they failed to send, the bytes sent are those of the first
+   packets of the burst. If no port has the index (e.g., it is
+   FP_PORT_DROP), the packets are dropped. */
+int
+fp_dataplane_send_burst(struct fp_dataplane* dp, fp_port_id_t index,
+                        struct fp_packet** pkts, int n)
+{
+  struct fp_port* port = NULL;
+  if (index < FP_DATAPLANE_MAX_PORTS)
+    port = fp_dataplane_port(dp, index);
+  if (!port) {
+    for (int i = 0; i < n; ++i) {
+      fp_packet_release_buffer(pkts[i]);
+      fp_packet_delete(pkts[i]);
+    }
+    fp_dataplane_count_drops(dp, index, FP_DROP_NO_PORT, n);
+    return 0;
+  }
+  uint64_t bytes[n + 1];
+  uint64_t stamps[n];
+  uint64_t begin = fp_dataplane_clock(dp);
+  bytes[0] = 0;
+  for (int i = 0; i < n; ++i) {
+    bytes[i + 1] = bytes[i] + pkts[i]->size;
+    if (begin)
+      stamps[i] = pkts[i]->timestamp;
+  }
+  int sent = fp_port_send_burst(port, pkts, n);
+  if (begin) {
+    uint64_t end = fp_cycles();
+    fp_dataplane_time(dp, FP_STAGE_EGRESS, begin, end, n);
+    time_since_receive(dp, FP_STAGE_TOTAL, stamps, n, end);
+  }
+  int shard;
+  struct fp_port_stats* s = fp_dataplane_port_counters(dp, index, &shard);
+  if (s) {
+    fp_stats_add(&s->tx_packets, sent, shard);
+    fp_stats_add(&s->tx_bytes, bytes[sent], shard);
+    if (sent < n)
+      fp_stats_add(&s->drops[FP_DROP_TX], n - sent, shard);
+  }
+  return sent;
+}
+
+
+/* Drop the context's packet for the given reason, counting the
+   drop on its input port. */
+void
+fp_dataplane_drop(struct fp_dataplane* dp, struct fp_context* cxt, int reason)
+{
+  fp_port_id_t index = cxt->in_index;
+  struct fp_port* in = NULL;
+  if (index < FP_DATAPLANE_MAX_PORTS)
+    in = fp_dataplane_port(dp, index);
+  if (in) {
+    fp_port_drop_packet(in, cxt->packet);
+  } else {
+    fp_packet_release_buffer(cxt->packet);
+    fp_packet_delete(cxt->packet);
+  }
+  fp_dataplane_count_drops(dp, index, reason, 1);
+}
+
+
+/* Install the decoder in the data plane and return the decoder
+   it replaces. A null decoder removes the current one. The
+   previous decoder may still be running on other threads; the
+   caller must wait for them (e.g., fp_engine_synchronize())
+   before deleting it. The decoder's key size must not exceed
+   the data plane's. */
+struct fp_decoder*
+fp_dataplane_set_decoder(struct fp_dataplane* dp, struct fp_decoder* d)
+{
+  assert(!d || d->key_size <= dp->key_size);
+  struct fp_decoder* old =
+    __atomic_exchange_n(&dp->decoder, d, __ATOMIC_ACQ_REL);
+
+  /* Cached results depend on the extracted keys. */
+  fp_emc_invalidate();
+  return old;
+}
+
+
+
 #if 0
 
 
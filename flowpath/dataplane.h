@@ -13,17 +13,47 @@
 #include "error.h"
 #include "types.h"
 #include "hash.h"
+#include "decoder.h"
+#include "port.h"
+#include "packet.h"
+#include "stats.h"
+#include "latency.h"
 
-struct fp_packet;
-struct fp_context;
-struct fp_port;
+
+/* The maximum number of data planes. Data plane ids are less
+   than this value. */
+#define FP_DATAPLANE_MAX 64
+
+
+/* The maximum number of ports in a data plane. Local port
+   indexes are less than this value. */
+#define FP_DATAPLANE_MAX_PORTS 256
 
 
 /* A port table is a collection of named ports. This is a
-   resource managed by the data plane. */
+   resource managed by the data plane. 
+
+   Each port added to the data plane is given a compact local
+   index, and the ports are kept in a dense array indexed by it.
+   Port ids are mapped to local indexes when the data plane is
+   configured (see fp_dataplane_port_index()), so that resolving
+   the output port of a packet is a single load from the array
+   rather than a hash table lookup. A port records its own
+   index (see fp_port), and a packet's arrival carries the index
+   of its input port, so workers never search the table, which
+   only the control path reads and modifies.
+
+   Port counters (see stats.h) are also indexed by local index.
+   Since indexes are reused, the totals of an index when a port
+   is added are recorded, and subtracted when the port's
+   counters are read. */
 struct fp_ports
 {
-  struct fp_chained_hash_table* table;
+  struct fp_flat_hash_table* table; /* Maps port ids to local indexes. */
+  struct fp_port* index[FP_DATAPLANE_MAX_PORTS] fp_cache_aligned;
+
+  struct fp_stats_block stats; /* An fp_port_stats per index. */
+  struct fp_port_stats  base[FP_DATAPLANE_MAX_PORTS];
 };
 
 
@@ -33,7 +63,7 @@ struct fp_ports
    for managing tables. But it will work for now. */
 struct fp_tables
 {
-  struct fp_chained_hash_table* table;
+  struct fp_flat_hash_table* table;
 };
 
 
@@ -56,8 +86,22 @@ struct fp_dataplane
 
   struct fp_pipeline* pipeline;
 
+  /* True while workers must not run the pipeline (see
+     fp_dataplane_quiesce()). */
+  bool quiesce;
+
+  /* The decoder that extracts keys, if any. This is replaced
+     at run time (see fp_dataplane_set_decoder()). */
+  struct fp_decoder* decoder;
+
+  /* True while packets are timed, and the latency histograms
+     of each stage (see latency.h). */
+  bool                  timing;
+  struct fp_stats_block latency;
+
   /* Configuration parameters for Modular stages. */
-  size_t key_size;   /* Number of bytes of user-defined Key */
+  size_t key_size;   /* Number of bytes of user-defined Key. At most
+                        FP_PACKET_KEY_SIZE (see packet.h). */
 } fp_dataplane_t;
 
 
@@ -68,11 +112,26 @@ struct fp_dataplane* fp_dataplane_lookup(char const*);
 void            fp_dataplane_add_port(struct fp_dataplane* dp, struct fp_port*, fp_error_t*);
 void            fp_dataplane_remove_port(struct fp_dataplane* dp, struct fp_port*, fp_error_t*);
 struct fp_port* fp_dataplane_get_port(struct fp_dataplane*, fp_port_id_t);
+fp_port_id_t    fp_dataplane_port_index(struct fp_dataplane*, fp_port_id_t);
+fp_port_id_t    fp_dataplane_find_index(struct fp_dataplane*, fp_port_id_t);
 void            fp_dataplane_list_ports(struct fp_dataplane*, struct fp_port**, fp_error_t*);
+void            fp_dataplane_port_stats(struct fp_dataplane*, fp_port_id_t, struct fp_port_stats*);
 
 fp_error_t fp_dataplane_start(struct fp_dataplane*);
 fp_error_t fp_dataplane_stop(struct fp_dataplane*);
 
+int fp_dataplane_receive(struct fp_dataplane*, struct fp_port*, int);
+int fp_dataplane_receive_ring(struct fp_dataplane*, struct fp_port*, int, int);
+
+void fp_dataplane_output(struct fp_dataplane*, struct fp_context*);
+int  fp_dataplane_send_burst(struct fp_dataplane*, fp_port_id_t, struct fp_packet**, int);
+void fp_dataplane_drop(struct fp_dataplane*, struct fp_context*, int);
+
+void     fp_dataplane_set_timing(struct fp_dataplane*, bool);
+uint64_t fp_dataplane_ingress(struct fp_dataplane*, struct fp_packet**, int);
+
+struct fp_decoder* fp_dataplane_set_decoder(struct fp_dataplane*, struct fp_decoder*);
+
 
 /* Returns true if the dataplane is up and running. */
 static inline bool
@@ -82,6 +141,119 @@ fp_dataplane_is_up(struct fp_dataplane const* dp)
 }
 
 
+/* Extract the context's key using the data plane's decoder.
+   This does nothing if the data plane has no decoder. Pipelines
+   call this after attaching a context. If the decoder sets the
+   output port ($op), the context's out_index is set to match. */
+static inline void
+fp_dataplane_decode(struct fp_dataplane* dp, struct fp_context* cxt)
+{
+  struct fp_decoder* d = __atomic_load_n(&dp->decoder, __ATOMIC_ACQUIRE);
+  if (!d)
+    return;
+  fp_port_id_t out = cxt->out_port;
+  fp_decoder_run(d, cxt);
+  if (cxt->out_port != out)
+    cxt->out_index = fp_dataplane_find_index(dp, cxt->out_port);
+}
+
+
+/* Set whether workers may run the data plane's pipeline. While
+   the data plane is quiesced, receiving from its ports does
+   nothing, and packets remain queued in their devices. A worker
+   that has passed through a quiescent point after this is set
+   is not running the pipeline. */
+static inline void
+fp_dataplane_quiesce(struct fp_dataplane* dp, bool q)
+{
+  __atomic_store_n(&dp->quiesce, q, __ATOMIC_SEQ_CST);
+}
+
+
+/* Returns true if the data plane is quiesced. */
+static inline bool
+fp_dataplane_is_quiesced(struct fp_dataplane* dp)
+{
+  return __atomic_load_n(&dp->quiesce, __ATOMIC_ACQUIRE);
+}
+
+
+/* Returns the port with the given local index, or NULL if
+   there is none. */
+static inline struct fp_port*
+fp_dataplane_port(struct fp_dataplane* dp, fp_port_id_t index)
+{
+  return __atomic_load_n(&dp->ports.index[index], __ATOMIC_ACQUIRE);
+}
+
+
+/* Returns the port through which the context's packet is to be
+   sent, or NULL if the packet is to be dropped. The output is
+   the context's out_index: a local port index or a reserved
+   port. Of the reserved ports, only IN_PORT names a single
+   port, which is found through the context's in_index; the
+   others (e.g., FLOOD or CONTROLLER) must be handled by the
+   pipeline before the packet is output. */
+static inline struct fp_port*
+fp_dataplane_output_port(struct fp_dataplane* dp, struct fp_context const* cxt)
+{
+  fp_port_id_t i = cxt->out_index;
+  if (__builtin_expect(i < FP_DATAPLANE_MAX_PORTS, 1))
+    return fp_dataplane_port(dp, i);
+  if (i == FP_PORT_IN_PORT && cxt->in_index < FP_DATAPLANE_MAX_PORTS)
+    return fp_dataplane_port(dp, cxt->in_index);
+  return NULL;
+}
+
+
+/* Returns the calling thread's counters for the port with the
+   given local index, and sets *shard to their shard (see
+   fp_stats_add()). Returns NULL if the counters cannot be
+   allocated. */
+static inline struct fp_port_stats*
+fp_dataplane_port_counters(struct fp_dataplane* dp, fp_port_id_t index, int* shard)
+{
+  uint64_t* p = fp_stats_block_get(&dp->ports.stats, shard);
+  return p ? (struct fp_port_stats*)p + index : NULL;
+}
+
+
+/* Count n packets dropped for the given reason on the port with
+   the given local index. This does nothing if the index is not
+   a local index. */
+static inline void
+fp_dataplane_count_drops(struct fp_dataplane* dp, fp_port_id_t index,
+                         int reason, int n)
+{
+  int shard;
+  struct fp_port_stats* s;
+  if (index < FP_DATAPLANE_MAX_PORTS &&
+      (s = fp_dataplane_port_counters(dp, index, &shard)))
+    fp_stats_add(&s->drops[reason], n, shard);
+}
+
+
+/* Returns the time stamp counter if the data plane is timing
+   packets, or 0 if it is not. Pipelines pass this to
+   fp_dataplane_time() to time their stages. */
+static inline uint64_t
+fp_dataplane_clock(struct fp_dataplane* dp)
+{
+  return __atomic_load_n(&dp->timing, __ATOMIC_RELAXED) ? fp_cycles() : 0;
+}
+
+
+/* Record that n packets spent from begin to end (see
+   fp_dataplane_clock()) in the given stage. This does nothing
+   if begin is 0. */
+static inline void
+fp_dataplane_time(struct fp_dataplane* dp, int stage,
+                  uint64_t begin, uint64_t end, int n)
+{
+  fp_latency_record(&dp->latency, stage, begin, end, n);
+}
+
+
 /* Put the dataplane in the up state. This should only ever be called
    from the start() method of a pipeline module. */
 static inline void
@@ -0,0 +1,604 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "decoder.h"
+#include "packet.h"
+#include "pipeline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+
+/* Specialized opcodes. */
+enum
+{
+  HALT,
+  EXT_PACKET,   /* Packet to key. */
+  EXT_REG,      /* Register to key. */
+  READ_PACKET,  /* Packet to register. */
+  READ_REG,     /* Register to register. */
+  WRITE_KEY,    /* Immediate to key. */
+  WRITE_REG,    /* Immediate to register. */
+  JUMP,
+  JEQ,
+  JNE,
+  JLT,
+  JGT,
+  JSET,
+};
+
+
+/* The first scratch register in the register file. */
+#define SCRATCH 4
+
+
+/* Returns true if the operand names a register. */
+static inline bool
+is_register(int32_t x)
+{
+  return x < 0;
+}
+
+
+/* Translate the register operand x to an index in the register
+   file. Returns -1 if x does not name a register. */
+static int
+register_index(int32_t x)
+{
+  int32_t n = ~x;
+  if (n >= FP_PROKEX_IP && n <= FP_PROKEX_OP)
+    return n;
+  if (n >= FP_PROKEX_R0 && n <= FP_PROKEX_R31)
+    return n - FP_PROKEX_R0 + SCRATCH;
+  return -1;
+}
+
+
+/* Returns true if a register can be stored in len bytes of the
+   key. */
+static inline bool
+is_store_length(int len)
+{
+  return len == 1 || len == 2 || len == 4 || len == 8;
+}
+
+
+/* The state of verification. */
+struct verifier
+{
+  size_t   key_size;
+  uint32_t extent;
+  uint32_t nscratch;
+};
+
+
+/* Check the register operand x and return its index, or -1. */
+static int
+verify_register(struct verifier* v, int32_t x)
+{
+  int r = register_index(x);
+  if (r >= SCRATCH && (uint32_t)(r - SCRATCH + 1) > v->nscratch)
+    v->nscratch = r - SCRATCH + 1;
+  return r;
+}
+
+
+/* Check that len bytes at the packet offset x can be read. */
+static bool
+verify_packet(struct verifier* v, int32_t x, int len)
+{
+  uint64_t end = (uint64_t)x + len;
+  if (x < 0 || end > FP_DECODER_MAX_EXTENT)
+    return false;
+  if (end > v->extent)
+    v->extent = end;
+  return true;
+}
+
+
+/* Check that len bytes at the key offset x can be written. */
+static bool
+verify_key(struct verifier* v, int32_t x, int len)
+{
+  return x >= 0 && (uint64_t)x + len <= v->key_size;
+}
+
+
+/* Verify the instruction i, at index pc of a program of n
+   instructions, and translate it to out. Returns false if the
+   instruction is invalid. */
+static bool
+verify(struct verifier* v, struct fp_prokex_insn const* i,
+       size_t pc, size_t n, struct fp_decoder_insn* out)
+{
+  int len = i->len;
+  out->len = len;
+  out->target = 0;
+  out->src = 0;
+  out->dst = 0;
+  out->imm = i->imm;
+  switch (i->op) {
+  case FP_PROKEX_HALT:
+    out->op = HALT;
+    return true;
+
+  case FP_PROKEX_EXT:
+    if (len == 0 || !verify_key(v, i->dst, len))
+      return false;
+    out->dst = i->dst;
+    if (is_register(i->src)) {
+      int r = verify_register(v, i->src);
+      if (r < 0 || !is_store_length(len))
+        return false;
+      out->op = EXT_REG;
+      out->src = r;
+    } else {
+      if (!verify_packet(v, i->src, len))
+        return false;
+      out->op = EXT_PACKET;
+      out->src = i->src;
+    }
+    return true;
+
+  case FP_PROKEX_READ: {
+    int r = verify_register(v, i->dst);
+    if (len == 0 || len > 8 || r < 0)
+      return false;
+    out->dst = r;
+    if (is_register(i->src)) {
+      int s = verify_register(v, i->src);
+      if (s < 0)
+        return false;
+      out->op = READ_REG;
+      out->src = s;
+    } else {
+      if (!verify_packet(v, i->src, len))
+        return false;
+      out->op = READ_PACKET;
+      out->src = i->src;
+    }
+    return true;
+  }
+
+  case FP_PROKEX_WRITE:
+    if (is_register(i->dst)) {
+      int r = verify_register(v, i->dst);
+      if (r < 0)
+        return false;
+      out->op = WRITE_REG;
+      out->dst = r;
+    } else {
+      if (!is_store_length(len) || !verify_key(v, i->dst, len))
+        return false;
+      out->op = WRITE_KEY;
+      out->dst = i->dst;
+    }
+    return true;
+
+  case FP_PROKEX_JUMP:
+  case FP_PROKEX_JEQ:
+  case FP_PROKEX_JNE:
+  case FP_PROKEX_JLT:
+  case FP_PROKEX_JGT:
+  case FP_PROKEX_JSET:
+    if (i->target <= pc || i->target > n)
+      return false;
+    out->target = i->target;
+    if (i->op == FP_PROKEX_JUMP) {
+      out->op = JUMP;
+      return true;
+    }
+    if (!is_register(i->src))
+      return false;
+    int r = verify_register(v, i->src);
+    if (r < 0)
+      return false;
+    out->op = JEQ + (i->op - FP_PROKEX_JEQ);
+    out->src = r;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+
+/* Verify the program of n instructions and create a decoder
+   that writes keys of the given size. Returns NULL and sets err
+   to FP_BAD_DECODER if the program is invalid. */
+struct fp_decoder*
+fp_decoder_new(struct fp_prokex_insn const* insns, size_t n,
+               size_t key_size, fp_error_t* err)
+{
+  if (n == 0 || n > FP_DECODER_MAX_INSNS || key_size > FP_PACKET_KEY_SIZE) {
+    *err = FP_BAD_DECODER;
+    return NULL;
+  }
+
+  struct fp_decoder* d = fp_allocate(struct fp_decoder);
+  if (!d) {
+    *err = fp_system_error(ENOMEM);
+    return NULL;
+  }
+  d->insns = fp_allocate_n(struct fp_decoder_insn, n);
+  if (!d->insns) {
+    fp_deallocate(d);
+    *err = fp_system_error(ENOMEM);
+    return NULL;
+  }
+  d->native = NULL;
+  d->module = NULL;
+
+  struct verifier v = {key_size, 0, 0};
+  for (size_t pc = 0; pc < n; ++pc) {
+    if (!verify(&v, &insns[pc], pc, n, &d->insns[pc])) {
+      fp_decoder_delete(d);
+      *err = FP_BAD_DECODER;
+      return NULL;
+    }
+  }
+  d->key_size = key_size;
+  d->extent = v.extent;
+  d->nscratch = v.nscratch;
+  d->ninsns = n;
+  *err = FP_OK;
+  return d;
+}
+
+
+/* Delete the decoder. */
+void
+fp_decoder_delete(struct fp_decoder* d)
+{
+  if (!d)
+    return;
+  fp_module_close(d->module);
+  fp_deallocate(d->insns);
+  fp_deallocate(d);
+}
+
+
+/* Load len bytes at p in network byte order. */
+static inline uint64_t
+load_network(unsigned char const* p, int len)
+{
+  uint64_t x = 0;
+  for (int i = 0; i < len; ++i)
+    x = (x << 8) | p[i];
+  return x;
+}
+
+
+/* Store x in the len bytes at p as a field of that size. */
+static inline void
+store_host(unsigned char* p, uint64_t x, int len)
+{
+  switch (len) {
+  case 1: {
+    uint8_t y = x;
+    memcpy(p, &y, 1);
+    break;
+  }
+  case 2: {
+    uint16_t y = x;
+    memcpy(p, &y, 2);
+    break;
+  }
+  case 4: {
+    uint32_t y = x;
+    memcpy(p, &y, 4);
+    break;
+  }
+  default:
+    memcpy(p, &x, 8);
+    break;
+  }
+}
+
+
+/* Interpret the program with the register file r, the padded
+   packet p, and the key k. */
+static void
+interpret(struct fp_decoder const* d, uint64_t* r, unsigned char const* p,
+          unsigned char* k)
+{
+  struct fp_decoder_insn const* i = d->insns;
+  struct fp_decoder_insn const* end = i + d->ninsns;
+  while (i != end) {
+    switch (i->op) {
+    case HALT:
+      i = end;
+      continue;
+    case EXT_PACKET:
+      memcpy(k + i->dst, p + i->src, i->len);
+      break;
+    case EXT_REG:
+      store_host(k + i->dst, r[i->src], i->len);
+      break;
+    case READ_PACKET:
+      r[i->dst] = load_network(p + i->src, i->len);
+      break;
+    case READ_REG:
+      r[i->dst] = r[i->src];
+      break;
+    case WRITE_KEY:
+      store_host(k + i->dst, i->imm, i->len);
+      break;
+    case WRITE_REG:
+      r[i->dst] = i->imm;
+      break;
+    case JUMP:
+      i = d->insns + i->target;
+      continue;
+    case JEQ:
+      if (r[i->src] == i->imm) {
+        i = d->insns + i->target;
+        continue;
+      }
+      break;
+    case JNE:
+      if (r[i->src] != i->imm) {
+        i = d->insns + i->target;
+        continue;
+      }
+      break;
+    case JLT:
+      if (r[i->src] < i->imm) {
+        i = d->insns + i->target;
+        continue;
+      }
+      break;
+    case JGT:
+      if (r[i->src] > i->imm) {
+        i = d->insns + i->target;
+        continue;
+      }
+      break;
+    case JSET:
+      if (r[i->src] & i->imm) {
+        i = d->insns + i->target;
+        continue;
+      }
+      break;
+    }
+    ++i;
+  }
+
+}
+
+
+/* Returns the C type of a key field of len bytes. */
+static char const*
+field_type(int len)
+{
+  switch (len) {
+  case 1: return "uint8_t";
+  case 2: return "uint16_t";
+  case 4: return "uint32_t";
+  default: return "uint64_t";
+  }
+}
+
+
+/* Emit a load of len bytes at the packet offset off, in
+   network byte order. */
+static void
+emit_load(FILE* f, uint32_t off, int len)
+{
+  for (int i = 0; i < len - 1; ++i)
+    fprintf(f, "(uint64_t)p[%u] << %d | ", off + i, 8 * (len - 1 - i));
+  fprintf(f, "p[%u]", off + len - 1);
+}
+
+
+/* Emit a store of the expression x in len bytes of the key at
+   off. */
+static void
+emit_store(FILE* f, uint32_t off, char const* x, int len)
+{
+  char const* t = field_type(len);
+  fprintf(f, "  { %s x = (%s)(%s); memcpy(k + %u, &x, %d); }\n",
+          t, t, x, off, len);
+}
+
+
+/* Emit a branch to the target if the register src compares
+   with imm by the operator. */
+static void
+emit_branch(FILE* f, struct fp_decoder_insn const* i, char const* op)
+{
+  fprintf(f, "  if (r[%u] %s %uu) goto L%u;\n", i->src, op, i->imm, i->target);
+}
+
+
+/* Write the program as a C function named fp_decode. Every
+   instruction is a statement, and only instructions that are
+   the targets of branches are labeled. Returns false if memory
+   cannot be allocated. */
+static bool
+emit_program(FILE* f, struct fp_decoder const* d)
+{
+  bool* targets = (bool*)calloc(d->ninsns + 1, sizeof(bool));
+  if (!targets)
+    return false;
+  for (uint32_t pc = 0; pc < d->ninsns; ++pc)
+    if (d->insns[pc].op >= JUMP)
+      targets[d->insns[pc].target] = true;
+
+  fprintf(f, "#include <stdint.h>\n"
+             "#include <string.h>\n\n"
+             "void\n"
+             "fp_decode(uint64_t* restrict r, unsigned char const* restrict p,\n"
+             "          unsigned char* restrict k)\n"
+             "{\n");
+  char x[32];
+  for (uint32_t pc = 0; pc < d->ninsns; ++pc) {
+    struct fp_decoder_insn const* i = &d->insns[pc];
+    if (targets[pc])
+      fprintf(f, "L%u:\n", pc);
+    switch (i->op) {
+    case HALT:
+      fprintf(f, "  return;\n");
+      break;
+    case EXT_PACKET:
+      fprintf(f, "  memcpy(k + %u, p + %u, %u);\n", i->dst, i->src, i->len);
+      break;
+    case EXT_REG:
+      snprintf(x, sizeof(x), "r[%u]", i->src);
+      emit_store(f, i->dst, x, i->len);
+      break;
+    case READ_PACKET:
+      fprintf(f, "  r[%u] = ", i->dst);
+      emit_load(f, i->src, i->len);
+      fprintf(f, ";\n");
+      break;
+    case READ_REG:
+      fprintf(f, "  r[%u] = r[%u];\n", i->dst, i->src);
+      break;
+    case WRITE_KEY:
+      snprintf(x, sizeof(x), "%uu", i->imm);
+      emit_store(f, i->dst, x, i->len);
+      break;
+    case WRITE_REG:
+      fprintf(f, "  r[%u] = %uu;\n", i->dst, i->imm);
+      break;
+    case JUMP:
+      fprintf(f, "  goto L%u;\n", i->target);
+      break;
+    case JEQ:
+      emit_branch(f, i, "==");
+      break;
+    case JNE:
+      emit_branch(f, i, "!=");
+      break;
+    case JLT:
+      emit_branch(f, i, "<");
+      break;
+    case JGT:
+      emit_branch(f, i, ">");
+      break;
+    case JSET:
+      emit_branch(f, i, "&");
+      break;
+    }
+  }
+  if (targets[d->ninsns])
+    fprintf(f, "L%u:\n  return;\n", d->ninsns);
+  fprintf(f, "}\n");
+  fp_deallocate(targets);
+  return true;
+}
+
+
+/* Compile the C file src into the shared object obj. */
+static fp_error_t
+run_compiler(char const* src, char const* obj)
+{
+  char const* cc = getenv("FP_DECODER_CC");
+  if (!cc || !*cc)
+    cc = "cc";
+  char* argv[] = {(char*)cc, "-std=gnu99", "-O2", "-fPIC", "-shared", "-w",
+                  "-o", (char*)obj, (char*)src, NULL};
+  pid_t pid;
+  int e = posix_spawnp(&pid, cc, NULL, NULL, argv, environ);
+  if (e)
+    return fp_system_error(e);
+  int status;
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return fp_get_system_error();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return FP_ERROR;
+  return FP_OK;
+}
+
+
+/* Compile the decoder to native code. The generated source and
+   module are written to a temporary directory, which is removed
+   once the module is loaded. If compilation fails, the decoder
+   is unchanged and continues to be interpreted. This must not
+   be called once the decoder is installed in a data plane. */
+fp_error_t
+fp_decoder_compile(struct fp_decoder* d)
+{
+  if (d->native)
+    return FP_OK;
+
+  char dir[] = "/tmp/fp-decoder-XXXXXX";
+  if (!mkdtemp(dir))
+    return fp_get_system_error();
+  char src[64];
+  char obj[64];
+  snprintf(src, sizeof(src), "%s/decoder.c", dir);
+  snprintf(obj, sizeof(obj), "%s/decoder.so", dir);
+
+  fp_error_t err = FP_OK;
+  FILE* f = fopen(src, "w");
+  if (f) {
+    if (!emit_program(f, d))
+      err = fp_system_error(ENOMEM);
+    if (fclose(f) && fp_ok(err))
+      err = fp_get_system_error();
+  } else {
+    err = fp_get_system_error();
+  }
+
+  void* m = NULL;
+  void* sym = NULL;
+  if (fp_ok(err))
+    err = run_compiler(src, obj);
+  if (fp_ok(err))
+    m = fp_module_open(obj, "fp_decode", &sym, &err);
+  unlink(obj);
+  unlink(src);
+  rmdir(dir);
+  if (!m)
+    return err;
+
+  d->module = m;
+  d->native = (fp_decoder_fn)sym;
+  return FP_OK;
+}
+
+
+/* Run the decoder on the context's packet, writing the context's
+   key and registers. The key must be at least as large as the
+   decoder's key size. */
+void
+fp_decoder_run(struct fp_decoder const* d, struct fp_context* cxt)
+{
+  uint64_t* r = cxt->regs;
+  r[FP_PROKEX_IP] = cxt->in_port;
+  r[FP_PROKEX_IPP] = cxt->in_phy_port;
+  r[FP_PROKEX_TNL] = (uint32_t)cxt->tunnel_id;
+  r[FP_PROKEX_OP] = cxt->out_port;
+  memset(r + SCRATCH, 0, d->nscratch * sizeof(uint64_t));
+
+  /* Pad short packets so that every read is in bounds. */
+  unsigned char pad[FP_DECODER_MAX_EXTENT];
+  unsigned char const* p = cxt->packet->data;
+  int size = cxt->packet->size;
+  if (size < (int)d->extent) {
+    if (size < 0)
+      size = 0;
+    memcpy(pad, p, size);
+    memset(pad + size, 0, d->extent - size);
+    p = pad;
+  }
+
+  unsigned char* k = (unsigned char*)cxt->key;
+  if (d->native)
+    d->native(r, p, k);
+  else
+    interpret(d, r, p, k);
+
+  cxt->in_port = r[FP_PROKEX_IP];
+  cxt->in_phy_port = r[FP_PROKEX_IPP];
+  cxt->tunnel_id = r[FP_PROKEX_TNL];
+  cxt->out_port = r[FP_PROKEX_OP];
+}
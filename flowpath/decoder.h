@@ -0,0 +1,164 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_DECODER_H
+#define FLOWPATH_DECODER_H
+
+/* This module implements decoders: programs that extract a
+   packet's key. A decoder runs a Prokex program (see
+   doc/old/EXTRACT.md) over the bytes of a packet, writing fields
+   into the first key_size bytes of the packet's key, and reading
+   and writing the registers carried in the packet's context.
+   Decoders can be installed in a data plane at run time, so what
+   gets extracted can change without loading a new pipeline.
+
+   As in Prokex, an operand that is non-negative is an offset
+   into the input buffer (the packet) or the output buffer (the
+   key), and a negative operand names the register whose index
+   is its one's complement (i.e., ~n). The registers are:
+
+     0        $ip   the input port
+     1        $ipp  the input physical port
+     2        $tnl  the tunnel id
+     3        $op   the output port
+     32 - 63  $r0 - $r31, scratch registers
+
+   Registers are 64 bits wide, and are stored in the context's
+   register file (see FP_CONTEXT_REGS). Scratch registers are
+   cleared before a decoder runs, and $op starts as the context's
+   output port, which is FP_PORT_DROP for a new context.
+
+   The instructions are:
+
+     ext src len dst     Copy len bytes from the packet at src to
+                         the key at dst. If src is a register,
+                         store its low-order len bytes in host
+                         byte order, as a field of that size would
+                         be laid out (len is 1, 2, 4, or 8).
+     read src len dst    Load len bytes (at most 8) from the
+                         packet at src into the register dst, in
+                         network byte order. If src is a register,
+                         copy it.
+     write dst len imm   Store imm in the key at dst (as by ext
+                         from a register), or in the register dst.
+     jeq/jne/jlt/jgt/jset src imm target
+                         Compare the register src with imm (for
+                         jset, test any common bits) and continue
+                         at target if the comparison holds.
+     jump target         Continue at target.
+     halt                Stop.
+
+   Execution stops after the last instruction.
+
+   All programs are verified when a decoder is created. Every
+   opcode, register, and length is checked, every key access
+   must lie within the key, every packet access must lie within
+   FP_DECODER_MAX_EXTENT bytes, and branches may only go forward,
+   so every program terminates after at most one pass over its
+   instructions. A packet that is shorter than the furthest
+   byte a program can read is decoded as if it were padded with
+   zeros. As a result, running a decoder needs no checks other
+   than the dispatch on each instruction.
+
+   A verified program can also be compiled to native code (see
+   fp_decoder_compile()). The program is translated into a C
+   function in which every offset, length, and register is a
+   constant and every branch is a forward goto, built with the
+   host's C compiler, and loaded as a module. The compiler is
+   the one named by the FP_DECODER_CC environment variable, or
+   "cc". A compiled decoder has no dispatch at all. */
+
+#include "util.h"
+#include "error.h"
+
+struct fp_context;
+
+
+/* The maximum number of instructions in a program. */
+#define FP_DECODER_MAX_INSNS  1024
+
+/* Packet accesses must lie within this many bytes of the start
+   of the packet. */
+#define FP_DECODER_MAX_EXTENT 256
+
+
+/* Registers. Use the one's complement of these as operands. */
+#define FP_PROKEX_IP   0   /* $ip */
+#define FP_PROKEX_IPP  1   /* $ipp */
+#define FP_PROKEX_TNL  2   /* $tnl */
+#define FP_PROKEX_OP   3   /* $op */
+#define FP_PROKEX_R0   32  /* $r0 */
+#define FP_PROKEX_R31  63  /* $r31 */
+
+
+/* Opcodes. */
+#define FP_PROKEX_HALT  0
+#define FP_PROKEX_EXT   1
+#define FP_PROKEX_READ  2
+#define FP_PROKEX_WRITE 3
+#define FP_PROKEX_JUMP  4
+#define FP_PROKEX_JEQ   5
+#define FP_PROKEX_JNE   6
+#define FP_PROKEX_JLT   7
+#define FP_PROKEX_JGT   8
+#define FP_PROKEX_JSET  9
+
+
+/* A Prokex instruction. Branches use src and imm, and continue
+   at target, an instruction index. The number of instructions
+   in the program is a valid target; branching to it stops the
+   program. */
+struct fp_prokex_insn
+{
+  uint8_t  op;
+  uint8_t  len;
+  uint16_t target;
+  int32_t  src;
+  int32_t  dst;
+  uint32_t imm;
+};
+
+
+/* A verified instruction. Register operands are translated
+   to indexes in the context's register file, and each opcode is
+   specialized for the kinds of its operands. */
+struct fp_decoder_insn
+{
+  uint8_t  op;
+  uint8_t  len;
+  uint16_t target;
+  uint32_t src;
+  uint32_t dst;
+  uint32_t imm;
+};
+
+
+/* The type of a compiled program. It is called with the
+   register file, the packet (padded to the program's extent),
+   and the key. */
+typedef void (*fp_decoder_fn)(uint64_t*, unsigned char const*, unsigned char*);
+
+
+/* A decoder is a verified program. The extent is the number of
+   packet bytes the program can read. When the program has been
+   compiled, native is the compiled program and module is the
+   module that defines it. */
+struct fp_decoder
+{
+  size_t                  key_size;
+  uint32_t                extent;
+  uint32_t                nscratch; /* Scratch registers used. */
+  uint32_t                ninsns;
+  struct fp_decoder_insn* insns;
+  fp_decoder_fn           native;
+  void*                   module;
+};
+
+
+struct fp_decoder* fp_decoder_new(struct fp_prokex_insn const*, size_t, size_t, fp_error_t*);
+void               fp_decoder_delete(struct fp_decoder*);
+fp_error_t         fp_decoder_compile(struct fp_decoder*);
+void               fp_decoder_run(struct fp_decoder const*, struct fp_context*);
+
+
+#endif
@@ -0,0 +1,172 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "emc.h"
+#include "hashfn.h"
+
+#include <string.h>
+
+
+#define REF_MASK   ((1u << FP_EMC_WAYS) - 1)
+#define HAND_SHIFT FP_EMC_WAYS
+
+
+/* The current generation. Only entries inserted in this
+   generation are valid. This starts at 1 so that zeroed
+   entries are never valid. */
+static uint32_t generation_ = 1;
+
+
+/* Returns the current generation. */
+static inline uint32_t
+current_generation()
+{
+  return __atomic_load_n(&generation_, __ATOMIC_ACQUIRE);
+}
+
+
+/* Compute the hash of a key. */
+static inline uint64_t
+hash_key(unsigned char const* k, size_t n)
+{
+  return fp_hash_bytes(k, n, FP_HASH_SEED);
+}
+
+
+static inline unsigned char*
+entry_key(struct fp_emc* c, size_t i)
+{
+  return c->keys + i * c->key_size;
+}
+
+
+/* Allocate a cache for keys of the given size. Returns NULL if
+   the cache cannot be allocated. */
+struct fp_emc*
+fp_emc_new(size_t key_size)
+{
+  struct fp_emc* c = fp_allocate(struct fp_emc);
+  if (!c)
+    return NULL;
+  c->key_size = key_size;
+  c->nsets = FP_EMC_ENTRIES / FP_EMC_WAYS;
+  c->clock = (uint8_t*)calloc(c->nsets, sizeof(uint8_t));
+  c->entries = NULL;
+  c->keys = fp_allocate_n(unsigned char, (FP_EMC_ENTRIES * key_size + 1));
+  if (posix_memalign((void**)&c->entries, FP_CACHE_LINE,
+                     FP_EMC_ENTRIES * sizeof(struct fp_emc_entry)) != 0)
+    c->entries = NULL;
+  if (!c->clock || !c->keys || !c->entries) {
+    fp_emc_delete(c);
+    return NULL;
+  }
+  fp_emc_clear(c);
+  return c;
+}
+
+
+/* Delete the cache. */
+void
+fp_emc_delete(struct fp_emc* c)
+{
+  if (!c)
+    return;
+  fp_deallocate(c->entries);
+  fp_deallocate(c->keys);
+  fp_deallocate(c->clock);
+  fp_deallocate(c);
+}
+
+
+/* Remove all entries from the cache and reset its counters. */
+void
+fp_emc_clear(struct fp_emc* c)
+{
+  memset(c->entries, 0, FP_EMC_ENTRIES * sizeof(struct fp_emc_entry));
+  memset(c->clock, 0, c->nsets);
+  c->gen = current_generation();
+  c->hits = 0;
+  c->misses = 0;
+}
+
+
+/* Returns the value cached for the key, or 0 if the key is not
+   cached. */
+uintptr_t
+fp_emc_lookup(struct fp_emc* c, void const* key)
+{
+  uint64_t h = hash_key((unsigned char const*)key, c->key_size);
+  uint32_t set = h & (c->nsets - 1);
+  uint32_t sig = h >> 32;
+  uint32_t gen = c->gen = current_generation();
+  struct fp_emc_entry* e = &c->entries[set * FP_EMC_WAYS];
+  for (int w = 0; w < FP_EMC_WAYS; ++w) {
+    if (e[w].sig == sig && e[w].gen == gen && e[w].value &&
+        !memcmp(entry_key(c, set * FP_EMC_WAYS + w), key, c->key_size)) {
+      c->clock[set] |= 1u << w;
+      ++c->hits;
+      return e[w].value;
+    }
+  }
+  ++c->misses;
+  return 0;
+}
+
+
+/* Cache the value for the key, which should have been computed
+   after the last lookup. Stale and empty entries are replaced
+   first; otherwise, the clock chooses a victim. */
+void
+fp_emc_insert(struct fp_emc* c, void const* key, uintptr_t value)
+{
+  uint64_t h = hash_key((unsigned char const*)key, c->key_size);
+  uint32_t set = h & (c->nsets - 1);
+  uint32_t sig = h >> 32;
+  uint32_t gen = c->gen;
+  struct fp_emc_entry* e = &c->entries[set * FP_EMC_WAYS];
+
+  int victim = -1;
+  for (int w = 0; w < FP_EMC_WAYS; ++w) {
+    if (!e[w].value || e[w].gen != gen) {
+      if (victim < 0)
+        victim = w;
+      continue;
+    }
+    if (e[w].sig == sig &&
+        !memcmp(entry_key(c, set * FP_EMC_WAYS + w), key, c->key_size)) {
+      e[w].value = value;
+      return;
+    }
+  }
+
+  uint8_t clock = c->clock[set];
+  if (victim < 0) {
+    int hand = clock >> HAND_SHIFT;
+    while (clock & (1u << hand)) {
+      clock &= ~(1u << hand);
+      hand = (hand + 1) % FP_EMC_WAYS;
+    }
+    victim = hand;
+    clock = (clock & REF_MASK) | (((hand + 1) % FP_EMC_WAYS) << HAND_SHIFT);
+  }
+  c->clock[set] = clock & ~(1u << victim);
+
+  e[victim].sig = sig;
+  e[victim].gen = gen;
+  e[victim].value = value;
+  memcpy(entry_key(c, set * FP_EMC_WAYS + victim), key, c->key_size);
+}
+
+
+/* Invalidate every entry of every cache. This must be called
+   whenever a change to flow tables (or anything else a cached
+   result depends on) could change the result of processing a
+   packet. A worker that is processing a packet concurrently
+   may still use an old entry for that packet. */
+void
+fp_emc_invalidate()
+{
+  uint32_t gen = __atomic_add_fetch(&generation_, 1, __ATOMIC_RELEASE);
+  if (gen == 0)
+    __atomic_add_fetch(&generation_, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_EMC_H
+#define FLOWPATH_EMC_H
+
+/* This module implements the exact match cache (EMC), a small
+   per-worker cache that maps a packet's full key to the result
+   of processing it (e.g., the flow or action list chosen by the
+   pipeline). A pipeline that walks several flow tables can
+   consult the cache first, and on a hit skip its tables with a
+   single hash probe.
+
+   The cache is set associative. Each set holds FP_EMC_WAYS
+   entries in one cache line, and stores a signature of each
+   key so that most mismatches are rejected without comparing
+   keys. When a set is full, a victim is chosen by the clock
+   algorithm: each entry has a reference bit, which is set when
+   the entry is hit, and the set's clock hand skips (and clears)
+   referenced entries. A new entry must be hit once before it
+   is protected from replacement, so short-lived flows do not
+   evict long-lived ones.
+
+   Entries are invalidated whenever any flow table changes
+   (see fp_emc_invalidate()). Every entry records the
+   generation in which it was inserted, and only entries of the
+   current generation can hit, so invalidation is a single
+   counter increment rather than a flush. An entry is inserted
+   in the generation observed by the last lookup, so a result
+   computed from tables that changed after that lookup is never
+   valid.
+
+   Each cache is owned by one thread and is not synchronized.
+   Workers get their caches from fp_worker_emc(). */
+
+#include "util.h"
+
+
+/* The number of entries in a cache. */
+#define FP_EMC_ENTRIES 8192
+
+/* The number of entries in a set. */
+#define FP_EMC_WAYS    4
+
+
+/* A cache entry. The entry is empty when its value is 0. */
+struct fp_emc_entry
+{
+  uint32_t  sig;   /* High bits of the key's hash. */
+  uint32_t  gen;   /* Generation of insertion. */
+  uintptr_t value;
+};
+
+
+/* An exact match cache.
+
+   Each set's clock byte holds the reference bits of its ways in
+   the low bits, and the position of the clock hand above
+   them. */
+struct fp_emc
+{
+  size_t               key_size;
+  uint32_t             nsets;    /* A power of 2. */
+  uint8_t*             clock;
+  struct fp_emc_entry* entries;
+  unsigned char*       keys;     /* key_size bytes per entry. */
+  uint32_t             gen;      /* Generation of the last lookup. */
+
+  uint64_t hits;
+  uint64_t misses;
+};
+
+
+struct fp_emc* fp_emc_new(size_t);
+void           fp_emc_delete(struct fp_emc*);
+uintptr_t      fp_emc_lookup(struct fp_emc*, void const*);
+void           fp_emc_insert(struct fp_emc*, void const*, uintptr_t);
+void           fp_emc_clear(struct fp_emc*);
+void           fp_emc_invalidate();
+
+
+#endif
@@ -18,6 +18,8 @@ static char const* errors[] = {
   "Too many data planes",         /* FP_DATAPLANE_LIMIT_EXCEEED */
   "Cannot load pipeline",         /* FP_BAD_PIPELINE */
   "Cannot load pipeline symbols", /* FP_BAD_PIPELINE_MODULE */
+  "Invalid decoder program",      /* FP_BAD_DECODER */
+  "Bad port",                     /* FP_BAD_PORT */
 };
 
 
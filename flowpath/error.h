@@ -22,6 +22,8 @@
 #define FP_DATAPLANE_LIMIT_EXCEEED   7  /* Too many data planes. */
 #define FP_BAD_PIPELINE              8  /* Cannot load pipeline module. */
 #define FP_BAD_PIPELINE_MODULE       9  /* Cannot resolve pipeline symbols. */
+#define FP_BAD_DECODER              10  /* Decoder program is invalid. */
+#define FP_BAD_PORT                 11  /* No such port. */
 
 
 #ifdef __cplusplus
@@ -2,45 +2,368 @@
 // All rights reserved
 
 #include "flow.h"
+#include "cuckoo.h"
+#include "trie.h"
+#include "wildcard.h"
+#include "emc.h"
+#include "packet.h"
+#include "qsbr.h"
 #include "util.h"
 
+#include <string.h>
 
-/* FIXME: Do something better with this. */
 
+/* Allocate an empty flow table. */
+static struct fp_flow_table*
+alloc_flow_table(int match, size_t key_size)
+{
+  struct fp_flow_table* table = fp_allocate(struct fp_flow_table);
+  if (!table)
+    return NULL;
+  fp_error_t err;
+  table->counters = fp_counter_alloc(&err);
+  if (fp_error(err)) {
+    fp_deallocate(table);
+    return NULL;
+  }
+  table->match = match;
+  table->key_size = key_size;
+  table->exact = NULL;
+  table->prefix = NULL;
+  table->reclaims = 0;
+  table->wildcard = NULL;
+  return table;
+}
+
+
+/* Returns the default number of trie groups for a prefix match
+   table of the given key size and number of prefixes.
+
+   Most IPv4 prefixes are no longer than the first level of the
+   trie, so groups are provisioned for a fraction of them. IPv6
+   prefixes are usually /32 to /48, and a /48 needs a group at
+   each of the levels ending at bits 32, 40 and 48, so three
+   groups are provisioned per prefix. This holds a table of /48
+   prefixes that share no groups; longer prefixes need up to
+   one more group per 8 bits, but in practice share their upper
+   levels. Groups are 1KB each, and are only touched when
+   used. */
+static uint32_t
+prefix_groups(size_t key_size, int size)
+{
+  uint64_t groups = key_size <= 4 ? (uint64_t)size / 16 : (uint64_t)size * 3;
+  groups += 256;
+  return groups > FP_TRIE_MAX_GROUPS ? FP_TRIE_MAX_GROUPS : (uint32_t)groups;
+}
+
+
+/* Create a flow table with the given kind of match, key size,
+   and maximum number of flows. Wildcard tables are not bounded
+   in size, and match the key in a single stage. Returns NULL if
+   the table cannot be allocated. */
 struct fp_flow_table*
-fp_flow_table_new(int match, int size)
+fp_flow_table_new(int match, size_t key_size, int size)
 {
-  struct fp_flow_table* table = allocate(struct fp_flow_table);
+  if (match == FP_TABLE_MATCH_WILDCARD)
+    return fp_flow_table_new_staged(key_size, NULL, 0);
+  if (match == FP_TABLE_MATCH_PREFIX)
+    return fp_flow_table_new_prefix(key_size, size, prefix_groups(key_size, size));
+
+  struct fp_flow_table* table = alloc_flow_table(match, key_size);
+  if (!table)
+    return NULL;
+  if (match == FP_TABLE_MATCH_EXACT) {
+    table->exact = fp_cuckoo_table_new(key_size, size);
+    if (!table->exact) {
+      fp_flow_table_delete(table);
+      return NULL;
+    }
+  }
+  if (!table->exact) {
+    fp_flow_table_delete(table);
+    return NULL;
+  }
   return table;
 }
 
-/* Add the given flow to the flow table. 
 
-   TODO: Define a collision strategy. 
+/* Create a prefix match table with the given key size, maximum
+   number of prefixes, and number of trie groups (see trie.h).
+   Each group takes 1KB. Callers that know the distribution of
+   their prefix lengths may use this to size the table more
+   tightly than fp_flow_table_new(). Returns NULL if the table
+   cannot be allocated. */
+struct fp_flow_table*
+fp_flow_table_new_prefix(size_t key_size, int size, uint32_t groups)
+{
+  struct fp_flow_table* table = alloc_flow_table(FP_TABLE_MATCH_PREFIX, key_size);
+  if (!table)
+    return NULL;
+  table->prefix = fp_trie_new(key_size * 8, size, groups);
+  if (!table->prefix) {
+    fp_flow_table_delete(table);
+    return NULL;
+  }
+  return table;
+}
+
+
+/* Create a wildcard match table whose keys are matched in
+   stages, given by the end offset of each stage in the key.
+   For example, the stages of a key holding L2, L3, and L4
+   fields end at the end of each group of fields. A flow whose
+   mask does not match the rest of the key after some stage
+   only costs a partial lookup for packets that differ from it
+   in that stage. */
+struct fp_flow_table*
+fp_flow_table_new_staged(size_t key_size, size_t const* stages, int nstages)
+{
+  struct fp_flow_table* table = alloc_flow_table(FP_TABLE_MATCH_WILDCARD, key_size);
+  if (!table)
+    return NULL;
+  table->wildcard = fp_wildcard_table_new(key_size, stages, nstages);
+  if (!table->wildcard) {
+    fp_flow_table_delete(table);
+    return NULL;
+  }
+  return table;
+}
 
-   FIXME: Actually do something useful. */
+
+/* Delete the flow table. This does not delete its flows. If
+   reclamations of the table's trie are still deferred, this
+   waits for them to run. */
 void
-fp_flow_add(struct fp_flow_table* table, struct fp_flow* flow)
+fp_flow_table_delete(struct fp_flow_table* table)
 {
-  table->flow = flow;
+  if (!table)
+    return;
+  if (table->reclaims)
+    fp_qsbr_barrier();
+  fp_cuckoo_table_delete(table->exact);
+  fp_trie_delete(table->prefix);
+  fp_wildcard_table_delete(table->wildcard);
+  fp_counter_release(table->counters);
+  fp_deallocate(table);
 }
 
-/* Remove the given flow from the flow table. 
 
-   FIXME: Actually do something useful. */
+/* Aggregate the table's counters. */
 void
-fp_flow_remove(struct fp_flow_table* table, struct fp_flow* flow)
+fp_flow_table_stats(struct fp_flow_table const* table, struct fp_table_stats* stats)
 {
-  table->flow = NULL;
+  uint64_t c[2];
+  fp_counter_read(table->counters, c);
+  stats->matches = c[0];
+  stats->misses = c[1];
+  stats->lookups = c[0] + c[1];
+}
+
+
+/* Initialize a flow with the given priority and program, and
+   allocate its counters. Fails with ENOSPC if no counters are
+   available. */
+fp_error_t
+fp_flow_init(struct fp_flow* flow, int priority, int program)
+{
+  fp_error_t err;
+  flow->priority = priority;
+  flow->program = program;
+  flow->counters = fp_counter_alloc(&err);
+  return err;
+}
+
+
+/* Release the flow's counters. The flow must have been removed
+   from every table. Its counters are reused once no worker can
+   be counting in them. */
+void
+fp_flow_release(struct fp_flow* flow)
+{
+  fp_counter_release(flow->counters);
+  flow->counters = 0;
+}
+
+
+/* Aggregate the flow's counters. */
+void
+fp_flow_stats(struct fp_flow const* flow, struct fp_flow_stats* stats)
+{
+  uint64_t c[2];
+  fp_counter_read(flow->counters, c);
+  stats->packets = c[0];
+  stats->bytes = c[1];
+}
+
+
+/* A deferred reclamation of what a prefix table's trie released
+   before the mark. */
+struct trie_reclaim
+{
+  struct fp_flow_table* table;
+  struct fp_trie_mark   mark;
+};
+
+
+static void
+reclaim_trie(void* arg)
+{
+  struct trie_reclaim* r = (struct trie_reclaim*)arg;
+  fp_trie_reclaim_to(r->table->prefix, r->mark);
+  --r->table->reclaims;
+  fp_deallocate(r);
+}
+
+
+/* Reclaim the groups and rules released by removals from the
+   table's trie once no worker can be searching them. */
+static void
+defer_reclaim(struct fp_flow_table* table)
+{
+  struct fp_trie_mark m = fp_trie_mark(table->prefix);
+  struct trie_reclaim* r = fp_allocate(struct trie_reclaim);
+  if (!r) {
+    fp_qsbr_synchronize();
+    fp_trie_reclaim_to(table->prefix, m);
+    return;
+  }
+  r->table = table;
+  r->mark = m;
+  ++table->reclaims;
+  fp_qsbr_defer(reclaim_trie, r);
+}
+
+
+/* Add the given flow to the flow table. For exact match tables,
+   a flow with the same key is replaced, and this fails with
+   ENOSPC when the table is full. For prefix and wildcard match
+   tables, the flow matches the full key (see fp_flow_add_prefix
+   and fp_flow_add_wildcard), and a flow with the same key and
+   priority is replaced. */
+fp_error_t
+fp_flow_add(struct fp_flow_table* table, void const* key, struct fp_flow* flow)
+{
+  if (table->exact) {
+    fp_error_t err = fp_cuckoo_table_insert(table->exact, key, (uintptr_t)flow);
+    fp_emc_invalidate();
+    return err;
+  }
+  if (table->prefix)
+    return fp_flow_add_prefix(table, key, table->key_size * 8, flow);
+
+  unsigned char mask[table->key_size];
+  memset(mask, 0xff, table->key_size);
+  return fp_flow_add_wildcard(table, key, mask, flow);
+}
+
+
+/* Remove the flow with the given key from the flow table. For
+   prefix and wildcard match tables, this removes every flow of
+   the full key. */
+void
+fp_flow_remove(struct fp_flow_table* table, void const* key)
+{
+  if (table->exact) {
+    fp_cuckoo_table_remove(table->exact, key);
+  } else if (table->prefix) {
+    fp_trie_clear(table->prefix, key, table->key_size * 8);
+    defer_reclaim(table);
+  } else {
+    unsigned char mask[table->key_size];
+    memset(mask, 0xff, table->key_size);
+    fp_wildcard_table_clear(table->wildcard, key, mask);
+  }
+  fp_emc_invalidate();
+}
+
+
+/* Add the flow to a prefix match table under the prefix formed
+   by the first len bits of the key. A flow of the prefix with
+   the same priority is replaced. Fails with ENOSPC when the
+   table is full, including space released by removals whose
+   grace periods have not yet elapsed. */
+fp_error_t
+fp_flow_add_prefix(struct fp_flow_table* table, void const* key, int len,
+                   struct fp_flow* flow)
+{
+  assert(table->prefix);
+  fp_error_t err = fp_trie_insert(table->prefix, key, len, flow->priority,
+                                  (uintptr_t)flow);
+  if (err == fp_system_error(ENOSPC) && table->reclaims) {
+    fp_qsbr_reclaim();
+    err = fp_trie_insert(table->prefix, key, len, flow->priority,
+                         (uintptr_t)flow);
+  }
+  fp_emc_invalidate();
+  return err;
 }
 
-/* Search the flow table for the lowest priority entry that
-   matches the current packet context. */
 
+/* Remove the flow from the prefix formed by the first len bits
+   of the key in a prefix match table. */
+void
+fp_flow_remove_prefix(struct fp_flow_table* table, void const* key, int len,
+                      struct fp_flow* flow)
+{
+  assert(table->prefix);
+  fp_trie_remove(table->prefix, key, len, flow->priority);
+  defer_reclaim(table);
+  fp_emc_invalidate();
+}
+
+
+/* Add the flow to a wildcard match table, matching keys that
+   equal the given key under the mask. A flow with the same key,
+   mask, and priority is replaced. */
+fp_error_t
+fp_flow_add_wildcard(struct fp_flow_table* table, void const* key,
+                     void const* mask, struct fp_flow* flow)
+{
+  assert(table->wildcard);
+  fp_error_t err = fp_wildcard_table_insert(table->wildcard, key, mask,
+                                            flow->priority, (uintptr_t)flow);
+  fp_emc_invalidate();
+  return err;
+}
+
+
+/* Remove the flow with the given key and mask from a wildcard
+   match table. */
+void
+fp_flow_remove_wildcard(struct fp_flow_table* table, void const* key,
+                        void const* mask, struct fp_flow* flow)
+{
+  assert(table->wildcard);
+  fp_wildcard_table_remove(table->wildcard, key, mask, flow->priority);
+  fp_emc_invalidate();
+}
+
+
+/* Returns the flow with the given key, or NULL if there is
+   no such flow. For prefix match tables, this is the flow with
+   the highest priority for the longest matching prefix, and for
+   wildcard tables, the matching flow with the highest
+   priority. */
+struct fp_flow*
+fp_flow_lookup(struct fp_flow_table* table, void const* key)
+{
+  if (table->exact)
+    return (struct fp_flow*)fp_cuckoo_table_find(table->exact, key);
+  if (table->prefix)
+    return (struct fp_flow*)fp_trie_find(table->prefix, key);
+  return (struct fp_flow*)fp_wildcard_table_find(table->wildcard, key);
+}
+
+
+/* Search the flow table for the lowest priority entry that
+   matches the current packet context. This counts the lookup in
+   the table and, if a flow matches, the packet in the flow. */
 struct fp_flow* 
 fp_match(struct fp_flow_table* table, struct fp_context* cxt)
 {
-  /* FIXME: This is not a search. */
-  return table->flow;
+  struct fp_flow* flow = fp_flow_lookup(table, cxt->key);
+  fp_counter_add(table->counters, flow != NULL, flow == NULL);
+  if (flow)
+    fp_counter_add(flow->counters, 1, cxt->packet->size);
+  return flow;
 }
-
@@ -10,9 +10,17 @@
 #define FP_TABLE_MATCH_PREFIX   2
 #define FP_TABLE_MATCH_WILDCARD 3
 
+#include "error.h"
+#include "stats.h"
+
+#include <stddef.h>
+
 
 struct fp_instruction;
 struct fp_context;
+struct fp_cuckoo_table;
+struct fp_trie;
+struct fp_wildcard_table;
 
 /* A flow is an entry in a flow table. Each flow is described
    by a tuple, which includes its priority, counters, associated
@@ -21,24 +29,30 @@ struct fp_context;
    Note that the match that defines the flow is a property
    of the table, not this object. 
 
-   TODO: Implement counters, timeouts, and cookies. */
+   A flow initialized with fp_flow_init() counts the packets and
+   bytes it matches (see stats.h). A zero-initialized flow is not
+   counted.
+
+   TODO: Implement timeouts and cookies. */
 struct fp_flow
 {
-  int priority;   /* The priority of the flow. */
-  int program;    /* The program associated with the flow. */
+  int      priority; /* The priority of the flow. */
+  int      program;  /* The program associated with the flow. */
+  uint32_t counters; /* The flow's counter slot, or 0. */
 };
 
 /* A flow table maintains a mapping of keys to flow entries.
    Flow tables are one of several kinds:
    - exact match (hash table)
-   - prefix match (prefix tree)
-   - wildcard match (???)
+   - prefix match (multibit trie)
+   - wildcard match (tuple space search)
    - others?
   The specific type of flow table is maintained by the underlying
   table object.
 
   This wrapper contains affiliated counters and
-  configuration information.
+  configuration information. Every call to fp_match() counts
+  a lookup, and either a match or a miss.
 
   The underlying table maps keys to lists of flows where each list
   an array sorted by priority. 
@@ -49,18 +63,71 @@ struct fp_flow
   miss means different things for different kinds of flow table.
   For example, you can't install a table-miss rule in a hash table
   because the hash table matches keys exactly. The default behavior
-  is to drop unmatched packets. */
+  is to drop unmatched packets.
+
+  Exact match tables are cuckoo hash tables (see cuckoo.h) keyed
+  by the first key_size bytes of the packet's key. Any number of
+  workers may match against an exact match table while a single
+  thread adds and removes flows. A removed flow may still be
+  returned by a concurrent match, so it must not be deleted until
+  every worker has passed through a quiescent point.
+
+  Prefix match tables are tries (see trie.h) over keys of
+  key_size bytes, which is 4 for IPv4 and 16 for IPv6. A prefix
+  may have several flows, one per priority, and a match returns
+  the flow with the highest priority for the longest matching
+  prefix. By default, tables are provisioned for prefixes of up
+  to /48 (see fp_flow_table_new_prefix() to choose the number of
+  trie groups). The same concurrency rules apply. The groups and rules
+  released by removals are reclaimed for reuse once every worker
+  has passed through a quiescent point (see qsbr.h). Deferred
+  releases run on the thread that modifies the table.
+
+  Wildcard match tables are tuple space classifiers (see
+  wildcard.h). Each flow has a mask, and a match returns the
+  flow with the highest priority whose masked key equals the
+  masked packet key. Wildcard tables must not be modified while
+  workers match against them. */
 struct fp_flow_table
 {
-  /* FIXME: This is totally TOTALLY wrong. */
-  struct fp_flow* flow;
-};
+  int                     match;    /* The kind of match. */
+  size_t                  key_size; /* Number of key bytes matched. */
+  struct fp_cuckoo_table* exact;    /* Exact match flows. */
+  struct fp_trie*         prefix;   /* Prefix match flows. */
+  int                     reclaims; /* Pending trie reclamations. */
 
-struct fp_flow_table* fp_flow_table_new(int match, int size);
+  struct fp_wildcard_table* wildcard; /* Wildcard match flows. */
 
-void fp_flow_add(struct fp_flow_table* table, struct fp_flow* flow);
-void fp_flow_remove(struct fp_flow_table* table, struct fp_flow* flow);
+  uint32_t counters; /* Matches and misses (see stats.h). */
+};
 
+struct fp_flow_table* fp_flow_table_new(int match, size_t key_size, int size);
+struct fp_flow_table* fp_flow_table_new_prefix(size_t key_size, int size,
+                                               uint32_t groups);
+struct fp_flow_table* fp_flow_table_new_staged(size_t key_size,
+                                               size_t const* stages,
+                                               int nstages);
+void                  fp_flow_table_delete(struct fp_flow_table* table);
+void                  fp_flow_table_stats(struct fp_flow_table const* table,
+                                          struct fp_table_stats* stats);
+
+fp_error_t fp_flow_init(struct fp_flow* flow, int priority, int program);
+void       fp_flow_release(struct fp_flow* flow);
+void       fp_flow_stats(struct fp_flow const* flow, struct fp_flow_stats* stats);
+
+fp_error_t fp_flow_add(struct fp_flow_table* table, void const* key,
+                       struct fp_flow* flow);
+void       fp_flow_remove(struct fp_flow_table* table, void const* key);
+fp_error_t fp_flow_add_prefix(struct fp_flow_table* table, void const* key,
+                              int len, struct fp_flow* flow);
+void       fp_flow_remove_prefix(struct fp_flow_table* table, void const* key,
+                                 int len, struct fp_flow* flow);
+fp_error_t fp_flow_add_wildcard(struct fp_flow_table* table, void const* key,
+                                void const* mask, struct fp_flow* flow);
+void       fp_flow_remove_wildcard(struct fp_flow_table* table, void const* key,
+                                   void const* mask, struct fp_flow* flow);
+
+struct fp_flow* fp_flow_lookup(struct fp_flow_table* table, void const* key);
 struct fp_flow* fp_match(struct fp_flow_table* table, 
                          struct fp_context* cxt);
 
@@ -2,86 +2,31 @@
 // All rights reserved
 
 #include "hash.h"
+#include "hashfn.h"
 #include "util.h"
 
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
 
-/* List of pirme numbers whose values are at least twice
-   as large as the preceeding value. */
-static size_t const primes[] = {
-        53,          97,       193,       389,       769,
-      1543,        3079,      6151,     12289,     24593, 
-     49157,       98317,    196613,    393241,    786433, 
-   1572869,     3145739,   6291469,  12582917,  25165843,
-  50331653,   100663319, 201326611, 402653189, 805306457,
-  1610612741,
-};
-static size_t const nprimes = sizeof(primes) / sizeof(size_t);
 
-
-/* Return the next prime number larger that the given
-   value. If there is no next larger prime, returns 0.
-
-  TODO: This is an upper bound problem. Use a binary
-  search! */
-static size_t 
-next_prime(size_t n)
-{
-  for (int i = 0; i < nprimes; ++i)
-    if (primes[i] > n)
-      return primes[i];
-  return 0;
-}
-
-
-/* Compute the hash of a multi-byte string using the 
-   one-at-a-time algorithm shown in the web page below:
-
-     http://www.burtleburtle.net/bob/hash/doobs.html 
-
-   FIXME: This needs to return a size_t.
-
-   TODO: This currently uses a simple hash algorithm. We should
-   probably replace this with CityHash or something more
-   effective. Note that CityHash relies on CRC32 functions
-   present in SSE4.2, so that could be very fast. CityHahsh
-   is published here:
-
-     https://code.google.com/p/cityhash/ 
-
-   Alternatively, we could use 
-
-   FIXME: The one-at-a-time hash generates a 32-bit key,
-   meaning we're not effectively hashing the data.  */
-static uint32_t
-one_at_a_time_hash(unsigned char const* key, size_t len)
-{
-    size_t hash = 0, i = 0;
-    for( ; i < len; ++i)
-    {
-        hash += key[i];
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
-    }
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
-}
-
-
-/* Compute the hash value of a pointer. */
+/* Compute the hash value of a pointer. The low bits of a
+   pointer are mostly zero, so its bits are mixed. */
 size_t
 fp_pointer_hash(uintptr_t p)
 {
-  return (size_t)p;
+  return fp_hash_mix64(p);
 }
 
 
-/* Compute the hash value of an unsigned integer. */
+/* Compute the hash value of an unsigned integer. Consecutive
+   integers have hashes that differ in every bit. */
 size_t
 fp_uint_hash(uintptr_t n)
 {
-  return (size_t)n;
+  return fp_hash_mix64(n);
 }
 
 
@@ -90,7 +35,7 @@ size_t
 fp_string_hash(uintptr_t x)
 {
   char const* s = (char const*)x;
-  return one_at_a_time_hash((unsigned char*)s, strlen(s));
+  return fp_hash_bytes(s, strlen(s), FP_HASH_SEED);
 }
 
 
@@ -118,30 +63,59 @@ fp_string_eq(uintptr_t a, uintptr_t b)
 }
 
 
-/* Compute the hash index for the given key.
-
-   TODO: This should be a macro. I presume that it's well
-   defined for any hash table. */
+/* Compute the hash index for the given key in the new bucket
+   array. */
 static inline size_t
 hash_index(struct fp_chained_hash_table const* t, uintptr_t k)
 {
-  return t->hash(k) % t->buckets;
+  return fp_hash_bucket(t->hash(k), t->buckets);
 }
 
 
-/* Allocate a new separately chained hash table with thes
-   specified number buckets (which should be a prime number),
-   and the given hash and equality comparison functions. */
+/* Returns the head of the chain that holds the given key, which
+   is in the old bucket array if the key's old bucket has not
+   been migrated. */
+static inline struct fp_chained_hash_entry**
+hash_chain(struct fp_chained_hash_table const* t, uintptr_t k)
+{
+  size_t h = t->hash(k);
+  if (t->old) {
+    size_t n = fp_hash_bucket(h, t->old_buckets);
+    if (n >= t->migrated)
+      return &t->old[n];
+  }
+  return &t->data[fp_hash_bucket(h, t->buckets)];
+}
+
+
+/* Allocate a zeroed array of n buckets. */
+static struct fp_chained_hash_entry**
+bucket_array_new(size_t n)
+{
+  struct fp_chained_hash_entry** data = fp_allocate_n(struct fp_chained_hash_entry*, n);
+  if (data)
+    memset(data, 0, sizeof(struct fp_chained_hash_entry*) * n);
+  return data;
+}
+
+
+/* Allocate a new separately chained hash table with at least
+   the specified number buckets, and the given hash and equality
+   comparison functions. The number of buckets is rounded up to
+   a power of 2. */
 struct fp_chained_hash_table*
 fp_chained_hash_table_new(size_t buckets, fp_hash_fn hash, fp_compare_fn comp)
 {
+  buckets = fp_hash_pow2(buckets);
   struct fp_chained_hash_table* t = fp_allocate(struct fp_chained_hash_table);
   t->size = 0;
   t->buckets = buckets;
   t->hash = hash;
   t->comp = comp;
-  t->data = fp_allocate_n(struct fp_chained_hash_entry*, buckets);
-  memset(t->data, 0, sizeof(struct fp_chained_hash_entry*) * buckets);
+  t->data = bucket_array_new(buckets);
+  t->old_buckets = 0;
+  t->migrated = 0;
+  t->old = NULL;
   return t;
 }
 
@@ -153,6 +127,7 @@ fp_chained_hash_table_delete(struct fp_chained_hash_table* t)
 {
   if (!t)
     return;
+  fp_deallocate(t->old);
   fp_deallocate(t->data);
   fp_deallocate(t);
 }
@@ -162,7 +137,7 @@ fp_chained_hash_table_delete(struct fp_chained_hash_table* t)
 double
 fp_chained_hash_table_load(struct fp_chained_hash_table const* t)
 {
-  return (double)t->buckets / (double)t->size;
+  return (double)t->size / (double)t->buckets;
 }
 
 
@@ -172,10 +147,7 @@ fp_chained_hash_table_load(struct fp_chained_hash_table const* t)
 struct fp_chained_hash_entry*
 fp_chained_hash_table_find(struct fp_chained_hash_table const* t, uintptr_t k)
 {
-  int n = hash_index(t, k);
-  struct fp_chained_hash_entry* p = t->data[n];
-  if (!p)
-    return p;
+  struct fp_chained_hash_entry* p = *hash_chain(t, k);
 
   /* TODO: This is where we could use a sorted sequence
      instead of a chained list. */
@@ -221,54 +193,73 @@ fp_chained_hash_entry_insert(struct fp_chained_hash_entry** head,
 }
 
 
-/* Resize the hash table. If the hash table is maximally
-   sized, no action is taken. */
-void
-fp_chained_hash_table_resize(struct fp_chained_hash_table* t1)
+/* Move up to n buckets of the old bucket array into the new
+   one. Entries are relinked, not copied. When the last bucket
+   has been moved, the old array is released. */
+static void
+migrate(struct fp_chained_hash_table* t, size_t n)
 {
-  size_t n = next_prime(t1->buckets);
-  if (n == 0)
-    return;
-
-  /* Build a new hash table and all kv pairs of t into
-     the new table. */
-  struct fp_chained_hash_table* t2 = fp_chained_hash_table_new(n, t1->hash, t1->comp);
-  for (int i = 0; i < t1->buckets; ++i) {
-    struct fp_chained_hash_entry* p = t1->data[i];
+  while (n-- && t->migrated < t->old_buckets) {
+    struct fp_chained_hash_entry* p = t->old[t->migrated];
     while (p) {
-      fp_chained_hash_table_insert(t2, p->key, p->value);
-      p = p->next;
+      struct fp_chained_hash_entry* next = p->next;
+      struct fp_chained_hash_entry** head = &t->data[hash_index(t, p->key)];
+      p->next = *head;
+      *head = p;
+      p = next;
     }
+    t->old[t->migrated++] = NULL;
+  }
+  if (t->migrated == t->old_buckets) {
+    fp_deallocate(t->old);
+    t->old = NULL;
+    t->old_buckets = 0;
+    t->migrated = 0;
   }
+}
+
 
-  /* Move the essential information from t2 into t1 and get 
-     rid of the temporary hash table. */
-  fp_deallocate(t1->data);
-  t1->buckets = n;
-  t1->data = t2->data;
-  fp_deallocate(t2);
+/* Begin resizing the hash table to twice its number of
+   buckets. Entries are moved to the new buckets by later
+   insertions and removals. If a resize is in progress, it is
+   completed first. If the hash table is maximally sized, or the
+   new buckets cannot be allocated, no action is taken. */
+void
+fp_chained_hash_table_resize(struct fp_chained_hash_table* t)
+{
+  if (t->old)
+    migrate(t, t->old_buckets);
+  if (t->buckets > SIZE_MAX / 2 / sizeof(struct fp_chained_hash_entry*))
+    return;
+  size_t n = t->buckets * 2;
+  struct fp_chained_hash_entry** data = bucket_array_new(n);
+  if (!data)
+    return;
+  t->old = t->data;
+  t->old_buckets = t->buckets;
+  t->migrated = 0;
+  t->data = data;
+  t->buckets = n;
 }
 
 
 /* Insert the the given key/value pair into the hash table,
-   returning a pointer to the inserted value structure.
-
-   TODO: Implement dynamic resize, rehash. */
+   returning a pointer to the inserted value structure. */
 struct fp_chained_hash_entry*
 fp_chained_hash_table_insert(struct fp_chained_hash_table* t, 
                              uintptr_t k, 
                              uintptr_t v)
 {
-  /* Resize if we hit the high-water mark. */
-  if (fp_chained_hash_table_load(t) >= .75)
+  /* Resize if we hit the high-water mark. Because the buckets
+     double and each insertion moves several of them, a resize
+     is complete long before the next one is needed. */
+  if (t->old)
+    migrate(t, FP_CHAINED_MIGRATE);
+  else if (fp_chained_hash_table_load(t) >= .75)
     fp_chained_hash_table_resize(t);
 
-  int n = hash_index(t, k);
   ++t->size;
-  if (!t->data[n])
-    return t->data[n] = fp_chained_hash_entry_new(k, v);
-  else
-    return fp_chained_hash_entry_insert(&t->data[n], k, v);
+  return fp_chained_hash_entry_insert(hash_chain(t, k), k, v);
 }
 
 
@@ -276,8 +267,7 @@ fp_chained_hash_table_insert(struct fp_chained_hash_table* t,
 void
 fp_chained_hash_table_update(struct fp_chained_hash_table* t, uintptr_t k, uintptr_t v)
 {
-  int n = hash_index(t, k);
-  struct fp_chained_hash_entry* ent = t->data[n];
+  struct fp_chained_hash_entry* ent = fp_chained_hash_table_find(t, k);
   if (ent)
     ent->value = v;
 }
@@ -287,8 +277,11 @@ fp_chained_hash_table_update(struct fp_chained_hash_table* t, uintptr_t k, uintp
 void 
 fp_chained_hash_table_remove(struct fp_chained_hash_table* t, uintptr_t k)
 {
-  int n = hash_index(t, k);
-  struct fp_chained_hash_entry* p = t->data[n];
+  if (t->old)
+    migrate(t, FP_CHAINED_MIGRATE);
+
+  struct fp_chained_hash_entry** head = hash_chain(t, k);
+  struct fp_chained_hash_entry* p = *head;
 
   /* Find the first instance of the key to remove. */
   struct fp_chained_hash_entry* q = NULL;
@@ -306,9 +299,305 @@ fp_chained_hash_table_remove(struct fp_chained_hash_table* t, uintptr_t k)
   if (q)
     q->next = p->next;
   else
-    t->data[n] = p->next;
+    *head = p->next;
   --t->size;
 
   /* Reclaim memory. */
   fp_chained_hash_entry_delete(p);
 }
+
+
+/* -------------------------------------------------------------------------- */
+/* Flat hash table */
+
+/* The control byte of an empty slot. Full slots hold 7 bits of
+   the key's hash, so only empty slots have the high bit set. */
+#define FP_FLAT_EMPTY ((uint8_t)0x80)
+
+/* The minimum number of slots. This must be at least the
+   group size. */
+#define FP_FLAT_MIN_CAPACITY 32
+
+
+/* A bit mask with one bit per slot of a group. */
+typedef uint32_t fp_flat_mask_t;
+
+
+/* Returns a mask of the slots in the group at p whose control
+   byte equals c. */
+static inline fp_flat_mask_t
+group_match(uint8_t const* p, uint8_t c)
+{
+#if defined(__AVX2__)
+  __m256i g = _mm256_loadu_si256((__m256i const*)p);
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(g, _mm256_set1_epi8(c)));
+#elif defined(__SSE2__)
+  __m128i g = _mm_loadu_si128((__m128i const*)p);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+#else
+  fp_flat_mask_t m = 0;
+  for (int i = 0; i < FP_FLAT_GROUP; ++i)
+    m |= (fp_flat_mask_t)(p[i] == c) << i;
+  return m;
+#endif
+}
+
+
+/* Returns a mask of the empty slots in the group at p. */
+static inline fp_flat_mask_t
+group_empty(uint8_t const* p)
+{
+#if defined(__AVX2__)
+  return _mm256_movemask_epi8(_mm256_loadu_si256((__m256i const*)p));
+#elif defined(__SSE2__)
+  return _mm_movemask_epi8(_mm_loadu_si128((__m128i const*)p));
+#else
+  return group_match(p, FP_FLAT_EMPTY);
+#endif
+}
+
+
+/* Compute the hash of a key. Tags are taken from the low 7
+   bits of the hash and slots from the bits above them, so the
+   hash function must mix its input (see hashfn.h). */
+static inline uint64_t
+flat_hash(struct fp_flat_hash_table const* t, uintptr_t k)
+{
+  return t->hash(k);
+}
+
+
+/* The first slot of the key's probe sequence. */
+static inline size_t
+flat_home(struct fp_flat_hash_table const* t, uint64_t h)
+{
+  return (h >> 7) & (t->capacity - 1);
+}
+
+
+/* The control byte for a key's hash. */
+static inline uint8_t
+flat_tag(uint64_t h)
+{
+  return h & 0x7f;
+}
+
+
+/* Set the control byte for slot i, and its mirror if the slot
+   is in the first group. */
+static inline void
+set_ctrl(struct fp_flat_hash_table* t, size_t i, uint8_t c)
+{
+  t->ctrl[i] = c;
+  if (i < FP_FLAT_GROUP - 1)
+    t->ctrl[t->capacity + i] = c;
+}
+
+
+/* Allocate the slot and control arrays for the given capacity,
+   with every slot empty. */
+static void
+flat_allocate(struct fp_flat_hash_table* t, size_t capacity)
+{
+  t->capacity = capacity;
+  t->ctrl = fp_allocate_n(uint8_t, capacity + FP_FLAT_GROUP - 1);
+  memset(t->ctrl, FP_FLAT_EMPTY, capacity + FP_FLAT_GROUP - 1);
+  t->data = fp_allocate_n(struct fp_flat_hash_entry, capacity);
+}
+
+
+/* Returns the slot holding the key, or -1 if it is not in
+   the table. */
+static ptrdiff_t
+flat_find_slot(struct fp_flat_hash_table const* t, uintptr_t k)
+{
+  uint64_t h = flat_hash(t, k);
+  size_t mask = t->capacity - 1;
+  size_t pos = flat_home(t, h);
+  uint8_t tag = flat_tag(h);
+  while (true) {
+    uint8_t const* g = t->ctrl + pos;
+    for (fp_flat_mask_t m = group_match(g, tag); m; m &= m - 1) {
+      size_t i = (pos + __builtin_ctz(m)) & mask;
+      if (t->comp(t->data[i].key, k))
+        return i;
+    }
+
+    /* Entries are never stored past an empty slot in their
+       probe sequence. */
+    if (group_empty(g))
+      return -1;
+    pos = (pos + FP_FLAT_GROUP) & mask;
+  }
+}
+
+
+/* Returns the first empty slot in the probe sequence for h. */
+static size_t
+flat_find_empty(struct fp_flat_hash_table const* t, uint64_t h)
+{
+  size_t mask = t->capacity - 1;
+  size_t pos = flat_home(t, h);
+  while (true) {
+    fp_flat_mask_t m = group_empty(t->ctrl + pos);
+    if (m)
+      return (pos + __builtin_ctz(m)) & mask;
+    pos = (pos + FP_FLAT_GROUP) & mask;
+  }
+}
+
+
+/* Double the number of slots and re-insert every entry. */
+static void
+flat_resize(struct fp_flat_hash_table* t)
+{
+  size_t n = t->capacity;
+  uint8_t* ctrl = t->ctrl;
+  struct fp_flat_hash_entry* data = t->data;
+
+  flat_allocate(t, n * 2);
+  for (size_t i = 0; i < n; ++i) {
+    if (ctrl[i] & FP_FLAT_EMPTY)
+      continue;
+    uint64_t h = flat_hash(t, data[i].key);
+    size_t j = flat_find_empty(t, h);
+    set_ctrl(t, j, flat_tag(h));
+    t->data[j] = data[i];
+  }
+  fp_deallocate(ctrl);
+  fp_deallocate(data);
+}
+
+
+/* Allocate a new flat hash table with room for at least n
+   elements, and the given hash and equality comparison
+   functions. */
+struct fp_flat_hash_table*
+fp_flat_hash_table_new(size_t n, fp_hash_fn hash, fp_compare_fn comp)
+{
+  size_t capacity = FP_FLAT_MIN_CAPACITY;
+  while (capacity * 7 / 8 < n)
+    capacity *= 2;
+
+  struct fp_flat_hash_table* t = fp_allocate(struct fp_flat_hash_table);
+  t->size = 0;
+  t->hash = hash;
+  t->comp = comp;
+  flat_allocate(t, capacity);
+  return t;
+}
+
+
+/* Delete a flat hash table. This function is not responsible
+   for deleting the contents of the table. */
+void
+fp_flat_hash_table_delete(struct fp_flat_hash_table* t)
+{
+  if (!t)
+    return;
+  fp_deallocate(t->ctrl);
+  fp_deallocate(t->data);
+  fp_deallocate(t);
+}
+
+
+/* Returns the load factor for the table. */
+double
+fp_flat_hash_table_load(struct fp_flat_hash_table const* t)
+{
+  return (double)t->size / (double)t->capacity;
+}
+
+
+/* Search for the given key within the hash table. This returns
+   a pointer to the entry if the key exists in the table, or
+   NULL if it does not. */
+struct fp_flat_hash_entry*
+fp_flat_hash_table_find(struct fp_flat_hash_table const* t, uintptr_t k)
+{
+  ptrdiff_t i = flat_find_slot(t, k);
+  return i < 0 ? NULL : &t->data[i];
+}
+
+
+/* Insert the given key/value pair into the hash table,
+   returning a pointer to the entry. If the key is already
+   in the table, its value is replaced. The table grows when
+   it would be more than 7/8 full. */
+struct fp_flat_hash_entry*
+fp_flat_hash_table_insert(struct fp_flat_hash_table* t, 
+                          uintptr_t k, 
+                          uintptr_t v)
+{
+  ptrdiff_t i = flat_find_slot(t, k);
+  if (i >= 0) {
+    t->data[i].value = v;
+    return &t->data[i];
+  }
+
+  if ((t->size + 1) * 8 > t->capacity * 7)
+    flat_resize(t);
+
+  uint64_t h = flat_hash(t, k);
+  size_t j = flat_find_empty(t, h);
+  set_ctrl(t, j, flat_tag(h));
+  t->data[j].key = k;
+  t->data[j].value = v;
+  ++t->size;
+  return &t->data[j];
+}
+
+
+/* Update the key with a new value. If the key is not in
+   the table, this has no effect. */
+void
+fp_flat_hash_table_update(struct fp_flat_hash_table* t, uintptr_t k, uintptr_t v)
+{
+  ptrdiff_t i = flat_find_slot(t, k);
+  if (i >= 0)
+    t->data[i].value = v;
+}
+
+
+/* Remove the key from the table. Each following entry in the
+   probe run is moved into the hole if the hole lies between
+   the entry's home slot and its current slot. The run ends at
+   the first empty slot, which preserves the invariant that no
+   entry follows an empty slot in its probe sequence. */
+void 
+fp_flat_hash_table_remove(struct fp_flat_hash_table* t, uintptr_t k)
+{
+  ptrdiff_t found = flat_find_slot(t, k);
+  if (found < 0)
+    return;
+
+  size_t mask = t->capacity - 1;
+  size_t hole = found;
+  for (size_t j = (hole + 1) & mask; t->ctrl[j] != FP_FLAT_EMPTY; j = (j + 1) & mask) {
+    size_t home = flat_home(t, flat_hash(t, t->data[j].key));
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      t->data[hole] = t->data[j];
+      set_ctrl(t, hole, t->ctrl[j]);
+      hole = j;
+    }
+  }
+  set_ctrl(t, hole, FP_FLAT_EMPTY);
+  --t->size;
+}
+
+
+/* Returns the first entry at or after slot *pos, and sets
+   *pos to the following slot. Returns NULL when there are no
+   more entries. To visit every entry, start with *pos = 0. */
+struct fp_flat_hash_entry*
+fp_flat_hash_table_next(struct fp_flat_hash_table const* t, size_t* pos)
+{
+  for (size_t i = *pos; i < t->capacity; ++i) {
+    if (t->ctrl[i] != FP_FLAT_EMPTY) {
+      *pos = i + 1;
+      return &t->data[i];
+    }
+  }
+  *pos = t->capacity;
+  return NULL;
+}
@@ -24,10 +24,17 @@
    for the bucket. This would allow us to perform a
    binary search instead of a linear scan.
 
-   TODO: Implement the flat hash table and various probing
-   algorithms (linear, quadratic, double hashing). 
-
-   TOOD: Build an iteration interface? */
+   The flat hash table stores entries in a single array
+   and resolves collisions by linear probing. Like a Swiss
+   table, each slot has a control byte that is either EMPTY or
+   holds 7 bits of the key's hash. Lookups compare a group of
+   control bytes against the hash bits at once using SSE2 (16
+   slots) or AVX2 (32 slots), so keys are only compared for
+   slots whose hash bits match. Removal shifts later entries of
+   the probe sequence backward, so there are no tombstones and
+   lookup cost does not degrade as entries come and go.
+
+   TOOD: Build an iteration interface for the chained table? */
 
 #include <stddef.h>
 #include <stdint.h>
@@ -36,7 +43,9 @@
 
 
 /* A hash function maps a key to an unsigned 
-   integer value. */
+   integer value. Tables index buckets by the low bits of the
+   hash, so hash functions must mix their input (see
+   hashfn.h). */
 typedef size_t (*fp_hash_fn)(uintptr_t);
 
 
@@ -56,13 +65,40 @@ struct fp_chained_hash_entry
 };
 
 
-/* A hash table using separate chaining. */
+/* The number of buckets moved from the old bucket array to the
+   new one by each insertion or removal while the table is being
+   resized. */
+#define FP_CHAINED_MIGRATE 8
+
+
+/* A hash table using separate chaining. 
+
+   The table is resized incrementally. When it grows, a bucket
+   array twice as large is allocated, and each subsequent
+   insertion or removal moves a few buckets of the old array
+   into the new one, relinking their entries. Until every bucket
+   has been moved, a key is found in the old array if its old
+   bucket has not yet been moved, and in the new array
+   otherwise. Entries are never reallocated, so pointers to
+   entries remain valid until they are removed.
+
+   The table is not safe for concurrent use: migration relinks
+   entries that a concurrent search may be walking, and removed
+   entries are freed immediately. A table must only be accessed
+   by one thread at a time, e.g., from the control path. Tables
+   that workers search while they are modified should be cuckoo
+   tables (see cuckoo.h). */
 struct fp_chained_hash_table {
   size_t        size;    /* Number of elements. */
   size_t        buckets; /* Number of buckets. */
   fp_hash_fn    hash;    /* The hash function. */
   fp_compare_fn comp;    /* Equality comparison. */
   struct fp_chained_hash_entry** data;  /* The array of elements. */
+
+  /* The bucket array being migrated, if any. */
+  size_t        old_buckets; /* Number of old buckets. */
+  size_t        migrated;    /* Number of old buckets moved. */
+  struct fp_chained_hash_entry** old;
 };
 
 
@@ -73,6 +109,51 @@ struct fp_chained_hash_entry* fp_chained_hash_table_find(struct fp_chained_hash_
 struct fp_chained_hash_entry* fp_chained_hash_table_insert(struct fp_chained_hash_table*, uintptr_t, uintptr_t);
 void                          fp_chained_hash_table_remove(struct fp_chained_hash_table*, uintptr_t);
 void                          fp_chained_hash_table_update(struct fp_chained_hash_table*, uintptr_t, uintptr_t);
+void                          fp_chained_hash_table_resize(struct fp_chained_hash_table*);
+
+/* The number of control bytes examined at once when probing
+   a flat hash table. */
+#if defined(__AVX2__)
+#  define FP_FLAT_GROUP 32
+#elif defined(__SSE2__)
+#  define FP_FLAT_GROUP 16
+#else
+#  define FP_FLAT_GROUP 8
+#endif
+
+
+/* A key-value pair stored in a flat hash table. Pointers to
+   entries are invalidated by insertion and removal. */
+struct fp_flat_hash_entry
+{
+  uintptr_t key;
+  uintptr_t value;
+};
+
+
+/* A hash table using open addressing. The number of slots
+   is a power of 2. The control array has FP_FLAT_GROUP - 1
+   bytes beyond the last slot that mirror the first slots so
+   that a group can be loaded from any position. */
+struct fp_flat_hash_table
+{
+  size_t        size;     /* Number of elements. */
+  size_t        capacity; /* Number of slots. */
+  fp_hash_fn    hash;     /* The hash function. */
+  fp_compare_fn comp;     /* Equality comparison. */
+  uint8_t*      ctrl;     /* Control bytes. */
+  struct fp_flat_hash_entry* data; /* The array of slots. */
+};
+
+
+struct fp_flat_hash_table* fp_flat_hash_table_new(size_t, fp_hash_fn, fp_compare_fn);
+void                       fp_flat_hash_table_delete(struct fp_flat_hash_table*);
+double                     fp_flat_hash_table_load(struct fp_flat_hash_table const*);
+struct fp_flat_hash_entry* fp_flat_hash_table_find(struct fp_flat_hash_table const*, uintptr_t);
+struct fp_flat_hash_entry* fp_flat_hash_table_insert(struct fp_flat_hash_table*, uintptr_t, uintptr_t);
+void                       fp_flat_hash_table_remove(struct fp_flat_hash_table*, uintptr_t);
+void                       fp_flat_hash_table_update(struct fp_flat_hash_table*, uintptr_t, uintptr_t);
+struct fp_flat_hash_entry* fp_flat_hash_table_next(struct fp_flat_hash_table const*, size_t*);
 
 /* Hashing functions. */
 size_t fp_pointer_hash(uintptr_t);
@@ -0,0 +1,184 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "hashfn.h"
+
+#include <string.h>
+
+#if defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#else
+#  include <pthread.h>
+#endif
+
+
+/* Odd constants with balanced bits (those of wyhash). */
+#define P0 0xa0761d6478bd642full
+#define P1 0xe7037ed1a0b428dbull
+#define P2 0x8ebc6af09c88c6e3ull
+#define P3 0x589965cc75374cc3ull
+
+
+static inline uint64_t
+read64(unsigned char const* p)
+{
+  uint64_t w;
+  memcpy(&w, p, 8);
+  return w;
+}
+
+
+static inline uint64_t
+read32(unsigned char const* p)
+{
+  uint32_t w;
+  memcpy(&w, p, 4);
+  return w;
+}
+
+
+/* Multiply a and b, storing the low half of the 128-bit product
+   in a and the high half in b. */
+static inline void
+multiply(uint64_t* a, uint64_t* b)
+{
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, la = (uint32_t)*a;
+  uint64_t hb = *b >> 32, lb = (uint32_t)*b;
+  uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+  uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+  *a = (mid << 32) | (uint32_t)ll;
+  *b = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
+}
+
+
+/* Multiply a and b and fold the halves of the product. */
+static inline uint64_t
+fold(uint64_t a, uint64_t b)
+{
+  multiply(&a, &b);
+  return a ^ b;
+}
+
+
+/* Compute the 64-bit hash of the n bytes at key. Different
+   seeds give independent hash functions. */
+uint64_t
+fp_hash_bytes(void const* key, size_t n, uint64_t seed)
+{
+  unsigned char const* p = (unsigned char const*)key;
+  uint64_t a, b;
+  seed ^= fold(seed ^ P0, P1);
+  if (n <= 16) {
+    if (n >= 4) {
+      /* Two possibly overlapping pairs of words cover the key. */
+      size_t d = (n >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + d);
+      b = (read32(p + n - 4) << 32) | read32(p + n - 4 - d);
+    } else if (n > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = n;
+    if (i > 48) {
+      /* Three independent lanes of 16 bytes each. */
+      uint64_t s1 = seed, s2 = seed;
+      do {
+        seed = fold(read64(p) ^ P1, read64(p + 8) ^ seed);
+        s1 = fold(read64(p + 16) ^ P2, read64(p + 24) ^ s1);
+        s2 = fold(read64(p + 32) ^ P3, read64(p + 40) ^ s2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= s1 ^ s2;
+    }
+    while (i > 16) {
+      seed = fold(read64(p) ^ P1, read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    /* The last 16 bytes of the key, which may overlap bytes
+       already consumed. */
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+  a ^= P1;
+  b ^= seed;
+  multiply(&a, &b);
+  return fold(a ^ P0 ^ n, b ^ P1);
+}
+
+
+#if !defined(__SSE4_2__)
+/* The CRC32C (Castagnoli) table for the reflected polynomial. */
+static uint32_t crc32c_table[256];
+
+
+static void
+init_crc32c()
+{
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int j = 0; j < 8; ++j)
+      c = (c >> 1) ^ (c & 1 ? 0x82f63b78 : 0);
+    crc32c_table[i] = c;
+  }
+}
+#endif
+
+
+/* Extend the CRC32C of a message with the n bytes at p. The
+   CRC of a message is fp_crc32c(0, p, n). */
+uint32_t
+fp_crc32c(uint32_t crc, void const* p, size_t n)
+{
+  unsigned char const* b = (unsigned char const*)p;
+  crc = ~crc;
+#if defined(__SSE4_2__)
+  for (; n >= 8; n -= 8, b += 8)
+    crc = (uint32_t)_mm_crc32_u64(crc, read64(b));
+  for (; n; --n, ++b)
+    crc = _mm_crc32_u8(crc, *b);
+#else
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, init_crc32c);
+  for (; n; --n, ++b)
+    crc = (crc >> 8) ^ crc32c_table[(crc ^ *b) & 0xff];
+#endif
+  return ~crc;
+}
+
+
+/* Compute a 64-bit hash of the n bytes at key using CRC32C.
+   Even words of the key feed the low CRC and odd words the high
+   CRC, so that the two are independent for keys longer than a
+   word. The final word is padded with zeros, and the length is
+   mixed in so that padding cannot cause collisions. */
+uint64_t
+fp_hash_crc(void const* key, size_t n, uint64_t seed)
+{
+  unsigned char const* p = (unsigned char const*)key;
+  uint32_t lo = (uint32_t)seed;
+  uint32_t hi = (uint32_t)(seed >> 32) ^ (uint32_t)P0;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    lo = fp_crc32c(lo, p + i, 8);
+    hi = fp_crc32c(hi, p + i + 8, 8);
+  }
+  if (i < n) {
+    unsigned char w[16] = {0};
+    memcpy(w, p + i, n - i);
+    lo = fp_crc32c(lo, w, 8);
+    if (n - i > 8)
+      hi = fp_crc32c(hi, w + 8, 8);
+  }
+  return fp_hash_mix64((((uint64_t)hi << 32) | lo) ^ (n * P1));
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_HASHFN_H
+#define FLOWPATH_HASHFN_H
+
+/* This module provides the hash functions used by the hash
+   tables, caches and classifiers.
+
+   - fp_hash_bytes computes a 64-bit hash of a key of any
+     length. It follows the design of wyhash: the key is read
+     in 8-byte words, pairs of words are combined by a 64x64 to
+     128-bit multiply whose halves are folded together, and keys
+     of at most 16 bytes are hashed without a loop.
+   - fp_hash_crc computes a 64-bit hash from CRC32C, which uses
+     the SSE4.2 CRC instruction when it is available. Even and
+     odd words of the key feed separate CRCs, so the result has
+     64 bits of state, which are then mixed.
+   - fp_hash_mix64 is a strong mixer for integers (the
+     finalizer of MurmurHash3). Every input bit affects every
+     output bit, so integer and pointer keys can be hashed by
+     mixing them.
+   - fp_hash_bucket indexes a power-of-two array of buckets by
+     masking a hash, in place of taking the hash modulo a prime
+     number of buckets.
+
+   The low bits of every hash are as good as its high bits, so
+   tables may take buckets from the low bits and signatures or
+   tags from the high bits. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* The default seed. */
+#define FP_HASH_SEED 0
+
+
+uint64_t fp_hash_bytes(void const*, size_t, uint64_t);
+uint64_t fp_hash_crc(void const*, size_t, uint64_t);
+uint32_t fp_crc32c(uint32_t, void const*, size_t);
+
+
+/* Mix the bits of an integer. */
+static inline uint64_t
+fp_hash_mix64(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+
+/* Returns the bucket of a hash in an array of n buckets, where
+   n is a power of 2. */
+static inline size_t
+fp_hash_bucket(uint64_t h, size_t n)
+{
+  return (size_t)h & (n - 1);
+}
+
+
+/* Returns the smallest power of 2 that is at least n, and at
+   least 1. */
+static inline size_t
+fp_hash_pow2(size_t n)
+{
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+
+#endif
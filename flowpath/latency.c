@@ -0,0 +1,145 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "latency.h"
+
+#include <pthread.h>
+
+
+/* The rate of the time stamp counter, measured once. */
+static double cycles_per_ns_ = 1.0;
+static pthread_once_t calibrated_ = PTHREAD_ONCE_INIT;
+
+
+/* Returns the monotonic time in nanoseconds. */
+static uint64_t
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Measure the rate of the time stamp counter against the
+   monotonic clock over 10ms. This assumes that the counter runs
+   at a constant rate on every core, as it does on processors
+   with an invariant TSC. */
+static void
+calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t t0 = now_ns();
+  uint64_t c0 = fp_cycles();
+  struct timespec d = {0, 10000000};
+  nanosleep(&d, NULL);
+  uint64_t t1 = now_ns();
+  uint64_t c1 = fp_cycles();
+  if (t1 > t0 && c1 > c0)
+    cycles_per_ns_ = (double)(c1 - c0) / (double)(t1 - t0);
+#endif
+}
+
+
+/* Returns the number of cycles per nanosecond. The first call
+   takes about 10ms. */
+double
+fp_cycles_per_ns()
+{
+  pthread_once(&calibrated_, calibrate);
+  return cycles_per_ns_;
+}
+
+
+/* Convert a number of cycles to nanoseconds. */
+uint64_t
+fp_cycles_to_ns(uint64_t c)
+{
+  return (uint64_t)((double)c / fp_cycles_per_ns());
+}
+
+
+/* Returns the greatest value counted in the bucket. */
+uint64_t
+fp_hist_value(int b)
+{
+  if (b < (1 << FP_HIST_SUB_BITS))
+    return b;
+  int shift = (b >> FP_HIST_SUB_BITS) - 1;
+  uint64_t m = (b & ((1 << FP_HIST_SUB_BITS) - 1)) + (1 << FP_HIST_SUB_BITS);
+  return ((m + 1) << shift) - 1;
+}
+
+
+/* Returns the number of values counted in the histogram. */
+uint64_t
+fp_hist_count(uint64_t const* h)
+{
+  uint64_t n = 0;
+  for (int i = 0; i < FP_HIST_BUCKETS; ++i)
+    n += h[i];
+  return n;
+}
+
+
+/* Returns the q-quantile of the histogram's values, for q in
+   [0, 1], as the greatest value of the bucket that holds it.
+   This overstates the quantile by less than 1/32 of its value.
+   Returns 0 if the histogram is empty. */
+uint64_t
+fp_hist_quantile(uint64_t const* h, double q)
+{
+  uint64_t n = fp_hist_count(h);
+  if (!n)
+    return 0;
+  uint64_t rank = (uint64_t)(q * n);
+  if (rank < q * n)
+    ++rank;
+  if (rank < 1)
+    rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < FP_HIST_BUCKETS; ++i) {
+    seen += h[i];
+    if (seen >= rank)
+      return fp_hist_value(i);
+  }
+  return fp_hist_value(FP_HIST_BUCKETS - 1);
+}
+
+
+/* Returns the greatest value of the bucket of the histogram's
+   greatest value, or 0 if the histogram is empty. */
+uint64_t
+fp_hist_max(uint64_t const* h)
+{
+  for (int i = FP_HIST_BUCKETS - 1; i >= 0; --i)
+    if (h[i])
+      return fp_hist_value(i);
+  return 0;
+}
+
+
+/* Store the stage's histogram, aggregated over every shard, in
+   h, which has FP_HIST_BUCKETS counters. */
+void
+fp_latency_read(struct fp_stats_block* b, int stage, uint64_t* h)
+{
+  assert(0 <= stage && stage < FP_LATENCY_STAGES);
+  fp_stats_block_sum(b, stage * FP_HIST_BUCKETS * sizeof(uint64_t),
+                     FP_HIST_BUCKETS, h);
+}
+
+
+/* Empty every histogram of the block. Times recorded
+   concurrently may or may not be kept. */
+void
+fp_latency_reset(struct fp_stats_block* b)
+{
+  for (int i = 0; i < FP_STATS_SHARDS; ++i) {
+    uint64_t* p = __atomic_load_n(&b->shards[i], __ATOMIC_ACQUIRE);
+    if (!p)
+      continue;
+    for (size_t j = 0; j < b->size / sizeof(uint64_t); ++j)
+      __atomic_store_n(&p[j], 0, __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_LATENCY_H
+#define FLOWPATH_LATENCY_H
+
+/* This module measures the time packets spend in each stage of
+   a data plane. Timestamps are read from the CPU's time stamp
+   counter (see fp_cycles()), and the time each packet spends in
+   a stage is recorded in a log-linear histogram of cycles.
+   Quantiles (e.g., p99) are computed from the histograms when
+   they are read.
+
+   A data plane keeps one histogram per stage in a statistics
+   block (see stats.h), so each worker records in its own copy
+   and readers aggregate the copies. Recording a time is a bucket
+   computation and an add to memory private to the worker.
+
+   Timestamps are taken once per burst, not once per packet:
+   every packet of a burst is given the time at which the burst
+   was received, and a stage's time is recorded once for all
+   packets of the burst that entered it together. Timing a burst
+   costs a handful of counter reads, whatever its size.
+
+   A histogram has FP_HIST_BUCKETS buckets. Values less than
+   2^FP_HIST_SUB_BITS have their own buckets. Above that, each
+   power of two is split into 2^FP_HIST_SUB_BITS buckets of equal
+   width, so a bucket's values differ by less than 1/32 of the
+   least of them. Values of 2^FP_HIST_MAX_BITS cycles or more are
+   counted in the last bucket. */
+
+#include "stats.h"
+
+#include <time.h>
+
+
+/* Stages. The first few are timed by the data plane and its
+   pipelines; pipelines may time their own stages (e.g., each
+   flow table) from FP_STAGE_USER. */
+#define FP_STAGE_RECEIVE  0 /* From receive to pipeline ingress. This
+                               includes time spent in RSS rings. */
+#define FP_STAGE_PIPELINE 1 /* From ingress to egress. */
+#define FP_STAGE_EGRESS   2 /* Sending through the output device. */
+#define FP_STAGE_TOTAL    3 /* From receive to the end of egress. */
+#define FP_STAGE_USER     4 /* The first pipeline-defined stage. */
+#define FP_LATENCY_STAGES 8
+
+
+/* Histogram parameters (see above). */
+#define FP_HIST_SUB_BITS 5
+#define FP_HIST_MAX_BITS 40
+#define FP_HIST_BUCKETS \
+  ((FP_HIST_MAX_BITS - FP_HIST_SUB_BITS + 1) << FP_HIST_SUB_BITS)
+
+
+/* The size in bytes of a block of latency histograms. */
+#define FP_LATENCY_BLOCK_SIZE \
+  (FP_LATENCY_STAGES * FP_HIST_BUCKETS * sizeof(uint64_t))
+
+
+double   fp_cycles_per_ns();
+uint64_t fp_cycles_to_ns(uint64_t);
+
+uint64_t fp_hist_value(int);
+uint64_t fp_hist_count(uint64_t const*);
+uint64_t fp_hist_quantile(uint64_t const*, double);
+uint64_t fp_hist_max(uint64_t const*);
+
+void fp_latency_read(struct fp_stats_block*, int, uint64_t*);
+void fp_latency_reset(struct fp_stats_block*);
+
+
+/* Returns the value of the time stamp counter. This does not
+   serialize execution, so it may be reordered with a few
+   neighbouring instructions. On other architectures, this
+   returns a monotonic time in nanoseconds. */
+static inline uint64_t
+fp_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+/* Returns the histogram bucket of a value. */
+static inline int
+fp_hist_bucket(uint64_t v)
+{
+  if (v < (1 << FP_HIST_SUB_BITS))
+    return (int)v;
+  int e = 63 - __builtin_clzll(v);
+  if (e >= FP_HIST_MAX_BITS)
+    return FP_HIST_BUCKETS - 1;
+  int shift = e - FP_HIST_SUB_BITS;
+  return ((shift + 1) << FP_HIST_SUB_BITS) +
+         (int)((v >> shift) - (1 << FP_HIST_SUB_BITS));
+}
+
+
+/* Record that n packets spent from begin to end in the stage.
+   A begin time of 0 denotes packets that were not timed, and
+   records nothing. */
+static inline void
+fp_latency_record(struct fp_stats_block* b, int stage,
+                  uint64_t begin, uint64_t end, int n)
+{
+  if (!begin || end < begin)
+    return;
+  int shard;
+  uint64_t* h = fp_stats_block_get(b, &shard);
+  if (h)
+    fp_stats_add(&h[stage * FP_HIST_BUCKETS + fp_hist_bucket(end - begin)], n, shard);
+}
+
+
+#endif
@@ -4,26 +4,50 @@
 #include "util.h"
 #include "dataplane.h"
 #include "manage.h"
+#include "worker.h"
+
+#include "poll.h"
+#include "qsbr.h"
 
 #include <unistd.h>
-#include <poll.h>
 #include <stdio.h>
 #include <signal.h>
 
 
-/* FIXME: Not good! */
-struct pollfd fp_poll_set[16];
+/* The number of forwarding workers. */
+int fp_workers = 1;
 
 
-/* The size of the poll set. */
-size_t fp_poll_size;
+/* Print a usage message. */
+static void
+usage()
+{
+  fprintf(stderr, "usage: flowpath [-w <workers>]\n\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, "    -w workers   the number of forwarding threads (default 1).\n");
+  fprintf(stderr, "                 With 0 workers, ports are serviced by the\n");
+  fprintf(stderr, "                 main loop.\n");
+}
 
 
-static void
-clear_poll_results()
+/* Parse command line options. Returns false if the options
+   are invalid. */
+static bool
+parse_options(int argc, char* argv[])
 {
-  for (int i = 0; i < fp_poll_size; ++i)
-    fp_poll_set[i].revents = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:")) != -1) {
+    switch (opt) {
+    case 'w':
+      fp_workers = atoi(optarg);
+      if (fp_workers < 0 || fp_workers > FP_WORKER_MAX)
+        return false;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
 }
 
 
@@ -51,9 +75,24 @@ set_signal_mask()
 }
 
 
+/* Handle a message from flowmgr. Shut down if the channel
+   is closed or fails. */
+static void
+on_mgr_ready(int fd, void* arg)
+{
+  if (fp_mgr_incoming() <= 0)
+    running = false;
+}
+
+
 int 
 main(int argc, char* argv[]) 
 {
+  if (!parse_options(argc, argv)) {
+    usage();
+    return -1;
+  }
+
   /* Set the signal masks. */
   set_signal_mask();
 
@@ -63,30 +102,57 @@ main(int argc, char* argv[])
   if (mgr < 1)
     return -1;
 
-  /* Put mgr into the poll loop. */
-  fp_poll_set[0].fd = mgr;
-  fp_poll_set[0].events = POLLIN;
+  /* The main loop waits for messages from flowmgr and, when
+     running without workers, traffic on ports. */
+  fp_error_t err;
+  struct fp_poller* poller = fp_poller_create(FP_POLL_BUDGET, &err);
+  if (!poller) {
+    fprintf(stderr, "error: %s\n", fp_strerror(err));
+    return -1;
+  }
+  err = fp_poller_add_fd(poller, mgr, on_mgr_ready, NULL);
+  if (fp_error(err)) {
+    fprintf(stderr, "error: %s\n", fp_strerror(err));
+    return -1;
+  }
+
+  /* Start the forwarding engine. Ports added through the
+     manager are assigned to its workers. */
+  struct fp_engine* engine = NULL;
+  if (fp_workers > 0) {
+    engine = fp_engine_create(fp_workers, &err);
+    if (!engine) {
+      fprintf(stderr, "error: %s\n", fp_strerror(err));
+      return -1;
+    }
+    err = fp_engine_start(engine);
+    if (fp_error(err)) {
+      fprintf(stderr, "error: %s\n", fp_strerror(err));
+      return -1;
+    }
+    fp_mgr_set_engine(engine);
+  }
+  else {
+    fp_mgr_set_poller(poller);
+  }
 
-  /* Set the poll set size. */
-  fp_poll_size = 1;
-  running = true;
   /* Run the main loop. */
+  running = true;
   while (running) {
-    clear_poll_results();
-
-    /* Poll for events. */
-    if (poll(fp_poll_set, fp_poll_size, 100) < 0) {
+    if (fp_poller_wait(poller, 100) < 0) {
       perror("main/poll");
       break;
     }
 
-    /* Did we get a message from flowmgr. */
-    if (fp_poll_set[0].revents &= POLLIN) {
-      int result = fp_mgr_incoming();
-      if (result <= 0)
-        break;
-    }
+    /* Run the releases deferred by the control path (e.g.,
+       replaced decoders and released counters) whose grace
+       periods have elapsed. */
+    fp_qsbr_reclaim();
   }
 
+  fp_mgr_set_engine(NULL);
+  fp_mgr_set_poller(NULL);
+  fp_engine_delete(engine);
+  fp_poller_delete(poller);
   fp_mgr_close();
 }
@@ -3,9 +3,14 @@
 
 #include "manage.h"
 #include "dataplane.h"
+#include "pipeline.h"
+#include "decoder.h"
 #include "port.h"
 #include "port_udp.h"
 #include "proto.h"
+#include "worker.h"
+#include "poll.h"
+#include "qsbr.h"
 
 #include "error.h"
 
@@ -25,6 +30,74 @@ static int mgr_;
 static const char* mgr_socket_ = "/tmp/switch-socket";
 
 
+/* The engine that receives from newly added ports. */
+static struct fp_engine* engine_;
+
+
+/* The poller that receives from newly added ports when there
+   is no engine. Only descriptor-backed ports can be serviced
+   this way. */
+static struct fp_poller* poller_;
+
+
+/* Set the engine that services ports added through the
+   manager. */
+void
+fp_mgr_set_engine(struct fp_engine* e)
+{
+  engine_ = e;
+}
+
+
+/* Set the poller that services ports added through the manager
+   when there is no engine. */
+void
+fp_mgr_set_poller(struct fp_poller* p)
+{
+  poller_ = p;
+}
+
+
+/* Start receiving from the port. */
+static fp_error_t
+attach_port(struct fp_dataplane* dp, struct fp_port* port)
+{
+  if (engine_)
+    return fp_engine_add_port(engine_, dp, port);
+  if (poller_ && fp_port_fd(port) >= 0)
+    return fp_poller_add_port(poller_, dp, port);
+  fprintf(stderr, "[flowpath] warning: port %u is not being polled\n", port->id);
+  return FP_OK;
+}
+
+
+/* Stop receiving from the port. */
+static void
+detach_port(struct fp_port* port)
+{
+  if (engine_)
+    fp_engine_remove_port(engine_, port);
+  else if (poller_)
+    fp_poller_remove_port(poller_, port);
+}
+
+
+/* Release a removed port. */
+static void
+delete_port(void* p)
+{
+  fp_port_delete((struct fp_port*)p);
+}
+
+
+/* Release a replaced decoder. */
+static void
+delete_decoder(void* d)
+{
+  fp_decoder_delete((struct fp_decoder*)d);
+}
+
+
 /* Open a connection to the flowmgr manager channel. Returns
    a file descriptor for the connected manager, or -1
    if the connection failed. */
@@ -101,9 +174,124 @@ fp_on_dataplane_del(struct fp_request const* req, struct fp_reply* rep)
 }
 
 
-/* Adds a port. 
+/* Copy port counters into a reply. */
+static void
+copy_counters(struct fp_stat_counters* out, struct fp_port_stats const* in)
+{
+  out->rx_packets = in->rx_packets;
+  out->rx_bytes = in->rx_bytes;
+  out->tx_packets = in->tx_packets;
+  out->tx_bytes = in->tx_bytes;
+  for (int i = 0; i < FP_STAT_DROPS && i < FP_DROP_REASONS; ++i)
+    out->drops[i] = in->drops[i];
+}
+
 
-   FIXME: Add the port the poll set in the main loop. */
+/* Returns the counters of a data plane, aggregated over its
+   ports. */
+static int
+fp_on_dataplane_stat(struct fp_request const* req, struct fp_reply* rep)
+{
+  fprintf(stderr, "[flowpath] dataplane stats\n");
+
+  struct fp_dataplane_query_arguments const* args =
+    (struct fp_dataplane_query_arguments const*)req->data;
+
+  struct fp_dataplane* dp = fp_dataplane_lookup(args->name);
+  if (!dp) {
+    rep->result = FP_BAD_DATAPLANE;
+    return rep->result;
+  }
+
+  struct fp_port_stats total;
+  memset(&total, 0, sizeof(total));
+  uint32_t nports = 0;
+  for (fp_port_id_t i = 0; i < FP_DATAPLANE_MAX_PORTS; ++i) {
+    if (!fp_dataplane_port(dp, i))
+      continue;
+    struct fp_port_stats ps;
+    fp_dataplane_port_stats(dp, i, &ps);
+    total.rx_packets += ps.rx_packets;
+    total.rx_bytes += ps.rx_bytes;
+    total.tx_packets += ps.tx_packets;
+    total.tx_bytes += ps.tx_bytes;
+    for (int j = 0; j < FP_DROP_REASONS; ++j)
+      total.drops[j] += ps.drops[j];
+    ++nports;
+  }
+
+  struct fp_dataplane_stat_result* res =
+    (struct fp_dataplane_stat_result*)rep->data;
+  memset(res, 0, sizeof(*res));
+  res->state = fp_dataplane_is_up(dp) ? FP_DATAPLANE_STATE_UP
+                                      : FP_DATAPLANE_STATE_DOWN;
+  res->nports = nports;
+  copy_counters(&res->counters, &total);
+  rep->result = FP_OK;
+  return rep->result;
+}
+
+
+/* Starts or stops timing a data plane's packets, and returns
+   the latency of each stage. */
+static int
+fp_on_dataplane_latency(struct fp_request const* req, struct fp_reply* rep)
+{
+  fprintf(stderr, "[flowpath] dataplane latency\n");
+
+  struct fp_dataplane_latency_arguments const* args =
+    (struct fp_dataplane_latency_arguments const*)req->data;
+
+  struct fp_dataplane* dp = fp_dataplane_lookup(args->name);
+  if (!dp) {
+    rep->result = FP_BAD_DATAPLANE;
+    return rep->result;
+  }
+
+  switch (args->action) {
+  case FP_LATENCY_READ:
+    break;
+  case FP_LATENCY_START:
+    fp_dataplane_set_timing(dp, true);
+    break;
+  case FP_LATENCY_STOP:
+    fp_dataplane_set_timing(dp, false);
+    break;
+  case FP_LATENCY_RESET:
+    fp_latency_reset(&dp->latency);
+    break;
+  default:
+    rep->result = FP_BAD_OPERATION;
+    return rep->result;
+  }
+
+  struct fp_dataplane_latency_result* res =
+    (struct fp_dataplane_latency_result*)rep->data;
+  memset(res, 0, sizeof(*res));
+  res->timing = dp->timing;
+  res->nstages = FP_STAT_STAGES < FP_LATENCY_STAGES ? FP_STAT_STAGES
+                                                    : FP_LATENCY_STAGES;
+  uint64_t* h = fp_allocate_n(uint64_t, FP_HIST_BUCKETS);
+  if (!h) {
+    rep->result = FP_FAILURE;
+    return rep->result;
+  }
+  for (uint32_t i = 0; i < res->nstages; ++i) {
+    struct fp_stage_latency* s = &res->stages[i];
+    fp_latency_read(&dp->latency, i, h);
+    s->count = fp_hist_count(h);
+    s->p50 = fp_cycles_to_ns(fp_hist_quantile(h, 0.5));
+    s->p99 = fp_cycles_to_ns(fp_hist_quantile(h, 0.99));
+    s->p999 = fp_cycles_to_ns(fp_hist_quantile(h, 0.999));
+    s->max = fp_cycles_to_ns(fp_hist_max(h));
+  }
+  fp_deallocate(h);
+  rep->result = FP_OK;
+  return rep->result;
+}
+
+
+/* Adds a port and starts receiving from it. */
 static int
 fp_on_port_add(struct fp_request const* req, struct fp_reply* rep)
 {
@@ -146,6 +334,13 @@ fp_on_port_add(struct fp_request const* req, struct fp_reply* rep)
       fprintf(stderr, "port error: %s\n", fp_strerror(rep->result));
       return -1;
     }
+
+    /* Start receiving from the port. */
+    rep->result = attach_port(dp, port);
+    if (fp_error(rep->result)) {
+      fprintf(stderr, "port error: %s\n", fp_strerror(rep->result));
+      return -1;
+    }
   }
   else
     rep->result = FP_BAD_DATAPLANE;
@@ -166,14 +361,61 @@ fp_on_port_del(struct fp_request const* req, struct fp_reply* rep)
   /* Check if data plane exists. Remove the port from the data plane using
      the PID passed through the request arguments. */
   struct fp_dataplane* dp = fp_dataplane_lookup(args->name);
-  if (dp)
-    fp_dataplane_remove_port(dp, fp_dataplane_get_port(dp, (fp_port_id_t)args->pid), &rep->result);
+  if (dp) {
+    struct fp_port* port = fp_dataplane_get_port(dp, (fp_port_id_t)args->pid);
+
+    /* Stop receiving before the port leaves the data plane. */
+    if (port)
+      detach_port(port);
+    fp_dataplane_remove_port(dp, port, &rep->result);
+
+    /* Workers may still refer to the port through the data
+       plane's port array. Wait for them before replying, so that
+       the port's device is closed (e.g., its address can be
+       bound again) and its id is free when the reply is sent. */
+    if (port && rep->result == FP_OK) {
+      fp_qsbr_defer(delete_port, port);
+      fp_qsbr_barrier();
+    }
+  }
   else
     rep->result = FP_BAD_DATAPLANE;
 
   return rep->result;
 }
 
+/* Returns the counters of a port. */
+static int
+fp_on_port_get(struct fp_request const* req, struct fp_reply* rep)
+{
+  fprintf(stderr, "[flowpath] get port\n");
+
+  struct fp_port_get_arguments const* args =
+    (struct fp_port_get_arguments const*)req->data;
+
+  struct fp_dataplane* dp = fp_dataplane_lookup(args->name);
+  if (!dp) {
+    rep->result = FP_BAD_DATAPLANE;
+    return rep->result;
+  }
+  fp_port_id_t index = fp_dataplane_port_index(dp, args->pid);
+  if (index >= FP_DATAPLANE_MAX_PORTS) {
+    rep->result = FP_BAD_PORT;
+    return rep->result;
+  }
+
+  struct fp_port_stats ps;
+  fp_dataplane_port_stats(dp, index, &ps);
+  struct fp_port_get_result* res = (struct fp_port_get_result*)rep->data;
+  memset(res, 0, sizeof(*res));
+  res->pid = args->pid;
+  res->index = index;
+  copy_counters(&res->counters, &ps);
+  rep->result = FP_OK;
+  return rep->result;
+}
+
+
 /* Returns the list of ports being used by the data plane. */
 static int
 fp_on_port_list(struct fp_request const* req, struct fp_reply* rep)
@@ -186,7 +428,7 @@ fp_on_port_list(struct fp_request const* req, struct fp_reply* rep)
   /* Check if data plane exists. */
   struct fp_dataplane* dp = fp_dataplane_lookup(args->name);
   if (dp) {
-    size_t size = ((struct fp_chained_hash_table*)dp->ports.table)->size;
+    size_t size = dp->ports.table->size;
     struct fp_port** ports = fp_allocate_n(struct fp_port*, size);
     fp_dataplane_list_ports(dp, ports, &rep->result);
   }
@@ -195,6 +437,80 @@ fp_on_port_list(struct fp_request const* req, struct fp_reply* rep)
 }
 
 
+/* Replaces the decoder of a data plane. The new program is
+   verified before it is installed, and the old decoder is
+   deleted once no worker can be running it. */
+static int
+fp_on_decoder_set(struct fp_request const* req, struct fp_reply* rep)
+{
+  fprintf(stderr, "[flowpath] set decoder\n");
+
+  struct fp_decoder_set_arguments const* args =
+    (struct fp_decoder_set_arguments const*)req->data;
+
+  struct fp_dataplane* dp = fp_dataplane_lookup(args->name);
+  if (!dp) {
+    rep->result = FP_BAD_DATAPLANE;
+    return rep->result;
+  }
+  if (args->ninsns > FP_DECODER_SET_MAX_INSNS) {
+    rep->result = FP_BAD_DECODER;
+    return rep->result;
+  }
+
+  /* Instructions are not aligned within the message. */
+  struct fp_decoder* dec = NULL;
+  if (args->ninsns) {
+    struct fp_prokex_insn insns[FP_DECODER_SET_MAX_INSNS];
+    memcpy(insns, args->insns, args->ninsns * sizeof(struct fp_prokex_insn));
+    dec = fp_decoder_new(insns, args->ninsns, dp->key_size, &rep->result);
+    if (!dec) {
+      fprintf(stderr, "decoder error: %s\n", fp_strerror(rep->result));
+      return rep->result;
+    }
+
+    /* Interpret the program if it cannot be compiled. */
+    fp_error_t err = fp_decoder_compile(dec);
+    if (fp_error(err))
+      fprintf(stderr, "[flowpath] warning: decoder not compiled: %s\n",
+              fp_strerror(err));
+  }
+
+  struct fp_decoder* old = fp_dataplane_set_decoder(dp, dec);
+  if (old)
+    fp_qsbr_defer(delete_decoder, old);
+  rep->result = FP_OK;
+  return rep->result;
+}
+
+
+/* Replaces the pipeline of a data plane with one loaded from
+   the given module, keeping its ports. The new pipeline is
+   built while the old one forwards. The data plane is then
+   quiesced for a grace period while the pipelines are
+   exchanged; during that pause, workers skip its ports and
+   packets wait in the devices' queues (see fp_pipeline_swap()). */
+static int
+fp_on_pipeline_swap(struct fp_request const* req, struct fp_reply* rep)
+{
+  fprintf(stderr, "[flowpath] swap pipeline\n");
+
+  struct fp_pipeline_swap_arguments const* args =
+    (struct fp_pipeline_swap_arguments const*)req->data;
+
+  struct fp_dataplane* dp = fp_dataplane_lookup(args->name);
+  if (!dp) {
+    rep->result = FP_BAD_DATAPLANE;
+    return rep->result;
+  }
+
+  /* Poller-driven ports run on this thread, so only the engine's
+     workers can be inside the pipeline. */
+  rep->result = fp_pipeline_swap(dp, args->type, engine_);
+  return rep->result;
+}
+
+
 static int
 fp_on_request(struct fp_request const* req, struct fp_reply* rep)
 {
@@ -205,18 +521,29 @@ fp_on_request(struct fp_request const* req, struct fp_reply* rep)
   case FP_DATPLANE_DEL:
     return fp_on_dataplane_del(req, rep);
 
+  case FP_DATPLANE_STAT:
+    return fp_on_dataplane_stat(req, rep);
+
+  case FP_DATPLANE_LATENCY:
+    return fp_on_dataplane_latency(req, rep);
+
   case FP_PORT_ADD:    
     return fp_on_port_add(req, rep);
 
   case FP_PORT_DEL:    
     return fp_on_port_del(req, rep);
 
+  case FP_PORT_GET:
+    return fp_on_port_get(req, rep);
+
   case FP_PORT_LIST:
     return fp_on_port_list(req, rep);
   
   case FP_DECODER_SET:
-    fprintf(stderr, "set decoder: not implemented\n");
-    return FP_FAILURE;
+    return fp_on_decoder_set(req, rep);
+
+  case FP_PIPELINE_SWAP:
+    return fp_on_pipeline_swap(req, rep);
   
   case FP_TABLE_ADD:
     fprintf(stderr, "add table: not implemented\n");
@@ -8,8 +8,13 @@
 /* The management module handles communication with a
    flowmgr instance.  */
 
-int fp_mgr_open();
-int fp_mgr_close();
-int fp_mgr_incoming();
+struct fp_engine;
+struct fp_poller;
+
+int  fp_mgr_open();
+int  fp_mgr_close();
+int  fp_mgr_incoming();
+void fp_mgr_set_engine(struct fp_engine*);
+void fp_mgr_set_poller(struct fp_poller*);
 
 #endif
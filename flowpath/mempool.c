@@ -0,0 +1,217 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "mempool.h"
+
+
+/* The number of threads that have been assigned a cache slot. */
+static int nthreads_;
+
+/* The cache slot of the current thread, or -1 if the thread
+   has not yet used a pool. */
+static __thread int slot_ = -1;
+
+
+/* Returns the cache slot of the calling thread. Slots are
+   assigned on first use and are never reused. */
+static inline int
+thread_slot()
+{
+  if (slot_ < 0)
+    slot_ = __atomic_fetch_add(&nthreads_, 1, __ATOMIC_RELAXED);
+  return slot_;
+}
+
+
+/* Returns the calling thread's cache for the pool, creating
+   it if needed, or NULL if the thread cannot have a cache.
+   Only the owning thread ever touches its slot, so no
+   synchronization is needed. */
+static inline struct fp_mempool_cache*
+get_cache(struct fp_mempool* p)
+{
+  int slot = thread_slot();
+  if (slot >= FP_MEMPOOL_MAX_THREADS)
+    return NULL;
+  struct fp_mempool_cache* c = p->caches[slot];
+  if (!c) {
+    c = fp_allocate(struct fp_mempool_cache);
+    c->len = 0;
+    __atomic_store_n(&p->caches[slot], c, __ATOMIC_RELEASE);
+  }
+  return c;
+}
+
+
+/* Take between min and max objects from the shared stack. If
+   fewer than min objects are available, none are taken.
+   Returns the number of objects taken. */
+static int
+pop_shared(struct fp_mempool* p, void** objs, int min, int max)
+{
+  pthread_spin_lock(&p->lock);
+  int n = p->nfree < max ? p->nfree : max;
+  if (n < min) {
+    pthread_spin_unlock(&p->lock);
+    return 0;
+  }
+  p->nfree -= n;
+  memcpy(objs, p->free + p->nfree, n * sizeof(void*));
+  pthread_spin_unlock(&p->lock);
+  return n;
+}
+
+
+/* Return n objects to the shared stack. */
+static void
+push_shared(struct fp_mempool* p, void** objs, int n)
+{
+  pthread_spin_lock(&p->lock);
+  assert(p->nfree + n <= p->capacity);
+  memcpy(p->free + p->nfree, objs, n * sizeof(void*));
+  p->nfree += n;
+  pthread_spin_unlock(&p->lock);
+}
+
+
+/* Create a pool of n objects of the given size. Each object
+   is aligned to FP_MEMPOOL_ALIGN bytes. Returns NULL if the
+   memory cannot be allocated. */
+struct fp_mempool*
+fp_mempool_create(size_t size, int n)
+{
+  size = (size + FP_MEMPOOL_ALIGN - 1) & ~(size_t)(FP_MEMPOOL_ALIGN - 1);
+
+  struct fp_mempool* p = fp_allocate(struct fp_mempool);
+  if (!p)
+    return NULL;
+  memset(p, 0, sizeof(struct fp_mempool));
+  if (posix_memalign((void**)&p->storage, FP_MEMPOOL_ALIGN, size * n) != 0) {
+    fp_deallocate(p);
+    return NULL;
+  }
+  p->free = fp_allocate_n(void*, n);
+  if (!p->free) {
+    fp_deallocate(p->storage);
+    fp_deallocate(p);
+    return NULL;
+  }
+  p->size = size;
+  p->capacity = n;
+  pthread_spin_init(&p->lock, PTHREAD_PROCESS_PRIVATE);
+
+  /* Stack the objects so that they are handed out in address
+     order. */
+  p->nfree = n;
+  for (int i = 0; i < n; ++i)
+    p->free[i] = p->storage + (size_t)(n - i - 1) * size;
+  return p;
+}
+
+
+/* Destroy the pool. All objects allocated from the pool are
+   invalidated. */
+void
+fp_mempool_delete(struct fp_mempool* p)
+{
+  if (!p)
+    return;
+  for (int i = 0; i < FP_MEMPOOL_MAX_THREADS; ++i)
+    fp_deallocate(p->caches[i]);
+  pthread_spin_destroy(&p->lock);
+  fp_deallocate(p->free);
+  fp_deallocate(p->storage);
+  fp_deallocate(p);
+}
+
+
+/* Allocate n objects from the pool. Either all n objects are
+   allocated, or none are. Returns the number of objects
+   allocated. */
+int
+fp_mempool_get_bulk(struct fp_mempool* p, void** objs, int n)
+{
+  struct fp_mempool_cache* c = get_cache(p);
+  if (!c || n > FP_MEMPOOL_CACHE_SIZE)
+    return pop_shared(p, objs, n, n);
+
+  /* Refill the cache so that it can satisfy the request and
+     is left about half full. */
+  if (c->len < n) {
+    int want = FP_MEMPOOL_CACHE_SIZE / 2 + n - c->len;
+    if (want > FP_MEMPOOL_CACHE_SIZE - c->len)
+      want = FP_MEMPOOL_CACHE_SIZE - c->len;
+    c->len += pop_shared(p, c->objs + c->len, n - c->len, want);
+    if (c->len < n)
+      return 0;
+  }
+
+  for (int i = 0; i < n; ++i)
+    objs[i] = c->objs[--c->len];
+  return n;
+}
+
+
+/* Return n objects to the pool. */
+void
+fp_mempool_put_bulk(struct fp_mempool* p, void** objs, int n)
+{
+  struct fp_mempool_cache* c = get_cache(p);
+  if (!c || n > FP_MEMPOOL_CACHE_SIZE) {
+    push_shared(p, objs, n);
+    return;
+  }
+
+  /* Flush the cache so that it is about half full after the
+     objects are added. */
+  if (c->len + n > FP_MEMPOOL_CACHE_SIZE) {
+    int flush = c->len + n - FP_MEMPOOL_CACHE_SIZE / 2;
+    if (flush > c->len)
+      flush = c->len;
+    c->len -= flush;
+    push_shared(p, c->objs + c->len, flush);
+  }
+
+  memcpy(c->objs + c->len, objs, n * sizeof(void*));
+  c->len += n;
+}
+
+
+/* Allocate a single object from the pool. Returns NULL if
+   the pool is exhausted. */
+void*
+fp_mempool_get(struct fp_mempool* p)
+{
+  void* obj;
+  if (fp_mempool_get_bulk(p, &obj, 1) == 1)
+    return obj;
+  return NULL;
+}
+
+
+/* Return a single object to the pool. */
+void
+fp_mempool_put(struct fp_mempool* p, void* obj)
+{
+  assert((unsigned char*)obj >= p->storage &&
+         (unsigned char*)obj < p->storage + p->size * p->capacity);
+  fp_mempool_put_bulk(p, &obj, 1);
+}
+
+
+/* Returns the number of free objects in the pool, including
+   those held in thread caches. This is only a snapshot when
+   other threads are using the pool. */
+int
+fp_mempool_available(struct fp_mempool* p)
+{
+  pthread_spin_lock(&p->lock);
+  int n = p->nfree;
+  pthread_spin_unlock(&p->lock);
+  for (int i = 0; i < FP_MEMPOOL_MAX_THREADS; ++i) {
+    struct fp_mempool_cache* c = __atomic_load_n(&p->caches[i], __ATOMIC_ACQUIRE);
+    if (c)
+      n += __atomic_load_n(&c->len, __ATOMIC_RELAXED);
+  }
+  return n;
+}
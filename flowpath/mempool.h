@@ -0,0 +1,74 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_MEMPOOL_H
+#define FLOWPATH_MEMPOOL_H
+
+/* The mempool module provides fixed-size object pools. All
+   objects in a pool are carved from a single allocation made
+   when the pool is created, so a pool bounds the memory that it
+   can hand out; when it is exhausted, allocation fails instead
+   of growing.
+
+   Free objects are kept on a shared stack guarded by a spin
+   lock. To keep the lock off the fast path, each thread has a
+   private cache of free objects for every pool it uses. Objects
+   are allocated from and freed to the cache; the shared stack
+   is only touched when a cache runs empty or overflows, and then
+   half a cache worth of objects is moved at once.
+
+   Objects may be freed by a different thread than the one that
+   allocated them. Objects cached by a thread that exits are not
+   returned to the pool.
+
+   TODO: Reclaim the caches of exited threads. */
+
+#include "util.h"
+
+#include <pthread.h>
+
+
+/* The number of objects held by a thread's cache. */
+#define FP_MEMPOOL_CACHE_SIZE  256
+
+/* The maximum number of threads with caches. Threads beyond
+   this limit allocate directly from the shared stack. */
+#define FP_MEMPOOL_MAX_THREADS 128
+
+/* The alignment of each object. */
+#define FP_MEMPOOL_ALIGN       64
+
+
+/* A per-thread cache of free objects. */
+struct fp_mempool_cache
+{
+  int   len;
+  void* objs[FP_MEMPOOL_CACHE_SIZE];
+};
+
+
+/* A pool of fixed-size objects. */
+struct fp_mempool
+{
+  size_t             size;     /* Size of each object (aligned). */
+  int                capacity; /* Total number of objects. */
+  unsigned char*     storage;  /* Backing store for all objects. */
+
+  pthread_spinlock_t lock;     /* Guards the shared stack. */
+  int                nfree;
+  void**             free;     /* Shared stack of free objects. */
+
+  struct fp_mempool_cache* caches[FP_MEMPOOL_MAX_THREADS];
+};
+
+
+struct fp_mempool* fp_mempool_create(size_t, int);
+void               fp_mempool_delete(struct fp_mempool*);
+void*              fp_mempool_get(struct fp_mempool*);
+void               fp_mempool_put(struct fp_mempool*, void*);
+int                fp_mempool_get_bulk(struct fp_mempool*, void**, int);
+void               fp_mempool_put_bulk(struct fp_mempool*, void**, int);
+int                fp_mempool_available(struct fp_mempool*);
+
+
+#endif
@@ -2,16 +2,128 @@
 // All rights reserved
 
 #include "packet.h"
+#include "port.h"
 #include "util.h"
+#include "mempool.h"
 
-/* Allocate a packet from the underlying buffer. */
+#include <pthread.h>
+
+
+/* Pools of packet descriptors and packet buffers. These are
+   created on first use. */
+static struct fp_mempool* packets_;
+static struct fp_mempool* buffers_;
+static pthread_once_t     pools_once_ = PTHREAD_ONCE_INIT;
+
+
+static void
+create_pools()
+{
+  packets_ = fp_mempool_create(sizeof(struct fp_packet_block), FP_PACKET_POOL_SIZE);
+  buffers_ = fp_mempool_create(FP_PACKET_BUF_SIZE, FP_PACKET_BUF_POOL_SIZE);
+  assert(packets_ && buffers_);
+}
+
+
+static inline void
+init_pools()
+{
+  pthread_once(&pools_once_, create_pools);
+}
+
+
+/* Allocate a FP_PACKET_BUF_SIZE byte buffer from the packet
+   buffer pool. Returns NULL if the pool is exhausted. */
+unsigned char*
+fp_packet_alloc_buffer()
+{
+  init_pools();
+  return (unsigned char*)fp_mempool_get(buffers_);
+}
+
+
+/* Allocate up to n buffers from the packet buffer pool,
+   storing them in bufs. Returns the number of buffers allocated,
+   which is less than n only if the pool is nearly exhausted. */
+int
+fp_packet_alloc_buffers(unsigned char** bufs, int n)
+{
+  init_pools();
+  if (fp_mempool_get_bulk(buffers_, (void**)bufs, n) == n)
+    return n;
+  int k = 0;
+  while (k < n && (bufs[k] = (unsigned char*)fp_mempool_get(buffers_)))
+    ++k;
+  return k;
+}
+
+
+/* Return n buffers allocated from the packet buffer pool. */
+void
+fp_packet_free_buffers(unsigned char** bufs, int n)
+{
+  fp_mempool_put_bulk(buffers_, (void**)bufs, n);
+}
+
+
+/* Return a buffer allocated by fp_packet_alloc_buffer() to
+   the pool. */
+void
+fp_packet_free_buffer(unsigned char* buf)
+{
+  fp_mempool_put(buffers_, buf);
+}
+
+
+/* Release a FP_BUF_ALLOC buffer. */
+static void
+release_alloc(struct fp_packet* pkt)
+{
+  fp_packet_free_buffer(pkt->data);
+}
+
+
+/* Table of buffer release functions, indexed by buffer kind. */
+static fp_buf_release_fn releasers_[FP_BUF_MAX] = {
+  [FP_BUF_ALLOC] = release_alloc
+};
+
+
+/* Register the release function for a kind of buffer. */
+void
+fp_packet_register_buffer(fp_buf_t kind, fp_buf_release_fn fn)
+{
+  releasers_[kind] = fn;
+}
+
+
+/* Return the packet's buffer to its owner. The packet no
+   longer refers to valid data after this call, but the
+   packet itself is not deleted. */
+void
+fp_packet_release_buffer(struct fp_packet* pkt)
+{
+  fp_buf_release_fn fn = releasers_[pkt->buf_dev];
+  assert(fn);
+  fn(pkt);
+  pkt->data = NULL;
+}
+
+
+/* Allocate a packet from the underlying buffer. Returns NULL
+   if no descriptors are available. The packet is the first
+   member of a descriptor block (see struct fp_packet_block). */
 struct fp_packet*
 fp_packet_create(unsigned char* data, int size, uint64_t timestamp,
                  void* buf_handle, fp_buf_t buf_dev)
 {
-  struct fp_packet* packet = fp_allocate(struct fp_packet);
+  init_pools();
+  struct fp_packet* packet = (struct fp_packet*)fp_mempool_get(packets_);
+  if (!packet)
+    return NULL;
   packet->data = data;
   packet->size = size;
+  packet->hash = 0;
   packet->timestamp = timestamp;
   packet->buf_handle = buf_handle;
   packet->buf_dev = buf_dev;
@@ -25,19 +137,62 @@ fp_packet_create(unsigned char* data, int size, uint64_t timestamp,
 void 
 fp_packet_delete(struct fp_packet* packet)
 {
-  fp_deallocate(packet);
+  fp_mempool_put(packets_, packet);
+}
+
+
+/* Deallocate n packets. */
+void
+fp_packet_delete_n(struct fp_packet** pkts, int n)
+{
+  fp_mempool_put_bulk(packets_, (void**)pkts, n);
 }
 
 
+/* Allocate a new context for the packet. */
 struct fp_context* 
 fp_context_create(struct fp_packet* pkt, struct fp_arrival arr)
 {
   struct fp_context* cxt = fp_allocate(struct fp_context);
+  fp_context_init(cxt, pkt, arr);
+  return cxt;
+}
+
+
+/* Initialize a context in place. This allows pipelines to
+   keep contexts in automatic storage. */
+void
+fp_context_init(struct fp_context* cxt, struct fp_packet* pkt, struct fp_arrival arr)
+{
   cxt->in_port = arr.in_port;
   cxt->in_phy_port = arr.in_phy_port;
   cxt->tunnel_id = arr.tunnel_id;
+  cxt->in_index = arr.in_index;
+  cxt->out_port = FP_PORT_DROP;
+  cxt->out_index = FP_PORT_DROP;
   cxt->packet = pkt;
-  return cxt;
+}
+
+
+/* Initialize the context embedded in the packet's descriptor
+   and return it. The context's key refers to the descriptor's
+   key storage. The first key_size bytes of the key are cleared,
+   and its base fields are set from the arrival. This performs
+   no allocation. */
+struct fp_context*
+fp_context_attach(struct fp_packet* pkt, struct fp_arrival arr, size_t key_size)
+{
+  struct fp_packet_block* b = (struct fp_packet_block*)pkt;
+  assert(key_size >= sizeof(struct fp_base_key));
+  assert(key_size <= FP_PACKET_KEY_SIZE);
+  fp_context_init(&b->context, pkt, arr);
+
+  struct fp_base_key* key = (struct fp_base_key*)b->key;
+  memset(key, 0, key_size);
+  key->in_port = arr.in_port;
+  key->in_phy_port = arr.in_phy_port;
+  b->context.key = key;
+  return &b->context;
 }
 
 
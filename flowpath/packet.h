@@ -6,11 +6,31 @@
 
 #include "types.h"
 
+#include <stddef.h>
+
 
 #define FP_MAX_KEY_LEN   64
 #define FP_MAX_VALUE_LEN 128
 
-typedef enum {FP_BUF_NADK, FP_BUF_NETMAP, FP_BUF_ALLOC} fp_buf_t;
+/* Packet descriptors and FP_BUF_ALLOC buffers are allocated
+   from fixed-size pools (see mempool.h). These limit the number
+   of packets that can be in flight at once. */
+#define FP_PACKET_POOL_SIZE     65536 /* Number of descriptors. */
+#define FP_PACKET_BUF_POOL_SIZE 8192  /* Number of buffers. */
+#define FP_PACKET_BUF_SIZE      4096  /* Size of each buffer. This
+                                         holds any datagram the UDP
+                                         device has accepted. */
+
+/* The largest key that can be stored in a packet descriptor.
+   This bounds a data plane's key_size. */
+#define FP_PACKET_KEY_SIZE      128
+
+/* The number of registers in a packet context: the port and
+   tunnel registers, followed by 32 scratch registers. See
+   decoder.h. */
+#define FP_CONTEXT_REGS         36
+
+typedef enum {FP_BUF_NADK, FP_BUF_NETMAP, FP_BUF_ALLOC, FP_BUF_MAX} fp_buf_t;
 
 
 /* A packet is a datagram containing layered protocol information
@@ -30,7 +50,9 @@ struct fp_packet
 {
   unsigned char* data; /* Packet buffer. */
   int            size; /* Number of bytes. */
-  uint64_t       timestamp;  /* Time of packet arrival */
+  uint32_t       hash; /* Flow hash (see rss.h), or 0. */
+  uint64_t       timestamp;  /* Time of packet arrival in cycles
+                                (see latency.h), or 0 */
   void*          buf_handle; /* [optional] port-specific buffer handle */
   fp_buf_t       buf_dev;    /* [optional] owner of buffer handle (dev*) */
 };
@@ -39,6 +61,26 @@ struct fp_packet
 struct fp_packet* fp_packet_create(unsigned char*, int, uint64_t,
                                    void*, fp_buf_t);
 void              fp_packet_delete(struct fp_packet*);
+void              fp_packet_delete_n(struct fp_packet**, int);
+
+unsigned char*    fp_packet_alloc_buffer();
+void              fp_packet_free_buffer(unsigned char*);
+int               fp_packet_alloc_buffers(unsigned char**, int);
+void              fp_packet_free_buffers(unsigned char**, int);
+
+
+/* A function that returns a packet's buffer to the buffer's
+   owner. Each kind of buffer has exactly one release function;
+   devices that own buffers register theirs when they are
+   opened. Buffers allocated with fp_packet_alloc_buffer()
+   (FP_BUF_ALLOC) are returned to the packet buffer pool.
+
+   This allows a device to send or drop a packet received on
+   a different kind of device. */
+typedef void (*fp_buf_release_fn)(struct fp_packet*);
+
+void fp_packet_register_buffer(fp_buf_t, fp_buf_release_fn);
+void fp_packet_release_buffer(struct fp_packet*);
 
 
 /* The arrival type saves information about the arrival
@@ -56,6 +98,11 @@ void              fp_packet_delete(struct fp_packet*);
      the tunnel_id may be set to indicate a tunnel for
      e.g., GRE tunneling.
 
+   - in_index -- The local index of the in_port in its data
+     plane (see dataplane.h), or FP_PORT_DROP if it has none.
+     Workers use this, and never the data plane's port table,
+     to find the input port.
+
    - timestamp -- When the packet was received.
 
    TODO: This might actually be a set of macros that can
@@ -65,6 +112,7 @@ struct fp_arrival
   fp_port_id_t in_port;
   fp_port_id_t in_phy_port;
   int          tunnel_id;
+  fp_port_id_t in_index;
 };
 
 
@@ -118,6 +166,7 @@ struct fp_context
   fp_port_id_t in_port;
   fp_port_id_t in_phy_port;
   int          tunnel_id;
+  fp_port_id_t in_index; /* See fp_arrival. */
 //  int          timestamp;
 
   /* Actions.
@@ -127,16 +176,56 @@ struct fp_context
   fp_port_id_t out_port;    /* The output port. */
   int table;       /* The current table */
 
+  /* The output port as a local port index or a reserved port
+     (see fp_dataplane_output_port()). Pipelines set this along
+     with out_port. */
+  fp_port_id_t out_index;
+
   
   /* Configurable elements. */
   /* Important: the size of the Key is configurable */
   struct fp_base_key* key;
 
+  /* The register file. The port and tunnel registers mirror
+     the fields above while a decoder runs. */
+  uint64_t regs[FP_CONTEXT_REGS];
 };
 
 
 struct fp_context* fp_context_create(struct fp_packet*, struct fp_arrival);
+void               fp_context_init(struct fp_context*, struct fp_packet*, struct fp_arrival);
+struct fp_context* fp_context_attach(struct fp_packet*, struct fp_arrival, size_t);
 void               fp_context_delete(struct fp_context*);
 
 
+/* A packet descriptor block. Every packet created by
+   fp_packet_create() is the first member of one of these, so
+   the packet, its processing context, and the context's key are
+   allocated together from a single cache-aligned pool object.
+   The packet metadata and context share the first cache line,
+   and a small key follows immediately after.
+
+   This is similar to the headroom of an mbuf, except that it
+   is kept apart from the packet data, since that is usually
+   owned by a device.
+
+   Use fp_packet_context() to get the embedded context, and
+   fp_context_attach() to initialize it. The embedded context
+   must not be passed to fp_context_delete(). */
+struct fp_packet_block
+{
+  struct fp_packet  packet;
+  struct fp_context context;
+  unsigned char     key[FP_PACKET_KEY_SIZE] __attribute__((aligned(8)));
+};
+
+
+/* Returns the context embedded in the packet's descriptor. */
+static inline struct fp_context*
+fp_packet_context(struct fp_packet* pkt)
+{
+  return &((struct fp_packet_block*)pkt)->context;
+}
+
+
 #endif
@@ -0,0 +1,300 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "parse.h"
+#include "packet.h"
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+
+/* Header sizes. */
+#define ETH_LEN  14
+#define VLAN_LEN 4
+#define IPV4_LEN 20
+#define IPV6_LEN 40
+#define TCP_LEN  20
+#define UDP_LEN  8
+
+/* EtherTypes. */
+#define ETH_IPV4 0x0800
+#define ETH_IPV6 0x86dd
+#define ETH_VLAN 0x8100
+#define ETH_QINQ 0x88a8
+
+/* IP protocols. */
+#define IP_TCP 6
+#define IP_UDP 17
+
+
+/* A set of packets in a batch, with one bit per packet. */
+typedef uint64_t fp_parse_mask_t;
+
+
+/* Load a 16-bit value in network byte order. */
+static inline uint16_t
+load16(unsigned char const* p)
+{
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+
+/* Returns the index of the next packet in the set, and removes
+   it from the set, which must not be empty. */
+static inline int
+next_packet(fp_parse_mask_t* m)
+{
+  int i = __builtin_ctzll(*m);
+  *m &= *m - 1;
+  return i;
+}
+
+
+/* Returns the set of packets whose element of v (an array of
+   FP_PARSE_BATCH elements) equals x. */
+static inline fp_parse_mask_t
+match16(uint16_t const* v, uint16_t x)
+{
+  fp_parse_mask_t m = 0;
+#if defined(__AVX2__)
+  __m256i k = _mm256_set1_epi16((short)x);
+  for (int i = 0; i < FP_PARSE_BATCH; i += 32) {
+    __m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256((__m256i const*)(v + i)), k);
+    __m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256((__m256i const*)(v + i + 16)), k);
+    /* Packing interleaves the 128-bit halves of a and b. */
+    __m256i c = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8);
+    m |= (fp_parse_mask_t)(uint32_t)_mm256_movemask_epi8(c) << i;
+  }
+#elif defined(__SSE2__)
+  __m128i k = _mm_set1_epi16((short)x);
+  for (int i = 0; i < FP_PARSE_BATCH; i += 16) {
+    __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((__m128i const*)(v + i)), k);
+    __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((__m128i const*)(v + i + 8)), k);
+    m |= (fp_parse_mask_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(a, b)) << i;
+  }
+#else
+  for (int i = 0; i < FP_PARSE_BATCH; ++i)
+    m |= (fp_parse_mask_t)(v[i] == x) << i;
+#endif
+  return m;
+}
+
+
+/* Returns the set of packets whose element of v (an array of
+   FP_PARSE_BATCH elements) equals x. */
+static inline fp_parse_mask_t
+match8(uint8_t const* v, uint8_t x)
+{
+  fp_parse_mask_t m = 0;
+#if defined(__AVX2__)
+  __m256i k = _mm256_set1_epi8((char)x);
+  for (int i = 0; i < FP_PARSE_BATCH; i += 32) {
+    __m256i a = _mm256_loadu_si256((__m256i const*)(v + i));
+    m |= (fp_parse_mask_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, k)) << i;
+  }
+#elif defined(__SSE2__)
+  __m128i k = _mm_set1_epi8((char)x);
+  for (int i = 0; i < FP_PARSE_BATCH; i += 16) {
+    __m128i a = _mm_loadu_si128((__m128i const*)(v + i));
+    m |= (fp_parse_mask_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, k)) << i;
+  }
+#else
+  for (int i = 0; i < FP_PARSE_BATCH; ++i)
+    m |= (fp_parse_mask_t)(v[i] == x) << i;
+#endif
+  return m;
+}
+
+
+/* Parse the Ethernet headers of the batch, prefetching the
+   headers of later packets. */
+static void
+parse_ethernet(struct fp_packet* const* pkts, int n, struct fp_parse* out)
+{
+  for (int i = 0; i < n; ++i) {
+    if (i + FP_PARSE_PREFETCH < n) {
+      unsigned char const* d = pkts[i + FP_PARSE_PREFETCH]->data;
+      __builtin_prefetch(d);
+      __builtin_prefetch(d + 64);
+    }
+    struct fp_packet const* p = pkts[i];
+    if (p->size < ETH_LEN) {
+      out->flags[i] = FP_PARSE_TRUNCATED;
+      continue;
+    }
+    out->flags[i] = FP_PARSE_ETH;
+    out->eth_type[i] = load16(p->data + 12);
+    out->l3[i] = ETH_LEN;
+  }
+}
+
+
+/* Parse the VLAN tags of the given packets. An inner C-tag
+   may follow the outer tag. */
+static void
+parse_vlan(struct fp_packet* const* pkts, fp_parse_mask_t m, struct fp_parse* out)
+{
+  while (m) {
+    int i = next_packet(&m);
+    unsigned char const* d = pkts[i]->data;
+    int size = pkts[i]->size;
+    int off = ETH_LEN;
+    if (size < off + VLAN_LEN) {
+      out->flags[i] |= FP_PARSE_TRUNCATED;
+      out->eth_type[i] = 0;
+      continue;
+    }
+    out->flags[i] |= FP_PARSE_VLAN;
+    out->vlan[i] = load16(d + off);
+    uint16_t type = load16(d + off + 2);
+    off += VLAN_LEN;
+    if (type == ETH_VLAN) {
+      if (size < off + VLAN_LEN) {
+        out->flags[i] |= FP_PARSE_TRUNCATED;
+        out->eth_type[i] = 0;
+        continue;
+      }
+      out->flags[i] |= FP_PARSE_QINQ;
+      type = load16(d + off + 2);
+      off += VLAN_LEN;
+    }
+    out->eth_type[i] = type;
+    out->l3[i] = off;
+  }
+}
+
+
+/* Parse the IPv4 headers of the given packets. Returns the set
+   of non-initial fragments. */
+static fp_parse_mask_t
+parse_ipv4(struct fp_packet* const* pkts, fp_parse_mask_t m, struct fp_parse* out)
+{
+  fp_parse_mask_t frags = 0;
+  while (m) {
+    int i = next_packet(&m);
+    unsigned char const* d = pkts[i]->data;
+    int size = pkts[i]->size;
+    int off = out->l3[i];
+    if (size < off + IPV4_LEN) {
+      out->flags[i] |= FP_PARSE_TRUNCATED;
+      continue;
+    }
+    if (d[off] >> 4 != 4)
+      continue;
+    int len = (d[off] & 0x0f) * 4;
+    if (len < IPV4_LEN || size < off + len) {
+      out->flags[i] |= FP_PARSE_TRUNCATED;
+      continue;
+    }
+    out->flags[i] |= FP_PARSE_IPV4;
+    out->ip_proto[i] = d[off + 9];
+    out->l4[i] = off + len;
+    if (load16(d + off + 6) & 0x1fff) {
+      out->flags[i] |= FP_PARSE_FRAGMENT;
+      frags |= (fp_parse_mask_t)1 << i;
+    }
+  }
+  return frags;
+}
+
+
+/* Parse the IPv6 headers of the given packets. */
+static void
+parse_ipv6(struct fp_packet* const* pkts, fp_parse_mask_t m, struct fp_parse* out)
+{
+  while (m) {
+    int i = next_packet(&m);
+    unsigned char const* d = pkts[i]->data;
+    int size = pkts[i]->size;
+    int off = out->l3[i];
+    if (size < off + IPV6_LEN) {
+      out->flags[i] |= FP_PARSE_TRUNCATED;
+      continue;
+    }
+    if (d[off] >> 4 != 6)
+      continue;
+    out->flags[i] |= FP_PARSE_IPV6;
+    out->ip_proto[i] = d[off + 6];
+    out->l4[i] = off + IPV6_LEN;
+  }
+}
+
+
+/* Parse the TCP headers of the given packets. */
+static void
+parse_tcp(struct fp_packet* const* pkts, fp_parse_mask_t m, struct fp_parse* out)
+{
+  while (m) {
+    int i = next_packet(&m);
+    unsigned char const* d = pkts[i]->data;
+    int size = pkts[i]->size;
+    int off = out->l4[i];
+    if (size < off + TCP_LEN) {
+      out->flags[i] |= FP_PARSE_TRUNCATED;
+      continue;
+    }
+    int len = (d[off + 12] >> 4) * 4;
+    if (len < TCP_LEN || size < off + len) {
+      out->flags[i] |= FP_PARSE_TRUNCATED;
+      continue;
+    }
+    out->flags[i] |= FP_PARSE_TCP;
+    out->payload[i] = off + len;
+  }
+}
+
+
+/* Parse the UDP headers of the given packets. */
+static void
+parse_udp(struct fp_packet* const* pkts, fp_parse_mask_t m, struct fp_parse* out)
+{
+  while (m) {
+    int i = next_packet(&m);
+    int off = out->l4[i];
+    if (pkts[i]->size < off + UDP_LEN) {
+      out->flags[i] |= FP_PARSE_TRUNCATED;
+      continue;
+    }
+    out->flags[i] |= FP_PARSE_UDP;
+    out->payload[i] = off + UDP_LEN;
+  }
+}
+
+
+/* Parse the headers of the n packets (at most FP_PARSE_BATCH),
+   storing the results in out. */
+void
+fp_parse_batch(struct fp_packet* const* pkts, int n, struct fp_parse* out)
+{
+  assert(0 <= n && n <= FP_PARSE_BATCH);
+
+  /* Every array is compared in full, so elements of missing
+     packets must not match anything. */
+  memset(out, 0, sizeof(struct fp_parse));
+
+  parse_ethernet(pkts, n, out);
+
+  fp_parse_mask_t vlan = match16(out->eth_type, ETH_VLAN) |
+                         match16(out->eth_type, ETH_QINQ);
+  if (vlan)
+    parse_vlan(pkts, vlan, out);
+
+  fp_parse_mask_t ipv4 = match16(out->eth_type, ETH_IPV4);
+  fp_parse_mask_t ipv6 = match16(out->eth_type, ETH_IPV6);
+  fp_parse_mask_t frags = 0;
+  if (ipv4)
+    frags = parse_ipv4(pkts, ipv4, out);
+  if (ipv6)
+    parse_ipv6(pkts, ipv6, out);
+
+  /* Only packets whose IP header was parsed have a protocol. */
+  fp_parse_mask_t tcp = match8(out->ip_proto, IP_TCP) & ~frags;
+  fp_parse_mask_t udp = match8(out->ip_proto, IP_UDP) & ~frags;
+  if (tcp)
+    parse_tcp(pkts, tcp, out);
+  if (udp)
+    parse_udp(pkts, udp, out);
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_PARSE_H
+#define FLOWPATH_PARSE_H
+
+/* This module implements a batch header parser. Given a burst
+   of packets, it finds the network and transport headers of
+   each, for Ethernet frames carrying (up to two) VLAN tags,
+   IPv4 or IPv6, and TCP or UDP.
+
+   Results are stored as a structure of arrays: the ith element
+   of each array describes the ith packet. This lets the parser
+   classify a whole burst at once. Each layer is parsed in a
+   pass over the batch: first the fields that determine the
+   next header (the EtherType, or the IP protocol) are gathered
+   from every packet into an array, and then the array is
+   compared against the values of interest many packets at a
+   time with SIMD instructions (AVX2 or SSE2 when available).
+   While gathering, the headers of later packets in the batch
+   are prefetched.
+
+   The Ethernet header is always at offset 0. IPv6 extension
+   headers are not followed; a packet whose IPv6 next header is
+   not TCP or UDP is parsed only to the network layer, as are
+   non-initial IPv4 fragments. Headers that are cut short by the
+   end of the packet are not parsed, and the packet is flagged
+   as truncated. */
+
+#include "util.h"
+
+struct fp_packet;
+
+
+/* The maximum number of packets in a batch. */
+#define FP_PARSE_BATCH    64
+
+/* The number of packets ahead of the current packet whose
+   headers are prefetched. */
+#define FP_PARSE_PREFETCH 4
+
+
+/* Protocol flags. */
+#define FP_PARSE_ETH       0x0001 /* Has an Ethernet header. */
+#define FP_PARSE_VLAN      0x0002 /* Has a VLAN tag. */
+#define FP_PARSE_QINQ      0x0004 /* Has two VLAN tags. */
+#define FP_PARSE_IPV4      0x0008 /* Has an IPv4 header at l3. */
+#define FP_PARSE_IPV6      0x0010 /* Has an IPv6 header at l3. */
+#define FP_PARSE_TCP       0x0020 /* Has a TCP header at l4. */
+#define FP_PARSE_UDP       0x0040 /* Has a UDP header at l4. */
+#define FP_PARSE_FRAGMENT  0x0080 /* Is a non-initial IPv4 fragment. */
+#define FP_PARSE_TRUNCATED 0x0100 /* A header is cut short. */
+
+
+/* The result of parsing a batch. Offsets are from the start of
+   each packet, and are only meaningful when the corresponding
+   flags are set: l3 for IPv4 or IPv6, l4 for TCP or UDP, and
+   payload for TCP or UDP. Multi-byte values are in host byte
+   order. */
+struct fp_parse
+{
+  uint16_t flags[FP_PARSE_BATCH];
+  uint16_t eth_type[FP_PARSE_BATCH]; /* Innermost EtherType. */
+  uint16_t vlan[FP_PARSE_BATCH];     /* Outer VLAN TCI. */
+  uint8_t  ip_proto[FP_PARSE_BATCH]; /* IP protocol or next header. */
+  uint16_t l3[FP_PARSE_BATCH];
+  uint16_t l4[FP_PARSE_BATCH];
+  uint16_t payload[FP_PARSE_BATCH];
+};
+
+
+void fp_parse_batch(struct fp_packet* const*, int, struct fp_parse*);
+
+
+#endif
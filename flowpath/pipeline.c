@@ -2,6 +2,8 @@
 // All rights reserved
 
 #include "pipeline.h"
+#include "worker.h"
+#include "emc.h"
 
 #include <dlfcn.h>
 
@@ -11,19 +13,64 @@
 typedef fp_error_t (*pipeline_ctor)(struct fp_pipeline*);
 
 
+/* The default burst entry point for modules that only
+   process single packets. */
+static void
+insert_each(struct fp_dataplane* dp, struct fp_packet** pkts,
+            struct fp_arrival* arrs, int n)
+{
+  for (int i = 0; i < n; ++i)
+    dp->pipeline->insert(dp, pkts[i], arrs[i]);
+}
+
+
 /* A helper function for releasing resources on failure. */
 static inline void
 delete_pipeline(struct fp_pipeline* p)
 {
-    dlclose(p->pipeline_module);
+    fp_module_close(p->pipeline_module);
     fp_deallocate(p);
 }
 
 
-/* Load the given DLL as a pipeline provider. Returns NULL if
-   the pipeline cannot be loaded. */
-struct fp_pipeline*
-fp_pipeline_load(struct fp_dataplane* dp, char const* dll, fp_error_t* err)
+/* Open the DLL and resolve the named symbol, storing its
+   address in addr. Returns the module handle, or NULL if the
+   module cannot be opened (FP_BAD_PIPELINE) or does not define
+   the symbol (FP_BAD_PIPELINE_MODULE). */
+void*
+fp_module_open(char const* dll, char const* sym, void** addr, fp_error_t* err)
+{
+  void* m = dlopen(dll, RTLD_NOW);
+  if (!m) {
+    fprintf(stderr, "[flowpath] %s\n", dlerror());
+    *err = FP_BAD_PIPELINE;
+    return NULL;
+  }
+  *addr = dlsym(m, sym);
+  if (!*addr) {
+    dlclose(m);
+    *err = FP_BAD_PIPELINE_MODULE;
+    return NULL;
+  }
+  *err = FP_OK;
+  return m;
+}
+
+
+/* Close a module opened by fp_module_open(). */
+void
+fp_module_close(void* m)
+{
+  if (m)
+    dlclose(m);
+}
+
+
+/* Open the DLL and instantiate its pipeline for the data
+   plane. The pipeline is not loaded. Returns NULL if the module
+   cannot be opened or its constructor fails. */
+static struct fp_pipeline*
+open_pipeline(struct fp_dataplane* dp, char const* dll, fp_error_t* err)
 {
   assert(dll != NULL);
   fprintf(stderr, "[flowpath] loading pipeline '%s'\n", dll);
@@ -31,23 +78,17 @@ fp_pipeline_load(struct fp_dataplane* dp, char const* dll, fp_error_t* err)
   /* Initialize the pipeline. */
   struct fp_pipeline* p = fp_allocate(struct fp_pipeline);
   memset(p, 0, sizeof(struct fp_pipeline));
+  p->dp = dp;
   
-  /* Open the module. */
-  p->pipeline_module = dlopen(dll, RTLD_NOW);
+  /* Open the module and find the pipeline constructor. */
+  void* sym;
+  p->pipeline_module = fp_module_open(dll, "pipeline_init", &sym, err);
   if (!p->pipeline_module) {
-    *err = FP_BAD_PIPELINE;
     fp_deallocate(p);
     return NULL;
   }
+  pipeline_ctor init = (pipeline_ctor)sym;
   fprintf(stderr, "[flowpath] pipeline module loaded\n");
-
-  /* Find the pipeline constructor. */
-  pipeline_ctor init = dlsym(p->pipeline_module, "pipeline_init");
-  if (!init) {
-    *err = FP_BAD_PIPELINE_MODULE;
-    delete_pipeline(p);
-    return NULL;
-  }
   fprintf(stderr, "[flowpath] resolved pipeline construcor\n");
 
   /* Instantiate the pipeline. */
@@ -57,6 +98,20 @@ fp_pipeline_load(struct fp_dataplane* dp, char const* dll, fp_error_t* err)
     delete_pipeline(p);
     return NULL;
   }
+  if (!p->insert_burst)
+    p->insert_burst = insert_each;
+  return p;
+}
+
+
+/* Load the given DLL as a pipeline provider. Returns NULL if
+   the pipeline cannot be loaded. */
+struct fp_pipeline*
+fp_pipeline_load(struct fp_dataplane* dp, char const* dll, fp_error_t* err)
+{
+  struct fp_pipeline* p = open_pipeline(dp, dll, err);
+  if (!p)
+    return NULL;
   dp->pipeline = p;
 
   /* Load pipeline resources. */
@@ -86,10 +141,68 @@ fp_pipeline_unload(struct fp_dataplane* dp, fp_error_t* err)
   p->unload(dp);
 
   /* Close the pipeline handle. */
-  if (p->pipeline_module)
-    dlclose(p->pipeline_module);
+  fp_module_close(p->pipeline_module);
 
   fp_deallocate(p);
   
   dp->pipeline = NULL;
 }
+
+
+/* Replace the data plane's pipeline with one from the given
+   DLL without removing its ports. The new pipeline adopts the
+   data plane's ports and tables before it is installed; if
+   it cannot, the running pipeline is left in place and an error
+   is returned. If the data plane is up, the new pipeline is
+   started.
+
+   The engine's workers are those that may be running the
+   pipeline. While the pipelines are exchanged, which takes a
+   grace period, workers do not receive from the data plane's
+   ports, so traffic pauses briefly: packets wait in the devices'
+   queues, and are only dropped if a queue fills. The old module is closed only after every worker
+   has passed through a quiescent point. If the engine is NULL,
+   no other thread may be running the pipeline. */
+fp_error_t
+fp_pipeline_swap(struct fp_dataplane* dp, char const* dll, struct fp_engine* e)
+{
+  fp_error_t err;
+  struct fp_pipeline* p = open_pipeline(dp, dll, &err);
+  if (!p)
+    return err;
+  if (!p->adopt) {
+    delete_pipeline(p);
+    return FP_BAD_PIPELINE_MODULE;
+  }
+
+  /* Build the new pipeline alongside the running one. */
+  fprintf(stderr, "[flowpath] adopt data plane\n");
+  struct fp_pipeline* old = dp->pipeline;
+  err = p->adopt(p, dp, old);
+  if (err != FP_OK) {
+    delete_pipeline(p);
+    return err;
+  }
+
+  /* Wait until no worker is running the old pipeline. */
+  fp_dataplane_quiesce(dp, true);
+  if (e)
+    fp_engine_synchronize(e);
+
+  /* Exchange the pipelines. The old pipeline is unloaded while
+     it is still installed, since its functions find their
+     state through the data plane. */
+  old->unload(dp);
+  __atomic_store_n(&dp->pipeline, p, __ATOMIC_RELEASE);
+  fp_emc_invalidate();
+  if (fp_dataplane_is_up(dp)) {
+    err = p->start(dp);
+    if (fp_error(err))
+      fp_dataplane_down(dp);
+  }
+  fp_dataplane_quiesce(dp, false);
+
+  /* No worker entered the old module after the grace period. */
+  delete_pipeline(old);
+  return err;
+}
@@ -8,6 +8,8 @@
 #include "dataplane.h"
 #include "packet.h"
 
+struct fp_engine;
+
 
 /* A pipeline is a parameterized packet processing function
    whose behavior is defined entirely with an exteranlly
@@ -17,6 +19,16 @@
    TODO: Document the members of this struct.
 
 
+   A running data plane's pipeline can be replaced by one from
+   another module (see fp_pipeline_swap()). The new module is
+   loaded alongside the old one, and its adopt function takes
+   over the data plane's ports and tables. Workers stop running
+   the data plane's pipeline for one grace period, which leaves
+   arriving packets in their device queues. When every worker is
+   quiescent, the old pipeline is unloaded, the new one is
+   installed, and workers resume. Modules that do not provide
+   adopt cannot replace a running pipeline.
+
    Not every pipeline has a decoder. For example, simple
    hub pipelines do not decode packets.
 
@@ -36,9 +48,15 @@ struct fp_pipeline
 
   struct fp_dataplane* dp; /* The owning dataplane. */
 
-  /* Initialization. */
+  /* Initialization. The adopt function is called instead of
+     load when the pipeline replaces the running pipeline given
+     as its last argument. It must initialize the pipeline's
+     object and take over the data plane's ports and tables
+     without using dp->pipeline, which still refers to the
+     running pipeline. */
   fp_error_t (*load)(struct fp_dataplane*);
   fp_error_t (*unload)(struct fp_dataplane*);
+  fp_error_t (*adopt)(struct fp_pipeline*, struct fp_dataplane*, struct fp_pipeline*);
   
   /* Configuration. */
   fp_error_t (*add_port)(struct fp_dataplane*, struct fp_port*);
@@ -48,13 +66,30 @@ struct fp_pipeline
   fp_error_t (*start)(struct fp_dataplane*);
   fp_error_t (*stop)(struct fp_dataplane*);
 
-  /* Processing Element's Interface. */
+  /* Processing Element's Interface. The insert_burst function
+     processes n packets, where the ith packet arrived as
+     described by the ith arrival. Modules that do not provide
+     it get a default that calls insert for each packet.
+
+     To be timed (see latency.h), a module marks the entry of
+     packets with fp_dataplane_ingress() and the end of each of
+     its stages with fp_dataplane_time(). Egress is timed when
+     packets are output through the data plane. */
   void (*insert)(struct fp_dataplane*, struct fp_packet*, struct fp_arrival);
+  void (*insert_burst)(struct fp_dataplane*, struct fp_packet**, struct fp_arrival*, int);
 };
 
 
+/* The largest burst that drivers pass to insert_burst. */
+#define FP_PIPELINE_BURST 64
+
+
 struct fp_pipeline* fp_pipeline_load(struct fp_dataplane*, char const*, fp_error_t*);
 void                fp_pipeline_unload(struct fp_dataplane*, fp_error_t*);
+fp_error_t          fp_pipeline_swap(struct fp_dataplane*, char const*, struct fp_engine*);
+
+void* fp_module_open(char const*, char const*, void**, fp_error_t*);
+void  fp_module_close(void*);
 
 
 #endif
@@ -9,13 +9,28 @@
 #include <stdio.h>
 
 
-/* The wrie pipeline is a simple 2-port configuraiton. */
+/* The wrie pipeline is a simple 2-port configuraiton.
+
+   Workers read the ports while the control path adds and
+   removes them. A port's local index is written before the port
+   is published (with release ordering), so a worker that loads
+   a port (with acquire ordering) sees its index. */
 struct wire
 {
   struct fp_port* ports[2];
+  fp_port_id_t    index[2]; /* Local indexes of the ports. */
 };
 
 
+/* Returns the i-th end point of the wire, or NULL if it is
+   unset. */
+static inline struct fp_port*
+wire_port(struct wire* w, int i)
+{
+  return __atomic_load_n(&w->ports[i], __ATOMIC_ACQUIRE);
+}
+
+
 /* Return a pointer to the wire objet for the pipeline. */
 static inline struct wire*
 get_wire(struct fp_dataplane* dp)
@@ -34,42 +49,43 @@ get_wire(struct fp_dataplane* dp)
 static fp_error_t
 wire_route(struct wire* w, struct fp_context* cxt)
 {
-  if (!w->ports[0] || !w->ports[1]) {
+  struct fp_port* ports[2] = {wire_port(w, 0), wire_port(w, 1)};
+  if (!ports[0] || !ports[1]) {
     cxt->out_port = FP_PORT_DROP; // something is wrong, with setup...
+    cxt->out_index = FP_PORT_DROP;
     return FP_ERROR;
   }
 
   // Forward the packet.
-  if (cxt->in_port == w->ports[0]->id)
-    cxt->out_port = w->ports[1]->id;
-  else
-    cxt->out_port = w->ports[0]->id;
+  int out = cxt->in_port == ports[0]->id;
+  cxt->out_port = ports[out]->id;
+  cxt->out_index = w->index[out];
   return FP_OK;
 }
 
 
 /* Establish context for the packet, and initialize
-   it's out port. */
+   it's out port. The context is embedded in the packet's
+   descriptor. */
 static struct fp_context*
 wire_ingress(struct fp_dataplane* dp, 
              struct fp_packet* pkt, 
              struct fp_arrival arr)
 {
 //  fprintf(stderr, "[wire] ifput from port(arrival struct) %d\n", arr.in_port);
-  struct fp_context* cxt = fp_context_create(pkt, arr);
+  struct fp_context* cxt = fp_context_attach(pkt, arr, dp->key_size);
+  fp_dataplane_decode(dp, cxt);
   return cxt;
 }
 
 
-/* Queue the packet on its output port and release
-   the context. */
+/* Queue the packet on its output port. The context goes
+   with the packet. */
 static void
 wire_egress(struct fp_dataplane* dp, struct fp_context* cxt)
 {
 //  fprintf(stderr, "[wire] output to port %d\n", cxt->out_port);
-  struct fp_port* port = fp_dataplane_get_port(dp, cxt->out_port);
-  fp_port_output(port, cxt);
-  fp_context_delete(cxt);
+  fp_dataplane_output(dp, cxt);
 }
 
 
@@ -82,12 +98,42 @@ wire_load(struct fp_dataplane* dp)
   fprintf(stderr, "[flowpath] loading 'wire'\n");
   struct wire* w = fp_allocate(struct wire);
   w->ports[0] = w->ports[1] = NULL;
+  w->index[0] = w->index[1] = FP_PORT_DROP;
   dp->pipeline->pipeline_object = w;
   fprintf(stderr, "[flowpath] loaded 'wire'\n");
   return FP_OK;
 }
 
 
+/* Called instead of load when the wire replaces a running
+   pipeline. The wire takes the data plane's ports, in local
+   index order. If the data plane has more than two ports, the
+   wire cannot replace its pipeline. */
+static fp_error_t
+wire_adopt(struct fp_pipeline* p, struct fp_dataplane* dp, struct fp_pipeline* old)
+{
+  fprintf(stderr, "[flowpath] adopting data plane in 'wire'\n");
+  struct wire* w = fp_allocate(struct wire);
+  w->ports[0] = w->ports[1] = NULL;
+  w->index[0] = w->index[1] = FP_PORT_DROP;
+  int n = 0;
+  for (fp_port_id_t i = 0; i < FP_DATAPLANE_MAX_PORTS; ++i) {
+    struct fp_port* port = fp_dataplane_port(dp, i);
+    if (!port)
+      continue;
+    if (n == 2) {
+      fp_deallocate(w);
+      return FP_ERROR; /* FIXME: Find a better error code. */
+    }
+    w->ports[n] = port;
+    w->index[n] = i;
+    ++n;
+  }
+  p->pipeline_object = w;
+  return FP_OK;
+}
+
+
 /* Called prior to unloading a pipeline. This is responsible for 
    deallocting resources that are acquired by load. Note that this must 
    not deallocate the pipeline instance. 
@@ -111,12 +157,15 @@ static fp_error_t
 wire_add_port(struct fp_dataplane* dp, struct fp_port* p)
 {
   struct wire* w = get_wire(dp);
+  int i;
   if (!w->ports[0])
-    w->ports[0] = p;
+    i = 0;
   else if (!w->ports[1])
-    w->ports[1] = p;
+    i = 1;
   else
     return FP_ERROR; /* FIXME: Find a better error code. */
+  w->index[i] = fp_dataplane_port_index(dp, p->id);
+  __atomic_store_n(&w->ports[i], p, __ATOMIC_RELEASE);
   return FP_OK;
 }
 
@@ -128,9 +177,9 @@ wire_del_port(struct fp_dataplane* dp, struct fp_port* p)
 {
   struct wire* w = get_wire(dp);
   if (w->ports[0] == p)
-    w->ports[0] = NULL;
+    __atomic_store_n(&w->ports[0], NULL, __ATOMIC_RELEASE);
   else if (w->ports[1] == p)
-    w->ports[1] = NULL;
+    __atomic_store_n(&w->ports[1], NULL, __ATOMIC_RELEASE);
   else
     return FP_ERROR; /* FIXME: Find a better error code. */
   return FP_OK;
@@ -169,22 +218,85 @@ wire_insert(struct fp_dataplane* dp,
             struct fp_packet* pkt, struct fp_arrival arr)
 {
   struct wire* w = get_wire(dp);
+  uint64_t in = fp_dataplane_ingress(dp, &pkt, 1);
   struct fp_context* cxt = wire_ingress(dp, pkt, arr);
   wire_route(w, cxt);  // currently ignorning return message...
+  if (in)
+    fp_dataplane_time(dp, FP_STAGE_PIPELINE, in, fp_cycles(), 1);
   wire_egress(dp, cxt);
 }
 
 
+/* Insert a burst of packets into the pipeline. The wire's
+   end points are read once for the whole burst, output ports
+   are addressed by the local indexes kept by the wire rather
+   than looked up by id, and each packet's context is the one
+   embedded in its descriptor. Packets are gathered by output
+   port and sent as (at most) two bursts. The burst is timed
+   from ingress to egress as a whole. */
+static void
+wire_insert_burst(struct fp_dataplane* dp, struct fp_packet** pkts,
+                  struct fp_arrival* arrs, int n)
+{
+  struct wire* w = get_wire(dp);
+  struct fp_port* a = wire_port(w, 0);
+  struct fp_port* b = wire_port(w, 1);
+
+  /* If the wire is not fully configured, drop everything. */
+  if (!a || !b) {
+    for (int i = 0; i < n; ++i) {
+      struct fp_context* cxt = fp_context_attach(pkts[i], arrs[i], dp->key_size);
+      fp_dataplane_drop(dp, cxt, FP_DROP_NO_PORT);
+    }
+    return;
+  }
+
+  fp_port_id_t ia = w->index[0];
+  fp_port_id_t ib = w->index[1];
+  struct fp_packet* to_a[FP_PIPELINE_BURST];
+  struct fp_packet* to_b[FP_PIPELINE_BURST];
+  while (n > 0) {
+    int m = n < FP_PIPELINE_BURST ? n : FP_PIPELINE_BURST;
+    int na = 0, nb = 0;
+    uint64_t in = fp_dataplane_ingress(dp, pkts, m);
+    for (int i = 0; i < m; ++i) {
+      struct fp_context* cxt = fp_context_attach(pkts[i], arrs[i], dp->key_size);
+      fp_dataplane_decode(dp, cxt);
+      if (cxt->in_port == a->id) {
+        cxt->out_port = b->id;
+        cxt->out_index = ib;
+        to_b[nb++] = cxt->packet;
+      } else {
+        cxt->out_port = a->id;
+        cxt->out_index = ia;
+        to_a[na++] = cxt->packet;
+      }
+    }
+    if (in)
+      fp_dataplane_time(dp, FP_STAGE_PIPELINE, in, fp_cycles(), m);
+    if (na)
+      fp_dataplane_send_burst(dp, ia, to_a, na);
+    if (nb)
+      fp_dataplane_send_burst(dp, ib, to_b, nb);
+    pkts += m;
+    arrs += m;
+    n -= m;
+  }
+}
+
+
 /* Initialize the pipeline with the processing entry points. */
 fp_error_t
 pipeline_init(struct fp_pipeline* p)
 {
   p->load   = wire_load;
   p->unload = wire_unload;
+  p->adopt  = wire_adopt;
   p->add_port = wire_add_port;
   p->del_port = wire_del_port;
   p->start  = wire_start;
   p->stop   = wire_stop;
   p->insert = wire_insert;
+  p->insert_burst = wire_insert_burst;
   return FP_OK;
 }
@@ -0,0 +1,190 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "poll.h"
+#include "dataplane.h"
+#include "port.h"
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+
+/* The maximum number of events handled by a single wait. */
+#define FP_POLL_MAX_EVENTS 64
+
+
+/* Create a new poller with the given per-port budget. If
+   the budget is not positive, FP_POLL_BUDGET is used. */
+struct fp_poller*
+fp_poller_create(int budget, fp_error_t* err)
+{
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    *err = fp_get_system_error();
+    return NULL;
+  }
+
+  struct fp_poller* p = fp_allocate(struct fp_poller);
+  p->epfd = epfd;
+  p->budget = budget > 0 ? budget : FP_POLL_BUDGET;
+  p->nsources = 0;
+  for (int i = 0; i < FP_POLL_MAX_SOURCES; ++i)
+    p->sources[i].fd = -1;
+  *err = FP_OK;
+  return p;
+}
+
+
+/* Close the poller. This does not affect its sources. */
+void
+fp_poller_delete(struct fp_poller* p)
+{
+  if (!p)
+    return;
+  close(p->epfd);
+  fp_deallocate(p);
+}
+
+
+/* Find an unused source slot, or return -1 if the poller
+   is full. */
+static int
+find_slot(struct fp_poller* p)
+{
+  for (int i = 0; i < p->nsources; ++i)
+    if (p->sources[i].fd < 0)
+      return i;
+  if (p->nsources == FP_POLL_MAX_SOURCES)
+    return -1;
+  return p->nsources++;
+}
+
+
+/* Register the source in the given slot with epoll. The slot
+   index is the event's user data. */
+static fp_error_t
+add_source(struct fp_poller* p, int slot)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = slot;
+  if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, p->sources[slot].fd, &ev) < 0) {
+    fp_error_t err = fp_get_system_error();
+    __atomic_store_n(&p->sources[slot].port, NULL, __ATOMIC_RELEASE);
+    p->sources[slot].fd = -1;
+    return err;
+  }
+  return FP_OK;
+}
+
+
+/* Add a descriptor whose readiness is reported through
+   the callback function. */
+fp_error_t
+fp_poller_add_fd(struct fp_poller* p, int fd, fp_poll_fn fn, void* arg)
+{
+  int slot = find_slot(p);
+  if (slot < 0)
+    return fp_system_error(ENOSPC);
+
+  struct fp_poll_source* s = &p->sources[slot];
+  s->dp = NULL;
+  s->port = NULL;
+  s->fn = fn;
+  s->arg = arg;
+  s->fd = fd;
+  return add_source(p, slot);
+}
+
+
+/* Add a port to the poller. When the port is ready, its
+   packets are inserted into the given data plane. The port
+   must be backed by a device with a file descriptor. This may
+   be called while another thread waits (see poll.h): the slot
+   is published before its descriptor is added to epoll. */
+fp_error_t
+fp_poller_add_port(struct fp_poller* p, struct fp_dataplane* dp, struct fp_port* port)
+{
+  int fd = fp_port_fd(port);
+  if (fd < 0)
+    return fp_system_error(EINVAL);
+
+  int slot = find_slot(p);
+  if (slot < 0)
+    return fp_system_error(ENOSPC);
+
+  struct fp_poll_source* s = &p->sources[slot];
+  s->dp = dp;
+  s->fn = NULL;
+  s->arg = NULL;
+  s->fd = fd;
+  __atomic_store_n(&s->port, port, __ATOMIC_RELEASE);
+  return add_source(p, slot);
+}
+
+
+/* Remove the descriptor from the poller. */
+void
+fp_poller_remove_fd(struct fp_poller* p, int fd)
+{
+  for (int i = 0; i < p->nsources; ++i) {
+    struct fp_poll_source* s = &p->sources[i];
+    if (s->fd == fd && !s->port) {
+      epoll_ctl(p->epfd, EPOLL_CTL_DEL, fd, NULL);
+      s->fd = -1;
+    }
+  }
+}
+
+
+/* Remove the port from the poller. */
+void
+fp_poller_remove_port(struct fp_poller* p, struct fp_port* port)
+{
+  for (int i = 0; i < p->nsources; ++i) {
+    struct fp_poll_source* s = &p->sources[i];
+    if (s->port == port) {
+      epoll_ctl(p->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+      __atomic_store_n(&s->port, NULL, __ATOMIC_SEQ_CST);
+      s->fd = -1;
+    }
+  }
+}
+
+
+/* Wait up to timeout milliseconds for sources to become
+   ready, and then service each ready source once. A timeout
+   of 0 does not block; a negative timeout blocks indefinitely.
+   Returns the number of packets received, or -1 on error. */
+int
+fp_poller_wait(struct fp_poller* p, int timeout)
+{
+  struct epoll_event events[FP_POLL_MAX_EVENTS];
+  int n = epoll_wait(p->epfd, events, FP_POLL_MAX_EVENTS, timeout);
+  if (n < 0)
+    return errno == EINTR ? 0 : -1;
+
+  int pkts = 0;
+  for (int i = 0; i < n; ++i) {
+    struct fp_poll_source* s = &p->sources[events[i].data.u32];
+    struct fp_port* port = __atomic_load_n(&s->port, __ATOMIC_ACQUIRE);
+    if (port)
+      pkts += fp_dataplane_receive(s->dp, port, p->budget);
+    else if (s->fd >= 0 && s->fn)
+      s->fn(s->fd, s->arg);
+  }
+  return pkts;
+}
+
+
+/* Block for up to timeout milliseconds until some source is
+   ready, without servicing it. Returns true if a source is
+   ready. Because the poller is level-triggered, the ready
+   sources are reported again by the next call to wait. */
+bool
+fp_poller_sleep(struct fp_poller* p, int timeout)
+{
+  struct epoll_event ev;
+  return epoll_wait(p->epfd, &ev, 1, timeout) > 0;
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_POLL_H
+#define FLOWPATH_POLL_H
+
+/* The poll module provides an event-driven driver for ports
+   whose devices expose a file descriptor (see fp_port_fd()),
+   and for other descriptors such as the flowmgr channel.
+
+   Waiting on a poller sleeps until one or more sources are
+   ready. Each ready port is then drained of at most a fixed
+   budget of packets before the poller moves on to the next
+   ready source. This is the same strategy used by NAPI: a busy
+   port cannot starve its neighbors, and because the poller is
+   level-triggered, a port that still has packets after using
+   its budget is reported again by the next wait without
+   sleeping.
+
+   A poller is not thread-safe, except that one thread (e.g.,
+   the control path) may add and remove ports while another
+   thread waits, as the engine does with its workers' pollers.
+   This is safe because a port's source is filled in and its
+   port published (with release ordering) before its descriptor
+   is added to the epoll instance, so a waiting thread only
+   receives events for a slot once the slot is complete, and it
+   loads the port (with acquire ordering) before reading the
+   rest of the slot. epoll_ctl() may be called while another
+   thread is in epoll_wait(). A removed port's slot may be
+   reused for a new port while the waiting thread still holds an
+   event for it; that event is then delivered to the new port,
+   which at worst finds nothing to receive. The caller must wait
+   for the waiting thread to become quiescent before deleting a
+   removed port (see fp_engine_synchronize()). Descriptor sources
+   may only be added and removed by the waiting thread. */
+
+#include "util.h"
+#include "error.h"
+
+
+struct fp_dataplane;
+struct fp_port;
+
+
+/* The default number of packets received from a ready port
+   before yielding to other sources. */
+#define FP_POLL_BUDGET      64
+
+/* The maximum number of sources in a poller. */
+#define FP_POLL_MAX_SOURCES 256
+
+
+/* The type of callback for descriptor sources. */
+typedef void (*fp_poll_fn)(int, void*);
+
+
+/* A source of events. A port source has a non-null port;
+   otherwise, the source is a descriptor whose readiness is
+   reported through the callback. A source with a negative
+   fd is an unused slot. */
+struct fp_poll_source
+{
+  int                  fd;
+  struct fp_dataplane* dp;
+  struct fp_port*      port;
+  fp_poll_fn           fn;
+  void*                arg;
+};
+
+
+/* An epoll-based event driver. */
+struct fp_poller
+{
+  int                   epfd;    /* The epoll instance. */
+  int                   budget;  /* Per-port receive budget. */
+  int                   nsources;
+  struct fp_poll_source sources[FP_POLL_MAX_SOURCES];
+};
+
+
+struct fp_poller* fp_poller_create(int, fp_error_t*);
+void              fp_poller_delete(struct fp_poller*);
+fp_error_t        fp_poller_add_fd(struct fp_poller*, int, fp_poll_fn, void*);
+fp_error_t        fp_poller_add_port(struct fp_poller*, struct fp_dataplane*, struct fp_port*);
+void              fp_poller_remove_fd(struct fp_poller*, int);
+void              fp_poller_remove_port(struct fp_poller*, struct fp_port*);
+int               fp_poller_wait(struct fp_poller*, int);
+bool              fp_poller_sleep(struct fp_poller*, int);
+
+
+#endif
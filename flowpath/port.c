@@ -12,27 +12,30 @@
 fp_port_id_t port_alloc = 1;
 
 
-/* Allocate a new port id. */
+/* Master table of ports, mapping allocated ids to ports. */
+static struct fp_flat_hash_table* ports_;
+
+
+/* Allocate a new port id for the given port. */
 inline static fp_port_id_t
-allocate_port_id()
+allocate_port_id(struct fp_port* port)
 {
+  if (!ports_)
+    ports_ = fp_flat_hash_table_new(17, fp_uint_hash, fp_uint_eq);
+
   /* Find an unused port ID. */
-  struct fp_chained_hash_entry* ent = fp_chained_hash_table_find(ports_, port_alloc);
-  while (ent && ent->value) {
+  while (fp_flat_hash_table_find(ports_, port_alloc))
     port_alloc = (port_alloc + 1 > FP_PORT_MAX_ID ? 1 : port_alloc + 1);
-    ent = fp_chained_hash_table_find(ports_, port_alloc);
-  }
+  fp_flat_hash_table_insert(ports_, port_alloc, (uintptr_t)port);
   return port_alloc;
 }
 
 
-/* Release a previously allocated port id.
-
-   FIXME: Implement me. */
+/* Release a previously allocated port id. */
 inline static void
 release_port_id(fp_port_id_t id)
 {
-  fp_chained_hash_table_update(ports_, id, (uintptr_t)NULL);
+  fp_flat_hash_table_remove(ports_, id);
 }
 
 
@@ -41,8 +44,10 @@ struct fp_port*
 fp_port_create(struct fp_device* dev)
 {
   struct fp_port* port = fp_allocate(struct fp_port);
-  port->id = allocate_port_id(); 
+  memset(port, 0, sizeof(struct fp_port));
+  port->id = allocate_port_id(port); 
   port->device = dev;  
+  port->index = FP_PORT_DROP;
   return port;
 }
 
@@ -67,3 +72,33 @@ fp_port_output(struct fp_port* port, struct fp_context* cxt)
   return fp_port_send_packet(port, cxt->packet);
 }
 
+
+/* The generic burst receive. This calls the device's recv
+   function until it runs out of packets or n packets have
+   been received. */
+int
+fp_device_recv_each(struct fp_device* dev, struct fp_packet** pkts, int n)
+{
+  fp_device_recv_fn recv = dev->vtbl->recv;
+  int i = 0;
+  for (; i < n; ++i) {
+    pkts[i] = recv(dev);
+    if (!pkts[i])
+      break;
+  }
+  return i;
+}
+
+
+/* The generic burst send. This calls the device's send
+   function for each packet. */
+int
+fp_device_send_each(struct fp_device* dev, struct fp_packet** pkts, int n)
+{
+  fp_device_send_fn send = dev->vtbl->send;
+  int sent = 0;
+  for (int i = 0; i < n; ++i)
+    if (send(dev, pkts[i]) > 0)
+      ++sent;
+  return sent;
+}
@@ -52,9 +52,6 @@ struct fp_context;
 #define FP_PORT_ANY        0xffffffff
 
 
-/* Master table of ports. */
-static struct fp_chained_hash_table* ports_;
-
 struct fp_device;
 struct fp_port;
 
@@ -65,6 +62,9 @@ typedef struct fp_packet* (*fp_device_recv_fn)(struct fp_device*);
 typedef int (*fp_device_send_fn)(struct fp_device*, struct fp_packet*);
 typedef void (*fp_device_drop_fn)(struct fp_device*, struct fp_packet*);
 typedef void (*fp_device_close_fn)(struct fp_device*);
+typedef int (*fp_device_fd_fn)(struct fp_device*);
+typedef int (*fp_device_recv_burst_fn)(struct fp_device*, struct fp_packet**, int);
+typedef int (*fp_device_send_burst_fn)(struct fp_device*, struct fp_packet**, int);
 
 
 /* The type of the virtual table for device types. 
@@ -86,13 +86,31 @@ typedef void (*fp_device_close_fn)(struct fp_device*);
     associated with the packet.
 
   - close -- Reclaim resources and dispose of the port
-    object. */
+    object.
+
+  - fd -- [optional] Returns a file descriptor that becomes
+    readable when packets are waiting on the device. Devices
+    that cannot be waited on leave this null and must be
+    polled.
+
+  - recv_burst -- [optional] Receives up to n packets into the
+    given array, returning the number received. 
+
+  - send_burst -- [optional] Sends n packets, returning the
+    number actually transmitted. The device takes ownership of
+    every packet; those that cannot be transmitted are dropped.
+
+  Devices that do not provide the burst operations get generic
+  versions that call recv or send once per packet. */
 struct fp_device_vtbl
 {
   fp_device_recv_fn recv;
   fp_device_send_fn send;
   fp_device_drop_fn drop;
   fp_device_close_fn close;
+  fp_device_fd_fn fd;
+  fp_device_recv_burst_fn recv_burst;
+  fp_device_send_burst_fn send_burst;
 };
 
 
@@ -125,6 +143,15 @@ struct fp_port
   int live      : 1; /* Separate from link down? */
 
   struct fp_device* device;
+
+  /* The port's local index in the data plane to which it has
+     been added, or FP_PORT_DROP (see fp_dataplane_add_port()).
+     Workers read this when they receive from the port. */
+  fp_port_id_t index;
+
+  /* The RSS stage that distributes the port's packets over
+     workers, if any (see rss.h). */
+  struct fp_rss* rss;
 };
 
 
@@ -132,6 +159,9 @@ struct fp_port* fp_port_create(struct fp_device*);
 void fp_port_delete(struct fp_port*);
 int fp_port_output(struct fp_port*, struct fp_context*);
 
+int fp_device_recv_each(struct fp_device*, struct fp_packet**, int);
+int fp_device_send_each(struct fp_device*, struct fp_packet**, int);
+
 
 /* Receive a packet from a port. */
 static inline struct fp_packet*
@@ -149,6 +179,30 @@ fp_port_send_packet(struct fp_port* port, struct fp_packet* pkt)
 }
 
 
+/* Receive up to n packets from a port, returning the number
+   of packets received. */
+static inline int
+fp_port_recv_burst(struct fp_port* port, struct fp_packet** pkts, int n)
+{
+  struct fp_device* dev = port->device;
+  if (dev->vtbl->recv_burst)
+    return dev->vtbl->recv_burst(dev, pkts, n);
+  return fp_device_recv_each(dev, pkts, n);
+}
+
+
+/* Send n packets on a port, returning the number of packets
+   transmitted. The port takes ownership of all n packets. */
+static inline int
+fp_port_send_burst(struct fp_port* port, struct fp_packet** pkts, int n)
+{
+  struct fp_device* dev = port->device;
+  if (dev->vtbl->send_burst)
+    return dev->vtbl->send_burst(dev, pkts, n);
+  return fp_device_send_each(dev, pkts, n);
+}
+
+
 /* Drop a packet from the processing pipeline. */
 static inline void
 fp_port_drop_packet(struct fp_port* port, struct fp_packet* pkt)
@@ -157,6 +211,16 @@ fp_port_drop_packet(struct fp_port* port, struct fp_packet* pkt)
 }
 
 
+/* Returns a file descriptor that can be used to wait for
+   packets on the port, or -1 if the port must be polled. */
+static inline int
+fp_port_fd(struct fp_port* port)
+{
+  fp_device_fd_fn fd = port->device->vtbl->fd;
+  return fd ? fd(port->device) : -1;
+}
+
+
 /* Returns true if the id indicates a reserved port. */
 static inline bool
 fp_is_reserved_port(fp_port_id_t id)
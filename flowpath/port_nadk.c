@@ -82,7 +82,9 @@ static struct fp_device_vtbl nadk_vtbl = {
   .recv  = fp_nadk_recv,
   .send  = fp_nadk_send,
   .drop  = fp_nadk_drop,
-  .close = fp_nadk_close
+  .close = fp_nadk_close,
+  .recv_burst = fp_nadk_recv_burst,
+  .send_burst = fp_nadk_send_burst
 };
 
 
@@ -627,11 +629,126 @@ fp_nadk_send(struct fp_device* device, struct fp_packet* pkt)
 }
 
 
+/* Receive up to n packets directly from the device. Packets
+   already buffered by fp_nadk_recv() are returned first so that
+   arrival order is preserved. */
+int
+fp_nadk_recv_burst(struct fp_device* device, struct fp_packet** pkts, int n)
+{
+  struct fp_nadk_device* dev = (struct fp_nadk_device*)device;
+  struct nadk_dev* ndev = dev->handle;
+  struct nadk_mbuf* pkt_buf[NADK_FP_RX_BUDGET];
+
+  int got = fp_ring_pop_n(dev->rx_ring, (void**)pkts, n);
+  while (got < n) {
+    int max = n - got;
+    if (max > NADK_FP_RX_BUDGET)
+      max = NADK_FP_RX_BUDGET;
+
+    int ret = nadk_receive(ndev, ndev->rx_vq[0], max, pkt_buf);
+    if (unlikely(ret <= 0))
+      break; /* nothing waiting */
+
+    /* Drop mbufs for which no descriptor is available. */
+    for (int i = 0; i < ret; i++) {
+      struct fp_packet* pkt = fp_packet_create(pkt_buf[i]->data,
+                                               pkt_buf[i]->length,
+                                               pkt_buf[i]->timestamp,
+                                               pkt_buf[i], FP_BUF_NADK);
+      if (likely(pkt != NULL))
+        pkts[got++] = pkt;
+      else
+        nadk_mbuf_free(pkt_buf[i]);
+    }
+    if (ret < max)
+      break;
+  }
+  return got;
+}
+
+
+/* Return an mbuf holding the packet's data. Packets received
+   from NADK already own one; others are copied into a newly
+   allocated mbuf and their data released. Returns NULL if no
+   mbuf could be allocated. */
+static struct nadk_mbuf*
+fp_nadk_get_mbuf(struct nadk_dev* ndev, struct fp_packet* pkt)
+{
+  if (likely(pkt->buf_dev == FP_BUF_NADK))
+    return pkt->buf_handle;
+
+  struct nadk_mbuf* mbuf = nadk_mbuf_alloc(ndev, pkt->size);
+  if (unlikely(mbuf == NULL))
+    return NULL;
+  int ret = nadk_mbuf_data_copy_in(mbuf, pkt->data, 0, pkt->size);
+  if (unlikely(ret != NADK_SUCCESS)) {
+    nadk_mbuf_free(mbuf);
+    return NULL;
+  }
+  fp_packet_release_buffer(pkt);  // return the data to its owner
+  pkt->buf_handle = mbuf;
+  pkt->buf_dev = FP_BUF_NADK;
+  return mbuf;
+}
+
+
+/* Send a burst of packets with as few doorbells as possible.
+   Packets queued by fp_nadk_send() are flushed first so that
+   departure order is preserved. Packets that cannot be sent
+   are dropped. */
+int
+fp_nadk_send_burst(struct fp_device* device, struct fp_packet** pkts, int n)
+{
+  struct fp_nadk_device* dev = (struct fp_nadk_device*)device;
+  struct nadk_dev* ndev = dev->handle;
+  struct nadk_mbuf* pkt_buf[NADK_FP_RX_BUDGET];
+  struct fp_packet* batch[NADK_FP_RX_BUDGET];
+
+  while (fp_ring_count(dev->tx_ring) > 0)
+    if (fp_nadk_send_batch(device) == 0)
+      break;
+
+  int sent = 0;
+  for (int i = 0; i < n; ) {
+    /* Gather a batch of mbufs. */
+    int num = 0;
+    for (; i < n && num < NADK_FP_RX_BUDGET; i++) {
+      struct nadk_mbuf* mbuf = fp_nadk_get_mbuf(ndev, pkts[i]);
+      if (unlikely(mbuf == NULL)) {
+        NADK_WARN(APP1, "Failed to allocate mbuf...");
+        fp_nadk_drop(device, pkts[i]);
+        continue;
+      }
+      pkt_buf[num] = mbuf;
+      batch[num++] = pkts[i];
+    }
+    if (unlikely(num == 0))
+      continue;
+
+    int ret = nadk_send(ndev, ndev->tx_vq[0], num, pkt_buf);
+    if (unlikely(ret < 0))
+      ret = 0;
+    if (unlikely(ret != num))
+      NADK_WARN(APP1, "Failed to send %d/%d mbuf on demand...", ret, num);
+
+    for (int j = 0; j < ret; j++)
+      fp_packet_delete(batch[j]);
+    for (int j = ret; j < num; j++)
+      fp_nadk_drop(device, batch[j]);
+    sent += ret;
+  }
+  return sent;
+}
+
+
 /* Drop a packet from a NADK interface. */
 void
 fp_nadk_drop(struct fp_device* device, struct fp_packet* pkt)
 {
-  fp_deallocate(pkt->data);
+  if (pkt->buf_dev == FP_BUF_NADK)
+    nadk_mbuf_free(pkt->buf_handle);
+  else
+    fp_packet_release_buffer(pkt);
   fp_packet_delete(pkt);
 }
 
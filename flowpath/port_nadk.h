@@ -34,6 +34,8 @@ void              fp_nadk_close(struct fp_device*);
 struct fp_packet* fp_nadk_recv(struct fp_device*);
 int               fp_nadk_send(struct fp_device*, struct fp_packet*);
 void              fp_nadk_drop(struct fp_device*, struct fp_packet*);
+int               fp_nadk_recv_burst(struct fp_device*, struct fp_packet**, int);
+int               fp_nadk_send_burst(struct fp_device*, struct fp_packet**, int);
 
 
 /* nadk routines temporarily exposed */
@@ -61,15 +61,23 @@ fp_netmap_recv(struct fp_device* device)
   if (src == NULL)
     return NULL; /* nothing waiting */
 
-  /* Copy the buffer and create a new packet for it. */
-  dst = (unsigned char*)malloc(dev->header.len);
+  /* Copy the buffer and create a new packet for it. Frames
+     that do not fit in a pool buffer are dropped. */
+  if (dev->header.len > FP_PACKET_BUF_SIZE)
+    return NULL;
+  dst = fp_packet_alloc_buffer();
+  if (dst == NULL)
+    return NULL;
   memcpy(dst, src, dev->header.len);
 
   /* Allocate a flowpath packet. */
   /* TODO: replace dev_handle(NULL) with netmap buffer */
-  /* TODO: retrieve timestamp from ring */
-  packet = fp_packet_create(dst, dev->header.len, 0
-                            NULL, FP_BUF_NETMAP);
+  /* The timestamp is set by the data plane when it is timing
+     packets (see fp_dataplane_receive()). */
+  packet = fp_packet_create(dst, dev->header.len, 0,
+                            NULL, FP_BUF_ALLOC);
+  if (packet == NULL)
+    fp_packet_free_buffer(dst);
   return packet;
 }
 
@@ -83,7 +91,7 @@ fp_netmap_send(struct fp_device* device, struct fp_packet* pkt)
 {
   struct fp_netmap_device* dev = (struct fp_netmap_device*)device;
   int bytes = nm_inject(dev->handle, pkt->data, pkt->size);
-  fp_deallocate(pkt->data);
+  fp_packet_release_buffer(pkt);
   fp_packet_delete(pkt);
   return bytes;
 }
@@ -93,7 +101,7 @@ fp_netmap_send(struct fp_device* device, struct fp_packet* pkt)
 void
 fp_netmap_drop(struct fp_device* device, struct fp_packet* pkt)
 {
-  fp_deallocate(pkt->data);
+  fp_packet_release_buffer(pkt);
   fp_packet_delete(pkt);
 }
 
@@ -1,6 +1,9 @@
 // Copyright (c) 2014-2015 Flowgrammable.org
 // All rights reserved
 
+/* Required for recvmmsg and sendmmsg. */
+#define _GNU_SOURCE
+
 #include "port_udp.h"
 #include "packet.h"
 #include "port.h"
@@ -14,11 +17,6 @@ const int ADDR_STR_LEN = 256;
 const int PORT_STR_LEN = 16;
 
 
-/* The initial size of buffers allocated to read UDP ports.
-   If the message is larger than this value. */
-const int INIT_BUF_SIZE = 4096;
-
-
 /* Parse the address and port strings from the URI spec. */
 static int
 parse_udp_name(char const* str, char** addr, char** port, fp_error_t* err)
@@ -81,10 +79,32 @@ static struct fp_device_vtbl udp_vtbl = {
   .recv  = fp_udp_recv,
   .send  = fp_udp_send,
   .drop  = fp_udp_drop,
-  .close = fp_udp_close
+  .close = fp_udp_close,
+  .fd    = fp_udp_fd,
+  .recv_burst = fp_udp_recv_burst,
+  .send_burst = fp_udp_send_burst
 };
 
 
+/* Release the packet's buffer and the packet. */
+static inline void
+release_packet(struct fp_packet* pkt)
+{
+  fp_packet_release_buffer(pkt);
+  fp_packet_delete(pkt);
+}
+
+
+/* Release the buffers of n packets and the packets. */
+static inline void
+release_packets(struct fp_packet** pkts, int n)
+{
+  for (int i = 0; i < n; ++i)
+    fp_packet_release_buffer(pkts[i]);
+  fp_packet_delete_n(pkts, n);
+}
+
+
 /* Open the UDP port and give it the the given port number. 
 
    The address argument specifies the hostname and port number to 
@@ -144,17 +164,21 @@ fp_udp_open_sockaddr(struct sockaddr_in* addr, fp_error_t* err)
   struct fp_udp_device* dev = fp_allocate(struct fp_udp_device);
   dev->base.vtbl = &udp_vtbl;
   memcpy(&dev->addr, addr, sizeof(struct sockaddr_in));
+  dev->truncated = 0;
 
   /* Open the socket. */
   dev->fd = socket(AF_INET, SOCK_DGRAM, 0);
   if (dev->fd < 0) {
     *err = fp_get_system_error();
+    fp_deallocate(dev);
     return NULL;
   }
 
   /* Bind the socket to its address. */
   if (bind(dev->fd, (struct sockaddr*)&dev->addr, sizeof(dev->addr)) < 0) {
     *err = fp_get_system_error();
+    close(dev->fd);
+    fp_deallocate(dev);
     return NULL;
   }
 
@@ -162,7 +186,8 @@ fp_udp_open_sockaddr(struct sockaddr_in* addr, fp_error_t* err)
 }
 
 
-/* Close and destroy the UDP interface. */
+/* Close and destroy the UDP interface. Packets received from
+   the device remain valid. */
 void
 fp_udp_close(struct fp_device* device)
 {
@@ -172,44 +197,83 @@ fp_udp_close(struct fp_device* device)
 }
 
 
-/* Read from a UDP port. */
+/* Read from a UDP port. This does not block; if no message
+   is waiting, this returns NULL. */
 struct fp_packet*
 fp_udp_recv(struct fp_device* device)
+{
+  struct fp_packet* pkt;
+  if (fp_udp_recv_burst(device, &pkt, 1) == 1)
+    return pkt;
+  return NULL;
+}
+
+
+/* Receive up to n datagrams with a single system call. Each
+   datagram is received directly into a buffer from the packet
+   buffer pool. This does not block.
+
+   If the pool has run out of buffers, nothing is received; the
+   datagrams remain queued in the socket. */
+int
+fp_udp_recv_burst(struct fp_device* device, struct fp_packet** pkts, int n)
 {
   struct fp_udp_device* dev = (struct fp_udp_device*)device;
-  
-  struct sockaddr_in addr;
-  socklen_t len = sizeof(addr);
-
-  /* Receive the message. */
-  char buf[INIT_BUF_SIZE];
-  int bytes = recvfrom(dev->fd, buf, INIT_BUF_SIZE, 0, 
-                       (struct sockaddr*)&addr, &len);
-  if (bytes < 0)
-    return NULL;
-  
-  /* TODO: What should we do when the peer closes? 
-     Send a 0-byte packet through the pipeline? */
-  if (bytes == 0) 
-    return NULL;
+  unsigned char* bufs[FP_UDP_BURST];
+  struct iovec iovs[FP_UDP_BURST];
+  struct mmsghdr msgs[FP_UDP_BURST];
+
+  /* Take buffers from the pool. Those that are not filled are
+     returned. */
+  if (n > FP_UDP_BURST)
+    n = FP_UDP_BURST;
+  n = fp_packet_alloc_buffers(bufs, n);
+  if (n == 0)
+    return 0;
 
-  /* Copy the buffer so that we guarantee that we don't
-     accidentally overwrite it when we have multiple 
-     readers. 
+  memset(msgs, 0, n * sizeof(struct mmsghdr));
+  for (int i = 0; i < n; ++i) {
+    iovs[i].iov_base = bufs[i];
+    iovs[i].iov_len = FP_UDP_BUF_SIZE;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
 
-     TODO: We should probably have a better buffer management
-     framework so that we don't have to copy each time we
-     create a packet. */
-  unsigned char* data = fp_allocate_n(unsigned char, bytes);
-  memcpy(data, buf, bytes);
+  int got = recvmmsg(dev->fd, msgs, n, MSG_DONTWAIT, NULL);
+  if (got < 0)
+    got = 0;
+  if (got < n)
+    fp_packet_free_buffers(bufs + got, n - got);
+  if (got == 0)
+    return 0;
 
-  /* Allocate a flowpath packet. */
-  /* TODO: set timestamp */
-  return fp_packet_create(data, bytes, 0, NULL, FP_BUF_ALLOC);
+  /* Build packets over the filled buffers. Empty and truncated 
+     datagrams are dropped, as are datagrams for which no
+     descriptor is available.
+
+     TODO: What should we do when the peer closes? 
+     Send a 0-byte packet through the pipeline? 
+
+     The timestamp is set by the data plane when it is timing
+     packets (see fp_dataplane_receive()). */
+  int k = 0;
+  for (int i = 0; i < got; ++i) {
+    struct fp_packet* pkt = NULL;
+    if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      __atomic_add_fetch(&dev->truncated, 1, __ATOMIC_RELAXED);
+    else if (msgs[i].msg_len != 0)
+      pkt = fp_packet_create(bufs[i], msgs[i].msg_len, 0, NULL, FP_BUF_ALLOC);
+    if (pkt)
+      pkts[k++] = pkt;
+    else
+      fp_packet_free_buffer(bufs[i]);
+  }
+  return k;
 }
 
 
-/* Write to a UDP port and free the packet. */
+/* Write to a UDP port and free the packet. The packet is
+   released even if it cannot be sent. */
 int
 fp_udp_send(struct fp_device* device, struct fp_packet* pkt)
 {
@@ -217,23 +281,76 @@ fp_udp_send(struct fp_device* device, struct fp_packet* pkt)
 
   int bytes = sendto(dev->fd, pkt->data, pkt->size, 0,
                      (struct sockaddr*)&dev->addr, sizeof(dev->addr));
-  if (bytes < 0)
-    return bytes;
 
   /* TODO: What do we do if we send 0 bytes? */
-  if (bytes == 0)
-    return 0;
-
-  fp_deallocate(pkt->data);
-  fp_packet_delete(pkt);
+  release_packet(pkt);
   return bytes;
 }
 
 
+/* Send n packets, using as few system calls as possible. All
+   packets are released, whether or not they were sent. Returns
+   the number of packets sent, which are the first packets of the
+   burst: sending stops at the first packet that cannot be
+   sent. */
+int
+fp_udp_send_burst(struct fp_device* device, struct fp_packet** pkts, int n)
+{
+  struct fp_udp_device* dev = (struct fp_udp_device*)device;
+  struct iovec iovs[FP_UDP_BURST];
+  struct mmsghdr msgs[FP_UDP_BURST];
+
+  int sent = 0;
+  for (int i = 0; i < n; ) {
+    int m = n - i;
+    if (m > FP_UDP_BURST)
+      m = FP_UDP_BURST;
+
+    memset(msgs, 0, m * sizeof(struct mmsghdr));
+    for (int j = 0; j < m; ++j) {
+      iovs[j].iov_base = pkts[i + j]->data;
+      iovs[j].iov_len = pkts[i + j]->size;
+      msgs[j].msg_hdr.msg_name = &dev->addr;
+      msgs[j].msg_hdr.msg_namelen = sizeof(dev->addr);
+      msgs[j].msg_hdr.msg_iov = &iovs[j];
+      msgs[j].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* The kernel may accept only part of the batch. Retry the
+       remainder until it is sent or sending fails. */
+    int done = 0;
+    while (done < m) {
+      int ret = sendmmsg(dev->fd, msgs + done, m - done, 0);
+      if (ret <= 0)
+        break;
+      done += ret;
+    }
+    sent += done;
+    if (done < m) {
+      release_packets(pkts + i, n - i);
+      break;
+    }
+
+    release_packets(pkts + i, m);
+    i += m;
+  }
+  return sent;
+}
+
+
 /* Drop a packet, releasing its resources. */
 void
 fp_udp_drop(struct fp_device* device, struct fp_packet* pkt)
 {
-  fp_deallocate(pkt->data);
-  fp_packet_delete(pkt);
+  release_packet(pkt);
+}
+
+
+/* Returns the socket, which is readable when a message is
+   waiting. */
+int
+fp_udp_fd(struct fp_device* device)
+{
+  struct fp_udp_device* dev = (struct fp_udp_device*)device;
+  return dev->fd;
 }
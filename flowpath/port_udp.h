@@ -12,6 +12,7 @@
 #include "util.h"
 #include "port.h"
 #include "error.h"
+#include "packet.h"
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -23,9 +24,28 @@ struct nm_pkthdr;
 struct nm_desc;
 
 
+/* The size of each receive buffer. Larger datagrams are
+   truncated by the kernel, dropped, and counted in the device's
+   truncated count. */
+#define FP_UDP_BUF_SIZE FP_PACKET_BUF_SIZE
+
+/* The maximum number of datagrams moved by a single system
+   call. */
+#define FP_UDP_BURST    64
+
+
 /* A UDP socket that can act as a logical port. There is no
    tunnel id associated with this port.
 
+   Datagrams are received directly into buffers allocated from
+   the packet buffer pool (FP_BUF_ALLOC, see packet.h), and the
+   buffers return to the pool when the packet is sent or
+   dropped. The pool's per-thread caches make this safe and
+   cheap when packets finish on a different worker than the one
+   that received them (e.g., with RSS), and packets remain valid
+   after the device is closed. Batches of datagrams are moved
+   with recvmmsg and sendmmsg.
+
    Note that because UDP sockets are connectionless, data 
    sent through this device may not be delivered.
 
@@ -35,6 +55,7 @@ struct fp_udp_device
   struct fp_device   base; /* Base class sub-object. */
   struct sockaddr_in addr; /* The configured socket adress. */
   int                fd;   /* The underlying socket. */
+  uint64_t           truncated; /* Datagrams too large to receive. */
 };
 
 
@@ -45,5 +66,8 @@ void              fp_udp_close(struct fp_device*);
 struct fp_packet* fp_udp_recv(struct fp_device*);
 int               fp_udp_send(struct fp_device*, struct fp_packet*);
 void              fp_udp_drop(struct fp_device*, struct fp_packet*);
+int               fp_udp_fd(struct fp_device*);
+int               fp_udp_recv_burst(struct fp_device*, struct fp_packet**, int);
+int               fp_udp_send_burst(struct fp_device*, struct fp_packet**, int);
 
 #endif
@@ -47,9 +47,11 @@ extern "C" {
 #define FP_DATPLANE_SHOW  4
 #define FP_DATPLANE_STAT  5
 #define FP_DATPLANE_LIST  6
+#define FP_DATPLANE_LATENCY 7
 /* Pipeline configuration. */
 #define FP_DECODER_GET    10
 #define FP_DECODER_SET    11
+#define FP_PIPELINE_SWAP  12
 /* Port configuration. */
 #define FP_PORT_ADD       20
 #define FP_PORT_DEL       21
@@ -74,6 +76,8 @@ extern "C" {
 #define FP_DATAPLANE_LIMIT_EXCEEED   7  /* Too many data planes. */
 #define FP_BAD_PIPELINE              8  /* Cannot load pipeline module. */
 #define FP_BAD_PIPELINE_MODULE       9  /* Cannot resolve pipeline symbols. */
+#define FP_BAD_DECODER              10  /* Decoder program is invalid. */
+#define FP_BAD_PORT                 11  /* No such port. */
 
 
 /* -------------------------------------------------------------------------- */
@@ -131,6 +135,78 @@ struct fp_dataplane_list_arguments
 {
 };
 
+
+/* The number of drop reasons reported in counters. These are,
+   in order: dropped by the pipeline, no output port, not sent
+   by the device, and RSS ring full. */
+#define FP_STAT_DROPS 4
+
+
+/* Packet counters of a port or a data plane, as reported in
+   replies. */
+struct fp_stat_counters
+{
+  uint64_t rx_packets;
+  uint64_t rx_bytes;
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+  uint64_t drops[FP_STAT_DROPS];
+};
+
+
+/* The result of a data plane stat request. The counters are
+   the totals over the data plane's ports. */
+struct fp_dataplane_stat_result
+{
+  uint32_t                state;  /* See data plane property values. */
+  uint32_t                nports; /* The number of ports. */
+  struct fp_stat_counters counters;
+};
+
+
+/* Latency request actions. Every action replies with the
+   current latencies. */
+#define FP_LATENCY_READ  0 /* Only read the latencies. */
+#define FP_LATENCY_START 1 /* Start timing packets. */
+#define FP_LATENCY_STOP  2 /* Stop timing packets. */
+#define FP_LATENCY_RESET 3 /* Forget the times recorded so far. */
+
+
+/* Arguments for timing a data plane's packets and reading
+   their latencies. */
+struct fp_dataplane_latency_arguments
+{
+  char    name[FP_STRING_MAX_LEN];
+  uint8_t action; /* See latency request actions. */
+};
+
+
+/* The number of stages reported in latencies. These are, in
+   order: receive, pipeline, egress, and total, followed by
+   stages defined by the pipeline. */
+#define FP_STAT_STAGES 8
+
+
+/* The latency of a stage in nanoseconds. Quantiles overstate
+   the true value by less than 1/32 of it. */
+struct fp_stage_latency
+{
+  uint64_t count; /* The number of packets timed. */
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+};
+
+
+/* The result of a data plane latency request. */
+struct fp_dataplane_latency_result
+{
+  uint32_t                timing;  /* 1 if packets are being timed. */
+  uint32_t                nstages; /* The number of stages. */
+  struct fp_stage_latency stages[FP_STAT_STAGES];
+};
+
 /* -------------------------------------------------------------------------- */
 /*                            Port requests                                   */
 
@@ -172,6 +248,24 @@ struct fp_port_del_result
 };
 
 
+/* Get port arguments. These identify the data plane and the
+   port whose counters are requested. */
+struct fp_port_get_arguments
+{
+  char     name[FP_STRING_MAX_LEN];
+  uint32_t pid;
+};
+
+
+/* The result of a port get request. */
+struct fp_port_get_result
+{
+  uint32_t                pid;
+  uint32_t                index;    /* The port's local index. */
+  struct fp_stat_counters counters;
+};
+
+
 /* List ports arguments. Identifies the data plane name. */
 struct fp_port_list_arguments
 {
@@ -186,6 +280,44 @@ struct fp_port_list_result
 };
 
 
+/* -------------------------------------------------------------------------- */
+/*                            Decoder requests                                */
+
+/* The maximum number of instructions in a set decoder
+   request. */
+#define FP_DECODER_SET_MAX_INSNS 48
+
+
+/* The size of an encoded Prokex instruction. */
+#define FP_DECODER_INSN_LEN  16
+
+
+/* Set decoder arguments. These identify the data plane and
+   give the program that extracts its keys, as an array of
+   ninsns instructions laid out as struct fp_prokex_insn (see
+   decoder.h) in host byte order. An empty program removes the
+   data plane's decoder. */
+struct fp_decoder_set_arguments
+{
+  char          name[FP_STRING_MAX_LEN];
+  uint16_t      ninsns;
+  unsigned char insns[0];
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                            Pipeline requests                               */
+
+/* Swap pipeline arguments. These identify the data plane and
+   the module that replaces its pipeline. The data plane keeps
+   its ports and continues forwarding. */
+struct fp_pipeline_swap_arguments
+{
+  char name[FP_STRING_MAX_LEN];
+  char type[FP_STRING_MAX_LEN];
+};
+
+
 /* -------------------------------------------------------------------------- */
 /*                          Request and reply                                 */
 
@@ -271,6 +403,15 @@ fp_get_dataplane_list_arguments(struct fp_request* req)
 }
 
 
+/* Return the arguments for timing a data plane. */
+inline struct fp_dataplane_latency_arguments*
+fp_get_dataplane_latency_arguments(struct fp_request* req)
+{
+  req->kind = FP_DATPLANE_LATENCY;
+  return (struct fp_dataplane_latency_arguments*)(req->data);
+}
+
+
 /* Return the arguments for adding a port to a data plane. */
 inline struct fp_port_add_arguments*
 fp_get_port_add_arguments(struct fp_request* req)
@@ -289,6 +430,15 @@ fp_get_port_del_arguments(struct fp_request* req)
 }
 
 
+/* Returns the arguments for getting a port of a data plane. */
+inline struct fp_port_get_arguments*
+fp_get_port_get_arguments(struct fp_request* req)
+{
+  req->kind = FP_PORT_GET;
+  return (struct fp_port_get_arguments*)(req->data);
+}
+
+
 /* Returns the arguments for listing ports in a data plane. */
 inline struct fp_port_list_arguments*
 fp_get_port_list_arguments(struct fp_request* req)
@@ -298,6 +448,48 @@ fp_get_port_list_arguments(struct fp_request* req)
 }
 
 
+/* Returns the arguments for setting a data plane's decoder. */
+inline struct fp_decoder_set_arguments*
+fp_get_decoder_set_arguments(struct fp_request* req)
+{
+  req->kind = FP_DECODER_SET;
+  return (struct fp_decoder_set_arguments*)(req->data);
+}
+
+
+/* Returns the arguments for swapping a data plane's pipeline. */
+inline struct fp_pipeline_swap_arguments*
+fp_get_pipeline_swap_arguments(struct fp_request* req)
+{
+  req->kind = FP_PIPELINE_SWAP;
+  return (struct fp_pipeline_swap_arguments*)(req->data);
+}
+
+
+/* Returns the result of a data plane stat request. */
+inline struct fp_dataplane_stat_result const*
+fp_get_dataplane_stat_result(struct fp_reply const* rep)
+{
+  return (struct fp_dataplane_stat_result const*)(rep->data);
+}
+
+
+/* Returns the result of a data plane latency request. */
+inline struct fp_dataplane_latency_result const*
+fp_get_dataplane_latency_result(struct fp_reply const* rep)
+{
+  return (struct fp_dataplane_latency_result const*)(rep->data);
+}
+
+
+/* Returns the result of a port get request. */
+inline struct fp_port_get_result const*
+fp_get_port_get_result(struct fp_reply const* rep)
+{
+  return (struct fp_port_get_result const*)(rep->data);
+}
+
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
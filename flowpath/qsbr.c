@@ -0,0 +1,190 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "qsbr.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+
+/* A deferred release. The object may be released once every
+   online thread has observed the epoch. */
+struct fp_qsbr_entry
+{
+  fp_qsbr_fn            fn;
+  void*                 arg;
+  uint64_t              epoch;
+  struct fp_qsbr_entry* next;
+};
+
+
+/* The global epoch. This starts at 1 so that 0 can denote an
+   offline thread. */
+uint64_t fp_qsbr_epoch_ = 1;
+
+
+/* Registered threads. */
+static struct fp_qsbr_thread threads_[FP_QSBR_MAX_THREADS];
+
+
+/* Deferred releases, in the order they were deferred, and the
+   lock that protects them and the registry. */
+static struct fp_qsbr_entry* head_;
+static struct fp_qsbr_entry** tail_ = &head_;
+static pthread_mutex_t lock_ = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Returns the least epoch observed by an online thread, or
+   UINT64_MAX if no thread is online. */
+static uint64_t
+min_epoch()
+{
+  uint64_t m = UINT64_MAX;
+  for (int i = 0; i < FP_QSBR_MAX_THREADS; ++i) {
+    if (!__atomic_load_n(&threads_[i].used, __ATOMIC_ACQUIRE))
+      continue;
+    uint64_t e = __atomic_load_n(&threads_[i].epoch, __ATOMIC_SEQ_CST);
+    if (e && e < m)
+      m = e;
+  }
+  return m;
+}
+
+
+/* Advance the global epoch and return its new value. */
+static inline uint64_t
+advance()
+{
+  return __atomic_add_fetch(&fp_qsbr_epoch_, 1, __ATOMIC_SEQ_CST);
+}
+
+
+/* Register the calling thread as a reader. The thread is
+   online. Returns NULL if too many threads are registered. */
+struct fp_qsbr_thread*
+fp_qsbr_register()
+{
+  struct fp_qsbr_thread* t = NULL;
+  pthread_mutex_lock(&lock_);
+  for (int i = 0; i < FP_QSBR_MAX_THREADS; ++i) {
+    if (!threads_[i].used) {
+      t = &threads_[i];
+      break;
+    }
+  }
+  if (t) {
+    fp_qsbr_online(t);
+    __atomic_store_n(&t->used, true, __ATOMIC_SEQ_CST);
+  }
+  pthread_mutex_unlock(&lock_);
+  return t;
+}
+
+
+/* Unregister a reader thread. */
+void
+fp_qsbr_unregister(struct fp_qsbr_thread* t)
+{
+  if (!t)
+    return;
+  pthread_mutex_lock(&lock_);
+  fp_qsbr_offline(t);
+  __atomic_store_n(&t->used, false, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&lock_);
+}
+
+
+/* Bring the thread back online. The thread may acquire
+   references to shared objects when this returns. */
+void
+fp_qsbr_online(struct fp_qsbr_thread* t)
+{
+  __atomic_store_n(&t->epoch, __atomic_load_n(&fp_qsbr_epoch_, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+}
+
+
+/* Release the object by calling fn(arg) once no reader can
+   refer to it. The object must already be unreachable by
+   readers. This does not block; the release may run before this
+   returns. */
+void
+fp_qsbr_defer(fp_qsbr_fn fn, void* arg)
+{
+  struct fp_qsbr_entry* ent = fp_allocate(struct fp_qsbr_entry);
+  if (!ent) {
+    /* Fall back to waiting for the grace period. */
+    fp_qsbr_synchronize();
+    fn(arg);
+    return;
+  }
+  ent->fn = fn;
+  ent->arg = arg;
+  ent->next = NULL;
+  pthread_mutex_lock(&lock_);
+  ent->epoch = advance();
+  *tail_ = ent;
+  tail_ = &ent->next;
+  pthread_mutex_unlock(&lock_);
+  fp_qsbr_reclaim();
+}
+
+
+/* Run the deferred releases whose grace periods have elapsed.
+   Returns the number of objects released. This does not
+   block. */
+int
+fp_qsbr_reclaim()
+{
+  pthread_mutex_lock(&lock_);
+  uint64_t m = min_epoch();
+
+  /* Entries are queued in epoch order, so the completed ones
+     are a prefix of the queue. */
+  struct fp_qsbr_entry* done = NULL;
+  struct fp_qsbr_entry** link = &head_;
+  while (*link && (*link)->epoch <= m)
+    link = &(*link)->next;
+  if (link != &head_) {
+    done = head_;
+    head_ = *link;
+    *link = NULL;
+    if (!head_)
+      tail_ = &head_;
+  }
+  pthread_mutex_unlock(&lock_);
+
+  /* Releases run without the lock, since they may defer other
+     objects. */
+  int n = 0;
+  while (done) {
+    struct fp_qsbr_entry* next = done->next;
+    done->fn(done->arg);
+    fp_deallocate(done);
+    done = next;
+    ++n;
+  }
+  return n;
+}
+
+
+/* Wait until every online thread has announced a quiescent
+   state. Objects unpublished before this call are no longer
+   referenced by readers when it returns. This must not be
+   called by an online reader thread. */
+void
+fp_qsbr_synchronize()
+{
+  uint64_t e = advance();
+  while (min_epoch() < e)
+    sched_yield();
+}
+
+
+/* Wait for a grace period and run every deferred release. */
+void
+fp_qsbr_barrier()
+{
+  fp_qsbr_synchronize();
+  fp_qsbr_reclaim();
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_QSBR_H
+#define FLOWPATH_QSBR_H
+
+/* This module implements quiescent-state-based reclamation
+   (QSBR). It allows objects that are read without locks by
+   worker threads to be removed by the control path and freed
+   once no reader can refer to them.
+
+   Reader threads register with the subsystem and announce a
+   quiescent state -- a point at which they hold no references
+   to shared objects -- once per burst, by recording the current
+   global epoch. A thread that blocks (e.g., sleeping in a
+   poller) goes offline first, and is quiescent until it comes
+   back online. Announcing a quiescent state is a load and a
+   store to a cache line private to the thread; readers never
+   take locks.
+
+   The control path unpublishes an object (e.g., removes it from
+   a table or array) and then defers its release with
+   fp_qsbr_defer(). This advances the global epoch and queues the
+   release, which runs once every online thread has announced a
+   quiescent state in the new epoch. Deferred releases are run
+   by later calls to fp_qsbr_defer() and fp_qsbr_reclaim(), which
+   never block. fp_qsbr_synchronize() waits for a grace period,
+   and fp_qsbr_barrier() also runs every deferred release.
+
+   When no thread is registered, every grace period is complete
+   immediately, and deferred releases run at once. */
+
+#include "util.h"
+
+#include <stdint.h>
+
+
+/* The maximum number of registered threads. */
+#define FP_QSBR_MAX_THREADS 128
+
+
+/* A function that releases a deferred object. */
+typedef void (*fp_qsbr_fn)(void*);
+
+
+/* The state of a registered thread. The epoch is 0 while the
+   thread is offline. */
+struct fp_qsbr_thread
+{
+  uint64_t epoch fp_cache_aligned;
+  bool     used;
+};
+
+
+/* The global epoch. This is only modified by this module. */
+extern uint64_t fp_qsbr_epoch_;
+
+
+struct fp_qsbr_thread* fp_qsbr_register();
+void                   fp_qsbr_unregister(struct fp_qsbr_thread*);
+void                   fp_qsbr_online(struct fp_qsbr_thread*);
+void                   fp_qsbr_defer(fp_qsbr_fn, void*);
+int                    fp_qsbr_reclaim();
+void                   fp_qsbr_synchronize();
+void                   fp_qsbr_barrier();
+
+
+/* Announce that the thread holds no references to shared
+   objects. */
+static inline void
+fp_qsbr_quiescent(struct fp_qsbr_thread* t)
+{
+  uint64_t e = __atomic_load_n(&fp_qsbr_epoch_, __ATOMIC_ACQUIRE);
+  if (t->epoch != e)
+    __atomic_store_n(&t->epoch, e, __ATOMIC_RELEASE);
+}
+
+
+/* Take the thread offline. It must not hold references to
+   shared objects until it comes back online. */
+static inline void
+fp_qsbr_offline(struct fp_qsbr_thread* t)
+{
+  __atomic_store_n(&t->epoch, 0, __ATOMIC_RELEASE);
+}
+
+
+#endif
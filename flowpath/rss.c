@@ -0,0 +1,240 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "rss.h"
+#include "packet.h"
+#include "parse.h"
+#include "hashfn.h"
+
+
+/* The default Toeplitz key. Its 16-bit period makes the
+   Toeplitz hash itself symmetric, so flows hash the same with
+   it whether or not endpoints are ordered. */
+static uint8_t const default_key[FP_RSS_KEY_LEN] = {
+  0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+  0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+  0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+  0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+};
+
+
+/* Returns the 32 bits of the key starting at the given bit. */
+static uint32_t
+key_window(uint8_t const* key, int bit)
+{
+  int byte = bit / 8;
+  int shift = bit % 8;
+  uint64_t w = 0;
+  for (int i = 0; i < 5; ++i)
+    w = (w << 8) | (byte + i < FP_RSS_KEY_LEN ? key[byte + i] : 0);
+  return (uint32_t)(w >> (8 - shift));
+}
+
+
+/* Compute the contribution of each value of each input byte to
+   the Toeplitz hash. Bit j of the input (counting from the most
+   significant bit of the first byte) contributes the 32 bits of
+   the key starting at bit j. */
+static void
+init_toeplitz(struct fp_rss* rss)
+{
+  for (int i = 0; i < FP_RSS_TUPLE_MAX; ++i) {
+    uint32_t bits[8];
+    for (int j = 0; j < 8; ++j)
+      bits[j] = key_window(rss->key, i * 8 + j);
+    for (int b = 0; b < 256; ++b) {
+      uint32_t h = 0;
+      for (int j = 0; j < 8; ++j)
+        if (b & (0x80 >> j))
+          h ^= bits[j];
+      rss->toeplitz[i][b] = h;
+    }
+  }
+}
+
+
+/* Create an RSS stage with the given hash algorithm and n rings.
+   The key is used by the Toeplitz hash; if it is NULL, a default
+   key is used. */
+struct fp_rss*
+fp_rss_new(int algorithm, uint8_t const* key, int n, fp_error_t* err)
+{
+  if (n <= 0 || n > FP_RSS_MAX_RINGS ||
+      (algorithm != FP_RSS_TOEPLITZ && algorithm != FP_RSS_CRC32C)) {
+    *err = fp_system_error(EINVAL);
+    return NULL;
+  }
+
+  struct fp_rss* rss = fp_allocate(struct fp_rss);
+  if (!rss) {
+    *err = fp_system_error(ENOMEM);
+    return NULL;
+  }
+  rss->algorithm = algorithm;
+  memcpy(rss->key, key ? key : default_key, FP_RSS_KEY_LEN);
+  init_toeplitz(rss);
+  for (int i = 0; i < FP_RSS_RETA_SIZE; ++i)
+    rss->reta[i] = i % n;
+
+  rss->nrings = n;
+  for (int i = 0; i < n; ++i) {
+    rss->rings[i] = fp_spsc_ring_new(FP_RSS_RING_SIZE);
+    if (!rss->rings[i]) {
+      rss->nrings = i;
+      fp_rss_delete(rss);
+      *err = fp_system_error(ENOMEM);
+      return NULL;
+    }
+  }
+  *err = FP_OK;
+  return rss;
+}
+
+
+/* Delete the RSS stage. Packets remaining in its rings are
+   released. */
+void
+fp_rss_delete(struct fp_rss* rss)
+{
+  if (!rss)
+    return;
+  for (int i = 0; i < rss->nrings; ++i) {
+    struct fp_packet* pkt;
+    while ((pkt = (struct fp_packet*)fp_spsc_ring_pop(rss->rings[i]))) {
+      fp_packet_release_buffer(pkt);
+      fp_packet_delete(pkt);
+    }
+    fp_spsc_ring_delete(rss->rings[i]);
+  }
+  fp_deallocate(rss);
+}
+
+
+/* Compute the Toeplitz hash of the n bytes at p (at most
+   FP_RSS_TUPLE_MAX) with the given table (see fp_rss). */
+uint32_t
+fp_toeplitz_hash(uint32_t const (*table)[256], void const* p, size_t n)
+{
+  unsigned char const* b = (unsigned char const*)p;
+  uint32_t h = 0;
+  for (size_t i = 0; i < n; ++i)
+    h ^= table[i][b[i]];
+  return h;
+}
+
+
+/* Write the endpoints a and b, each an address of n bytes and
+   an optional port, to the tuple in canonical order. Returns
+   the length of the tuple. */
+static size_t
+make_tuple(unsigned char* t, unsigned char const* a, unsigned char const* b,
+           size_t n, unsigned char const* pa, unsigned char const* pb)
+{
+  int c = memcmp(a, b, n);
+  if (c == 0 && pa)
+    c = memcmp(pa, pb, 2);
+  if (c > 0) {
+    unsigned char const* x = a;
+    a = b;
+    b = x;
+    x = pa;
+    pa = pb;
+    pb = x;
+  }
+  memcpy(t, a, n);
+  memcpy(t + n, b, n);
+  if (!pa)
+    return 2 * n;
+  memcpy(t + 2 * n, pa, 2);
+  memcpy(t + 2 * n + 2, pb, 2);
+  return 2 * n + 4;
+}
+
+
+/* Compute the symmetric flow hash of each packet and store it in
+   the packet's descriptor. */
+void
+fp_rss_hash_burst(struct fp_rss const* rss, struct fp_packet** pkts, int n)
+{
+  struct fp_parse parse;
+  unsigned char tuple[FP_RSS_TUPLE_MAX];
+  while (n > 0) {
+    int m = n < FP_PARSE_BATCH ? n : FP_PARSE_BATCH;
+    fp_parse_batch(pkts, m, &parse);
+    for (int i = 0; i < m; ++i) {
+      unsigned char const* d = pkts[i]->data;
+      uint16_t flags = parse.flags[i];
+      unsigned char const* sport = NULL;
+      unsigned char const* dport = NULL;
+      if (flags & (FP_PARSE_TCP | FP_PARSE_UDP)) {
+        sport = d + parse.l4[i];
+        dport = sport + 2;
+      }
+      size_t len;
+      if (flags & FP_PARSE_IPV4)
+        len = make_tuple(tuple, d + parse.l3[i] + 12, d + parse.l3[i] + 16, 4, sport, dport);
+      else if (flags & FP_PARSE_IPV6)
+        len = make_tuple(tuple, d + parse.l3[i] + 8, d + parse.l3[i] + 24, 16, sport, dport);
+      else if (flags & FP_PARSE_ETH)
+        len = make_tuple(tuple, d + 6, d, 6, NULL, NULL);
+      else
+        len = 0;
+
+      if (rss->algorithm == FP_RSS_TOEPLITZ)
+        pkts[i]->hash = fp_toeplitz_hash(rss->toeplitz, tuple, len);
+      else
+        pkts[i]->hash = fp_crc32c(0, tuple, len);
+    }
+    pkts += m;
+    n -= m;
+  }
+}
+
+
+/* Hash the n packets (at most FP_PARSE_BATCH) and push each
+   onto the ring selected by its hash. Packets are grouped by ring
+   so that each ring is updated once. Packets that do not fit in
+   their rings are moved to the front of the array, and their
+   number is returned; the caller is responsible for them. This
+   must be called by only one thread at a time. */
+int
+fp_rss_distribute(struct fp_rss* rss, struct fp_packet** pkts, int n)
+{
+  assert(n <= FP_PARSE_BATCH);
+  fp_rss_hash_burst(rss, pkts, n);
+
+  /* Sort the packets by ring, preserving their order. */
+  uint8_t rings[FP_PARSE_BATCH];
+  int start[FP_RSS_MAX_RINGS + 1] = {0};
+  for (int i = 0; i < n; ++i) {
+    rings[i] = fp_rss_ring(rss, pkts[i]->hash);
+    ++start[rings[i] + 1];
+  }
+  for (int r = 0; r < rss->nrings; ++r)
+    start[r + 1] += start[r];
+  struct fp_packet* sorted[FP_PARSE_BATCH];
+  int next[FP_RSS_MAX_RINGS];
+  memcpy(next, start, rss->nrings * sizeof(int));
+  for (int i = 0; i < n; ++i)
+    sorted[next[rings[i]]++] = pkts[i];
+
+  int rejected = 0;
+  for (int r = 0; r < rss->nrings; ++r) {
+    int m = start[r + 1] - start[r];
+    if (!m)
+      continue;
+    int k = fp_spsc_ring_push_n(rss->rings[r], (void**)&sorted[start[r]], m);
+    for (int i = k; i < m; ++i)
+      pkts[rejected++] = sorted[start[r] + i];
+  }
+  return rejected;
+}
+
+
+/* Pop up to n packets from the given ring. This must be called
+   by only one thread for each ring. */
+int
+fp_rss_receive(struct fp_rss* rss, int ring, struct fp_packet** pkts, int n)
+{
+  return fp_spsc_ring_pop_n(rss->rings[ring], (void**)pkts, n);
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_RSS_H
+#define FLOWPATH_RSS_H
+
+/* This module implements software receive side scaling (RSS).
+   Devices without multiple hardware queues deliver all of their
+   packets to a single receive queue, and so to a single worker.
+   An RSS stage attached to such a port spreads the port's
+   traffic over several workers: the worker that receives from
+   the port computes a flow hash for each packet, stores it in
+   the packet descriptor, and uses it to push the packet onto
+   one of a set of single-producer, single-consumer rings, one
+   for each worker. Each worker then runs the pipeline on the
+   packets in its own ring.
+
+   The flow hash is computed over the packet's addresses and, for
+   TCP and UDP, ports (see parse.h), or over its Ethernet
+   addresses if it is not an IP packet. The hash is symmetric:
+   the two endpoints of the flow are put in a canonical order
+   before hashing, so both directions of a connection have the
+   same hash and are processed by the same worker. Per-flow state
+   kept by that worker (e.g., connection tracking or NAT) then
+   needs no synchronization.
+
+   Two hash functions are available. The Toeplitz hash is the
+   one used by hardware RSS, computed with a configurable key
+   using a table of precomputed per-byte contributions. CRC32C
+   is cheaper and uses the SSE4.2 CRC instruction when it is
+   available.
+
+   Hashes select rings through an indirection table, which
+   initially assigns hash buckets to rings round-robin.
+
+   The packets of a port with an RSS stage are sent or dropped
+   by workers other than the one that received them, so the
+   port's device must allow its buffers to be released from any
+   thread. Devices that receive into the packet buffer pool
+   (e.g., UDP) do. */
+
+#include "util.h"
+#include "error.h"
+
+struct fp_packet;
+
+
+/* Hash functions. */
+#define FP_RSS_TOEPLITZ 0
+#define FP_RSS_CRC32C   1
+
+/* The length of a Toeplitz key. */
+#define FP_RSS_KEY_LEN   40
+
+/* The longest input hashed for a packet: a pair of IPv6
+   addresses and a pair of ports. */
+#define FP_RSS_TUPLE_MAX 36
+
+/* The number of entries in the indirection table. */
+#define FP_RSS_RETA_SIZE 128
+
+/* The maximum number of rings. */
+#define FP_RSS_MAX_RINGS 64
+
+/* The number of packets that each ring can hold. */
+#define FP_RSS_RING_SIZE 1024
+
+
+/* An RSS stage. */
+struct fp_rss
+{
+  int      algorithm;
+  uint8_t  key[FP_RSS_KEY_LEN];
+  uint32_t toeplitz[FP_RSS_TUPLE_MAX][256];
+
+  int                  nrings;
+  struct fp_spsc_ring* rings[FP_RSS_MAX_RINGS];
+  uint8_t              reta[FP_RSS_RETA_SIZE];
+};
+
+
+struct fp_rss* fp_rss_new(int, uint8_t const*, int, fp_error_t*);
+void           fp_rss_delete(struct fp_rss*);
+void           fp_rss_hash_burst(struct fp_rss const*, struct fp_packet**, int);
+int            fp_rss_distribute(struct fp_rss*, struct fp_packet**, int);
+int            fp_rss_receive(struct fp_rss*, int, struct fp_packet**, int);
+
+uint32_t fp_toeplitz_hash(uint32_t const (*)[256], void const*, size_t);
+
+
+/* Returns the ring to which packets with the hash are steered. */
+static inline int
+fp_rss_ring(struct fp_rss const* rss, uint32_t hash)
+{
+  return rss->reta[hash % FP_RSS_RETA_SIZE];
+}
+
+
+#endif
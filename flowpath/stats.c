@@ -0,0 +1,191 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "stats.h"
+#include "qsbr.h"
+
+#include <pthread.h>
+
+
+struct fp_stats_block fp_counter_chunks_[FP_COUNTER_CHUNKS];
+
+__thread int fp_stats_shard_ = FP_STATS_SHARED;
+
+
+/* Free counter slots, the next slot never allocated, and the
+   lock that protects them. */
+static uint32_t* free_;
+static int       nfree_;
+static int       capacity_;
+static uint32_t  next_ = 1;
+static pthread_mutex_t lock_ = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Set the calling thread's shard. Workers call this with their
+   id; the shared shard is the default. */
+void
+fp_stats_set_shard(int shard)
+{
+  assert(0 <= shard && shard <= FP_STATS_SHARED);
+  fp_stats_shard_ = shard;
+}
+
+
+/* Initialize a block of size bytes of counters. No copies are
+   allocated until they are used. */
+void
+fp_stats_block_init(struct fp_stats_block* b, size_t size)
+{
+  b->size = size;
+  memset(b->shards, 0, sizeof(b->shards));
+}
+
+
+/* Release every copy of the block's counters. No thread may be
+   counting in the block. */
+void
+fp_stats_block_clear(struct fp_stats_block* b)
+{
+  for (int i = 0; i < FP_STATS_SHARDS; ++i) {
+    fp_deallocate(b->shards[i]);
+    b->shards[i] = NULL;
+  }
+}
+
+
+/* Allocate the shard's copy of the block, unless another thread
+   already has. Returns the copy, or NULL if it cannot be
+   allocated. */
+static uint64_t*
+alloc_shard(struct fp_stats_block* b, int shard)
+{
+  uint64_t* p = __atomic_load_n(&b->shards[shard], __ATOMIC_ACQUIRE);
+  if (p)
+    return p;
+  void* q;
+  if (posix_memalign(&q, FP_CACHE_LINE, b->size) != 0)
+    return NULL;
+  memset(q, 0, b->size);
+  p = (uint64_t*)q;
+
+  /* The shared copy may be allocated by several threads. */
+  uint64_t* prev = NULL;
+  if (__atomic_compare_exchange_n(&b->shards[shard], &prev, p, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return p;
+  fp_deallocate(p);
+  return prev;
+}
+
+
+/* The slow path of fp_stats_block_get(). When the calling
+   thread's copy cannot be allocated, it falls back to the
+   shared copy. */
+uint64_t*
+fp_stats_block_alloc(struct fp_stats_block* b, int* shard)
+{
+  *shard = fp_stats_shard_;
+  uint64_t* p = alloc_shard(b, *shard);
+  if (p || *shard == FP_STATS_SHARED)
+    return p;
+  *shard = FP_STATS_SHARED;
+  return alloc_shard(b, FP_STATS_SHARED);
+}
+
+
+/* Aggregate the n counters at the given byte offset of the
+   block over every shard, storing the totals in out. Counts made
+   concurrently may or may not be included. */
+void
+fp_stats_block_sum(struct fp_stats_block* b, size_t offset, int n, uint64_t* out)
+{
+  assert(offset % sizeof(uint64_t) == 0);
+  memset(out, 0, n * sizeof(uint64_t));
+  for (int i = 0; i < FP_STATS_SHARDS; ++i) {
+    uint64_t* p = __atomic_load_n(&b->shards[i], __ATOMIC_ACQUIRE);
+    if (!p)
+      continue;
+    p += offset / sizeof(uint64_t);
+    for (int j = 0; j < n; ++j)
+      out[j] += __atomic_load_n(&p[j], __ATOMIC_RELAXED);
+  }
+}
+
+
+/* Allocate a counter slot whose counters are zero. Returns 0
+   and sets *err to ENOSPC if every slot is in use. */
+uint32_t
+fp_counter_alloc(fp_error_t* err)
+{
+  uint32_t slot = 0;
+  pthread_mutex_lock(&lock_);
+  if (nfree_) {
+    slot = free_[--nfree_];
+  } else if (next_ < FP_COUNTER_CHUNK * FP_COUNTER_CHUNKS) {
+    struct fp_stats_block* chunk = &fp_counter_chunks_[next_ / FP_COUNTER_CHUNK];
+    if (!chunk->size)
+      fp_stats_block_init(chunk, FP_COUNTER_CHUNK * 2 * sizeof(uint64_t));
+    slot = next_++;
+  }
+  pthread_mutex_unlock(&lock_);
+  *err = slot ? FP_OK : fp_system_error(ENOSPC);
+  return slot;
+}
+
+
+/* Zero the slot in every shard and make it available. */
+static void
+free_slot(void* arg)
+{
+  uint32_t slot = (uint32_t)(uintptr_t)arg;
+  struct fp_stats_block* chunk = &fp_counter_chunks_[slot / FP_COUNTER_CHUNK];
+  for (int i = 0; i < FP_STATS_SHARDS; ++i) {
+    uint64_t* p = __atomic_load_n(&chunk->shards[i], __ATOMIC_ACQUIRE);
+    if (!p)
+      continue;
+    p += 2 * (slot % FP_COUNTER_CHUNK);
+    __atomic_store_n(&p[0], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p[1], 0, __ATOMIC_RELAXED);
+  }
+
+  pthread_mutex_lock(&lock_);
+  if (nfree_ == capacity_) {
+    int n = capacity_ ? 2 * capacity_ : 64;
+    uint32_t* p = (uint32_t*)realloc(free_, n * sizeof(uint32_t));
+    if (!p) {
+      /* The slot is lost. */
+      pthread_mutex_unlock(&lock_);
+      return;
+    }
+    free_ = p;
+    capacity_ = n;
+  }
+  free_[nfree_++] = slot;
+  pthread_mutex_unlock(&lock_);
+}
+
+
+/* Release a counter slot. The owner of the slot must already be
+   unreachable by workers; the slot is reused once no worker can
+   be counting in it. Threads other than workers must not count
+   in the slot after this is called. */
+void
+fp_counter_release(uint32_t slot)
+{
+  if (slot)
+    fp_qsbr_defer(free_slot, (void*)(uintptr_t)slot);
+}
+
+
+/* Store the totals of the slot's two counters in out. */
+void
+fp_counter_read(uint32_t slot, uint64_t* out)
+{
+  if (!slot) {
+    out[0] = out[1] = 0;
+    return;
+  }
+  struct fp_stats_block* chunk = &fp_counter_chunks_[slot / FP_COUNTER_CHUNK];
+  size_t offset = 2 * (slot % FP_COUNTER_CHUNK) * sizeof(uint64_t);
+  fp_stats_block_sum(chunk, offset, 2, out);
+}
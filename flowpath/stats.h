@@ -0,0 +1,168 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_STATS_H
+#define FLOWPATH_STATS_H
+
+/* This module implements sharded statistics counters. Every
+   counter is kept once per shard, and each worker thread counts
+   in its own shard, so counting a packet is a plain add to memory
+   that no other core writes. Readers aggregate the shards only
+   when asked (e.g., by the control channel). Counts are exact:
+   every increment lands in exactly one shard.
+
+   Worker i counts in shard i (see fp_stats_set_shard()). Every
+   other thread counts in the shared shard, whose counters are
+   updated with atomic adds.
+
+   Counters are grouped in blocks (see fp_stats_block), an array
+   of 64-bit counters with one copy per shard. A shard's copy is
+   allocated by the first thread that counts in it. If it cannot
+   be allocated, the thread counts in the shared copy instead.
+
+   Flows and flow tables are counted in slots, each a pair of
+   counters. Slots are allocated with fp_counter_alloc() and
+   released with fp_counter_release(), which zeroes the slot and
+   makes it available once no worker can be counting in it (see
+   qsbr.h). Slot 0 is never allocated; counting in it does
+   nothing.
+
+   Port counters are kept by data planes (see dataplane.h). */
+
+#include "util.h"
+#include "error.h"
+
+
+/* The shard used by threads other than workers. Worker ids
+   must be less than this. */
+#define FP_STATS_SHARED 64
+
+/* The number of shards. */
+#define FP_STATS_SHARDS (FP_STATS_SHARED + 1)
+
+/* Counter slots are allocated in chunks of this many slots per
+   shard. */
+#define FP_COUNTER_CHUNK  4096
+
+/* The maximum number of chunks, limiting the number of slots
+   to FP_COUNTER_CHUNK * FP_COUNTER_CHUNKS. */
+#define FP_COUNTER_CHUNKS 256
+
+
+/* Reasons for dropping a packet. */
+#define FP_DROP_POLICY  0 /* The pipeline chose to drop it. */
+#define FP_DROP_NO_PORT 1 /* There is no output port. */
+#define FP_DROP_TX      2 /* The device could not send it. */
+#define FP_DROP_RSS     3 /* The RSS ring was full. */
+#define FP_DROP_REASONS 4
+
+
+/* Port counters. These fill one cache line. Packets are counted
+   as received on their input port, as sent on their output port,
+   and as dropped on their output port when the device fails to
+   send them, or else on their input port. */
+struct fp_port_stats
+{
+  uint64_t rx_packets;
+  uint64_t rx_bytes;
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+  uint64_t drops[FP_DROP_REASONS];
+};
+
+
+/* Flow counters. */
+struct fp_flow_stats
+{
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+
+/* Flow table counters. Every lookup is either a match or a
+   miss. */
+struct fp_table_stats
+{
+  uint64_t lookups;
+  uint64_t matches;
+  uint64_t misses;
+};
+
+
+/* A block of size bytes of counters, with one copy per shard.
+   The copies are cache aligned, and a null copy has not been
+   used. */
+struct fp_stats_block
+{
+  size_t   size;
+  uint64_t* shards[FP_STATS_SHARDS];
+};
+
+
+/* The chunks of counter slots. This is only modified by this
+   module. */
+extern struct fp_stats_block fp_counter_chunks_[FP_COUNTER_CHUNKS];
+
+
+/* The calling thread's shard. */
+extern __thread int fp_stats_shard_;
+
+
+void      fp_stats_set_shard(int);
+void      fp_stats_block_init(struct fp_stats_block*, size_t);
+void      fp_stats_block_clear(struct fp_stats_block*);
+uint64_t* fp_stats_block_alloc(struct fp_stats_block*, int*);
+void      fp_stats_block_sum(struct fp_stats_block*, size_t, int, uint64_t*);
+
+uint32_t  fp_counter_alloc(fp_error_t*);
+void      fp_counter_release(uint32_t);
+void      fp_counter_read(uint32_t, uint64_t*);
+
+
+/* Returns the calling thread's copy of the block's counters,
+   allocating it on first use, and sets *shard to the copy's
+   shard. Returns NULL if no copy can be allocated. */
+static inline uint64_t*
+fp_stats_block_get(struct fp_stats_block* b, int* shard)
+{
+  int s = fp_stats_shard_;
+  uint64_t* p = __atomic_load_n(&b->shards[s], __ATOMIC_ACQUIRE);
+  if (__builtin_expect(p != NULL, 1)) {
+    *shard = s;
+    return p;
+  }
+  return fp_stats_block_alloc(b, shard);
+}
+
+
+/* Add n to a counter of the given shard. Only the shared shard
+   has concurrent writers, so counters of other shards are
+   updated without a locked instruction. */
+static inline void
+fp_stats_add(uint64_t* c, uint64_t n, int shard)
+{
+  if (__builtin_expect(shard != FP_STATS_SHARED, 1))
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+  else
+    __atomic_add_fetch(c, n, __ATOMIC_RELAXED);
+}
+
+
+/* Add a and b to the first and second counters of the slot. */
+static inline void
+fp_counter_add(uint32_t slot, uint64_t a, uint64_t b)
+{
+  if (!slot)
+    return;
+  int shard;
+  struct fp_stats_block* chunk = &fp_counter_chunks_[slot / FP_COUNTER_CHUNK];
+  uint64_t* c = fp_stats_block_get(chunk, &shard);
+  if (!c)
+    return;
+  c += 2 * (slot % FP_COUNTER_CHUNK);
+  fp_stats_add(&c[0], a, shard);
+  fp_stats_add(&c[1], b, shard);
+}
+
+
+#endif
@@ -0,0 +1,91 @@
+
+#include <stdio.h>
+
+#include "hash.h"
+
+
+#define NUM_KEYS 100000
+
+
+int 
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  /* Insertions grow the table incrementally. Every key is
+     reachable at every step, whether or not its bucket has been
+     migrated. */
+  struct fp_chained_hash_table* t = fp_chained_hash_table_new(17, fp_uint_hash, fp_uint_eq);
+  if (t->buckets != 32) {fail += 1;
+    printf("%d Expected 32 buckets\n", __LINE__);}
+  struct fp_chained_hash_entry* first = fp_chained_hash_table_insert(t, 0, 0);
+  int resizes = 0;
+  int lost = 0;
+  for (uintptr_t k = 1; k < NUM_KEYS; k++) {
+    bool migrating = t->old != NULL;
+    fp_chained_hash_table_insert(t, k, k * 2);
+    resizes += !migrating && t->old;
+    if (t->old && !fp_chained_hash_table_find(t, k / 2))
+      ++lost;
+  }
+  if (t->size != NUM_KEYS) {fail += 1;
+    printf("%d Expected %d elements\n", __LINE__, NUM_KEYS);}
+  if (lost) {fail += 1;
+    printf("%d Expected keys to be found during migration (%d)\n", __LINE__, lost);}
+  if (resizes < 10) {fail += 1;
+    printf("%d Expected the table to grow (%d)\n", __LINE__, resizes);}
+  double load = fp_chained_hash_table_load(t);
+  if (load > 0.75 || load < 0.25) {fail += 1;
+    printf("%d Expected load factor between 1/4 and 3/4 (%f)\n", __LINE__, load);}
+
+  /* Entries are relinked, not reallocated. */
+  if (fp_chained_hash_table_find(t, 0) != first) {fail += 1;
+    printf("%d Expected entries to keep their addresses\n", __LINE__);}
+
+  /* Every key is found with its value. */
+  for (uintptr_t k = 1; k < NUM_KEYS; k++) {
+    struct fp_chained_hash_entry* ent = fp_chained_hash_table_find(t, k);
+    if (!ent || ent->value != k * 2) {fail += 1;
+      printf("%d Expected to find key %lu\n", __LINE__, (unsigned long)k);
+      break;}
+  }
+  if (fp_chained_hash_table_find(t, NUM_KEYS) != NULL) {fail += 1;
+    printf("%d Expected not to find key %d\n", __LINE__, NUM_KEYS);}
+
+  /* Updates change the value of the given key only. */
+  fp_chained_hash_table_update(t, 7, 1);
+  if (fp_chained_hash_table_find(t, 7)->value != 1 ||
+      fp_chained_hash_table_find(t, 6)->value != 12) {fail += 1;
+    printf("%d Expected key 7 to be updated\n", __LINE__);}
+
+  /* Remove the odd keys, which also completes any migration. */
+  for (uintptr_t k = 1; k < NUM_KEYS; k += 2)
+    fp_chained_hash_table_remove(t, k);
+  fp_chained_hash_table_remove(t, NUM_KEYS);
+  if (t->size != NUM_KEYS / 2 || t->old) {fail += 1;
+    printf("%d Expected %d elements\n", __LINE__, NUM_KEYS / 2);}
+  for (uintptr_t k = 0; k < NUM_KEYS; k++) {
+    struct fp_chained_hash_entry* ent = fp_chained_hash_table_find(t, k);
+    if ((k % 2 == 0) != (ent != NULL)) {fail += 1;
+      printf("%d Unexpected result for key %lu\n", __LINE__, (unsigned long)k);
+      break;}
+  }
+  for (uintptr_t k = 0; k < NUM_KEYS; k += 2)
+    fp_chained_hash_table_remove(t, k);
+  fp_chained_hash_table_delete(t);
+
+  /* String keys. */
+  t = fp_chained_hash_table_new(0, fp_string_hash, fp_string_eq);
+  fp_chained_hash_table_insert(t, (uintptr_t)"eth0", 1);
+  fp_chained_hash_table_insert(t, (uintptr_t)"eth1", 2);
+  char name[] = "eth1";
+  struct fp_chained_hash_entry* ent = fp_chained_hash_table_find(t, (uintptr_t)name);
+  if (!ent || ent->value != 2) {fail += 1;
+    printf("%d Expected to find eth1\n", __LINE__);}
+  fp_chained_hash_table_remove(t, (uintptr_t)"eth0");
+  fp_chained_hash_table_remove(t, (uintptr_t)"eth1");
+  fp_chained_hash_table_delete(t);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,134 @@
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "cuckoo.h"
+
+
+#define NUM_KEYS   200000
+#define NUM_STABLE 50000
+
+
+/* A 5-tuple key. */
+struct five_tuple
+{
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t  proto;
+} __attribute__((packed));
+
+
+static struct five_tuple
+make_key(uint32_t n)
+{
+  struct five_tuple k = {0x0a000000 | n, 0xc0a80000 | (n * 7), 
+                         n & 0xffff, 80, 6};
+  return k;
+}
+
+
+static struct fp_cuckoo_table* table;
+static volatile int done;
+static long misses;
+
+
+/* Repeatedly look up the stable keys, which must always be
+   found with the right value. */
+static void*
+reader(void* arg)
+{
+  while (!done) {
+    for (uint32_t n = 0; n < NUM_STABLE && !done; n++) {
+      struct five_tuple k = make_key(n);
+      if (fp_cuckoo_table_find(table, &k) != n + 1)
+        misses++;
+    }
+  }
+  return NULL;
+}
+
+
+int 
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  table = fp_cuckoo_table_new(sizeof(struct five_tuple), NUM_KEYS);
+
+  /* Fill the table. This requires displacement. */
+  uint32_t inserted = 0;
+  for (uint32_t n = 0; n < NUM_KEYS; n++) {
+    struct five_tuple k = make_key(n);
+    if (fp_cuckoo_table_insert(table, &k, n + 1) != FP_OK)
+      break;
+    inserted++;
+  }
+  if (inserted < NUM_KEYS * 9 / 10) {fail += 1;
+    printf("%d Expected to insert at least 90%% of keys (%u)\n", __LINE__, inserted);}
+  for (uint32_t n = 0; n < inserted; n++) {
+    struct five_tuple k = make_key(n);
+    if (fp_cuckoo_table_find(table, &k) != n + 1) {fail += 1;
+      printf("%d Expected to find key %u\n", __LINE__, n);
+      break;}
+  }
+  struct five_tuple absent = make_key(NUM_KEYS + 1);
+  if (fp_cuckoo_table_find(table, &absent) != 0) {fail += 1;
+    printf("%d Expected not to find an absent key\n", __LINE__);}
+
+  /* Bulk lookup. */
+  struct five_tuple keys[100];
+  void const* ptrs[100];
+  uintptr_t values[100];
+  for (int i = 0; i < 100; i++) {
+    keys[i] = make_key(i * 2);
+    ptrs[i] = &keys[i];
+  }
+  keys[99] = absent;
+  if (fp_cuckoo_table_find_n(table, ptrs, 100, values) != 99 ||
+      values[10] != 21 || values[99] != 0) {fail += 1;
+    printf("%d Expected bulk lookup to find 99 keys\n", __LINE__);}
+
+  /* Replace a value. */
+  struct five_tuple k0 = make_key(0);
+  fp_cuckoo_table_insert(table, &k0, 42);
+  if (fp_cuckoo_table_find(table, &k0) != 42) {fail += 1;
+    printf("%d Expected value to be replaced\n", __LINE__);}
+  fp_cuckoo_table_insert(table, &k0, 1);
+
+  /* Remove all but the stable keys. */
+  for (uint32_t n = NUM_STABLE; n < inserted; n++) {
+    struct five_tuple k = make_key(n);
+    fp_cuckoo_table_remove(table, &k);
+  }
+  if (table->size != NUM_STABLE) {fail += 1;
+    printf("%d Expected %d elements\n", __LINE__, NUM_STABLE);}
+
+  /* Churn the table to high load while a reader searches. */
+  pthread_t t;
+  pthread_create(&t, NULL, reader, NULL);
+  for (int round = 0; round < 4; round++) {
+    uint32_t hi = NUM_STABLE;
+    for (uint32_t n = NUM_STABLE; n < NUM_KEYS; n++, hi++) {
+      struct five_tuple k = make_key(n + round * NUM_KEYS);
+      if (fp_cuckoo_table_insert(table, &k, n + 1) != FP_OK)
+        break;
+    }
+    for (uint32_t n = NUM_STABLE; n < hi; n++) {
+      struct five_tuple k = make_key(n + round * NUM_KEYS);
+      fp_cuckoo_table_remove(table, &k);
+    }
+  }
+  done = 1;
+  pthread_join(t, NULL);
+  if (misses != 0) {fail += 1;
+    printf("%d Expected no missed lookups (%ld)\n", __LINE__, misses);}
+  if (table->size != NUM_STABLE) {fail += 1;
+    printf("%d Expected %d elements after churn\n", __LINE__, NUM_STABLE);}
+
+  fp_cuckoo_table_delete(table);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,190 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "packet.h"
+#include "port.h"
+
+
+#define KEY_SIZE 16
+
+#define REG(n) (~(int32_t)(n))
+#define R(n)   REG(FP_PROKEX_R0 + (n))
+
+
+/* The key extracted by the test program. */
+struct key
+{
+  uint32_t in_port;
+  uint16_t eth_type;
+  uint16_t pad;
+  uint32_t src;
+  uint32_t dst;
+};
+
+
+/* Extract the input port and Ethernet type, and the IPv4
+   addresses of IPv4 packets. Other packets get a destination
+   of all ones. */
+static struct fp_prokex_insn const program[] = {
+  {FP_PROKEX_EXT,   4, 0, REG(FP_PROKEX_IP), 0, 0},
+  {FP_PROKEX_EXT,   2, 0, 12, 4, 0},
+  {FP_PROKEX_READ,  2, 0, 12, R(0), 0},
+  {FP_PROKEX_JNE,   0, 7, R(0), 0, 0x0800},
+  {FP_PROKEX_EXT,   4, 0, 26, 8, 0},
+  {FP_PROKEX_EXT,   4, 0, 30, 12, 0},
+  {FP_PROKEX_HALT,  0, 0, 0, 0, 0},
+  {FP_PROKEX_WRITE, 4, 0, 0, 12, 0xffffffff},
+};
+
+#define PROGRAM_LEN (sizeof(program) / sizeof(program[0]))
+
+
+static unsigned char ipv4[64] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0x08, 0x00,
+  0x45, 0, 0, 46, 0, 0, 0, 0, 64, 17, 0, 0,
+  10, 0, 0, 1,
+  192, 168, 0, 2,
+};
+
+static unsigned char arp[64] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0x08, 0x06,
+};
+
+
+/* Run the decoder on n bytes of the data in a fresh context
+   arriving on the given port. */
+static struct key
+run(struct fp_decoder* d, unsigned char* data, int n, fp_port_id_t port,
+    struct fp_context* cxt)
+{
+  static unsigned char key[FP_PACKET_KEY_SIZE];
+  static struct fp_packet pkt;
+  memset(key, 0, sizeof(key));
+  pkt.data = data;
+  pkt.size = n;
+  struct fp_arrival arr = {port, port, 0, FP_PORT_DROP};
+  fp_context_init(cxt, &pkt, arr);
+  cxt->key = (struct fp_base_key*)key;
+  fp_decoder_run(d, cxt);
+  struct key k;
+  memcpy(&k, key, sizeof(k));
+  return k;
+}
+
+
+/* Returns true if the single instruction is rejected. */
+static bool
+rejects(struct fp_prokex_insn i)
+{
+  fp_error_t err;
+  struct fp_decoder* d = fp_decoder_new(&i, 1, KEY_SIZE, &err);
+  fp_decoder_delete(d);
+  return !d && err == FP_BAD_DECODER;
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  fp_error_t err;
+  struct fp_decoder* d = fp_decoder_new(program, PROGRAM_LEN, KEY_SIZE, &err);
+  if (!d || err != FP_OK) {
+    printf("%d Expected the program to verify\n", __LINE__);
+    return -1;
+  }
+  if (d->extent != 34 || d->nscratch != 1) {fail += 1;
+    printf("%d Expected an extent of 34 and 1 scratch register\n", __LINE__);}
+
+  /* Extraction and branching. */
+  struct fp_context cxt;
+  struct key k = run(d, ipv4, sizeof(ipv4), 3, &cxt);
+  if (k.in_port != 3 || k.eth_type != 0x0008 ||
+      k.src != 0x0100000a || k.dst != 0x0200a8c0) {fail += 1;
+    printf("%d Expected the IPv4 key\n", __LINE__);}
+  if (cxt.regs[4] != 0x0800) {fail += 1;
+    printf("%d Expected $r0 to hold the Ethernet type\n", __LINE__);}
+  if (cxt.out_port != FP_PORT_DROP || cxt.regs[FP_PROKEX_OP] != FP_PORT_DROP) {fail += 1;
+    printf("%d Expected $op to start as the drop port\n", __LINE__);}
+  k = run(d, arp, sizeof(arp), 4, &cxt);
+  if (k.in_port != 4 || k.eth_type != 0x0608 || k.src != 0 || k.dst != 0xffffffff) {fail += 1;
+    printf("%d Expected the non-IPv4 key\n", __LINE__);}
+
+  /* Short packets are padded with zeros. */
+  k = run(d, ipv4, 30, 5, &cxt);
+  if (k.src != 0x0100000a || k.dst != 0) {fail += 1;
+    printf("%d Expected a short packet to be padded\n", __LINE__);}
+
+  /* A compiled program extracts the same keys. */
+  struct fp_decoder* c = fp_decoder_new(program, PROGRAM_LEN, KEY_SIZE, &err);
+  if (!c || fp_error(fp_decoder_compile(c)) || !c->native) {fail += 1;
+    printf("%d Expected the program to compile\n", __LINE__);}
+  else {
+    unsigned char* pkts[] = {ipv4, arp, ipv4};
+    int sizes[] = {sizeof(ipv4), sizeof(arp), 30};
+    for (int i = 0; i < 3; ++i) {
+      struct fp_context cc;
+      struct key ki = run(d, pkts[i], sizes[i], i, &cxt);
+      struct key kc = run(c, pkts[i], sizes[i], i, &cc);
+      if (memcmp(&ki, &kc, sizeof(ki)) || cxt.regs[4] != cc.regs[4]) {fail += 1;
+        printf("%d Expected compiled and interpreted keys to match\n", __LINE__);}
+    }
+  }
+  fp_decoder_delete(c);
+  fp_decoder_delete(d);
+
+  /* Writing registers, and clearing scratch registers, both
+     interpreted and compiled. */
+  struct fp_prokex_insn const regs[] = {
+    {FP_PROKEX_EXT,   8, 0, R(5), 0, 0},
+    {FP_PROKEX_WRITE, 4, 0, 0, R(5), 42},
+    {FP_PROKEX_READ,  8, 0, R(5), REG(FP_PROKEX_OP), 0},
+  };
+  d = fp_decoder_new(regs, 3, KEY_SIZE, &err);
+  if (!d) {fail += 1;
+    printf("%d Expected the register program to verify\n", __LINE__);}
+  else {
+    for (int native = 0; native < 2; ++native) {
+      if (native && fp_error(fp_decoder_compile(d))) {fail += 1;
+        printf("%d Expected the register program to compile\n", __LINE__);}
+      run(d, arp, sizeof(arp), 1, &cxt);
+      uint64_t first;
+      memcpy(&first, cxt.key, 8);
+      run(d, arp, sizeof(arp), 1, &cxt);
+      uint64_t second;
+      memcpy(&second, cxt.key, 8);
+      if (first != 0 || second != 0 || cxt.out_port != 42) {fail += 1;
+        printf("%d Expected cleared scratch registers and $op to be written\n", __LINE__);}
+    }
+    fp_decoder_delete(d);
+  }
+
+  /* Verification. */
+  struct fp_prokex_insn const bad[] = {
+    {42, 0, 0, 0, 0, 0},                          /* Bad opcode. */
+    {FP_PROKEX_EXT, 0, 0, 0, 0, 0},               /* Empty. */
+    {FP_PROKEX_EXT, 4, 0, 0, 14, 0},              /* Past the key. */
+    {FP_PROKEX_EXT, 4, 0, 254, 0, 0},             /* Past the extent. */
+    {FP_PROKEX_EXT, 4, 0, REG(10), 0, 0},         /* Bad register. */
+    {FP_PROKEX_EXT, 3, 0, R(0), 0, 0},            /* Bad store length. */
+    {FP_PROKEX_EXT, 4, 0, 0, REG(FP_PROKEX_OP), 0}, /* Register destination. */
+    {FP_PROKEX_READ, 9, 0, 0, R(0), 0},           /* Too long. */
+    {FP_PROKEX_READ, 2, 0, 0, 0, 0},              /* Key destination. */
+    {FP_PROKEX_WRITE, 4, 0, 0, REG(64), 0},       /* Bad register. */
+    {FP_PROKEX_JEQ, 0, 1, 0, 0, 0},               /* Packet operand. */
+    {FP_PROKEX_JUMP, 0, 0, 0, 0, 0},              /* Backward branch. */
+    {FP_PROKEX_JUMP, 0, 2, 0, 0, 0},              /* Out of range. */
+  };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+    if (!rejects(bad[i])) {fail += 1;
+      printf("%d Expected instruction %zu to be rejected\n", __LINE__, i);}
+  struct fp_prokex_insn const jump = {FP_PROKEX_JUMP, 0, 1, 0, 0, 0};
+  if (rejects(jump)) {fail += 1;
+    printf("%d Expected a branch to the end to verify\n", __LINE__);}
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,99 @@
+
+#include <stdio.h>
+
+#include "emc.h"
+
+
+#define NUM_HOT    1000
+#define NUM_COLD   2000
+#define NUM_ROUNDS 20
+
+
+/* A 5-tuple key. */
+struct five_tuple
+{
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+  uint32_t proto;
+};
+
+
+static struct five_tuple
+make_key(uint32_t n)
+{
+  struct five_tuple k = {0x0a000000 | n, 0xc0a80000 | (n * 7),
+                         n & 0xffff, 80, 6};
+  return k;
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  struct fp_emc* c = fp_emc_new(sizeof(struct five_tuple));
+
+  /* Insert, hit, and update. */
+  struct five_tuple k1 = make_key(1);
+  struct five_tuple k2 = make_key(2);
+  if (fp_emc_lookup(c, &k1) != 0) {fail += 1;
+    printf("%d Expected a miss in an empty cache\n", __LINE__);}
+  fp_emc_insert(c, &k1, 10);
+  if (fp_emc_lookup(c, &k1) != 10 || fp_emc_lookup(c, &k2) != 0) {fail += 1;
+    printf("%d Expected a hit for the cached key only\n", __LINE__);}
+  fp_emc_insert(c, &k1, 11);
+  if (fp_emc_lookup(c, &k1) != 11) {fail += 1;
+    printf("%d Expected the entry to be updated\n", __LINE__);}
+  if (c->hits != 2 || c->misses != 2) {fail += 1;
+    printf("%d Expected 2 hits and 2 misses\n", __LINE__);}
+
+  /* Invalidation. A result computed before the invalidation
+     must not be cached as valid afterwards. */
+  fp_emc_invalidate();
+  if (fp_emc_lookup(c, &k1) != 0) {fail += 1;
+    printf("%d Expected invalidation to drop the entry\n", __LINE__);}
+  fp_emc_insert(c, &k1, 12);
+  if (fp_emc_lookup(c, &k1) != 12) {fail += 1;
+    printf("%d Expected the entry to be re-cached\n", __LINE__);}
+  fp_emc_lookup(c, &k2);
+  fp_emc_invalidate();
+  fp_emc_insert(c, &k2, 20);
+  if (fp_emc_lookup(c, &k2) != 0) {fail += 1;
+    printf("%d Expected a stale insertion to be invalid\n", __LINE__);}
+
+  /* Hot flows that are hit regularly survive a stream of
+     one-shot flows that together exceed the cache. */
+  fp_emc_clear(c);
+  for (uint32_t n = 0; n < NUM_HOT; n++) {
+    struct five_tuple k = make_key(n);
+    fp_emc_lookup(c, &k);
+    fp_emc_insert(c, &k, n + 1);
+  }
+  uint32_t cold = 1 << 20;
+  int hot_hits = 0;
+  for (int round = 0; round < NUM_ROUNDS; round++) {
+    for (uint32_t n = 0; n < NUM_HOT; n++) {
+      struct five_tuple k = make_key(n);
+      uintptr_t v = fp_emc_lookup(c, &k);
+      if (v == n + 1)
+        hot_hits++;
+      else
+        fp_emc_insert(c, &k, n + 1);
+    }
+    for (uint32_t n = 0; n < NUM_COLD; n++, cold++) {
+      struct five_tuple k = make_key(cold);
+      if (!fp_emc_lookup(c, &k))
+        fp_emc_insert(c, &k, 1);
+    }
+  }
+  if (hot_hits < NUM_HOT * NUM_ROUNDS * 9 / 10) {fail += 1;
+    printf("%d Expected hot flows to stay cached (%d hits)\n", __LINE__, hot_hits);}
+
+  fp_emc_delete(c);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
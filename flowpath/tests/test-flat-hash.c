@@ -0,0 +1,95 @@
+
+#include <stdio.h>
+
+#include "hash.h"
+
+
+#define NUM_KEYS 100000
+
+
+int 
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  struct fp_flat_hash_table* t = fp_flat_hash_table_new(17, fp_uint_hash, fp_uint_eq);
+  for (uintptr_t k = 0; k < NUM_KEYS; k++)
+    fp_flat_hash_table_insert(t, k, k * 2);
+  if (t->size != NUM_KEYS) {fail += 1;
+    printf("%d Expected %d elements\n", __LINE__, NUM_KEYS);}
+  if (fp_flat_hash_table_load(t) > 0.875) {fail += 1;
+    printf("%d Expected load factor at most 7/8\n", __LINE__);}
+
+  /* Every key is found with its value. */
+  for (uintptr_t k = 0; k < NUM_KEYS; k++) {
+    struct fp_flat_hash_entry* ent = fp_flat_hash_table_find(t, k);
+    if (!ent || ent->value != k * 2) {fail += 1;
+      printf("%d Expected to find key %lu\n", __LINE__, (unsigned long)k);
+      break;}
+  }
+  if (fp_flat_hash_table_find(t, NUM_KEYS) != NULL) {fail += 1;
+    printf("%d Expected not to find key %d\n", __LINE__, NUM_KEYS);}
+
+  /* Inserting an existing key replaces its value. */
+  fp_flat_hash_table_insert(t, 7, 1);
+  if (t->size != NUM_KEYS || fp_flat_hash_table_find(t, 7)->value != 1) {
+    fail += 1; printf("%d Expected key 7 to be replaced\n", __LINE__);}
+  fp_flat_hash_table_update(t, 7, 14);
+  if (fp_flat_hash_table_find(t, 7)->value != 14) {fail += 1;
+    printf("%d Expected key 7 to be updated\n", __LINE__);}
+
+  /* Remove the odd keys. Even keys must remain reachable after
+     entries are shifted back. */
+  for (uintptr_t k = 1; k < NUM_KEYS; k += 2)
+    fp_flat_hash_table_remove(t, k);
+  fp_flat_hash_table_remove(t, NUM_KEYS);
+  if (t->size != NUM_KEYS / 2) {fail += 1;
+    printf("%d Expected %d elements\n", __LINE__, NUM_KEYS / 2);}
+  for (uintptr_t k = 0; k < NUM_KEYS; k++) {
+    struct fp_flat_hash_entry* ent = fp_flat_hash_table_find(t, k);
+    if ((k % 2 == 0) != (ent != NULL)) {fail += 1;
+      printf("%d Unexpected result for key %lu\n", __LINE__, (unsigned long)k);
+      break;}
+  }
+
+  /* Iteration visits every entry exactly once. */
+  size_t pos = 0;
+  size_t count = 0;
+  uintptr_t sum = 0;
+  struct fp_flat_hash_entry* ent;
+  while ((ent = fp_flat_hash_table_next(t, &pos))) {
+    count++;
+    sum += ent->key;
+  }
+  if (count != NUM_KEYS / 2 || sum != (uintptr_t)(NUM_KEYS / 2 - 1) * (NUM_KEYS / 2)) {
+    fail += 1; printf("%d Expected to visit every entry once\n", __LINE__);}
+
+  /* Churn: many insertions and removals do not leave residue. */
+  for (int round = 0; round < 10; round++) {
+    for (uintptr_t k = 1; k < NUM_KEYS; k += 2)
+      fp_flat_hash_table_insert(t, k + round * NUM_KEYS, k);
+    for (uintptr_t k = 1; k < NUM_KEYS; k += 2)
+      fp_flat_hash_table_remove(t, k + round * NUM_KEYS);
+  }
+  if (t->size != NUM_KEYS / 2) {fail += 1;
+    printf("%d Expected %d elements after churn\n", __LINE__, NUM_KEYS / 2);}
+  for (uintptr_t k = 0; k < NUM_KEYS; k += 2) {
+    if (!fp_flat_hash_table_find(t, k)) {fail += 1;
+      printf("%d Expected to find key %lu after churn\n", __LINE__, (unsigned long)k);
+      break;}
+  }
+  fp_flat_hash_table_delete(t);
+
+  /* String keys. */
+  t = fp_flat_hash_table_new(0, fp_string_hash, fp_string_eq);
+  fp_flat_hash_table_insert(t, (uintptr_t)"eth0", 1);
+  fp_flat_hash_table_insert(t, (uintptr_t)"eth1", 2);
+  char name[] = "eth1";
+  ent = fp_flat_hash_table_find(t, (uintptr_t)name);
+  if (!ent || ent->value != 2) {fail += 1;
+    printf("%d Expected to find eth1\n", __LINE__);}
+  fp_flat_hash_table_delete(t);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,136 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hashfn.h"
+
+
+#define NUM_BUCKETS 256
+#define NUM_KEYS    (NUM_BUCKETS * 256)
+
+
+typedef uint64_t (*hash_fn)(void const*, size_t, uint64_t);
+
+
+/* Returns the number of differing bits. */
+static int
+distance(uint64_t a, uint64_t b)
+{
+  return __builtin_popcountll(a ^ b);
+}
+
+
+/* Returns the average number of output bits changed by flipping
+   each bit of an n-byte key. */
+static double
+avalanche(hash_fn hash, size_t n)
+{
+  unsigned char key[128];
+  for (size_t i = 0; i < n; ++i)
+    key[i] = (unsigned char)(i * 29 + 7);
+  uint64_t h = hash(key, n, FP_HASH_SEED);
+  long total = 0;
+  for (size_t i = 0; i < n * 8; ++i) {
+    key[i / 8] ^= 1 << (i % 8);
+    total += distance(h, hash(key, n, FP_HASH_SEED));
+    key[i / 8] ^= 1 << (i % 8);
+  }
+  return (double)total / (n * 8);
+}
+
+
+/* Returns the number of prefixes of a buffer, up to 128 bytes
+   long, whose hashes collide with that of a shorter prefix. */
+static int
+prefix_collisions(hash_fn hash)
+{
+  unsigned char key[128] = {0};
+  uint64_t h[129];
+  int n = 0;
+  for (size_t i = 0; i <= 128; ++i) {
+    h[i] = hash(key, i, FP_HASH_SEED);
+    for (size_t j = 0; j < i; ++j)
+      n += h[i] == h[j];
+  }
+  return n;
+}
+
+
+/* Returns the size of the fullest bucket when hashes of
+   consecutive integers are indexed by the low bits. */
+static int
+worst_bucket(hash_fn hash)
+{
+  int counts[NUM_BUCKETS] = {0};
+  int worst = 0;
+  for (uint32_t i = 0; i < NUM_KEYS; ++i) {
+    size_t b = fp_hash_bucket(hash(&i, sizeof(i), FP_HASH_SEED), NUM_BUCKETS);
+    if (++counts[b] > worst)
+      worst = counts[b];
+  }
+  return worst;
+}
+
+
+static uint64_t
+mix(void const* p, size_t n, uint64_t seed)
+{
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return fp_hash_mix64(x ^ seed);
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  /* CRC32C check value. */
+  if (fp_crc32c(0, "123456789", 9) != 0xe3069283 ||
+      fp_crc32c(fp_crc32c(0, "1234", 4), "56789", 5) != 0xe3069283) {fail += 1;
+    printf("%d Expected the CRC32C check value\n", __LINE__);}
+
+  /* Hashes are deterministic and depend on the seed. */
+  char const* s = "the quick brown fox jumps over the lazy dog";
+  size_t n = strlen(s);
+  hash_fn fns[] = {fp_hash_bytes, fp_hash_crc};
+  for (int f = 0; f < 2; ++f) {
+    if (fns[f](s, n, 1) != fns[f](s, n, 1)) {fail += 1;
+      printf("%d Expected hash %d to be deterministic\n", __LINE__, f);}
+    if (fns[f](s, n, 1) == fns[f](s, n, 2)) {fail += 1;
+      printf("%d Expected hash %d to depend on the seed\n", __LINE__, f);}
+    int c = prefix_collisions(fns[f]);
+    if (c) {fail += 1;
+      printf("%d Expected zero-filled keys of hash %d to differ by length (%d)\n",
+             __LINE__, f, c);}
+    int w = worst_bucket(fns[f]);
+    if (w > 2 * NUM_KEYS / NUM_BUCKETS) {fail += 1;
+      printf("%d Expected hash %d to spread integers (%d)\n", __LINE__, f, w);}
+  }
+
+  /* Each input bit flips about half of the output bits, for
+     every path through the byte hash. */
+  size_t lens[] = {1, 3, 4, 8, 13, 16, 17, 40, 48, 49, 100, 128};
+  for (int i = 0; i < 12; ++i) {
+    double a = avalanche(fp_hash_bytes, lens[i]);
+    if (a < 28 || a > 36) {fail += 1;
+      printf("%d Expected avalanche for %zu bytes (%.1f bits)\n", __LINE__, lens[i], a);}
+  }
+  double a = avalanche(mix, 4);
+  if (a < 28 || a > 36) {fail += 1;
+    printf("%d Expected the integer mixer to avalanche (%.1f bits)\n", __LINE__, a);}
+  int w = worst_bucket(mix);
+  if (w > 2 * NUM_KEYS / NUM_BUCKETS) {fail += 1;
+    printf("%d Expected the integer mixer to spread integers (%d)\n", __LINE__, w);}
+
+  /* Bucket counts. */
+  if (fp_hash_pow2(0) != 1 || fp_hash_pow2(1) != 1 || fp_hash_pow2(17) != 32 ||
+      fp_hash_pow2(64) != 64) {fail += 1;
+    printf("%d Expected powers of 2\n", __LINE__);}
+  if (fp_hash_bucket(0x12345, 256) != 0x45) {fail += 1;
+    printf("%d Expected the low bits\n", __LINE__);}
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,117 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "latency.h"
+
+
+#define NUM_THREADS 4
+#define NUM_TIMES   100000
+
+
+struct thread
+{
+  pthread_t              thread;
+  int                    shard;
+  struct fp_stats_block* block;
+};
+
+
+/* Record NUM_TIMES times of 1 to 1000 cycles in the total
+   stage. */
+static void*
+record(void* arg)
+{
+  struct thread* t = (struct thread*)arg;
+  fp_stats_set_shard(t->shard);
+  for (int i = 0; i < NUM_TIMES; ++i)
+    fp_latency_record(t->block, FP_STAGE_TOTAL, 1000, 1001 + i % 1000, 1);
+  return NULL;
+}
+
+
+int
+main()
+{
+  int fail = 0;
+
+  /* Buckets are ordered, and each value is within 1/32 of the
+     greatest value of its bucket. */
+  int prev = 0;
+  for (uint64_t v = 0; v < (1 << 20); ++v) {
+    int b = fp_hist_bucket(v);
+    uint64_t hi = fp_hist_value(b);
+    if (b < prev || b >= FP_HIST_BUCKETS || hi < v || (hi - v) * 32 > v) {fail += 1;
+      printf("%d Expected %lu to be near its bucket\n", __LINE__, (unsigned long)v);
+      break;
+    }
+    prev = b;
+  }
+  for (int b = 0; b < FP_HIST_BUCKETS; ++b)
+    if (fp_hist_bucket(fp_hist_value(b)) != b) {fail += 1;
+      printf("%d Expected bucket %d to hold its greatest value\n", __LINE__, b);
+      break;
+    }
+  if (fp_hist_bucket((uint64_t)1 << FP_HIST_MAX_BITS) != FP_HIST_BUCKETS - 1 ||
+      fp_hist_bucket(UINT64_MAX) != FP_HIST_BUCKETS - 1) {fail += 1;
+    printf("%d Expected large values in the last bucket\n", __LINE__);}
+
+  /* Quantiles of 1 to 1000. */
+  static uint64_t h[FP_HIST_BUCKETS];
+  if (fp_hist_quantile(h, 0.5) != 0 || fp_hist_max(h) != 0) {fail += 1;
+    printf("%d Expected an empty histogram to have no quantiles\n", __LINE__);}
+  for (uint64_t v = 1; v <= 1000; ++v)
+    ++h[fp_hist_bucket(v)];
+  uint64_t p50 = fp_hist_quantile(h, 0.5);
+  uint64_t p99 = fp_hist_quantile(h, 0.99);
+  uint64_t p999 = fp_hist_quantile(h, 0.999);
+  if (fp_hist_count(h) != 1000 || p50 < 500 || p50 > 516 ||
+      p99 < 990 || p99 > 1022 || p999 < 999 || p999 > 1023 ||
+      fp_hist_max(h) < 1000 || fp_hist_quantile(h, 0) != 1) {fail += 1;
+    printf("%d Expected quantiles of 1 to 1000\n", __LINE__);}
+
+  /* Recording in a block. */
+  struct fp_stats_block b;
+  fp_stats_block_init(&b, FP_LATENCY_BLOCK_SIZE);
+  fp_latency_record(&b, FP_STAGE_EGRESS, 100, 150, 5);
+  fp_latency_record(&b, FP_STAGE_EGRESS, 0, 150, 5);
+  fp_latency_record(&b, FP_STAGE_EGRESS, 150, 100, 5);
+  fp_latency_read(&b, FP_STAGE_EGRESS, h);
+  if (fp_hist_count(h) != 5 || fp_hist_quantile(h, 0.5) != 50) {fail += 1;
+    printf("%d Expected 5 times of 50 cycles\n", __LINE__);}
+  fp_latency_read(&b, FP_STAGE_RECEIVE, h);
+  if (fp_hist_count(h)) {fail += 1;
+    printf("%d Expected other stages to be empty\n", __LINE__);}
+
+  /* Times recorded by several shards are aggregated. */
+  int shards[NUM_THREADS] = {0, 1, FP_STATS_SHARED, FP_STATS_SHARED};
+  struct thread threads[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; ++i) {
+    threads[i].shard = shards[i];
+    threads[i].block = &b;
+    pthread_create(&threads[i].thread, NULL, record, &threads[i]);
+  }
+  for (int i = 0; i < NUM_THREADS; ++i)
+    pthread_join(threads[i].thread, NULL);
+  fp_latency_read(&b, FP_STAGE_TOTAL, h);
+  if (fp_hist_count(h) != NUM_THREADS * NUM_TIMES ||
+      fp_hist_quantile(h, 0.5) < 500 || fp_hist_quantile(h, 0.5) > 516) {fail += 1;
+    printf("%d Expected times from every shard\n", __LINE__);}
+
+  /* Resetting empties every stage. */
+  fp_latency_reset(&b);
+  for (int s = 0; s < FP_LATENCY_STAGES; ++s) {
+    fp_latency_read(&b, s, h);
+    if (fp_hist_count(h)) {fail += 1;
+      printf("%d Expected stage %d to be empty\n", __LINE__, s);}
+  }
+  fp_stats_block_clear(&b);
+
+  /* The clock advances. */
+  uint64_t c = fp_cycles();
+  if (fp_cycles_per_ns() <= 0 || fp_cycles() < c) {fail += 1;
+    printf("%d Expected a calibrated clock\n", __LINE__);}
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,85 @@
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "mempool.h"
+
+
+#define NUM_OBJS   1024
+#define NUM_ROUNDS 10000
+
+
+/* Repeatedly allocate and free bursts of objects. */
+static void*
+churn(void* arg)
+{
+  struct fp_mempool* p = (struct fp_mempool*)arg;
+  void* objs[32];
+  for (int i = 0; i < NUM_ROUNDS; i++) {
+    if (fp_mempool_get_bulk(p, objs, 32) != 32)
+      continue;
+    for (int j = 0; j < 32; j++)
+      *(int*)objs[j] = j;
+    fp_mempool_put_bulk(p, objs, 32);
+  }
+  return NULL;
+}
+
+
+int 
+main(int argc, char** argv)
+{
+  static void* objs[NUM_OBJS + 1];
+  int fail = 0;
+
+  struct fp_mempool* p = fp_mempool_create(100, NUM_OBJS);
+  if (p->size != 128) {fail += 1;
+    printf("%d Expected object size to be rounded to 128\n", __LINE__);}
+
+  /* Exhaust the pool one object at a time. */
+  for (int i = 0; i < NUM_OBJS; i++) {
+    objs[i] = fp_mempool_get(p);
+    if (objs[i] == NULL) {fail += 1;
+      printf("%d Expected to allocate object %d\n", __LINE__, i);}
+    if ((size_t)objs[i] % FP_MEMPOOL_ALIGN != 0) {fail += 1;
+      printf("%d Expected object %d to be aligned\n", __LINE__, i);}
+  }
+  if (fp_mempool_get(p) != NULL) {fail += 1;
+    printf("%d Expected pool to be exhausted\n", __LINE__);}
+  if (fp_mempool_available(p) != 0) {fail += 1;
+    printf("%d Expected no objects available\n", __LINE__);}
+
+  /* Objects must be distinct. */
+  for (int i = 1; i < NUM_OBJS; i++) {
+    if (objs[i] == objs[i - 1]) {fail += 1;
+      printf("%d Expected object %d to be distinct\n", __LINE__, i);}
+  }
+
+  /* Return everything in bulk, which overflows the cache. */
+  fp_mempool_put_bulk(p, objs, NUM_OBJS);
+  if (fp_mempool_available(p) != NUM_OBJS) {fail += 1;
+    printf("%d Expected all objects available\n", __LINE__);}
+
+  /* Bulk allocation is all or nothing. */
+  if (fp_mempool_get_bulk(p, objs, NUM_OBJS + 1) != 0) {fail += 1;
+    printf("%d Expected oversized bulk allocation to fail\n", __LINE__);}
+  if (fp_mempool_get_bulk(p, objs, 100) != 100) {fail += 1;
+    printf("%d Expected to allocate 100 objects\n", __LINE__);}
+  if (fp_mempool_available(p) != NUM_OBJS - 100) {fail += 1;
+    printf("%d Expected %d objects available\n", __LINE__, NUM_OBJS - 100);}
+  fp_mempool_put_bulk(p, objs, 100);
+
+  /* Several threads sharing the pool. */
+  pthread_t threads[4];
+  for (int i = 0; i < 4; i++)
+    pthread_create(&threads[i], NULL, churn, p);
+  for (int i = 0; i < 4; i++)
+    pthread_join(threads[i], NULL);
+  if (fp_mempool_available(p) != NUM_OBJS) {fail += 1;
+    printf("%d Expected all objects available after threads\n", __LINE__);}
+
+  fp_mempool_delete(p);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
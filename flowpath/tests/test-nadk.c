@@ -295,7 +295,7 @@ dataplane_test(struct fp_dataplane* dp,
                struct fp_port* port1, struct fp_port* port2) {
   struct fp_packet* pkt;
   // Process any packets from Port 1:
-  struct fp_arrival arrival1 = {port1->id, port1->id, 0};
+  struct fp_arrival arrival1 = {port1->id, port1->id, 0, port1->index};
   pkt = fp_port_recv_packet(port1);
   if (pkt) {
     dp->pipeline->insert(dp, pkt, arrival1);
@@ -303,7 +303,7 @@ dataplane_test(struct fp_dataplane* dp,
   }
 
   // Process any packets from Port 2:
-  struct fp_arrival arrival2 = {port2->id, port2->id, 0};
+  struct fp_arrival arrival2 = {port2->id, port2->id, 0, port2->index};
   pkt = fp_port_recv_packet(port2);
   if (pkt) {
     dp->pipeline->insert(dp, pkt, arrival2);
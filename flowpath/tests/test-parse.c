@@ -0,0 +1,230 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include "parse.h"
+#include "packet.h"
+
+
+/* A test packet and the expected parse. */
+struct sample
+{
+  unsigned char data[128];
+  int           size;
+  uint16_t      flags;
+  uint16_t      eth_type;
+  uint8_t       ip_proto;
+  uint16_t      l3;
+  uint16_t      l4;
+  uint16_t      payload;
+};
+
+
+#define NUM_SAMPLES 10
+
+static struct sample samples[NUM_SAMPLES];
+
+
+/* Append the Ethernet header, with the given tags, to the packet
+   and return the offset of the next header. */
+static int
+put_ethernet(unsigned char* d, uint16_t const* tags, int ntags, uint16_t type)
+{
+  memset(d, 0xaa, 12);
+  int off = 12;
+  for (int i = 0; i < ntags; ++i) {
+    d[off] = tags[i] >> 8;
+    d[off + 1] = tags[i] & 0xff;
+    d[off + 2] = 0x00;
+    d[off + 3] = 100 + i;
+    off += 4;
+  }
+  d[off] = type >> 8;
+  d[off + 1] = type & 0xff;
+  return off + 2;
+}
+
+
+/* Append an IPv4 header with ihl words and the fragment offset. */
+static int
+put_ipv4(unsigned char* d, int off, int ihl, uint8_t proto, uint16_t frag)
+{
+  memset(d + off, 0, ihl * 4);
+  d[off] = 0x40 | ihl;
+  d[off + 6] = frag >> 8;
+  d[off + 7] = frag & 0xff;
+  d[off + 9] = proto;
+  return off + ihl * 4;
+}
+
+
+static int
+put_ipv6(unsigned char* d, int off, uint8_t next)
+{
+  memset(d + off, 0, 40);
+  d[off] = 0x60;
+  d[off + 6] = next;
+  return off + 40;
+}
+
+
+static int
+put_tcp(unsigned char* d, int off, int doff)
+{
+  memset(d + off, 0, doff * 4);
+  d[off + 12] = doff << 4;
+  return off + doff * 4;
+}
+
+
+static int
+put_udp(unsigned char* d, int off)
+{
+  memset(d + off, 0, 8);
+  return off + 8;
+}
+
+
+static void
+expect(struct sample* s, int size, uint16_t flags, uint16_t type, uint8_t proto,
+       int l3, int l4, int payload)
+{
+  s->size = size;
+  s->flags = flags;
+  s->eth_type = type;
+  s->ip_proto = proto;
+  s->l3 = l3;
+  s->l4 = l4;
+  s->payload = payload;
+}
+
+
+static void
+make_samples()
+{
+  uint16_t one[] = {0x8100};
+  uint16_t two[] = {0x88a8, 0x8100};
+  struct sample* s = samples;
+  int l3, l4, end;
+
+  /* Ethernet, IPv4, TCP. */
+  l3 = put_ethernet(s->data, NULL, 0, 0x0800);
+  l4 = put_ipv4(s->data, l3, 5, 6, 0);
+  end = put_tcp(s->data, l4, 5);
+  expect(s++, end + 10, FP_PARSE_ETH | FP_PARSE_IPV4 | FP_PARSE_TCP, 0x0800, 6, l3, l4, end);
+
+  /* VLAN, IPv4 with options, UDP. */
+  l3 = put_ethernet(s->data, one, 1, 0x0800);
+  l4 = put_ipv4(s->data, l3, 7, 17, 0);
+  end = put_udp(s->data, l4);
+  expect(s++, end, FP_PARSE_ETH | FP_PARSE_VLAN | FP_PARSE_IPV4 | FP_PARSE_UDP,
+         0x0800, 17, l3, l4, end);
+
+  /* QinQ, IPv6, UDP. */
+  l3 = put_ethernet(s->data, two, 2, 0x86dd);
+  l4 = put_ipv6(s->data, l3, 17);
+  end = put_udp(s->data, l4);
+  expect(s++, end, FP_PARSE_ETH | FP_PARSE_VLAN | FP_PARSE_QINQ | FP_PARSE_IPV6 | FP_PARSE_UDP,
+         0x86dd, 17, l3, l4, end);
+
+  /* Ethernet, IPv6, TCP with options. */
+  l3 = put_ethernet(s->data, NULL, 0, 0x86dd);
+  l4 = put_ipv6(s->data, l3, 6);
+  end = put_tcp(s->data, l4, 8);
+  expect(s++, end, FP_PARSE_ETH | FP_PARSE_IPV6 | FP_PARSE_TCP, 0x86dd, 6, l3, l4, end);
+
+  /* ARP. */
+  l3 = put_ethernet(s->data, NULL, 0, 0x0806);
+  expect(s++, 60, FP_PARSE_ETH, 0x0806, 0, 14, 0, 0);
+
+  /* A non-initial IPv4 fragment. */
+  l3 = put_ethernet(s->data, NULL, 0, 0x0800);
+  l4 = put_ipv4(s->data, l3, 5, 6, 0x00b9);
+  expect(s++, l4 + 8, FP_PARSE_ETH | FP_PARSE_IPV4 | FP_PARSE_FRAGMENT, 0x0800, 6, l3, l4, 0);
+
+  /* A truncated IPv4 header. */
+  l3 = put_ethernet(s->data, NULL, 0, 0x0800);
+  put_ipv4(s->data, l3, 5, 6, 0);
+  expect(s++, l3 + 10, FP_PARSE_ETH | FP_PARSE_TRUNCATED, 0x0800, 0, l3, 0, 0);
+
+  /* A truncated TCP header. */
+  l3 = put_ethernet(s->data, one, 1, 0x0800);
+  l4 = put_ipv4(s->data, l3, 5, 6, 0);
+  put_tcp(s->data, l4, 5);
+  expect(s++, l4 + 12, FP_PARSE_ETH | FP_PARSE_VLAN | FP_PARSE_IPV4 | FP_PARSE_TRUNCATED,
+         0x0800, 6, l3, l4, 0);
+
+  /* A runt. */
+  expect(s++, 10, FP_PARSE_TRUNCATED, 0, 0, 0, 0, 0);
+
+  /* IPv6 with an extension header. */
+  l3 = put_ethernet(s->data, NULL, 0, 0x86dd);
+  l4 = put_ipv6(s->data, l3, 0);
+  expect(s++, l4 + 8, FP_PARSE_ETH | FP_PARSE_IPV6, 0x86dd, 0, l3, l4, 0);
+}
+
+
+/* Returns true if the ith result matches the sample. */
+static bool
+check(struct fp_parse const* r, int i, struct sample const* s)
+{
+  if (r->flags[i] != s->flags || r->eth_type[i] != s->eth_type ||
+      r->ip_proto[i] != s->ip_proto)
+    return false;
+  if ((s->flags & (FP_PARSE_IPV4 | FP_PARSE_IPV6)) && r->l3[i] != s->l3)
+    return false;
+  if ((s->flags & (FP_PARSE_IPV4 | FP_PARSE_IPV6)) && r->l4[i] != s->l4)
+    return false;
+  if ((s->flags & (FP_PARSE_TCP | FP_PARSE_UDP)) && r->payload[i] != s->payload)
+    return false;
+  if ((s->flags & FP_PARSE_VLAN) && r->vlan[i] != 100)
+    return false;
+  return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  make_samples();
+
+  /* Each sample on its own. */
+  struct fp_parse r;
+  for (int i = 0; i < NUM_SAMPLES; ++i) {
+    struct fp_packet pkt = {samples[i].data, samples[i].size};
+    struct fp_packet* p = &pkt;
+    fp_parse_batch(&p, 1, &r);
+    if (!check(&r, 0, &samples[i])) {fail += 1;
+      printf("%d Expected sample %d to parse (flags %x)\n", __LINE__, i, r.flags[0]);}
+  }
+
+  /* Full and partial batches of mixed samples, so that every
+     lane is used. */
+  struct fp_packet pkts[FP_PARSE_BATCH];
+  struct fp_packet* ptrs[FP_PARSE_BATCH];
+  for (int i = 0; i < FP_PARSE_BATCH; ++i) {
+    struct sample* s = &samples[(i * 7) % NUM_SAMPLES];
+    pkts[i].data = s->data;
+    pkts[i].size = s->size;
+    ptrs[i] = &pkts[i];
+  }
+  int sizes[] = {FP_PARSE_BATCH, 37, 16, 0};
+  for (int k = 0; k < 4; ++k) {
+    int n = sizes[k];
+    fp_parse_batch(ptrs, n, &r);
+    int bad = 0;
+    for (int i = 0; i < n; ++i)
+      if (!check(&r, i, &samples[(i * 7) % NUM_SAMPLES]))
+        ++bad;
+    for (int i = n; i < FP_PARSE_BATCH; ++i)
+      if (r.flags[i])
+        ++bad;
+    if (bad) {fail += 1;
+      printf("%d Expected a batch of %d to parse (%d bad)\n", __LINE__, n, bad);}
+  }
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
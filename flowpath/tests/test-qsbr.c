@@ -0,0 +1,141 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "qsbr.h"
+
+
+#define NUM_OBJECTS  64
+#define NUM_UPDATES  20000
+#define NUM_READERS  3
+
+
+/* A shared object. Released objects are poisoned rather than
+   freed so that readers can detect premature release. */
+struct object
+{
+  int live;
+  int released;
+};
+
+
+static struct object objects[NUM_OBJECTS];
+static struct object* current;
+static int stop;
+static int violations;
+
+
+static void
+release(void* p)
+{
+  struct object* obj = (struct object*)p;
+  __atomic_store_n(&obj->live, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&obj->released, 1, __ATOMIC_RELEASE);
+}
+
+
+static void
+count(void* p)
+{
+  ++*(int*)p;
+}
+
+
+/* Read the current object repeatedly between quiescent
+   states, sleeping offline now and then. */
+static void*
+reader(void* arg)
+{
+  struct fp_qsbr_thread* t = fp_qsbr_register();
+  int n = 0;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+    struct object* obj = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < 16; ++i)
+      if (!__atomic_load_n(&obj->live, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&violations, 1, __ATOMIC_RELAXED);
+    fp_qsbr_quiescent(t);
+    if (++n % 1024 == 0) {
+      fp_qsbr_offline(t);
+      sched_yield();
+      fp_qsbr_online(t);
+    }
+  }
+  fp_qsbr_unregister(t);
+  return NULL;
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  /* With no readers, releases run at once. */
+  int released = 0;
+  fp_qsbr_defer(count, &released);
+  if (released != 1) {fail += 1;
+    printf("%d Expected an immediate release\n", __LINE__);}
+
+  /* An online reader delays releases until it is quiescent. */
+  struct fp_qsbr_thread* t = fp_qsbr_register();
+  released = 0;
+  fp_qsbr_defer(count, &released);
+  fp_qsbr_defer(count, &released);
+  if (released != 0 || fp_qsbr_reclaim() != 0) {fail += 1;
+    printf("%d Expected releases to wait for the reader\n", __LINE__);}
+  fp_qsbr_quiescent(t);
+  if (fp_qsbr_reclaim() != 2 || released != 2) {fail += 1;
+    printf("%d Expected releases after a quiescent state\n", __LINE__);}
+
+  /* An offline reader does not delay releases. */
+  fp_qsbr_offline(t);
+  fp_qsbr_defer(count, &released);
+  if (released != 3) {fail += 1;
+    printf("%d Expected offline readers to be ignored\n", __LINE__);}
+  fp_qsbr_online(t);
+  fp_qsbr_defer(count, &released);
+  if (released != 3) {fail += 1;
+    printf("%d Expected online readers to be waited for\n", __LINE__);}
+  fp_qsbr_unregister(t);
+  fp_qsbr_reclaim();
+  if (released != 4) {fail += 1;
+    printf("%d Expected unregistered readers to be ignored\n", __LINE__);}
+
+  /* Concurrent readers never see a released object. The writer
+     replaces the current object and defers its release, and
+     only reuses objects that have been released. */
+  for (int i = 0; i < NUM_OBJECTS; ++i)
+    objects[i].released = 1;
+  objects[0].live = 1;
+  objects[0].released = 0;
+  current = &objects[0];
+  pthread_t readers[NUM_READERS];
+  for (int i = 0; i < NUM_READERS; ++i)
+    pthread_create(&readers[i], NULL, reader, NULL);
+  int next = 1;
+  for (int i = 0; i < NUM_UPDATES; ++i) {
+    struct object* obj = &objects[next];
+    while (!__atomic_load_n(&obj->released, __ATOMIC_ACQUIRE)) {
+      fp_qsbr_reclaim();
+      sched_yield();
+    }
+    obj->released = 0;
+    obj->live = 1;
+    struct object* old = __atomic_exchange_n(&current, obj, __ATOMIC_ACQ_REL);
+    fp_qsbr_defer(release, old);
+    next = (next + 1) % NUM_OBJECTS;
+  }
+  __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < NUM_READERS; ++i)
+    pthread_join(readers[i], NULL);
+  fp_qsbr_barrier();
+  int live = 0;
+  for (int i = 0; i < NUM_OBJECTS; ++i)
+    live += !objects[i].released;
+  if (violations || live != 1) {fail += 1;
+    printf("%d Expected no premature releases (%d, %d)\n", __LINE__, violations, live);}
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
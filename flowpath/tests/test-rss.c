@@ -0,0 +1,151 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rss.h"
+#include "packet.h"
+
+
+#define NUM_FLOWS 64
+
+
+/* The key and test vector from the Microsoft RSS verification
+   suite. */
+static uint8_t const ms_key[FP_RSS_KEY_LEN] = {
+  0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+  0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+  0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+  0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+  0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+static uint8_t const ms_input[] = {
+  66, 9, 149, 187,     /* Source address. */
+  161, 142, 100, 80,   /* Destination address. */
+  0x0a, 0xea,          /* Source port (2794). */
+  0x06, 0xe6,          /* Destination port (1766). */
+};
+
+
+/* Packet buffers and descriptors. */
+static unsigned char data[NUM_FLOWS * 2][64];
+static struct fp_packet pkts[NUM_FLOWS * 2];
+
+
+/* Write an Ethernet/IPv4/UDP packet. */
+static void
+make_packet(struct fp_packet* p, unsigned char* d, uint32_t src, uint32_t dst,
+            uint16_t sport, uint16_t dport)
+{
+  memset(d, 0, 64);
+  d[12] = 0x08;
+  d[14] = 0x45;
+  d[23] = 17;
+  for (int i = 0; i < 4; ++i) {
+    d[26 + i] = src >> (24 - 8 * i);
+    d[30 + i] = dst >> (24 - 8 * i);
+  }
+  d[34] = sport >> 8;
+  d[35] = sport & 0xff;
+  d[36] = dport >> 8;
+  d[37] = dport & 0xff;
+  p->data = d;
+  p->size = 64;
+  p->hash = 0;
+}
+
+
+/* Make each flow, followed by the reverse of each flow. */
+static void
+make_flows(struct fp_packet** ptrs)
+{
+  for (int i = 0; i < NUM_FLOWS; ++i) {
+    uint32_t a = 0x0a000001 + i * 37;
+    uint32_t b = 0xc0a80001 + i;
+    make_packet(&pkts[i], data[i], a, b, 1024 + i, 80);
+    make_packet(&pkts[NUM_FLOWS + i], data[NUM_FLOWS + i], b, a, 80, 1024 + i);
+  }
+  for (int i = 0; i < NUM_FLOWS * 2; ++i)
+    ptrs[i] = &pkts[i];
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+  fp_error_t err;
+
+  /* Known answers. */
+  struct fp_rss* rss = fp_rss_new(FP_RSS_TOEPLITZ, ms_key, 1, &err);
+  if (fp_toeplitz_hash(rss->toeplitz, ms_input, 12) != 0x51ccc178 ||
+      fp_toeplitz_hash(rss->toeplitz, ms_input, 8) != 0x323e8fc2) {fail += 1;
+    printf("%d Expected the Toeplitz test vector\n", __LINE__);}
+  fp_rss_delete(rss);
+
+  /* Both directions of a flow have the same hash, with either
+     algorithm and any key. */
+  struct fp_packet* ptrs[NUM_FLOWS * 2];
+  int algorithms[] = {FP_RSS_TOEPLITZ, FP_RSS_TOEPLITZ, FP_RSS_CRC32C};
+  uint8_t const* keys[] = {NULL, ms_key, NULL};
+  for (int a = 0; a < 3; ++a) {
+    rss = fp_rss_new(algorithms[a], keys[a], 4, &err);
+    make_flows(ptrs);
+    fp_rss_hash_burst(rss, ptrs, NUM_FLOWS * 2);
+    int asymmetric = 0;
+    int zero = 0;
+    for (int i = 0; i < NUM_FLOWS; ++i) {
+      asymmetric += pkts[i].hash != pkts[NUM_FLOWS + i].hash;
+      zero += pkts[i].hash == 0;
+    }
+    if (asymmetric || zero) {fail += 1;
+      printf("%d Expected symmetric hashes (%d, %d)\n", __LINE__, asymmetric, zero);}
+    fp_rss_delete(rss);
+  }
+
+  /* Distribution. Every packet lands in the ring selected by
+     its hash, and both directions of a flow share a ring. */
+  rss = fp_rss_new(FP_RSS_CRC32C, NULL, 4, &err);
+  make_flows(ptrs);
+  int rejected = fp_rss_distribute(rss, ptrs, NUM_FLOWS);
+  rejected += fp_rss_distribute(rss, ptrs + NUM_FLOWS, NUM_FLOWS);
+  if (rejected) {fail += 1;
+    printf("%d Expected every packet to be queued\n", __LINE__);}
+  int total = 0;
+  int misplaced = 0;
+  int used = 0;
+  int ring_of[NUM_FLOWS * 2];
+  for (int r = 0; r < 4; ++r) {
+    struct fp_packet* out[NUM_FLOWS * 2];
+    int n = fp_rss_receive(rss, r, out, NUM_FLOWS * 2);
+    total += n;
+    used += n > 0;
+    for (int i = 0; i < n; ++i) {
+      misplaced += fp_rss_ring(rss, out[i]->hash) != r;
+      ring_of[out[i] - pkts] = r;
+    }
+  }
+  for (int i = 0; i < NUM_FLOWS; ++i)
+    misplaced += ring_of[i] != ring_of[NUM_FLOWS + i];
+  if (total != NUM_FLOWS * 2 || misplaced || used != 4) {fail += 1;
+    printf("%d Expected packets to be steered by flow (%d, %d, %d)\n",
+           __LINE__, total, misplaced, used);}
+  fp_rss_delete(rss);
+
+  /* Packets that do not fit are returned to the caller. */
+  rss = fp_rss_new(FP_RSS_CRC32C, NULL, 1, &err);
+  rejected = 0;
+  for (int i = 0; i < FP_RSS_RING_SIZE / NUM_FLOWS + 1; ++i) {
+    make_flows(ptrs);
+    rejected += fp_rss_distribute(rss, ptrs, NUM_FLOWS);
+  }
+  if (rejected != NUM_FLOWS) {fail += 1;
+    printf("%d Expected a full ring to reject packets (%d)\n", __LINE__, rejected);}
+  struct fp_packet* out[NUM_FLOWS];
+  while (fp_rss_receive(rss, 0, out, NUM_FLOWS))
+    ;
+  fp_rss_delete(rss);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
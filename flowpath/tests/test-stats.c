@@ -0,0 +1,154 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+#include "flow.h"
+#include "packet.h"
+#include "port.h"
+
+
+#define NUM_THREADS 4
+#define NUM_COUNTS  200000
+
+
+struct thread
+{
+  pthread_t thread;
+  int       shard;
+  uint32_t  slot;
+};
+
+
+/* Count NUM_COUNTS packets of 3 bytes in the slot. */
+static void*
+count(void* arg)
+{
+  struct thread* t = (struct thread*)arg;
+  fp_stats_set_shard(t->shard);
+  for (int i = 0; i < NUM_COUNTS; ++i)
+    fp_counter_add(t->slot, 1, 3);
+  return NULL;
+}
+
+
+/* Count in the slot from NUM_THREADS threads in the given
+   shards, and check the totals. */
+static int
+count_concurrently(uint32_t slot, int const* shards)
+{
+  struct thread threads[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; ++i) {
+    threads[i].shard = shards[i];
+    threads[i].slot = slot;
+    pthread_create(&threads[i].thread, NULL, count, &threads[i]);
+  }
+  for (int i = 0; i < NUM_THREADS; ++i)
+    pthread_join(threads[i].thread, NULL);
+  uint64_t c[2];
+  fp_counter_read(slot, c);
+  return c[0] == NUM_THREADS * NUM_COUNTS && c[1] == 3 * c[0];
+}
+
+
+/* Match the key against the table in a context whose packet has
+   the given size. */
+static struct fp_flow*
+match(struct fp_flow_table* table, uint32_t key, int size)
+{
+  static unsigned char buf[FP_PACKET_KEY_SIZE];
+  struct fp_packet pkt = {NULL, size, 0, 0, NULL, FP_BUF_ALLOC};
+  struct fp_arrival arr = {1, 1, 0, FP_PORT_DROP};
+  struct fp_context cxt;
+  fp_context_init(&cxt, &pkt, arr);
+  memcpy(buf, &key, sizeof(key));
+  cxt.key = (struct fp_base_key*)buf;
+  return fp_match(table, &cxt);
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+  fp_error_t err;
+
+  /* Counts in private and shared shards are exact. */
+  uint32_t slot = fp_counter_alloc(&err);
+  if (fp_error(err) || slot == 0) {fail += 1;
+    printf("%d Expected a counter slot\n", __LINE__);}
+  int private[NUM_THREADS] = {0, 1, 2, 3};
+  if (!count_concurrently(slot, private)) {fail += 1;
+    printf("%d Expected exact counts in private shards\n", __LINE__);}
+  fp_counter_release(slot);
+  int shared[NUM_THREADS] = {FP_STATS_SHARED, FP_STATS_SHARED, 0, FP_STATS_SHARED};
+  uint32_t again = fp_counter_alloc(&err);
+  if (again != slot) {fail += 1;
+    printf("%d Expected the released slot to be reused\n", __LINE__);}
+  if (!count_concurrently(again, shared)) {fail += 1;
+    printf("%d Expected a reused slot to start from zero\n", __LINE__);}
+  fp_counter_release(again);
+
+  /* Slot 0 counts nothing. */
+  uint64_t c[2];
+  fp_counter_add(0, 1, 1);
+  fp_counter_read(0, c);
+  if (c[0] || c[1]) {fail += 1;
+    printf("%d Expected slot 0 to be empty\n", __LINE__);}
+
+  /* Blocks aggregate over shards. */
+  struct fp_stats_block b;
+  fp_stats_block_init(&b, 4 * sizeof(uint64_t));
+  int shard;
+  uint64_t* p = fp_stats_block_get(&b, &shard);
+  fp_stats_add(&p[2], 5, shard);
+  fp_stats_set_shard(7);
+  p = fp_stats_block_get(&b, &shard);
+  if (shard != 7) {fail += 1;
+    printf("%d Expected the thread's shard\n", __LINE__);}
+  fp_stats_add(&p[2], 6, shard);
+  fp_stats_add(&p[3], 1, shard);
+  fp_stats_set_shard(FP_STATS_SHARED);
+  uint64_t sum[2];
+  fp_stats_block_sum(&b, 2 * sizeof(uint64_t), 2, sum);
+  if (sum[0] != 11 || sum[1] != 1) {fail += 1;
+    printf("%d Expected block totals\n", __LINE__);}
+  fp_stats_block_clear(&b);
+
+  /* Matching counts lookups in the table and packets in flows. */
+  struct fp_flow_table* table = fp_flow_table_new(FP_TABLE_MATCH_EXACT, 4, 64);
+  struct fp_flow f1, f2;
+  fp_flow_init(&f1, 1, 0);
+  fp_flow_init(&f2, 1, 0);
+  uint32_t k1 = 1, k2 = 2;
+  fp_flow_add(table, &k1, &f1);
+  fp_flow_add(table, &k2, &f2);
+  for (int i = 0; i < 10; ++i)
+    match(table, k1, 100);
+  match(table, k2, 60);
+  match(table, k2, 40);
+  for (uint32_t k = 3; k < 6; ++k)
+    if (match(table, k, 100)) {fail += 1;
+      printf("%d Expected a miss\n", __LINE__);}
+  struct fp_table_stats ts;
+  fp_flow_table_stats(table, &ts);
+  if (ts.lookups != 15 || ts.matches != 12 || ts.misses != 3) {fail += 1;
+    printf("%d Expected table counts\n", __LINE__);}
+  struct fp_flow_stats fs1, fs2;
+  fp_flow_stats(&f1, &fs1);
+  fp_flow_stats(&f2, &fs2);
+  if (fs1.packets != 10 || fs1.bytes != 1000 || fs2.packets != 2 || fs2.bytes != 100) {fail += 1;
+    printf("%d Expected flow counts\n", __LINE__);}
+
+  /* Released flows are not counted. */
+  fp_flow_remove(table, &k2);
+  fp_flow_release(&f2);
+  fp_flow_stats(&f2, &fs2);
+  if (fs2.packets || fs2.bytes) {fail += 1;
+    printf("%d Expected a released flow to have no counts\n", __LINE__);}
+  fp_flow_release(&f1);
+  fp_flow_table_delete(table);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
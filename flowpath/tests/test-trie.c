@@ -0,0 +1,266 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trie.h"
+#include "flow.h"
+#include "qsbr.h"
+
+
+#define NUM_PREFIXES 4000
+#define NUM_LOOKUPS  20000
+#define NUM_CHURN    10000
+
+
+/* A reference prefix for the randomized test. */
+struct route
+{
+  uint32_t addr;
+  int      len;
+  int      live;
+};
+
+static struct route routes[NUM_PREFIXES];
+
+
+static uint32_t
+mask(int len)
+{
+  return len ? ~0u << (32 - len) : 0;
+}
+
+
+static void
+to_bytes(uint32_t a, uint8_t* b)
+{
+  b[0] = a >> 24;
+  b[1] = a >> 16;
+  b[2] = a >> 8;
+  b[3] = a;
+}
+
+
+/* Returns the value of the longest live route matching the
+   address by linear search, or 0. */
+static uintptr_t
+reference(uint32_t a)
+{
+  int best = -1;
+  for (int i = 0; i < NUM_PREFIXES; i++) {
+    if (!routes[i].live || (a & mask(routes[i].len)) != routes[i].addr)
+      continue;
+    if (best < 0 || routes[i].len > routes[best].len)
+      best = i;
+  }
+  return best < 0 ? 0 : (uintptr_t)best + 1;
+}
+
+
+static uintptr_t
+find4(struct fp_trie* t, uint32_t a)
+{
+  uint8_t k[4];
+  to_bytes(a, k);
+  return fp_trie_find(t, k);
+}
+
+
+static fp_error_t
+insert4(struct fp_trie* t, uint32_t a, int len, int prio, uintptr_t v)
+{
+  uint8_t k[4];
+  to_bytes(a, k);
+  return fp_trie_insert(t, k, len, prio, v);
+}
+
+
+static void
+remove4(struct fp_trie* t, uint32_t a, int len, int prio)
+{
+  uint8_t k[4];
+  to_bytes(a, k);
+  fp_trie_remove(t, k, len, prio);
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  /* IPv4 nesting. */
+  struct fp_trie* t = fp_trie_new(FP_TRIE_IPV4, NUM_PREFIXES + 16, 4096);
+  insert4(t, 0x0a000000, 8, 0, 1);   /* 10.0.0.0/8 */
+  insert4(t, 0x0a010000, 16, 0, 2);  /* 10.1.0.0/16 */
+  insert4(t, 0x0a010200, 24, 0, 3);  /* 10.1.2.0/24 */
+  insert4(t, 0x0a010280, 25, 0, 4);  /* 10.1.2.128/25 */
+  insert4(t, 0x0a010281, 32, 0, 5);  /* 10.1.2.129/32 */
+  if (find4(t, 0x0a090909) != 1 || find4(t, 0x0a010909) != 2 ||
+      find4(t, 0x0a010201) != 3 || find4(t, 0x0a0102ff) != 4 ||
+      find4(t, 0x0a010281) != 5 || find4(t, 0x0b000000) != 0) {fail += 1;
+    printf("%d Expected longest prefix matches\n", __LINE__);}
+  if (t->nfree_groups != 4095) {fail += 1;
+    printf("%d Expected one group in use\n", __LINE__);}
+
+  /* Priorities within a prefix. */
+  insert4(t, 0x0a010000, 16, 10, 20);
+  insert4(t, 0x0a010000, 16, 5, 50);
+  if (find4(t, 0x0a010909) != 20) {fail += 1;
+    printf("%d Expected the highest priority value\n", __LINE__);}
+  remove4(t, 0x0a010000, 16, 10);
+  if (find4(t, 0x0a010909) != 50) {fail += 1;
+    printf("%d Expected the next priority value\n", __LINE__);}
+  remove4(t, 0x0a010000, 16, 5);
+  if (find4(t, 0x0a010909) != 2) {fail += 1;
+    printf("%d Expected the remaining value\n", __LINE__);}
+
+  /* Removal falls back to the covering prefix. */
+  remove4(t, 0x0a010281, 32, 0);
+  if (find4(t, 0x0a010281) != 4) {fail += 1;
+    printf("%d Expected /25 after removing /32\n", __LINE__);}
+  remove4(t, 0x0a010280, 25, 0);
+  if (find4(t, 0x0a010281) != 3) {fail += 1;
+    printf("%d Expected /24 after removing /25\n", __LINE__);}
+  if (t->npending_groups != 1) {fail += 1;
+    printf("%d Expected the group to be released\n", __LINE__);}
+  fp_trie_reclaim(t);
+  if (t->nfree_groups != 4096) {fail += 1;
+    printf("%d Expected the group to be reclaimed\n", __LINE__);}
+  remove4(t, 0x0a010000, 16, 0);
+  if (find4(t, 0x0a010909) != 1 || find4(t, 0x0a010201) != 3) {fail += 1;
+    printf("%d Expected /8 after removing /16\n", __LINE__);}
+  remove4(t, 0x0a010200, 24, 0);
+  remove4(t, 0x0a000000, 8, 0);
+  if (find4(t, 0x0a010201) != 0) {fail += 1;
+    printf("%d Expected an empty trie\n", __LINE__);}
+  fp_trie_reclaim(t);
+
+  /* Randomized comparison against a linear search, including
+     removal of half of the prefixes. */
+  srand(42);
+  for (int i = 0; i < NUM_PREFIXES; i++) {
+    int len = 8 + rand() % 25;
+    uint32_t a = (((uint32_t)rand() << 16) ^ rand()) & mask(len);
+    routes[i].addr = a;
+    routes[i].len = len;
+    routes[i].live = 1;
+    for (int j = 0; j < i; j++)
+      if (routes[j].live && routes[j].addr == a && routes[j].len == len)
+        routes[i].live = 0;
+    if (routes[i].live && insert4(t, a, len, 0, i + 1) != FP_OK) {fail += 1;
+      printf("%d Expected to insert prefix %d\n", __LINE__, i);
+      break;}
+  }
+  for (int phase = 0; phase < 2; phase++) {
+    int bad = 0;
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+      uint32_t a;
+      if (i % 2)
+        a = routes[rand() % NUM_PREFIXES].addr | (rand() & 0xff);
+      else
+        a = ((uint32_t)rand() << 16) ^ rand();
+      if (find4(t, a) != reference(a))
+        bad++;
+    }
+    if (bad) {fail += 1;
+      printf("%d Expected lookups to match the reference (%d)\n", __LINE__, bad);}
+    for (int i = 0; i < NUM_PREFIXES; i += 2) {
+      if (routes[i].live)
+        remove4(t, routes[i].addr, routes[i].len, 0);
+      routes[i].live = 0;
+    }
+  }
+  fp_trie_delete(t);
+
+  /* IPv6. */
+  t = fp_trie_new(FP_TRIE_IPV6, 16, 64);
+  uint8_t p1[16] = {0x20, 0x01, 0x0d, 0xb8};
+  uint8_t p2[16] = {0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01};
+  uint8_t p3[16] = {0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0, 0,
+                    0, 0, 0, 0, 0, 0, 0, 0x01};
+  uint8_t k[16] = {0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0x00, 0x02};
+  fp_trie_insert(t, p1, 32, 0, 1);
+  fp_trie_insert(t, p2, 48, 0, 2);
+  fp_trie_insert(t, p3, 128, 0, 3);
+  if (fp_trie_find(t, k) != 2 || fp_trie_find(t, p3) != 3 ||
+      fp_trie_find(t, p1) != 1) {fail += 1;
+    printf("%d Expected IPv6 longest prefix matches\n", __LINE__);}
+  fp_trie_remove(t, p2, 48, 0);
+  if (fp_trie_find(t, k) != 1 || fp_trie_find(t, p3) != 3) {fail += 1;
+    printf("%d Expected /32 after removing /48\n", __LINE__);}
+  fp_trie_clear(t, p3, 128);
+  fp_trie_clear(t, p1, 32);
+  if (fp_trie_find(t, p3) != 0 || t->npending_groups != 13) {fail += 1;
+    printf("%d Expected an empty IPv6 trie\n", __LINE__);}
+  fp_trie_delete(t);
+
+  /* A default IPv6 table holds as many /48 prefixes as it was
+     sized for, even when they share no groups. */
+  struct fp_flow_table* ft = fp_flow_table_new(FP_TABLE_MATCH_PREFIX, 16, 4096);
+  struct fp_flow f;
+  fp_flow_init(&f, 0, 0);
+  for (int i = 0; i < 4096; i++) {
+    uint8_t k6[16] = {0x20, i >> 8, i & 0xff, i & 0xff, i >> 4, i};
+    if (fp_flow_add_prefix(ft, k6, 48, &f) != FP_OK) {fail += 1;
+      printf("%d Expected to add IPv6 prefix %d\n", __LINE__, i);
+      break;}
+  }
+  fp_flow_table_delete(ft);
+
+  /* Flows churned through a prefix table reuse the rules and
+     groups released by their removal, far beyond the size of the
+     table. */
+  ft = fp_flow_table_new(FP_TABLE_MATCH_PREFIX, 4, 16);
+  uint8_t fk[4];
+  for (int i = 0; i < NUM_CHURN; i++) {
+    to_bytes(0x0a000000 + i * 0x101, fk);
+    if (fp_flow_add_prefix(ft, fk, 32, &f) != FP_OK) {fail += 1;
+      printf("%d Expected to add flow %d\n", __LINE__, i);
+      break;}
+    if (i % 2)
+      fp_flow_remove_prefix(ft, fk, 32, &f);
+    else
+      fp_flow_remove(ft, fk);
+  }
+  if (ft->prefix->npending_rules || ft->prefix->npending_groups) {fail += 1;
+    printf("%d Expected churned flows to be reclaimed\n", __LINE__);}
+
+  /* Released space waits for every reader to pass through a
+     quiescent state, and later releases wait for their own grace
+     period. */
+  struct fp_qsbr_thread* self = fp_qsbr_register();
+  to_bytes(0x0b000001, fk);
+  fp_flow_add_prefix(ft, fk, 32, &f);
+  fp_flow_remove_prefix(ft, fk, 32, &f);
+  if (ft->prefix->npending_rules != 1 || ft->reclaims != 1) {fail += 1;
+    printf("%d Expected the rule to wait for a grace period\n", __LINE__);}
+  fp_qsbr_quiescent(self);
+  fp_flow_add_prefix(ft, fk, 32, &f);
+  fp_flow_remove(ft, fk);
+  if (ft->prefix->npending_rules != 1 || ft->reclaims != 1) {fail += 1;
+    printf("%d Expected only the first rule to be reclaimed\n", __LINE__);}
+  int added = 0;
+  for (int i = 0; i < 32; i++) {
+    to_bytes(0x0c000000 + i, fk);
+    if (fp_flow_add_prefix(ft, fk, 32, &f) != FP_OK)
+      break;
+    fp_flow_remove(ft, fk);
+    ++added;
+  }
+  if (added != 15) {fail += 1;
+    printf("%d Expected the table to fill during a grace period\n", __LINE__);}
+  fp_qsbr_quiescent(self);
+  if (fp_flow_add_prefix(ft, fk, 32, &f) != FP_OK) {fail += 1;
+    printf("%d Expected space once the grace period elapsed\n", __LINE__);}
+  fp_flow_remove(ft, fk);
+  fp_qsbr_unregister(self);
+  fp_qsbr_reclaim();
+  if (ft->reclaims || ft->prefix->nfree_rules != 16) {fail += 1;
+    printf("%d Expected every rule to be reclaimed\n", __LINE__);}
+  fp_flow_release(&f);
+  fp_flow_table_delete(ft);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,160 @@
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "util.h"
+
+
+#define NUM_ITEMS     100000
+#define NUM_PRODUCERS 4
+#define BURST         7
+
+
+/* Items are encoded as (producer << 24 | sequence) + 1 so that
+   no item is NULL. */
+static inline void*
+encode(uintptr_t producer, uintptr_t seq)
+{
+  return (void*)((producer << 24 | seq) + 1);
+}
+
+
+static void*
+spsc_producer(void* arg)
+{
+  struct fp_spsc_ring* r = (struct fp_spsc_ring*)arg;
+  void* x[BURST];
+  uintptr_t seq = 0;
+  while (seq < NUM_ITEMS) {
+    int n = 0;
+    for (; n < BURST && seq + n < NUM_ITEMS; n++)
+      x[n] = encode(0, seq + n);
+    int k = 0;
+    while ((k += fp_spsc_ring_push_n(r, x + k, n - k)) < n)
+      sched_yield();
+    seq += n;
+  }
+  return NULL;
+}
+
+
+struct mpsc_arg
+{
+  struct fp_mpsc_ring* r;
+  uintptr_t id;
+};
+
+
+static void*
+mpsc_producer(void* arg)
+{
+  struct mpsc_arg* a = (struct mpsc_arg*)arg;
+  void* x[BURST];
+  uintptr_t seq = 0;
+  while (seq < NUM_ITEMS) {
+    int n = 0;
+    for (; n < BURST && seq + n < NUM_ITEMS; n++)
+      x[n] = encode(a->id, seq + n);
+    int k = 0;
+    while ((k += fp_mpsc_ring_push_n(a->r, x + k, n - k)) < n)
+      sched_yield();
+    seq += n;
+  }
+  return NULL;
+}
+
+
+int 
+main(int argc, char** argv)
+{
+  int fail = 0;
+  void* b[64];
+
+  /* Sizes are rounded to powers of two, and every slot is usable. */
+  struct fp_spsc_ring* s = fp_spsc_ring_new(5);
+  if (s->size != 8) {fail += 1;
+    printf("%d Expected ring size of 8\n", __LINE__);}
+  void* a[16];
+  for (int i = 0; i < 16; i++)
+    a[i] = encode(0, i);
+  if (fp_spsc_ring_push_n(s, a, 10) != 8) {fail += 1;
+    printf("%d Expected to push 8 items\n", __LINE__);}
+  if (fp_spsc_ring_push(s, a[0]) != 0) {fail += 1;
+    printf("%d Expected push into full ring to fail\n", __LINE__);}
+  if (fp_spsc_ring_pop_n(s, b, 5) != 5 || b[4] != a[4]) {fail += 1;
+    printf("%d Expected to pop a[0] -> a[4]\n", __LINE__);}
+
+  /* Wrap around the end of the slot array. */
+  if (fp_spsc_ring_push_n(s, a + 8, 5) != 5) {fail += 1;
+    printf("%d Expected to push a[8] -> a[12]\n", __LINE__);}
+  if (fp_spsc_ring_count(s) != 8) {fail += 1;
+    printf("%d Expected 8 items\n", __LINE__);}
+  if (fp_spsc_ring_pop_n(s, b, 16) != 8) {fail += 1;
+    printf("%d Expected to pop 8 items\n", __LINE__);}
+  for (int i = 0; i < 3; i++) {
+    if (b[i] != a[5 + i]) {fail += 1;
+      printf("%d Expected b[%d] == a[%d]\n", __LINE__, i, 5 + i);}}
+  for (int i = 0; i < 5; i++) {
+    if (b[3 + i] != a[8 + i]) {fail += 1;
+      printf("%d Expected b[%d] == a[%d]\n", __LINE__, 3 + i, 8 + i);}}
+  if (fp_spsc_ring_pop(s) != NULL) {fail += 1;
+    printf("%d Expected pop from empty ring to return NULL\n", __LINE__);}
+  fp_spsc_ring_delete(s);
+
+  /* One producer, one consumer: items arrive in order. */
+  s = fp_spsc_ring_new(256);
+  pthread_t t;
+  pthread_create(&t, NULL, spsc_producer, s);
+  uintptr_t expect = 0;
+  while (expect < NUM_ITEMS) {
+    int n = fp_spsc_ring_pop_n(s, b, 64);
+    if (n == 0)
+      sched_yield();
+    for (int i = 0; i < n; i++, expect++) {
+      if (b[i] != encode(0, expect)) {fail += 1;
+        printf("%d Expected item %lu\n", __LINE__, (unsigned long)expect);
+        expect = NUM_ITEMS; break;}
+    }
+  }
+  pthread_join(t, NULL);
+  fp_spsc_ring_delete(s);
+
+  /* Several producers, one consumer: each producer's items
+     arrive in order, and none are lost. */
+  struct fp_mpsc_ring* m = fp_mpsc_ring_new(256);
+  pthread_t ts[NUM_PRODUCERS];
+  struct mpsc_arg args[NUM_PRODUCERS];
+  uintptr_t seqs[NUM_PRODUCERS] = {0};
+  for (int i = 0; i < NUM_PRODUCERS; i++) {
+    args[i].r = m;
+    args[i].id = i;
+    pthread_create(&ts[i], NULL, mpsc_producer, &args[i]);
+  }
+  long total = 0;
+  while (total < (long)NUM_ITEMS * NUM_PRODUCERS) {
+    int n = fp_mpsc_ring_pop_n(m, b, 64);
+    if (n == 0)
+      sched_yield();
+    for (int i = 0; i < n; i++) {
+      uintptr_t v = (uintptr_t)b[i] - 1;
+      uintptr_t id = v >> 24;
+      uintptr_t seq = v & 0xffffff;
+      if (id >= NUM_PRODUCERS || seq != seqs[id]) {fail += 1;
+        printf("%d Unexpected item %lu from producer %lu\n", __LINE__,
+               (unsigned long)seq, (unsigned long)id);
+        total = (long)NUM_ITEMS * NUM_PRODUCERS; break;}
+      seqs[id]++;
+      total++;
+    }
+  }
+  for (int i = 0; i < NUM_PRODUCERS; i++)
+    pthread_join(ts[i], NULL);
+  if (fp_mpsc_ring_count(m) != 0) {fail += 1;
+    printf("%d Expected the ring to be empty\n", __LINE__);}
+  fp_mpsc_ring_delete(m);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
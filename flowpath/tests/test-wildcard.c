@@ -0,0 +1,155 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wildcard.h"
+
+
+#define NUM_RULES   5000
+#define NUM_LOOKUPS 5000
+
+
+/* A key with L2, L3, and L4 stages. */
+struct key
+{
+  uint32_t vlan;
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+};
+
+static size_t const stages[] = {4, 12, 16};
+
+
+/* A reference rule for the randomized test. */
+struct rule
+{
+  struct key match;
+  struct key mask;
+  int        priority;
+  int        live;
+};
+
+static struct rule rules[NUM_RULES];
+
+
+static bool
+matches(struct key const* k, struct rule const* r)
+{
+  unsigned char const* a = (unsigned char const*)k;
+  unsigned char const* m = (unsigned char const*)&r->mask;
+  unsigned char const* b = (unsigned char const*)&r->match;
+  for (size_t i = 0; i < sizeof(struct key); i++)
+    if ((a[i] & m[i]) != (b[i] & m[i]))
+      return false;
+  return true;
+}
+
+
+/* Returns the highest priority of live rules matching the key
+   by linear search, or -1. */
+static int
+reference(struct key const* k)
+{
+  int best = -1;
+  for (int i = 0; i < NUM_RULES; i++)
+    if (rules[i].live && matches(k, &rules[i]) && rules[i].priority > best)
+      best = rules[i].priority;
+  return best;
+}
+
+
+static uint32_t
+prefix(int len)
+{
+  return len ? ~0u << (32 - len) : 0;
+}
+
+
+static struct key
+random_key()
+{
+  struct key k = {rand() % 4, 0x0a000000 | (rand() & 0xffff),
+                  0xc0a80000 | (rand() & 0xff), rand() % 8, rand() % 8};
+  return k;
+}
+
+
+int
+main(int argc, char** argv)
+{
+  int fail = 0;
+
+  struct fp_wildcard_table* t = fp_wildcard_table_new(sizeof(struct key), stages, 3);
+
+  /* Priorities across masks. */
+  struct key any = {0, 0, 0, 0, 0};
+  struct key exact = {~0u, ~0u, ~0u, 0xffff, 0xffff};
+  struct key l3 = {0, prefix(8), 0, 0, 0};
+  struct key k1 = {1, 0x0a000001, 0xc0a80001, 1000, 80};
+  struct key k2 = {1, 0x0b000001, 0xc0a80001, 1000, 80};
+  fp_wildcard_table_insert(t, &any, &any, 0, 1);
+  fp_wildcard_table_insert(t, &k1, &l3, 10, 2);
+  fp_wildcard_table_insert(t, &k1, &exact, 5, 3);
+  if (fp_wildcard_table_find(t, &k1) != 2 || fp_wildcard_table_find(t, &k2) != 1) {fail += 1;
+    printf("%d Expected the highest priority match\n", __LINE__);}
+  if (t->nsubtables != 3 || t->subtables[0]->max_priority != 10) {fail += 1;
+    printf("%d Expected sub-tables in priority order\n", __LINE__);}
+  fp_wildcard_table_insert(t, &k1, &exact, 20, 4);
+  if (fp_wildcard_table_find(t, &k1) != 4) {fail += 1;
+    printf("%d Expected the new highest priority match\n", __LINE__);}
+  fp_wildcard_table_remove(t, &k1, &exact, 20);
+  fp_wildcard_table_remove(t, &k1, &l3, 10);
+  if (fp_wildcard_table_find(t, &k1) != 3 || t->nsubtables != 2) {fail += 1;
+    printf("%d Expected removal to expose the next match\n", __LINE__);}
+  fp_wildcard_table_clear(t, &k1, &exact);
+  fp_wildcard_table_clear(t, &any, &any);
+  if (fp_wildcard_table_find(t, &k1) != 0 || t->nsubtables != 0 || t->size != 0) {fail += 1;
+    printf("%d Expected an empty table\n", __LINE__);}
+
+  /* Randomized comparison against a linear search over an ACL
+     with a few distinct masks, including removal of half of the
+     rules. Values are priorities, which are distinct. */
+  srand(42);
+  int lens[] = {0, 8, 16, 24, 32};
+  for (int i = 0; i < NUM_RULES; i++) {
+    struct rule* r = &rules[i];
+    struct key k = random_key();
+    r->mask.vlan = rand() % 2 ? ~0u : 0;
+    r->mask.src = prefix(lens[rand() % 5]);
+    r->mask.dst = prefix(lens[rand() % 3 + 2]);
+    r->mask.sport = rand() % 4 ? 0 : 0xffff;
+    r->mask.dport = rand() % 2 ? 0 : 0xffff;
+    r->match = k;
+    r->priority = i + 1;
+    r->live = 1;
+    if (fp_wildcard_table_insert(t, &r->match, &r->mask, r->priority, r->priority) != FP_OK) {fail += 1;
+      printf("%d Expected to insert rule %d\n", __LINE__, i);
+      break;}
+  }
+  for (int phase = 0; phase < 2; phase++) {
+    int bad = 0;
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+      struct key k = random_key();
+      int v = (int)fp_wildcard_table_find(t, &k);
+      int r = reference(&k);
+      if (v != (r < 0 ? 0 : r))
+        bad++;
+    }
+    if (bad) {fail += 1;
+      printf("%d Expected lookups to match the reference (%d)\n", __LINE__, bad);}
+    for (int i = phase; i < NUM_RULES; i += 2) {
+      if (rules[i].live)
+        fp_wildcard_table_remove(t, &rules[i].match, &rules[i].mask, rules[i].priority);
+      rules[i].live = 0;
+    }
+  }
+  if (t->size != 0 || t->nsubtables != 0) {fail += 1;
+    printf("%d Expected all rules to be removed\n", __LINE__);}
+  fp_wildcard_table_delete(t);
+
+  printf("%d tests failed!\n", fail);
+  return (fail == 0) ? 0 : -1;
+}
@@ -3,11 +3,54 @@
 #include "pipeline.h"
 #include "port.h"
 #include "port_udp.h"
+#include "worker.h"
+#include "qsbr.h"
+#include "rss.h"
+#include "decoder.h"
 
 #include "proto.h"
 #include "error.h"
 
 #include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+
+/* Set the flag when a deferred release runs. */
+static void
+set_flag(void* p)
+{
+  __atomic_store_n((bool*)p, true, __ATOMIC_RELEASE);
+}
+
+
+/* Send n datagrams of the given size to the UDP port on the
+   loopback address. */
+static void
+send_sized(short p, int size, int n)
+{
+  static char data[8192];
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_port = htons(p);
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int i = 0; i < n; ++i)
+    sendto(s, data, size, 0, (struct sockaddr*)&a, sizeof(a));
+  close(s);
+}
+
+
+/* Send a few datagrams to the UDP port on the loopback
+   address. The wire forwards them back and forth between its
+   ports, keeping their worker busy. */
+static void
+send_to_port(short p)
+{
+  send_sized(p, 5, 8);
+}
 
 
 /* Create a UDP port. */
@@ -77,14 +120,195 @@ main(int argc, char** argv)
   if (!port2)
     return -1;
 
-  /* Start the data plane. */
+  /* Ports are resolved through their local indexes. */
   bool ok = true;
+  fp_port_id_t i1 = fp_dataplane_port_index(dp, port1->id);
+  fp_port_id_t i2 = fp_dataplane_port_index(dp, port2->id);
+  if (i1 != 0 || i2 != 1 ||
+      fp_dataplane_port(dp, i1) != port1 || fp_dataplane_port(dp, i2) != port2 ||
+      fp_dataplane_get_port(dp, port2->id) != port2 ||
+      port1->index != i1 || port2->index != i2) {
+    fprintf(stderr, "error: ports have the wrong local indexes\n");
+    ok = false;
+  }
+  if (fp_dataplane_port_index(dp, FP_PORT_FLOOD) != FP_PORT_FLOOD ||
+      fp_dataplane_port_index(dp, port2->id + 1) != FP_PORT_DROP ||
+      fp_dataplane_get_port(dp, FP_PORT_IN_PORT) != NULL) {
+    fprintf(stderr, "error: unexpected index for an unattached port\n");
+    ok = false;
+  }
+  struct fp_context cxt;
+  struct fp_arrival arr = {port1->id, port1->id, 0, i1};
+  fp_context_init(&cxt, NULL, arr);
+  if (fp_dataplane_output_port(dp, &cxt) != NULL) {
+    fprintf(stderr, "error: expected a new context to drop\n");
+    ok = false;
+  }
+  cxt.out_index = i2;
+  struct fp_port* out2 = fp_dataplane_output_port(dp, &cxt);
+  cxt.out_index = FP_PORT_IN_PORT;
+  if (out2 != port2 || fp_dataplane_output_port(dp, &cxt) != port1) {
+    fprintf(stderr, "error: expected output ports to be resolved\n");
+    ok = false;
+  }
+
+  /* IN_PORT is resolved through the input port's local index,
+     not its id. */
+  cxt.in_port = port2->id;
+  struct fp_port* in = fp_dataplane_output_port(dp, &cxt);
+  cxt.in_index = FP_PORT_DROP;
+  if (in != port1 || fp_dataplane_output_port(dp, &cxt) != NULL) {
+    fprintf(stderr, "error: expected IN_PORT to use the input index\n");
+    ok = false;
+  }
+
+  /* A decoder that sets $op also sets the local index of the
+     output port. One that does not leaves the packet dropped. */
+  static unsigned char data[64];
+  static unsigned char key[FP_PACKET_KEY_SIZE];
+  struct fp_packet pkt = {0};
+  pkt.data = data;
+  pkt.size = sizeof(data);
+  struct fp_prokex_insn setop[] = {
+    {FP_PROKEX_WRITE, 4, 0, 0, ~FP_PROKEX_OP, port2->id},
+  };
+  struct fp_decoder* dec = fp_decoder_new(setop, 1, dp->key_size, &err);
+  fp_dataplane_set_decoder(dp, dec);
+  fp_context_init(&cxt, &pkt, arr);
+  cxt.key = (struct fp_base_key*)key;
+  fp_dataplane_decode(dp, &cxt);
+  if (!dec || cxt.out_port != port2->id || cxt.out_index != i2) {
+    fprintf(stderr, "error: expected $op to set the output index\n");
+    ok = false;
+  }
+  setop[0].dst = ~FP_PROKEX_R0;
+  struct fp_decoder* nop = fp_decoder_new(setop, 1, dp->key_size, &err);
+  fp_decoder_delete(fp_dataplane_set_decoder(dp, nop));
+  fp_context_init(&cxt, &pkt, arr);
+  fp_dataplane_decode(dp, &cxt);
+  if (!nop || cxt.out_port != FP_PORT_DROP || cxt.out_index != FP_PORT_DROP) {
+    fprintf(stderr, "error: expected an unset $op to drop\n");
+    ok = false;
+  }
+  fp_decoder_delete(fp_dataplane_set_decoder(dp, NULL));
+
+  /* Datagrams of up to 4KB are received. Larger ones are
+     dropped and counted. */
+  struct fp_device* udp = fp_udp_open_port(5002, &err);
+  if (udp) {
+    send_sized(5002, 4000, 1);
+    send_sized(5002, 5000, 1);
+    usleep(10000);
+    struct fp_packet* got[4];
+    int n = fp_udp_recv_burst(udp, got, 4);
+    if (n != 1 || got[0]->size != 4000 ||
+        ((struct fp_udp_device*)udp)->truncated != 1) {
+      fprintf(stderr, "error: expected a 4KB datagram and a truncation\n");
+      ok = false;
+    }
+    for (int i = 0; i < n; ++i)
+      fp_udp_drop(udp, got[i]);
+    fp_udp_close(udp);
+  } else {
+    fprintf(stderr, "error: cannot open a UDP device\n");
+    ok = false;
+  }
+
+  /* Start the data plane. */
   err = fp_dataplane_start(dp);
   if (fp_error(err)) {
     fprintf(stderr, "error: %s\n", fp_strerror(err));
     ok = false;
   }
   
+  /* Replace the running pipeline. The new wire adopts both
+     ports and stays up. */
+  struct fp_pipeline* old = dp->pipeline;
+  err = fp_pipeline_swap(dp, path, NULL);
+  if (fp_error(err) || dp->pipeline == old || !fp_dataplane_is_up(dp) ||
+      fp_dataplane_is_quiesced(dp)) {
+    fprintf(stderr, "error: expected the pipeline to be replaced\n");
+    ok = false;
+  }
+
+  /* Port counters are kept by local index, and start from zero
+     when a port is added. */
+  struct fp_port_stats ps;
+  fp_dataplane_count_drops(dp, i2, FP_DROP_POLICY, 3);
+  fp_dataplane_port_stats(dp, i2, &ps);
+  if (ps.drops[FP_DROP_POLICY] != 3 || ps.rx_packets != 0) {
+    fprintf(stderr, "error: expected drops to be counted\n");
+    ok = false;
+  }
+  fp_dataplane_remove_port(dp, port2, &err);
+  if (fp_error(err) || port2->index != FP_PORT_DROP) {
+    fprintf(stderr, "error: expected the new pipeline to own port 2\n");
+    ok = false;
+  }
+  fp_dataplane_add_port(dp, port2, &err);
+  fp_dataplane_port_stats(dp, i2, &ps);
+  if (ps.drops[FP_DROP_POLICY] != 0) {
+    fprintf(stderr, "error: expected a re-added port to have no counts\n");
+    ok = false;
+  }
+
+  /* A worker that serves only descriptor-backed ports and never
+     runs out of packets still ends grace periods. */
+  struct fp_engine* e = fp_engine_create(1, &err);
+  if (!e || fp_error(fp_engine_start(e))) {
+    fprintf(stderr, "error: cannot start the engine\n");
+    return -1;
+  }
+  fp_engine_add_port(e, dp, port1);
+  fp_engine_add_port(e, dp, port2);
+  send_to_port(5000);
+  usleep(100000);
+  struct fp_port_stats before, after;
+  fp_dataplane_port_stats(dp, i1, &before);
+  usleep(100000);
+  fp_dataplane_port_stats(dp, i1, &after);
+  if (after.rx_packets == before.rx_packets) {
+    fprintf(stderr, "error: expected the worker to be busy\n");
+    ok = false;
+  }
+  bool released = false;
+  fp_qsbr_defer(set_flag, &released);
+  for (int i = 0; i < 1000 && !__atomic_load_n(&released, __ATOMIC_ACQUIRE); ++i) {
+    usleep(1000);
+    fp_qsbr_reclaim();
+  }
+  if (!released) {
+    fprintf(stderr, "error: expected a busy worker to end grace periods\n");
+    ok = false;
+  }
+  fp_engine_remove_port(e, port1);
+  fp_engine_remove_port(e, port2);
+  fp_engine_delete(e);
+  fp_qsbr_barrier();
+
+  /* Packets spread over workers by RSS are released by workers
+     other than the one that received them, and the wire keeps
+     forwarding them. */
+  e = fp_engine_create(4, &err);
+  if (!e || fp_error(fp_engine_start(e))) {
+    fprintf(stderr, "error: cannot start the engine\n");
+    return -1;
+  }
+  err = fp_engine_add_port_rss(e, dp, port1, FP_RSS_CRC32C, NULL);
+  fp_engine_add_port(e, dp, port2);
+  send_to_port(5000);
+  usleep(200000);
+  fp_dataplane_port_stats(dp, i1, &before);
+  usleep(100000);
+  fp_dataplane_port_stats(dp, i1, &after);
+  if (fp_error(err) || after.rx_packets == before.rx_packets) {
+    fprintf(stderr, "error: expected RSS to keep forwarding\n");
+    ok = false;
+  }
+  fp_engine_remove_port(e, port1);
+  fp_engine_remove_port(e, port2);
+  fp_engine_delete(e);
+
   /* Stop the data plane. */
   err = fp_dataplane_stop(dp);
   if (fp_error(err)) {
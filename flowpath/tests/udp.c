@@ -23,8 +23,11 @@ main(int argc, char** argv)
   /* Build a port on the socket. */
   struct fp_port* port = fp_port_create(dev);
 
-  /* Recieve a packet and then stop. */
-  struct fp_packet* pkt = fp_port_recv_packet(port);
+  /* Recieve a packet and then stop. Receiving does not
+     block, so wait for something to arrive. */
+  struct fp_packet* pkt;
+  while (!(pkt = fp_port_recv_packet(port)))
+    ;
   printf("* got %d bytes\n", pkt->size);
   fp_port_drop_packet(port, pkt);
 
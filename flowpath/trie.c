@@ -2,34 +2,529 @@
 // All rights reserved
 
 #include "trie.h"
+#include "hash.h"
+#include "hashfn.h"
 #include "util.h"
 
+#include <string.h>
 
-/* Allocate a new trie. */
-struct fp_trie* 
-fp_trie_new()
+
+/* Entry encoding. A valid entry that is not extended names a
+   rule and records the length of its prefix. An extended entry
+   holds the index of a group. An entry that is neither is
+   empty. */
+#define ENTRY_VALID       0x80000000u
+#define ENTRY_EXT         0x40000000u
+#define ENTRY_DEPTH_SHIFT 22
+#define ENTRY_DEPTH_MASK  0xffu
+#define ENTRY_INDEX       0x003fffffu
+
+/* The maximum number of rules and groups in a trie (see
+   FP_TRIE_MAX_RULES). */
+#define INDEX_MAX         (ENTRY_INDEX + 1)
+
+#define ROOT_SIZE         (1u << FP_TRIE_ROOT_BITS)
+#define GROUP_SIZE        256
+
+
+static inline uint32_t
+rule_entry(int depth, uint32_t id)
+{
+  return ENTRY_VALID | ((uint32_t)depth << ENTRY_DEPTH_SHIFT) | id;
+}
+
+
+static inline int
+entry_depth(uint32_t e)
+{
+  return (e >> ENTRY_DEPTH_SHIFT) & ENTRY_DEPTH_MASK;
+}
+
+
+static inline void
+store_entry(uint32_t* e, uint32_t v)
+{
+  __atomic_store_n(e, v, __ATOMIC_RELEASE);
+}
+
+
+static inline uint32_t*
+group_of(struct fp_trie const* t, uint32_t e)
+{
+  return t->groups + (size_t)(e & ENTRY_INDEX) * GROUP_SIZE;
+}
+
+
+/* Returns the index of the key within the table at the given
+   level. The root is indexed by the first 24 bits, and each
+   group by the following byte. */
+static inline uint32_t
+level_index(uint8_t const* k, int level)
+{
+  if (level == 0)
+    return ((uint32_t)k[0] << 16) | ((uint32_t)k[1] << 8) | k[2];
+  return k[level + 2];
+}
+
+
+/* Returns the number of key bits resolved after the given
+   level. */
+static inline int
+level_end(int level)
+{
+  return FP_TRIE_ROOT_BITS + 8 * level;
+}
+
+
+/* Returns the number of groups that may be needed to insert a
+   prefix of the given length. */
+static inline uint32_t
+groups_needed(int len)
+{
+  if (len <= FP_TRIE_ROOT_BITS)
+    return 0;
+  return (len - FP_TRIE_ROOT_BITS + 7) / 8;
+}
+
+
+/* Copy the first len bits of the key into a 16-byte prefix,
+   clearing the rest. */
+static void
+mask_prefix(uint8_t* p, uint8_t const* k, int len)
+{
+  memset(p, 0, 16);
+  memcpy(p, k, (len + 7) / 8);
+  if (len % 8)
+    p[len / 8] &= (uint8_t)(0xff << (8 - len % 8));
+}
+
+
+/* Hashing and comparison of rules in the prefix index. Keys
+   are pointers to rules; only the prefix and length are
+   used. */
+static size_t
+hash_rule(uintptr_t k)
+{
+  struct fp_trie_rule const* r = (struct fp_trie_rule const*)k;
+  return fp_hash_bytes(r->prefix, 16, r->len);
+}
+
+
+static bool
+compare_rule(uintptr_t a, uintptr_t b)
+{
+  struct fp_trie_rule const* r1 = (struct fp_trie_rule const*)a;
+  struct fp_trie_rule const* r2 = (struct fp_trie_rule const*)b;
+  return r1->len == r2->len && !memcmp(r1->prefix, r2->prefix, 16);
+}
+
+
+/* Returns the id of the rule with the given (masked) prefix,
+   or -1 if there is no such rule. */
+static int64_t
+find_rule(struct fp_trie const* t, uint8_t const* p, int len)
+{
+  struct fp_trie_rule probe;
+  memcpy(probe.prefix, p, 16);
+  probe.len = len;
+  struct fp_flat_hash_entry* e = fp_flat_hash_table_find(t->index, (uintptr_t)&probe);
+  return e ? (int64_t)e->value : -1;
+}
+
+
+/* Allocate a group whose entries are all set to e. The group is
+   not visible to searches until an entry refers to it. */
+static uint32_t
+alloc_group(struct fp_trie* t, uint32_t e)
+{
+  assert(t->nfree_groups > 0);
+  uint32_t id = t->free_groups[--t->nfree_groups];
+  uint32_t* g = t->groups + (size_t)id * GROUP_SIZE;
+  for (int i = 0; i < GROUP_SIZE; ++i)
+    g[i] = e;
+  return id;
+}
+
+
+/* Set e to the rule entry r if r is a longer prefix than the
+   one currently stored at e (or the same). Groups below e are
+   updated likewise. */
+static void
+cover(struct fp_trie* t, uint32_t* e, int depth, uint32_t r)
+{
+  uint32_t cur = *e;
+  if (cur & ENTRY_EXT) {
+    uint32_t* g = group_of(t, cur);
+    for (int i = 0; i < GROUP_SIZE; ++i)
+      cover(t, &g[i], depth, r);
+  } else if (!(cur & ENTRY_VALID) || entry_depth(cur) <= depth) {
+    store_entry(e, r);
+  }
+}
+
+
+/* Replace the rule of the given depth at e (and below) with r,
+   which is the entry of the next shorter covering prefix or
+   empty. */
+static void collapse(struct fp_trie*, uint32_t*);
+
+static void
+uncover(struct fp_trie* t, uint32_t* e, int depth, uint32_t r)
+{
+  uint32_t cur = *e;
+  if (cur & ENTRY_EXT) {
+    uint32_t* g = group_of(t, cur);
+    for (int i = 0; i < GROUP_SIZE; ++i)
+      uncover(t, &g[i], depth, r);
+    collapse(t, e);
+  } else if ((cur & ENTRY_VALID) && entry_depth(cur) == depth) {
+    store_entry(e, r);
+  }
+}
+
+
+/* If every entry in the group referred to by e is the same
+   rule (or empty), replace e with that entry and release the
+   group. */
+static void
+collapse(struct fp_trie* t, uint32_t* e)
+{
+  uint32_t cur = *e;
+  uint32_t* g = group_of(t, cur);
+  uint32_t first = g[0];
+  if (first & ENTRY_EXT)
+    return;
+  for (int i = 1; i < GROUP_SIZE; ++i)
+    if (g[i] != first)
+      return;
+  store_entry(e, first);
+  t->pending_groups[t->npending_groups++] = cur & ENTRY_INDEX;
+  ++t->released_groups;
+}
+
+
+/* Install the rule entry r for the prefix p of the given depth
+   into the table at the given level. Groups are allocated along
+   the path as needed, and are filled before they are published. */
+static void
+install(struct fp_trie* t, uint32_t* tbl, int level, uint8_t const* p,
+        int depth, uint32_t r)
+{
+  int end = level_end(level);
+  uint32_t i = level_index(p, level);
+  if (depth <= end) {
+    uint32_t n = 1u << (end - depth);
+    for (uint32_t j = i; j < i + n; ++j)
+      cover(t, &tbl[j], depth, r);
+    return;
+  }
+
+  uint32_t cur = tbl[i];
+  if (!(cur & ENTRY_EXT)) {
+    cur = ENTRY_EXT | alloc_group(t, cur);
+    store_entry(&tbl[i], cur);
+  }
+  install(t, group_of(t, cur), level + 1, p, depth, r);
+}
+
+
+/* Remove the prefix p of the given depth from the table at the
+   given level, replacing it with r. Groups that become uniform
+   are released. */
+static void
+uninstall(struct fp_trie* t, uint32_t* tbl, int level, uint8_t const* p,
+          int depth, uint32_t r)
+{
+  int end = level_end(level);
+  uint32_t i = level_index(p, level);
+  if (depth <= end) {
+    uint32_t n = 1u << (end - depth);
+    for (uint32_t j = i; j < i + n; ++j)
+      uncover(t, &tbl[j], depth, r);
+    return;
+  }
+
+  uint32_t cur = tbl[i];
+  if (!(cur & ENTRY_EXT))
+    return;
+  uninstall(t, group_of(t, cur), level + 1, p, depth, r);
+  collapse(t, &tbl[i]);
+}
+
+
+/* Allocate a new trie for keys of the given number of bits,
+   holding at most nrules prefixes and using at most ngroups
+   groups below the root. Each group takes 1KB. Key sizes must
+   be a multiple of 8 between 24 and 128. Returns NULL if the
+   trie cannot be allocated. */
+struct fp_trie*
+fp_trie_new(int bits, uint32_t nrules, uint32_t ngroups)
 {
+  if (bits < FP_TRIE_ROOT_BITS || bits > FP_TRIE_IPV6 || bits % 8)
+    return NULL;
+  if (nrules == 0 || nrules > INDEX_MAX || ngroups > INDEX_MAX)
+    return NULL;
+
   struct fp_trie* t = fp_allocate(struct fp_trie);
-  /* FIXME: Initialize the root node. */
+  if (!t)
+    return NULL;
+  memset(t, 0, sizeof(struct fp_trie));
+  t->bits = bits;
+  t->key_bytes = bits / 8;
+  t->ngroups = ngroups;
+  t->nrules = nrules;
+  t->root = (uint32_t*)calloc(ROOT_SIZE, sizeof(uint32_t));
+  t->groups = fp_allocate_n(uint32_t, ((size_t)ngroups * GROUP_SIZE + 1));
+  t->free_groups = fp_allocate_n(uint32_t, (ngroups + 1));
+  t->pending_groups = fp_allocate_n(uint32_t, (ngroups + 1));
+  t->rules = (struct fp_trie_rule*)calloc(nrules, sizeof(struct fp_trie_rule));
+  t->free_rules = fp_allocate_n(uint32_t, (nrules + 1));
+  t->pending_rules = fp_allocate_n(uint32_t, (nrules + 1));
+  t->index = fp_flat_hash_table_new(nrules, hash_rule, compare_rule);
+  if (!t->root || !t->groups || !t->free_groups || !t->pending_groups ||
+      !t->rules || !t->free_rules || !t->pending_rules || !t->index) {
+    fp_trie_delete(t);
+    return NULL;
+  }
+
+  /* Stack the groups and rules so that they are handed out in
+     index order. */
+  for (uint32_t i = 0; i < ngroups; ++i)
+    t->free_groups[i] = ngroups - i - 1;
+  t->nfree_groups = ngroups;
+  for (uint32_t i = 0; i < nrules; ++i)
+    t->free_rules[i] = nrules - i - 1;
+  t->nfree_rules = nrules;
   return t;
 }
 
-/* FIXME: This is returning the wrong thing. */
-struct fp_trie_node* 
-fp_trie_find(struct fp_trie* t, struct fp_packet_subkey* k)
+
+/* Delete the trie. */
+void
+fp_trie_delete(struct fp_trie* t)
+{
+  if (!t)
+    return;
+  if (t->rules)
+    for (uint32_t i = 0; i < t->nrules; ++i)
+      fp_deallocate(t->rules[i].values);
+  fp_flat_hash_table_delete(t->index);
+  fp_deallocate(t->pending_rules);
+  fp_deallocate(t->free_rules);
+  fp_deallocate(t->rules);
+  fp_deallocate(t->pending_groups);
+  fp_deallocate(t->free_groups);
+  fp_deallocate(t->groups);
+  fp_deallocate(t->root);
+  fp_deallocate(t);
+}
+
+
+/* Returns the best value of the longest prefix matching the
+   key, or 0 if no prefix matches. The key has the number of
+   bits given when the trie was created. */
+uintptr_t
+fp_trie_find(struct fp_trie const* t, void const* key)
+{
+  uint8_t const* k = (uint8_t const*)key;
+  uint32_t e = __atomic_load_n(&t->root[level_index(k, 0)], __ATOMIC_ACQUIRE);
+  int i = 3;
+  while (e & ENTRY_EXT)
+    e = __atomic_load_n(&group_of(t, e)[k[i++]], __ATOMIC_ACQUIRE);
+  if (!(e & ENTRY_VALID))
+    return 0;
+  return __atomic_load_n(&t->rules[e & ENTRY_INDEX].best, __ATOMIC_RELAXED);
+}
+
+
+/* Add a value with the given priority to the prefix formed by
+   the first len bits of the key. If the prefix already has a
+   value with that priority, the value is replaced. Fails with
+   ENOSPC when the trie has no rules or groups left, and EINVAL
+   when the length is out of range. */
+fp_error_t
+fp_trie_insert(struct fp_trie* t, void const* key, int len, int priority,
+               uintptr_t value)
+{
+  if (len < 0 || len > t->bits)
+    return fp_system_error(EINVAL);
+
+  uint8_t p[16];
+  mask_prefix(p, (uint8_t const*)key, len);
+  int64_t id = find_rule(t, p, len);
+
+  /* Find the position of the priority in an existing rule. */
+  struct fp_trie_rule* r;
+  int pos = 0;
+  if (id >= 0) {
+    r = &t->rules[id];
+    while (pos < r->nvalues && r->values[pos].priority > priority)
+      ++pos;
+    if (pos < r->nvalues && r->values[pos].priority == priority) {
+      r->values[pos].value = value;
+      if (pos == 0)
+        __atomic_store_n(&r->best, value, __ATOMIC_RELAXED);
+      return FP_OK;
+    }
+  } else {
+    if (t->nfree_rules == 0 || t->nfree_groups < groups_needed(len))
+      return fp_system_error(ENOSPC);
+    id = t->free_rules[t->nfree_rules - 1];
+    r = &t->rules[id];
+    memcpy(r->prefix, p, 16);
+    r->len = len;
+    r->nvalues = 0;
+  }
+
+  /* Insert the value into the priority list. */
+  if (r->nvalues == r->capacity) {
+    int cap = r->capacity ? 2 * r->capacity : 1;
+    struct fp_trie_value* v = (struct fp_trie_value*)realloc(r->values, cap * sizeof(struct fp_trie_value));
+    if (!v)
+      return fp_system_error(ENOMEM);
+    r->values = v;
+    r->capacity = cap;
+  }
+  memmove(r->values + pos + 1, r->values + pos,
+          (r->nvalues - pos) * sizeof(struct fp_trie_value));
+  r->values[pos].priority = priority;
+  r->values[pos].value = value;
+  ++r->nvalues;
+  if (pos == 0)
+    __atomic_store_n(&r->best, value, __ATOMIC_RELAXED);
+
+  /* Publish a new rule. */
+  if (r->nvalues == 1) {
+    --t->nfree_rules;
+    fp_flat_hash_table_insert(t->index, (uintptr_t)r, id);
+    install(t, t->root, 0, p, len, rule_entry(len, id));
+  }
+  return FP_OK;
+}
+
+
+/* Remove the rule with the given id, whose prefix p has the
+   given length, from the trie. Searches for keys it covered
+   resolve to the next longest prefix. */
+static void
+drop_rule(struct fp_trie* t, uint32_t id, uint8_t const* p, int len)
+{
+  /* Find the longest prefix that covers this one, which replaces
+     it in the trie. */
+  uint32_t rep = 0;
+  for (int l = len - 1; l >= 0; --l) {
+    uint8_t q[16];
+    mask_prefix(q, p, l);
+    int64_t c = find_rule(t, q, l);
+    if (c >= 0) {
+      rep = rule_entry(l, c);
+      break;
+    }
+  }
+  uninstall(t, t->root, 0, p, len, rep);
+  fp_flat_hash_table_remove(t->index, (uintptr_t)&t->rules[id]);
+  t->rules[id].nvalues = 0;
+  t->pending_rules[t->npending_rules++] = id;
+  ++t->released_rules;
+}
+
+
+/* Remove the value with the given priority from the prefix
+   formed by the first len bits of the key. When the prefix has
+   no more values, it is removed from the trie. */
+void
+fp_trie_remove(struct fp_trie* t, void const* key, int len, int priority)
+{
+  if (len < 0 || len > t->bits)
+    return;
+
+  uint8_t p[16];
+  mask_prefix(p, (uint8_t const*)key, len);
+  int64_t id = find_rule(t, p, len);
+  if (id < 0)
+    return;
+
+  struct fp_trie_rule* r = &t->rules[id];
+  int pos = 0;
+  while (pos < r->nvalues && r->values[pos].priority != priority)
+    ++pos;
+  if (pos == r->nvalues)
+    return;
+  if (r->nvalues == 1) {
+    drop_rule(t, id, p, len);
+    return;
+  }
+  memmove(r->values + pos, r->values + pos + 1,
+          (r->nvalues - pos - 1) * sizeof(struct fp_trie_value));
+  --r->nvalues;
+  if (pos == 0)
+    __atomic_store_n(&r->best, r->values[0].value, __ATOMIC_RELAXED);
+}
+
+
+/* Remove the prefix formed by the first len bits of the key,
+   with all of its values. */
+void
+fp_trie_clear(struct fp_trie* t, void const* key, int len)
 {
-  return NULL;
+  if (len < 0 || len > t->bits)
+    return;
+
+  uint8_t p[16];
+  mask_prefix(p, (uint8_t const*)key, len);
+  int64_t id = find_rule(t, p, len);
+  if (id >= 0)
+    drop_rule(t, id, p, len);
 }
 
-/* FIXME: This is returning the wrong thing. */
-struct fp_trie_node* 
-fp_trie_insert(struct fp_trie* t, struct fp_packet_subkey* k, int v)
+
+/* Move the first n pending ids to the free list. Pending ids
+   are kept in the order they were released. */
+static void
+reclaim_pending(uint32_t* free, uint32_t* nfree, uint32_t* pending,
+                uint32_t* npending, uint32_t n)
 {
-  return NULL;
+  memcpy(free + *nfree, pending, n * sizeof(uint32_t));
+  *nfree += n;
+  *npending -= n;
+  memmove(pending, pending + n, *npending * sizeof(uint32_t));
 }
 
-/* Remove the given key from the packet. */
+
+/* Make the rules and groups released by removals available
+   for reuse. This must only be called when no search that
+   started before those removals is still running. */
+void
+fp_trie_reclaim(struct fp_trie* t)
+{
+  fp_trie_reclaim_to(t, fp_trie_mark(t));
+}
+
+
+/* Returns a mark of the rules and groups released so far. */
+struct fp_trie_mark
+fp_trie_mark(struct fp_trie const* t)
+{
+  struct fp_trie_mark m = {t->released_groups, t->released_rules};
+  return m;
+}
+
+
+/* Make the rules and groups released before the mark was taken
+   available for reuse. Those released since then stay pending.
+   This must only be called when no search that started before
+   the mark was taken is still running. */
 void
-fp_trie_remove(struct fp_trie* t, struct fp_packet_subkey* k)
+fp_trie_reclaim_to(struct fp_trie* t, struct fp_trie_mark m)
 {
+  /* Pending ids are the last ones released, so those released
+     before the mark are the first of them, if any. */
+  uint64_t done = t->released_groups - t->npending_groups;
+  if (m.groups > done)
+    reclaim_pending(t->free_groups, &t->nfree_groups, t->pending_groups,
+                    &t->npending_groups, (uint32_t)(m.groups - done));
+  done = t->released_rules - t->npending_rules;
+  if (m.rules > done)
+    reclaim_pending(t->free_rules, &t->nfree_rules, t->pending_rules,
+                    &t->npending_rules, (uint32_t)(m.rules - done));
 }
@@ -4,32 +4,136 @@
 #ifndef FLOWPATH_TRIE_H
 #define FLOWPATH_TRIE_H
 
-/* This module defines a trie implementation for flow tables. 
-   This maps packet keys to positions in the instruction memory
-   using prefix matches.
+/* This module defines a trie implementation for flow tables.
+   This maps packet keys to values using longest prefix matches.
 
-   TODO: Determine the best branching level for the trie.
+   The trie is a multibit trie with a 24-bit first level and
+   8-bit levels below it. For 32-bit (IPv4) keys, this is the
+   DIR-24-8 scheme: a prefix of up to 24 bits is resolved with a
+   single memory access, and a longer one with two. 128-bit
+   (IPv6) keys use the same structure with up to 13 levels of
+   8-bit groups, so they do not resolve in one or two accesses:
+   a search makes one dependent access per level down to its
+   longest match, which is 4 for a /48, 6 for a /64, and 14 for
+   a /128.
 
-   TODO: This does not yet account for priorities. As with the
-   the hash table, we might chain each node to an array of
-   k/v pairs ordered on priority. */
+   Each entry is 32 bits, and either names a rule (the longest
+   prefix covering the entry) or refers to a group of 256
+   entries at the next level. Prefixes are expanded into every
+   entry they cover that is not covered by a longer prefix. The
+   first level is allocated when the trie is created, as is a
+   fixed pool of groups, so memory use does not depend on the
+   set of prefixes. The first level takes 64MB for every key
+   size, and each group 1KB; pages are only touched as they are
+   used. A prefix longer than 24 bits needs a group at each
+   level below the root that it reaches, unless it shares them
+   with other prefixes, so the pool must be sized for the
+   expected prefix lengths.
 
-#include "packet.h"
+   Each prefix (a rule) has a list of values ordered by priority.
+   A search returns the value with the highest priority in the
+   rule for the longest matching prefix.
 
-/* A node in the trie. */
-struct fp_trie_node {
-  int key;
-  int value;
+   Concurrency: any number of threads may search the trie while
+   one thread modifies it. Groups and rules released by removal
+   are not reused until fp_trie_reclaim() is called, which the
+   caller must only do once concurrent searches that began
+   before the removal have finished. A caller that defers
+   reclamation takes a mark with fp_trie_mark() after removing,
+   and later passes it to fp_trie_reclaim_to(), which reclaims
+   only what was released before the mark. */
+
+#include "util.h"
+#include "error.h"
+
+
+/* Key sizes, in bits. */
+#define FP_TRIE_IPV4 32
+#define FP_TRIE_IPV6 128
+
+/* The number of bits resolved by the first level. */
+#define FP_TRIE_ROOT_BITS 24
+
+/* The maximum number of rules and of groups in a trie. */
+#define FP_TRIE_MAX_RULES  (1u << 22)
+#define FP_TRIE_MAX_GROUPS (1u << 22)
+
+
+struct fp_flat_hash_table;
+
+
+/* A value in a rule's priority list. */
+struct fp_trie_value
+{
+  int       priority;
+  uintptr_t value;
 };
 
-/* The trie */
-struct fp_trie {
-  struct fp_trie_node* root;
+
+/* A prefix and its values. The best value is the value with
+   the highest priority, which is what searches return. */
+struct fp_trie_rule
+{
+  uint8_t   prefix[16]; /* Masked to len bits. */
+  int       len;
+  uintptr_t best;
+
+  int                   nvalues;
+  int                   capacity;
+  struct fp_trie_value* values; /* Ordered by decreasing priority. */
 };
 
-struct fp_trie* fp_trie_new();
-struct fp_trie_node* fp_trie_find(struct fp_trie* t, struct fp_packet_subkey* k);
-struct fp_trie_node* fp_trie_insert(struct fp_trie* t, struct fp_packet_subkey* k, int v);
-void fp_trie_remove(struct fp_trie* t, struct fp_packet_subkey* k);
+
+/* The number of groups and rules released by a trie at some
+   point (see fp_trie_mark()). */
+struct fp_trie_mark
+{
+  uint64_t groups;
+  uint64_t rules;
+};
+
+
+/* The trie. */
+struct fp_trie
+{
+  int bits;        /* Key size in bits. */
+  int key_bytes;
+
+  uint32_t* root;   /* 2^24 entries. */
+  uint32_t* groups; /* ngroups * 256 entries. */
+
+  /* The group pool. Released groups are pending until
+     reclaimed. */
+  uint32_t  ngroups;
+  uint32_t  nfree_groups;
+  uint32_t* free_groups;
+  uint32_t  npending_groups;
+  uint32_t* pending_groups;
+  uint64_t  released_groups; /* Ever released. */
+
+  /* The rule pool. */
+  uint32_t             nrules;
+  struct fp_trie_rule* rules;
+  uint32_t             nfree_rules;
+  uint32_t*            free_rules;
+  uint32_t             npending_rules;
+  uint32_t*            pending_rules;
+  uint64_t             released_rules;
+
+  /* Maps prefixes to rule ids. */
+  struct fp_flat_hash_table* index;
+};
+
+
+struct fp_trie* fp_trie_new(int, uint32_t, uint32_t);
+void            fp_trie_delete(struct fp_trie*);
+uintptr_t       fp_trie_find(struct fp_trie const*, void const*);
+fp_error_t      fp_trie_insert(struct fp_trie*, void const*, int, int, uintptr_t);
+void            fp_trie_remove(struct fp_trie*, void const*, int, int);
+void            fp_trie_clear(struct fp_trie*, void const*, int);
+void            fp_trie_reclaim(struct fp_trie*);
+
+struct fp_trie_mark fp_trie_mark(struct fp_trie const*);
+void                fp_trie_reclaim_to(struct fp_trie*, struct fp_trie_mark);
 
 #endif
@@ -3,6 +3,8 @@
 
 #include "util.h"
 
+#include <sched.h>
+
 
 /* Allocate and initialize a new ring. */
 struct fp_ring*
@@ -165,3 +167,233 @@ fp_ring_free(const struct fp_ring* r)
   return free;
 }
 
+
+
+/* Round n up to the next power of 2. */
+static uint32_t
+ring_size(int n)
+{
+  uint32_t size = 1;
+  while (size < (uint32_t)n)
+    size <<= 1;
+  return size;
+}
+
+
+/* Allocate a concurrent ring with room for the header, which is
+   cache-aligned, and size slots. */
+static void*
+ring_allocate(size_t header, uint32_t size)
+{
+  void* p;
+  if (posix_memalign(&p, FP_CACHE_LINE, header + size * sizeof(void*)) != 0)
+    return NULL;
+  memset(p, 0, header);
+  return p;
+}
+
+
+/* Copy n items into the ring, starting at index idx. This copies
+   at most two segments: up to the end of the slot array, and
+   then from its start. */
+static inline void
+ring_copy_in(void** ring, uint32_t size, uint32_t mask, uint32_t idx,
+             void* const x[], int n)
+{
+  uint32_t i = idx & mask;
+  uint32_t first = size - i;
+  if ((uint32_t)n <= first) {
+    memcpy(&ring[i], x, n * sizeof(void*));
+  } else {
+    memcpy(&ring[i], x, first * sizeof(void*));
+    memcpy(&ring[0], x + first, (n - first) * sizeof(void*));
+  }
+}
+
+
+/* Copy n items out of the ring, starting at index idx. */
+static inline void
+ring_copy_out(void* const* ring, uint32_t size, uint32_t mask, uint32_t idx,
+              void* x[], int n)
+{
+  uint32_t i = idx & mask;
+  uint32_t first = size - i;
+  if ((uint32_t)n <= first) {
+    memcpy(x, &ring[i], n * sizeof(void*));
+  } else {
+    memcpy(x, &ring[i], first * sizeof(void*));
+    memcpy(x + first, &ring[0], (n - first) * sizeof(void*));
+  }
+}
+
+
+/* Allocate a new SPSC ring with at least num slots. The number
+ * of slots is rounded up to a power of 2. */
+struct fp_spsc_ring*
+fp_spsc_ring_new(int num)
+{
+  uint32_t size = ring_size(num);
+  struct fp_spsc_ring* r = ring_allocate(sizeof(struct fp_spsc_ring), size);
+  if (!r)
+    return NULL;
+  r->size = size;
+  r->mask = size - 1;
+  return r;
+}
+
+
+/* Destroy an SPSC ring. */
+void
+fp_spsc_ring_delete(struct fp_spsc_ring* r)
+{
+  free(r);
+}
+
+
+/* Push up to n items. Returns the number pushed. This must only
+ * be called from the producer thread. */
+int
+fp_spsc_ring_push_n(struct fp_spsc_ring* r, void* x[], int n)
+{
+  uint32_t tail = r->tail;
+  uint32_t free = r->size - (tail - r->head_cache);
+  if (free < (uint32_t)n) {
+    r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    free = r->size - (tail - r->head_cache);
+  }
+  int items = ((uint32_t)n <= free) ? n : (int)free;  // min(n, free)
+  if (items == 0)
+    return 0;
+  ring_copy_in(r->ring, r->size, r->mask, tail, x, items);
+  __atomic_store_n(&r->tail, tail + items, __ATOMIC_RELEASE);
+  return items;
+}
+
+
+/* Pop up to n items. Returns the number popped. This must only
+ * be called from the consumer thread. */
+int
+fp_spsc_ring_pop_n(struct fp_spsc_ring* r, void* x[], int n)
+{
+  uint32_t head = r->head;
+  uint32_t count = r->tail_cache - head;
+  if (count < (uint32_t)n) {
+    r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    count = r->tail_cache - head;
+  }
+  int items = ((uint32_t)n <= count) ? n : (int)count;  // min(n, count)
+  if (items == 0)
+    return 0;
+  ring_copy_out(r->ring, r->size, r->mask, head, x, items);
+  __atomic_store_n(&r->head, head + items, __ATOMIC_RELEASE);
+  return items;
+}
+
+
+/* Return the number of items in the ring. This is only a
+ * snapshot when called concurrently with push or pop. */
+int
+fp_spsc_ring_count(const struct fp_spsc_ring* r)
+{
+  uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
+
+
+/* Allocate a new MPSC ring with at least num slots. The number
+ * of slots is rounded up to a power of 2. */
+struct fp_mpsc_ring*
+fp_mpsc_ring_new(int num)
+{
+  uint32_t size = ring_size(num);
+  struct fp_mpsc_ring* r = ring_allocate(sizeof(struct fp_mpsc_ring), size);
+  if (!r)
+    return NULL;
+  r->size = size;
+  r->mask = size - 1;
+  return r;
+}
+
+
+/* Destroy an MPSC ring. */
+void
+fp_mpsc_ring_delete(struct fp_mpsc_ring* r)
+{
+  free(r);
+}
+
+
+/* Push up to n items. Returns the number pushed. This may be
+ * called from any number of threads. */
+int
+fp_mpsc_ring_push_n(struct fp_mpsc_ring* r, void* x[], int n)
+{
+  /* Claim slots [head, head + items). The cached consumer index
+   * is shared by all producers; a stale value only makes the
+   * ring look fuller than it is. */
+  uint32_t head = __atomic_load_n(&r->prod_head, __ATOMIC_RELAXED);
+  int items;
+  do {
+    uint32_t cons = __atomic_load_n(&r->cons_cache, __ATOMIC_RELAXED);
+    uint32_t free = r->size - (head - cons);
+    if (free < (uint32_t)n) {
+      cons = __atomic_load_n(&r->cons_head, __ATOMIC_ACQUIRE);
+      __atomic_store_n(&r->cons_cache, cons, __ATOMIC_RELAXED);
+      free = r->size - (head - cons);
+    }
+    items = ((uint32_t)n <= free) ? n : (int)free;  // min(n, free)
+    if (items == 0)
+      return 0;
+  } while (!__atomic_compare_exchange_n(&r->prod_head, &head, head + items,
+                                        true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+
+  ring_copy_in(r->ring, r->size, r->mask, head, x, items);
+
+  /* Publish in claim order: wait for earlier producers to
+   * publish their items before publishing ours. If an earlier
+   * producer has been preempted, yield so that it can finish.
+   * The wait acquires their publication, so that ours releases
+   * their items to the consumer along with our own. */
+  for (int spins = 1;
+       __atomic_load_n(&r->prod_tail, __ATOMIC_ACQUIRE) != head; ++spins) {
+    if (spins % 1024 == 0)
+      sched_yield();
+    else
+      fp_cpu_relax();
+  }
+  __atomic_store_n(&r->prod_tail, head + items, __ATOMIC_RELEASE);
+  return items;
+}
+
+
+/* Pop up to n items. Returns the number popped. This must only
+ * be called from the consumer thread. */
+int
+fp_mpsc_ring_pop_n(struct fp_mpsc_ring* r, void* x[], int n)
+{
+  uint32_t head = r->cons_head;
+  uint32_t count = r->tail_cache - head;
+  if (count < (uint32_t)n) {
+    r->tail_cache = __atomic_load_n(&r->prod_tail, __ATOMIC_ACQUIRE);
+    count = r->tail_cache - head;
+  }
+  int items = ((uint32_t)n <= count) ? n : (int)count;  // min(n, count)
+  if (items == 0)
+    return 0;
+  ring_copy_out(r->ring, r->size, r->mask, head, x, items);
+  __atomic_store_n(&r->cons_head, head + items, __ATOMIC_RELEASE);
+  return items;
+}
+
+
+/* Return the number of published items in the ring. This is
+ * only a snapshot when called concurrently with push or pop. */
+int
+fp_mpsc_ring_count(const struct fp_mpsc_ring* r)
+{
+  uint32_t head = __atomic_load_n(&r->cons_head, __ATOMIC_ACQUIRE);
+  uint32_t tail = __atomic_load_n(&r->prod_tail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
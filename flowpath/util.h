@@ -58,4 +58,120 @@ int   fp_ring_remove_n(struct fp_ring*, int);
 int   fp_ring_count(const struct fp_ring*);
 int   fp_ring_free(const struct fp_ring*);
 
+
+/* The assumed size of a cache line. */
+#define FP_CACHE_LINE 64
+
+#define fp_cache_aligned __attribute__((aligned(FP_CACHE_LINE)))
+
+
+/* Hint to the processor that the caller is spinning. */
+static inline void
+fp_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+
+/* Concurrent rings of pointers for passing objects between
+ * threads. These have the same push_n/pop_n interface as fp_ring
+ * but differ in their representation:
+ * - the number of slots is a power of 2, so indexes wrap with a
+ *   mask, and every slot can be used
+ * - head and tail are free-running 32-bit counters; the count is
+ *   (tail - head), which is correct across wrap-around
+ * - producer and consumer state are on separate cache lines, and
+ *   each side keeps a cached copy of the other side's index so
+ *   that it only reads the shared line when the ring appears
+ *   full (or empty)
+ * - bulk operations copy at most two contiguous segments
+ *
+ * fp_spsc_ring allows one producer thread and one consumer thread.
+ * fp_mpsc_ring allows any number of producer threads and one
+ * consumer thread. Producers claim space by advancing prod_head
+ * with a compare-and-swap, copy their items, and then publish them
+ * by advancing prod_tail in claim order.
+ */
+struct fp_spsc_ring
+{
+  /* Written by the producer. */
+  uint32_t tail fp_cache_aligned;
+  uint32_t head_cache;            // last observed head
+
+  /* Written by the consumer. */
+  uint32_t head fp_cache_aligned;
+  uint32_t tail_cache;            // last observed tail
+
+  /* Constant. */
+  uint32_t size fp_cache_aligned;
+  uint32_t mask;
+  void*    ring[];
+};
+
+struct fp_spsc_ring* fp_spsc_ring_new(int);
+void fp_spsc_ring_delete(struct fp_spsc_ring*);
+int  fp_spsc_ring_push_n(struct fp_spsc_ring*, void*[], int);
+int  fp_spsc_ring_pop_n(struct fp_spsc_ring*, void*[], int);
+int  fp_spsc_ring_count(const struct fp_spsc_ring*);
+
+
+struct fp_mpsc_ring
+{
+  /* Written by producers. */
+  uint32_t prod_head fp_cache_aligned;  // next slot to claim
+  uint32_t prod_tail;                   // end of published items
+  uint32_t cons_cache;                  // last observed cons_head
+
+  /* Written by the consumer. */
+  uint32_t cons_head fp_cache_aligned;
+  uint32_t tail_cache;                  // last observed prod_tail
+
+  /* Constant. */
+  uint32_t size fp_cache_aligned;
+  uint32_t mask;
+  void*    ring[];
+};
+
+struct fp_mpsc_ring* fp_mpsc_ring_new(int);
+void fp_mpsc_ring_delete(struct fp_mpsc_ring*);
+int  fp_mpsc_ring_push_n(struct fp_mpsc_ring*, void*[], int);
+int  fp_mpsc_ring_pop_n(struct fp_mpsc_ring*, void*[], int);
+int  fp_mpsc_ring_count(const struct fp_mpsc_ring*);
+
+
+/* Push a single item. Returns 1 on success or 0 if full. */
+static inline int
+fp_spsc_ring_push(struct fp_spsc_ring* r, void* x)
+{
+  return fp_spsc_ring_push_n(r, &x, 1);
+}
+
+
+/* Pop a single item. Returns NULL if empty. */
+static inline void*
+fp_spsc_ring_pop(struct fp_spsc_ring* r)
+{
+  void* x;
+  return fp_spsc_ring_pop_n(r, &x, 1) ? x : NULL;
+}
+
+
+/* Push a single item. Returns 1 on success or 0 if full. */
+static inline int
+fp_mpsc_ring_push(struct fp_mpsc_ring* r, void* x)
+{
+  return fp_mpsc_ring_push_n(r, &x, 1);
+}
+
+
+/* Pop a single item. Returns NULL if empty. */
+static inline void*
+fp_mpsc_ring_pop(struct fp_mpsc_ring* r)
+{
+  void* x;
+  return fp_mpsc_ring_pop_n(r, &x, 1) ? x : NULL;
+}
+
 #endif
@@ -0,0 +1,467 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#include "wildcard.h"
+#include "hash.h"
+#include "hashfn.h"
+#include "util.h"
+
+#include <limits.h>
+#include <string.h>
+
+
+#define MIN_BUCKETS 16
+
+
+/* Mix a word into a running hash. */
+static inline uint64_t
+mix(uint64_t h, uint64_t w)
+{
+  h ^= w * 0x87c37b91114253d5ull;
+  h = (h << 31) | (h >> 33);
+  return h * 0x4cf5ad432745937full;
+}
+
+
+/* Mix n bytes of the key, masked by m, into a running hash.
+   The bytes are consumed a word at a time. */
+static inline uint64_t
+hash_masked(uint64_t h, unsigned char const* k, unsigned char const* m, size_t n)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, k + i, 8);
+    memcpy(&b, m + i, 8);
+    h = mix(h, a & b);
+  }
+  if (i < n) {
+    uint64_t a = 0, b = 0;
+    memcpy(&a, k + i, n - i);
+    memcpy(&b, m + i, n - i);
+    h = mix(h, a & b);
+  }
+  return h;
+}
+
+
+/* Returns true when the key, masked by m, equals the (masked)
+   match. */
+static inline bool
+masked_equal(unsigned char const* k, unsigned char const* m,
+             unsigned char const* match, size_t n)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a, b, c;
+    memcpy(&a, k + i, 8);
+    memcpy(&b, m + i, 8);
+    memcpy(&c, match + i, 8);
+    if ((a & b) != c)
+      return false;
+  }
+  for (; i < n; ++i)
+    if ((k[i] & m[i]) != match[i])
+      return false;
+  return true;
+}
+
+
+/* Compute the hash of the key in the sub-table's stages. The
+   hash up to the end of each stage but the last is stored in
+   hs, and the final hash is returned. */
+static uint64_t
+hash_stages(struct fp_wildcard_table const* t,
+            struct fp_wildcard_subtable const* st,
+            unsigned char const* k, uint64_t* hs)
+{
+  uint64_t h = 0;
+  size_t start = 0;
+  for (int s = 0; s < st->nstages; ++s) {
+    h = hash_masked(h, k + start, st->mask + start, t->stages[s] - start);
+    hs[s] = h;
+    start = t->stages[s];
+  }
+  return fp_hash_mix64(h);
+}
+
+
+/* Re-establish the order of sub-tables by decreasing maximum
+   priority. There are few sub-tables, and at most one is out
+   of place. */
+static void
+sort_subtables(struct fp_wildcard_table* t)
+{
+  for (int i = 1; i < t->nsubtables; ++i) {
+    struct fp_wildcard_subtable* st = t->subtables[i];
+    int j = i;
+    while (j > 0 && t->subtables[j - 1]->max_priority < st->max_priority) {
+      t->subtables[j] = t->subtables[j - 1];
+      --j;
+    }
+    t->subtables[j] = st;
+  }
+}
+
+
+/* Returns the sub-table with the given mask, or NULL if there
+   is none. */
+static struct fp_wildcard_subtable*
+find_subtable(struct fp_wildcard_table const* t, unsigned char const* mask)
+{
+  for (int i = 0; i < t->nsubtables; ++i)
+    if (!memcmp(t->subtables[i]->mask, mask, t->key_size))
+      return t->subtables[i];
+  return NULL;
+}
+
+
+static void
+delete_subtable(struct fp_wildcard_subtable* st)
+{
+  if (!st)
+    return;
+  if (st->buckets) {
+    for (size_t i = 0; i < st->nbuckets; ++i) {
+      struct fp_wildcard_rule* r = st->buckets[i];
+      while (r) {
+        struct fp_wildcard_rule* next = r->next;
+        fp_deallocate(r);
+        r = next;
+      }
+    }
+  }
+  for (int s = 0; s < FP_WILDCARD_MAX_STAGES - 1; ++s)
+    fp_flat_hash_table_delete(st->stages[s]);
+  fp_deallocate(st->buckets);
+  fp_deallocate(st->mask);
+  fp_deallocate(st);
+}
+
+
+/* Create a sub-table for the mask and add it to the table.
+   Returns NULL if it cannot be allocated. */
+static struct fp_wildcard_subtable*
+new_subtable(struct fp_wildcard_table* t, unsigned char const* mask)
+{
+  if (t->nsubtables == t->capacity) {
+    int cap = t->capacity ? 2 * t->capacity : 8;
+    struct fp_wildcard_subtable** a = (struct fp_wildcard_subtable**)
+      realloc(t->subtables, cap * sizeof(struct fp_wildcard_subtable*));
+    if (!a)
+      return NULL;
+    t->subtables = a;
+    t->capacity = cap;
+  }
+
+  struct fp_wildcard_subtable* st = fp_allocate(struct fp_wildcard_subtable);
+  if (!st)
+    return NULL;
+  memset(st, 0, sizeof(struct fp_wildcard_subtable));
+  st->mask = fp_allocate_n(unsigned char, t->key_size);
+  st->nbuckets = MIN_BUCKETS;
+  st->buckets = (struct fp_wildcard_rule**)
+    calloc(MIN_BUCKETS, sizeof(struct fp_wildcard_rule*));
+  if (!st->mask || !st->buckets) {
+    delete_subtable(st);
+    return NULL;
+  }
+  memcpy(st->mask, mask, t->key_size);
+
+  /* Stages after the last masked byte are not hashed. */
+  st->nstages = 1;
+  for (int s = 0; s < t->nstages; ++s) {
+    size_t start = s ? t->stages[s - 1] : 0;
+    for (size_t i = start; i < t->stages[s]; ++i)
+      if (mask[i])
+        st->nstages = s + 1;
+  }
+  for (int s = 0; s < st->nstages - 1; ++s) {
+    st->stages[s] = fp_flat_hash_table_new(MIN_BUCKETS, fp_uint_hash, fp_uint_eq);
+    if (!st->stages[s]) {
+      delete_subtable(st);
+      return NULL;
+    }
+  }
+
+  t->subtables[t->nsubtables++] = st;
+  return st;
+}
+
+
+/* Remove the sub-table from the table and delete it. */
+static void
+remove_subtable(struct fp_wildcard_table* t, struct fp_wildcard_subtable* st)
+{
+  int i = 0;
+  while (t->subtables[i] != st)
+    ++i;
+  memmove(t->subtables + i, t->subtables + i + 1,
+          (t->nsubtables - i - 1) * sizeof(struct fp_wildcard_subtable*));
+  --t->nsubtables;
+  delete_subtable(st);
+}
+
+
+/* Double the number of buckets in the sub-table. If memory
+   cannot be allocated, the sub-table is left as is. */
+static void
+grow_subtable(struct fp_wildcard_subtable* st)
+{
+  size_t n = st->nbuckets * 2;
+  struct fp_wildcard_rule** b = (struct fp_wildcard_rule**)
+    calloc(n, sizeof(struct fp_wildcard_rule*));
+  if (!b)
+    return;
+  for (size_t i = 0; i < st->nbuckets; ++i) {
+    struct fp_wildcard_rule* r = st->buckets[i];
+    while (r) {
+      struct fp_wildcard_rule* next = r->next;
+      size_t j = r->hash & (n - 1);
+      r->next = b[j];
+      b[j] = r;
+      r = next;
+    }
+  }
+  fp_deallocate(st->buckets);
+  st->buckets = b;
+  st->nbuckets = n;
+}
+
+
+/* Unlink the rule at *link from the sub-table and delete it.
+   The stage hashes of the rule are given by hs. If the
+   sub-table becomes empty, it is removed from the table. */
+static void
+remove_rule(struct fp_wildcard_table* t, struct fp_wildcard_subtable* st,
+            struct fp_wildcard_rule** link, uint64_t const* hs)
+{
+  struct fp_wildcard_rule* r = *link;
+  *link = r->next;
+  for (int s = 0; s < st->nstages - 1; ++s) {
+    struct fp_flat_hash_entry* e = fp_flat_hash_table_find(st->stages[s], hs[s]);
+    if (--e->value == 0)
+      fp_flat_hash_table_remove(st->stages[s], hs[s]);
+  }
+  int priority = r->priority;
+  fp_deallocate(r);
+  --st->size;
+  --t->size;
+
+  if (st->size == 0) {
+    remove_subtable(t, st);
+    return;
+  }
+  if (priority == st->max_priority) {
+    int max = INT_MIN;
+    for (size_t i = 0; i < st->nbuckets; ++i)
+      for (r = st->buckets[i]; r; r = r->next)
+        if (r->priority > max)
+          max = r->priority;
+    st->max_priority = max;
+    sort_subtables(t);
+  }
+}
+
+
+/* Create a wildcard table for keys of the given size. The
+   stages are given by the end offset of each stage, in
+   increasing order; when there are none, the key is a single
+   stage. Returns NULL if the stages are invalid or the table
+   cannot be allocated. */
+struct fp_wildcard_table*
+fp_wildcard_table_new(size_t key_size, size_t const* stages, int nstages)
+{
+  if (key_size == 0 || nstages < 0 || nstages > FP_WILDCARD_MAX_STAGES)
+    return NULL;
+  for (int s = 0; s < nstages; ++s)
+    if (stages[s] == 0 || stages[s] > key_size || (s && stages[s] <= stages[s - 1]))
+      return NULL;
+
+  struct fp_wildcard_table* t = fp_allocate(struct fp_wildcard_table);
+  if (!t)
+    return NULL;
+  memset(t, 0, sizeof(struct fp_wildcard_table));
+  t->key_size = key_size;
+  memcpy(t->stages, stages, nstages * sizeof(size_t));
+  t->nstages = nstages;
+
+  /* The last stage always extends to the end of the key. */
+  if (nstages == 0 || stages[nstages - 1] < key_size) {
+    if (nstages == FP_WILDCARD_MAX_STAGES) {
+      fp_deallocate(t);
+      return NULL;
+    }
+    t->stages[t->nstages++] = key_size;
+  }
+  return t;
+}
+
+
+/* Delete the table and all of its rules. */
+void
+fp_wildcard_table_delete(struct fp_wildcard_table* t)
+{
+  if (!t)
+    return;
+  for (int i = 0; i < t->nsubtables; ++i)
+    delete_subtable(t->subtables[i]);
+  fp_deallocate(t->subtables);
+  fp_deallocate(t);
+}
+
+
+/* Returns the value of the highest priority rule matching the
+   key, or 0 if no rule matches. */
+uintptr_t
+fp_wildcard_table_find(struct fp_wildcard_table const* t, void const* key)
+{
+  unsigned char const* k = (unsigned char const*)key;
+  struct fp_wildcard_rule const* best = NULL;
+  for (int i = 0; i < t->nsubtables; ++i) {
+    struct fp_wildcard_subtable const* st = t->subtables[i];
+    if (best && best->priority >= st->max_priority)
+      break;
+
+    /* Hash the key one stage at a time, giving up on the
+       sub-table when no rule has the same masked prefix. */
+    uint64_t h = 0;
+    size_t start = 0;
+    int s = 0;
+    for (; s < st->nstages; ++s) {
+      h = hash_masked(h, k + start, st->mask + start, t->stages[s] - start);
+      start = t->stages[s];
+      if (s < st->nstages - 1 && !fp_flat_hash_table_find(st->stages[s], h))
+        break;
+    }
+    if (s < st->nstages)
+      continue;
+
+    h = fp_hash_mix64(h);
+    struct fp_wildcard_rule const* r = st->buckets[h & (st->nbuckets - 1)];
+    for (; r; r = r->next) {
+      if (r->hash != h || (best && r->priority <= best->priority))
+        continue;
+      if (masked_equal(k, st->mask, r->match, t->key_size))
+        best = r;
+    }
+  }
+  return best ? best->value : 0;
+}
+
+
+/* Add a rule matching keys that equal the given match under the
+   mask, with the given priority and value. A rule with the same
+   match, mask, and priority is replaced. Fails with ENOMEM if
+   memory cannot be allocated. */
+fp_error_t
+fp_wildcard_table_insert(struct fp_wildcard_table* t, void const* match,
+                         void const* mask, int priority, uintptr_t value)
+{
+  unsigned char const* k = (unsigned char const*)match;
+  unsigned char const* m = (unsigned char const*)mask;
+  struct fp_wildcard_subtable* st = find_subtable(t, m);
+  if (!st) {
+    st = new_subtable(t, m);
+    if (!st)
+      return fp_system_error(ENOMEM);
+  }
+
+  uint64_t hs[FP_WILDCARD_MAX_STAGES];
+  uint64_t h = hash_stages(t, st, k, hs);
+  struct fp_wildcard_rule* r = st->buckets[h & (st->nbuckets - 1)];
+  for (; r; r = r->next) {
+    if (r->hash == h && r->priority == priority &&
+        masked_equal(k, st->mask, r->match, t->key_size)) {
+      r->value = value;
+      return FP_OK;
+    }
+  }
+
+  r = (struct fp_wildcard_rule*)malloc(sizeof(struct fp_wildcard_rule) + t->key_size);
+  if (!r) {
+    if (st->size == 0)
+      remove_subtable(t, st);
+    return fp_system_error(ENOMEM);
+  }
+  r->hash = h;
+  r->priority = priority;
+  r->value = value;
+  for (size_t i = 0; i < t->key_size; ++i)
+    r->match[i] = k[i] & m[i];
+
+  for (int s = 0; s < st->nstages - 1; ++s) {
+    struct fp_flat_hash_entry* e = fp_flat_hash_table_find(st->stages[s], hs[s]);
+    if (e)
+      ++e->value;
+    else
+      fp_flat_hash_table_insert(st->stages[s], hs[s], 1);
+  }
+  struct fp_wildcard_rule** b = &st->buckets[h & (st->nbuckets - 1)];
+  r->next = *b;
+  *b = r;
+  ++t->size;
+
+  if (st->size++ == 0 || priority > st->max_priority) {
+    st->max_priority = priority;
+    sort_subtables(t);
+  }
+  if (st->size > st->nbuckets)
+    grow_subtable(st);
+  return FP_OK;
+}
+
+
+/* Remove the rule with the given match, mask, and priority. */
+void
+fp_wildcard_table_remove(struct fp_wildcard_table* t, void const* match,
+                         void const* mask, int priority)
+{
+  unsigned char const* k = (unsigned char const*)match;
+  struct fp_wildcard_subtable* st = find_subtable(t, (unsigned char const*)mask);
+  if (!st)
+    return;
+
+  uint64_t hs[FP_WILDCARD_MAX_STAGES];
+  uint64_t h = hash_stages(t, st, k, hs);
+  struct fp_wildcard_rule** link = &st->buckets[h & (st->nbuckets - 1)];
+  for (; *link; link = &(*link)->next) {
+    struct fp_wildcard_rule* r = *link;
+    if (r->hash == h && r->priority == priority &&
+        masked_equal(k, st->mask, r->match, t->key_size)) {
+      remove_rule(t, st, link, hs);
+      return;
+    }
+  }
+}
+
+
+/* Remove all rules with the given match and mask, regardless
+   of priority. */
+void
+fp_wildcard_table_clear(struct fp_wildcard_table* t, void const* match,
+                        void const* mask)
+{
+  unsigned char const* k = (unsigned char const*)match;
+  struct fp_wildcard_subtable* st = find_subtable(t, (unsigned char const*)mask);
+  if (!st)
+    return;
+
+  uint64_t hs[FP_WILDCARD_MAX_STAGES];
+  uint64_t h = hash_stages(t, st, k, hs);
+  size_t n = st->size;
+  while (n--) {
+    struct fp_wildcard_rule** link = &st->buckets[h & (st->nbuckets - 1)];
+    while (*link && ((*link)->hash != h ||
+                     !masked_equal(k, st->mask, (*link)->match, t->key_size)))
+      link = &(*link)->next;
+    if (!*link)
+      return;
+
+    /* This may delete the sub-table along with the last rule. */
+    bool last = st->size == 1;
+    remove_rule(t, st, link, hs);
+    if (last)
+      return;
+  }
+}
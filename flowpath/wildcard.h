@@ -0,0 +1,97 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_WILDCARD_H
+#define FLOWPATH_WILDCARD_H
+
+/* This module implements a tuple space search classifier for
+   wildcard flow tables. A rule matches a key when the key,
+   masked by the rule's mask, equals the rule's match. Rules
+   have priorities, and a search returns the value of the
+   matching rule with the highest priority.
+
+   Rules with the same mask are grouped in a sub-table, which
+   is a hash table over masked keys. A search probes each
+   sub-table once. Sub-tables are kept in order of the highest
+   priority of their rules, so a search stops as soon as no
+   remaining sub-table can hold a better match than the one
+   already found. An ACL with tens of thousands of rules but a
+   handful of distinct masks is searched in a handful of
+   probes.
+
+   Keys may be divided into stages (e.g., the L2, L3, and L4
+   fields of a key). Each sub-table records the hash of the
+   masked key up to the end of each stage for all of its rules.
+   A search hashes the key one stage at a time and abandons the
+   sub-table as soon as the hash of a stage is not present,
+   without hashing or comparing the rest of the key.
+
+   Concurrency: the table must not be modified while it is
+   being searched. */
+
+#include "util.h"
+#include "error.h"
+
+#include <stddef.h>
+
+
+/* The maximum number of stages in a key. */
+#define FP_WILDCARD_MAX_STAGES 4
+
+
+struct fp_flat_hash_table;
+
+
+/* A rule. Rules are chained within the buckets of their
+   sub-table. The match is stored masked. */
+struct fp_wildcard_rule
+{
+  struct fp_wildcard_rule* next;
+  uint64_t                 hash;
+  int                      priority;
+  uintptr_t                value;
+  unsigned char            match[];
+};
+
+
+/* The rules that share a mask. */
+struct fp_wildcard_subtable
+{
+  unsigned char* mask;
+  int            max_priority; /* Highest priority of any rule. */
+  int            nstages;      /* Stages up to the last masked byte. */
+  size_t         size;         /* Number of rules. */
+
+  size_t                    nbuckets; /* A power of 2. */
+  struct fp_wildcard_rule** buckets;
+
+  /* For each stage but the last, a multiset of the hashes of
+     rules' masked keys up to the end of that stage. */
+  struct fp_flat_hash_table* stages[FP_WILDCARD_MAX_STAGES - 1];
+};
+
+
+/* A wildcard table. */
+struct fp_wildcard_table
+{
+  size_t key_size;
+  int    nstages;
+  size_t stages[FP_WILDCARD_MAX_STAGES]; /* End offset of each stage. */
+  size_t size;                           /* Number of rules. */
+
+  /* Sub-tables, ordered by decreasing maximum priority. */
+  int                           nsubtables;
+  int                           capacity;
+  struct fp_wildcard_subtable** subtables;
+};
+
+
+struct fp_wildcard_table* fp_wildcard_table_new(size_t, size_t const*, int);
+void                      fp_wildcard_table_delete(struct fp_wildcard_table*);
+uintptr_t                 fp_wildcard_table_find(struct fp_wildcard_table const*, void const*);
+fp_error_t                fp_wildcard_table_insert(struct fp_wildcard_table*, void const*, void const*, int, uintptr_t);
+void                      fp_wildcard_table_remove(struct fp_wildcard_table*, void const*, void const*, int);
+void                      fp_wildcard_table_clear(struct fp_wildcard_table*, void const*, void const*);
+
+
+#endif
@@ -0,0 +1,355 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+/* Required for CPU affinity. */
+#define _GNU_SOURCE
+
+#include "worker.h"
+#include "dataplane.h"
+#include "pipeline.h"
+#include "port.h"
+#include "packet.h"
+#include "poll.h"
+#include "emc.h"
+#include "rss.h"
+#include "qsbr.h"
+#include "stats.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+
+/* Each worker counts in the statistics shard of its id. */
+#if FP_WORKER_MAX > FP_STATS_SHARED
+#  error "too few statistics shards for the workers"
+#endif
+
+
+/* The worker running on the current thread, if any. */
+static __thread struct fp_worker* self_;
+
+
+/* Returns the worker bound to the calling thread, or NULL if
+   the caller is not a worker thread. */
+struct fp_worker*
+fp_worker_self()
+{
+  return self_;
+}
+
+
+/* Returns the calling worker's exact match cache for the data
+   plane, creating it on first use. Returns NULL if the caller
+   is not a worker thread or the cache cannot be allocated. */
+struct fp_emc*
+fp_worker_emc(struct fp_dataplane* dp)
+{
+  struct fp_worker* w = self_;
+  if (!w)
+    return NULL;
+  struct fp_emc* c = w->emc[dp->id];
+  if (c && c->key_size == dp->key_size)
+    return c;
+
+  /* The data plane's key size has changed. */
+  fp_emc_delete(c);
+  w->emc[dp->id] = fp_emc_new(dp->key_size);
+  return w->emc[dp->id];
+}
+
+
+/* Pin the calling thread to the given CPU. Failure to pin is
+   not fatal; the worker simply floats. */
+static void
+pin_worker(struct fp_worker* w)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(w->cpu, &set);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret != 0) {
+    fprintf(stderr, "[flowpath] worker %d: cannot pin to cpu %d: %s\n",
+            w->id, w->cpu, strerror(ret));
+    w->cpu = -1;
+  }
+}
+
+
+/* Make a single pass over each of the worker's queues.
+   Descriptor-backed ports are serviced if they are ready; other
+   ports are polled. The worker announces a quiescent state
+   after each pass. Returns the number of packets processed.
+
+   This may be called directly (e.g., from a test driver) to
+   run a worker on the current thread. */
+int
+fp_worker_poll(struct fp_worker* w)
+{
+  int n = fp_poller_wait(w->poller, 0);
+  if (n < 0)
+    n = 0;
+  int nqueues = __atomic_load_n(&w->nqueues, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < nqueues; ++i) {
+    struct fp_worker_queue* q = &w->queues[i];
+    struct fp_port* port = __atomic_load_n(&q->port, __ATOMIC_ACQUIRE);
+    if (!port)
+      continue;
+    if (q->ring < 0)
+      n += fp_dataplane_receive(q->dp, port, FP_WORKER_BURST);
+    else
+      n += fp_dataplane_receive_ring(q->dp, port, q->ring, FP_WORKER_BURST);
+  }
+
+  /* Announce a quiescent state once per pass, whether or not
+     the worker has polled queues, so that grace periods end while
+     descriptor-backed ports keep it busy. */
+  if (w->qsbr)
+    fp_qsbr_quiescent(w->qsbr);
+  return n;
+}
+
+
+/* Sleep until one of the worker's descriptor-backed ports is
+   ready or the idle timeout expires. The worker is quiescent
+   while it sleeps. */
+static void
+sleep_worker(struct fp_worker* w)
+{
+  fp_qsbr_offline(w->qsbr);
+  fp_poller_sleep(w->poller, FP_WORKER_IDLE_TIMEOUT);
+  fp_qsbr_online(w->qsbr);
+}
+
+
+/* The worker thread's main loop. */
+static void*
+run_worker(void* arg)
+{
+  struct fp_worker* w = (struct fp_worker*)arg;
+  self_ = w;
+  if (w->cpu >= 0)
+    pin_worker(w);
+  w->qsbr = fp_qsbr_register();
+  if (!w->qsbr) {
+    fprintf(stderr, "[flowpath] worker %d: too many reader threads\n", w->id);
+    pthread_detach(pthread_self());
+    __atomic_store_n(&w->running, false, __ATOMIC_RELEASE);
+    self_ = NULL;
+    return NULL;
+  }
+  fp_stats_set_shard(w->id);
+  fprintf(stderr, "[flowpath] worker %d running on cpu %d\n", w->id, w->cpu);
+
+  while (__atomic_load_n(&w->running, __ATOMIC_ACQUIRE)) {
+    int n = fp_worker_poll(w);
+    if (n == 0 && !__atomic_load_n(&w->npolled, __ATOMIC_ACQUIRE))
+      sleep_worker(w);
+  }
+
+  fprintf(stderr, "[flowpath] worker %d stopped\n", w->id);
+  fp_qsbr_unregister(w->qsbr);
+  w->qsbr = NULL;
+  self_ = NULL;
+  return NULL;
+}
+
+
+/* Create an engine with the given number of workers. Worker i
+   is pinned to CPU i, wrapping around when there are more
+   workers than CPUs. The engine is not started. */
+struct fp_engine*
+fp_engine_create(int nworkers, fp_error_t* err)
+{
+  if (nworkers <= 0 || nworkers > FP_WORKER_MAX) {
+    *err = fp_system_error(EINVAL);
+    return NULL;
+  }
+
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpus <= 0)
+    ncpus = 1;
+
+  struct fp_engine* e = fp_allocate(struct fp_engine);
+  e->nworkers = nworkers;
+  e->next = 0;
+  e->running = false;
+  e->workers = fp_allocate_n(struct fp_worker, nworkers);
+  memset(e->workers, 0, nworkers * sizeof(struct fp_worker));
+  for (int i = 0; i < nworkers; ++i) {
+    struct fp_worker* w = &e->workers[i];
+    w->id = i;
+    w->cpu = i % ncpus;
+    w->poller = fp_poller_create(FP_WORKER_BURST, err);
+    if (!w->poller) {
+      fp_engine_delete(e);
+      return NULL;
+    }
+  }
+  *err = FP_OK;
+  return e;
+}
+
+
+/* Stop the engine and release its resources. This does not
+   affect the ports assigned to the engine. */
+void
+fp_engine_delete(struct fp_engine* e)
+{
+  if (!e)
+    return;
+  fp_engine_stop(e);
+  for (int i = 0; i < e->nworkers; ++i) {
+    fp_poller_delete(e->workers[i].poller);
+    for (int j = 0; j < FP_DATAPLANE_MAX; ++j)
+      fp_emc_delete(e->workers[i].emc[j]);
+  }
+  fp_deallocate(e->workers);
+  fp_deallocate(e);
+}
+
+
+/* Launch the worker threads. */
+fp_error_t
+fp_engine_start(struct fp_engine* e)
+{
+  if (e->running)
+    return FP_OK;
+
+  for (int i = 0; i < e->nworkers; ++i) {
+    struct fp_worker* w = &e->workers[i];
+    w->running = true;
+    int ret = pthread_create(&w->thread, NULL, run_worker, w);
+    if (ret != 0) {
+      w->running = false;
+      fp_engine_stop(e);
+      return fp_system_error(ret);
+    }
+  }
+  e->running = true;
+  return FP_OK;
+}
+
+
+/* Signal each worker to stop and wait for it to exit. */
+void
+fp_engine_stop(struct fp_engine* e)
+{
+  for (int i = 0; i < e->nworkers; ++i) {
+    struct fp_worker* w = &e->workers[i];
+    if (!w->running)
+      continue;
+    __atomic_store_n(&w->running, false, __ATOMIC_RELEASE);
+    pthread_join(w->thread, NULL);
+  }
+  e->running = false;
+}
+
+
+/* Add a polled queue to the worker. The queue slot is fully
+   written before the port pointer is published. */
+static fp_error_t
+add_queue(struct fp_worker* w, struct fp_dataplane* dp, struct fp_port* port, int ring)
+{
+  /* Reuse an empty slot if there is one. */
+  int i = 0;
+  for (; i < w->nqueues; ++i)
+    if (!w->queues[i].port)
+      break;
+  if (i == FP_WORKER_MAX_QUEUES)
+    return fp_system_error(ENOSPC);
+
+  w->queues[i].dp = dp;
+  w->queues[i].ring = ring;
+  __atomic_store_n(&w->queues[i].port, port, __ATOMIC_RELEASE);
+  if (i == w->nqueues)
+    __atomic_store_n(&w->nqueues, i + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&w->npolled, 1, __ATOMIC_RELEASE);
+  return FP_OK;
+}
+
+
+/* Assign the port's receive queue to a worker. Queues are
+   distributed round-robin over the workers.
+
+   This is called from the control thread and may run
+   concurrently with the workers. */
+fp_error_t
+fp_engine_add_port(struct fp_engine* e, struct fp_dataplane* dp, struct fp_port* port)
+{
+  struct fp_worker* w = &e->workers[e->next];
+  e->next = (e->next + 1) % e->nworkers;
+
+  /* Prefer to wait on the port's descriptor. The worker may be
+     waiting on its poller; ports may be added concurrently (see
+     poll.h), and a ready descriptor wakes the worker. */
+  if (fp_port_fd(port) >= 0)
+    return fp_poller_add_port(w->poller, dp, port);
+  return add_queue(w, dp, port, -1);
+}
+
+
+/* Assign the port's receive queue to a worker, and spread the
+   port's packets over all workers with an RSS stage using the
+   given hash algorithm and key (see fp_rss_new()). Every worker
+   serves one of the stage's rings. The stage is deleted when
+   the port is removed. */
+fp_error_t
+fp_engine_add_port_rss(struct fp_engine* e, struct fp_dataplane* dp,
+                       struct fp_port* port, int algorithm, uint8_t const* key)
+{
+  fp_error_t err;
+  struct fp_rss* rss = fp_rss_new(algorithm, key, e->nworkers, &err);
+  if (!rss)
+    return err;
+  port->rss = rss;
+
+  /* Rings are served before the port is received from. */
+  for (int i = 0; i < e->nworkers && fp_ok(err); ++i)
+    err = add_queue(&e->workers[i], dp, port, i);
+  if (fp_ok(err))
+    err = fp_engine_add_port(e, dp, port);
+  if (fp_error(err))
+    fp_engine_remove_port(e, port);
+  return err;
+}
+
+
+/* Remove the port's receive queue from its worker. When this
+   returns, no worker is receiving from the port, and the port
+   may be safely deleted. */
+void
+fp_engine_remove_port(struct fp_engine* e, struct fp_port* port)
+{
+  for (int i = 0; i < e->nworkers; ++i) {
+    struct fp_worker* w = &e->workers[i];
+    fp_poller_remove_port(w->poller, port);
+    for (int j = 0; j < w->nqueues; ++j) {
+      if (w->queues[j].port == port) {
+        __atomic_store_n(&w->queues[j].port, NULL, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&w->npolled, 1, __ATOMIC_RELEASE);
+      }
+    }
+  }
+  fp_engine_synchronize(e);
+
+  /* No worker refers to the port's RSS stage. */
+  fp_rss_delete(port->rss);
+  port->rss = NULL;
+}
+
+
+/* Wait until every running worker has passed through a
+   quiescent point, either by completing a pass or by sleeping.
+   Any object unpublished before this call is no longer
+   referenced by a worker when it returns. Workers announce
+   quiescent states through QSBR (see qsbr.h), so this is a QSBR
+   grace period.
+
+   This must not be called from a worker thread. */
+void
+fp_engine_synchronize(struct fp_engine* e)
+{
+  assert(!fp_worker_self());
+  (void)e;
+  fp_qsbr_synchronize();
+}
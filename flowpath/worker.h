@@ -0,0 +1,134 @@
+// Copyright (c) 2014-2015 Flowgrammable.org
+// All rights reserved
+
+#ifndef FLOWPATH_WORKER_H
+#define FLOWPATH_WORKER_H
+
+/* The worker module implements the run-to-completion forwarding
+   engine. An engine owns a set of worker threads, each pinned to
+   a CPU. Every receive queue (currently, one per port) is assigned
+   to exactly one worker, which repeatedly receives packets from
+   its queues and runs them through the owning data plane's
+   pipeline. Egress happens on the same thread, so a packet never
+   changes cores between arrival and departure.
+
+   Because a port is only ever read by one worker, devices do
+   not need to synchronize their receive paths. Sends may come
+   from any worker.
+
+   Ports whose devices expose a file descriptor are serviced
+   through the worker's poller (see poll.h). Other ports are
+   polled on every pass. A worker that has only descriptor-backed
+   ports sleeps in the poller when none of them has traffic, so
+   idle workers do not consume a core.
+
+   Each worker has an exact match cache (see emc.h) for every
+   data plane whose packets it processes. Pipelines get the
+   cache for the current worker with fp_worker_emc().
+
+   Each worker counts packets, flows, and table lookups in its
+   own statistics shard (see stats.h), so counting never shares
+   cache lines between workers.
+
+   A port with a single receive queue can be spread over all of
+   the workers with a software RSS stage (see rss.h and
+   fp_engine_add_port_rss()). The worker assigned to the port
+   distributes its packets to per-worker rings, and every worker
+   serves its ring as a polled queue.
+
+   TODO: Support multiple receive queues per port when the
+   underlying device supports them. */
+
+#include "util.h"
+#include "error.h"
+#include "types.h"
+#include "dataplane.h"
+
+#include <pthread.h>
+
+
+struct fp_port;
+struct fp_poller;
+struct fp_emc;
+
+
+/* Limits on the engine configuration. */
+#define FP_WORKER_MAX        64  /* Worker threads per engine. */
+#define FP_WORKER_MAX_QUEUES 64  /* Receive queues per worker. */
+
+/* The maximum number of packets taken from a single queue
+   before moving on to the next queue. */
+#define FP_WORKER_BURST      32
+
+/* The longest time, in milliseconds, that an idle worker
+   sleeps before checking whether it should stop. */
+#define FP_WORKER_IDLE_TIMEOUT 100
+
+
+/* A receive queue served by a worker. A queue whose port is
+   NULL is an empty slot. If ring is non-negative, the queue is
+   that ring of the port's RSS stage rather than the port. */
+struct fp_worker_queue
+{
+  struct fp_dataplane* dp;
+  struct fp_port*      port;
+  int                  ring;
+};
+
+
+/* A worker thread.
+
+  - qsbr -- The worker's reader state (see qsbr.h). Between
+    passes over its queues, the worker holds no references to
+    ports or packets, so it announces a quiescent state after
+    each pass. It is offline while it sleeps in its poller.
+
+  - npolled -- The number of queues that must be polled. While
+    this is non-zero, the worker never sleeps. */
+struct fp_worker
+{
+  int       id;      /* Index within the engine. */
+  int       cpu;     /* The CPU the worker is pinned to, or -1. */
+  pthread_t thread;
+  bool      running;
+
+  struct fp_poller* poller; /* Descriptor-backed ports. */
+
+  /* NULL unless the worker runs on its own thread. */
+  struct fp_qsbr_thread* qsbr;
+
+  int                    npolled;
+  int                    nqueues; /* Number of used queue slots. */
+  struct fp_worker_queue queues[FP_WORKER_MAX_QUEUES];
+
+  /* Exact match caches, indexed by data plane id. These are
+     only used by the worker thread. */
+  struct fp_emc* emc[FP_DATAPLANE_MAX];
+};
+
+
+/* The forwarding engine. */
+struct fp_engine
+{
+  int               nworkers;
+  int               next;    /* Next worker to receive a queue. */
+  bool              running;
+  struct fp_worker* workers;
+};
+
+
+struct fp_engine* fp_engine_create(int, fp_error_t*);
+void              fp_engine_delete(struct fp_engine*);
+fp_error_t        fp_engine_start(struct fp_engine*);
+void              fp_engine_stop(struct fp_engine*);
+fp_error_t        fp_engine_add_port(struct fp_engine*, struct fp_dataplane*, struct fp_port*);
+fp_error_t        fp_engine_add_port_rss(struct fp_engine*, struct fp_dataplane*, struct fp_port*, int, uint8_t const*);
+void              fp_engine_remove_port(struct fp_engine*, struct fp_port*);
+void              fp_engine_synchronize(struct fp_engine*);
+
+int               fp_worker_poll(struct fp_worker*);
+struct fp_worker* fp_worker_self();
+struct fp_emc*    fp_worker_emc(struct fp_dataplane*);
+
+
+#endif